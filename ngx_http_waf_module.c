@@ -5,6 +5,19 @@
 #include <ngx_http.h>
 #include <ngx_md5.h>
 
+#if (NGX_HTTP_WAF_HYPERSCAN)
+#include <hs/hs.h>
+#endif
+
+#if (NGX_HTTP_WAF_X86_SIMD)
+#include <immintrin.h>
+#endif
+
+#if (defined __aarch64__ && defined __ARM_NEON)
+#include <arm_neon.h>
+#define NGX_HTTP_WAF_NEON  1
+#endif
+
 #include "libinjection/src/libinjection.h"
 #include "libinjection/src/libinjection_sqli.h"
 
@@ -54,6 +67,51 @@
     + (NGX_MAXHOSTNAMELEN - 1) + 1 /* space */                                \
     + 32 /* tag */ + 2 /* colon, space */
 
+// a decode chain runs its stages over the chunks of a field at once.
+#define NGX_HTTP_WAF_DECODE_CHUNK   512
+#define NGX_HTTP_WAF_DECODE_STAGES  8
+// the bytes a stage holds between the chunks, e.g. an html entity, and
+// may output after a chunk over its length.
+#define NGX_HTTP_WAF_DECODE_HOLD    16
+#define NGX_HTTP_WAF_DECODE_BUF                                               \
+    (NGX_HTTP_WAF_DECODE_CHUNK                                                \
+     + NGX_HTTP_WAF_DECODE_STAGES * (NGX_HTTP_WAF_DECODE_HOLD + 1))
+
+// the content types of the body parsers.
+#define NGX_HTTP_WAF_BODY_RAW         0
+#define NGX_HTTP_WAF_BODY_URLENCODED  1
+#define NGX_HTTP_WAF_BODY_MULTIPART   2
+#define NGX_HTTP_WAF_BODY_JSON        3
+#define NGX_HTTP_WAF_BODY_XML         4
+
+// the zones of the request fields, in the order of the field table.
+#define NGX_HTTP_WAF_FIELD_URL      0
+#define NGX_HTTP_WAF_FIELD_ARGS     1
+#define NGX_HTTP_WAF_FIELD_HEADERS  2
+#define NGX_HTTP_WAF_FIELD_ZONES    3
+
+// an arg without a '=', its key is null.
+#define NGX_HTTP_WAF_FIELD_NO_KEY   0x01
+
+// the longest multipart boundary, and the least size of the body buf.
+#define NGX_HTTP_WAF_BODY_OVERLAP   256
+// the bytes of an uploaded file matched by the stream rules at once.
+#define NGX_HTTP_WAF_BODY_WINDOW    65536
+
+// the classes of ngx_http_waf_norm[], the bytes that start a sequence of
+// the normalizing stages and the characters of the sequences.
+#define NGX_HTTP_WAF_NORM_WS        0x01
+#define NGX_HTTP_WAF_NORM_HTML      0x02  /* '&' */
+#define NGX_HTTP_WAF_NORM_UNICODE   0x04  /* '%' */
+#define NGX_HTTP_WAF_NORM_COMMENT   0x08  /* '/' */
+#define NGX_HTTP_WAF_NORM_HEX       0x10
+#define NGX_HTTP_WAF_NORM_DIGIT     0x20
+#define NGX_HTTP_WAF_NORM_ALNUM     0x40
+#define NGX_HTTP_WAF_NORM_STAR      0x80  /* '*' */
+
+// the first block of the scratch arena of a request.
+#define NGX_HTTP_WAF_ARENA_SIZE     4096
+
 // rule status
 // action flag
 // ngx_http_waf_rule_t->sts
@@ -187,12 +245,26 @@ ngx_http_waf_get_act(ngx_uint_t flag) {
 typedef struct ngx_http_waf_log_s   ngx_http_waf_log_t;
 typedef struct ngx_http_waf_rule_s  ngx_http_waf_rule_t;
 typedef struct ngx_http_waf_public_rule_s  ngx_http_waf_public_rule_t;
+typedef struct ngx_http_waf_matcher_s  ngx_http_waf_matcher_t;
+typedef struct ngx_http_waf_re_s  ngx_http_waf_re_t;
+typedef struct ngx_http_waf_regex_s  ngx_http_waf_regex_t;
+typedef struct ngx_http_waf_hash_alg_s  ngx_http_waf_hash_alg_t;
 typedef void (*ngx_http_waf_log_write_pt) (ngx_http_waf_log_t *log,
     u_char *buf, size_t len);
 typedef ngx_int_t (*ngx_http_waf_rule_match_pt)(
     ngx_http_waf_public_rule_t *pr, ngx_str_t *s);
-typedef ngx_int_t (*ngx_http_waf_rule_decode_pt)(ngx_http_request_t *r,
-    ngx_str_t *dst, ngx_str_t *src, ngx_uint_t destory);
+typedef struct ngx_http_waf_decode_state_s  ngx_http_waf_decode_state_t;
+typedef u_char *(*ngx_http_waf_rule_decode_pt)(
+    ngx_http_waf_decode_state_t *st, u_char *d, u_char *p, u_char *e);
+typedef u_char *(*ngx_http_waf_rule_flush_pt)(
+    ngx_http_waf_decode_state_t *st, u_char *d);
+typedef ngx_int_t (*ngx_http_waf_rule_scan_pt)(u_char *p, u_char *e);
+typedef void (*ngx_http_waf_matcher_exec_pt)(ngx_http_waf_matcher_t *m,
+    ngx_str_t *s, ngx_str_t *lc, u_char *hits);
+typedef struct ngx_http_waf_stream_s  ngx_http_waf_stream_t;
+typedef ngx_int_t (*ngx_http_waf_matcher_stream_pt)(ngx_pool_t *pool,
+    ngx_http_waf_stream_t *ss, u_char *p, u_char *e, ngx_uint_t last);
+typedef struct ngx_http_waf_engine_s  ngx_http_waf_engine_t;
 
 // for check rule
 typedef struct ngx_http_waf_check_s {
@@ -223,18 +295,42 @@ typedef struct ngx_http_waf_score_s {
 struct ngx_http_waf_public_rule_s {
     ngx_int_t               id;
     ngx_str_t               str;
-    ngx_regex_t            *regex;
+    ngx_http_waf_regex_t   *regex;
+    ngx_http_waf_re_t      *re;      /* the parsed rx@. maybe null */
+    ngx_http_waf_hash_alg_t  *hash;    /* the hash: function. maybe null */
+    ngx_str_t                 digests; /* the binary hash: constants */
     ngx_array_t            *scores;  /* ngx_http_waf_score_t. maybe null */
     ngx_array_t                *decode_handlers;
+    ngx_uint_t                  decode;  /* wmcf->decodes index + 1, or 0 */
     ngx_http_waf_rule_match_pt  handler;
     unsigned                    not:1;
+    unsigned                    lower:1; /* the handler takes lowercase */
 };
 
 
+// the pcre of rx@ and the regex zones, executed with the limits.
+struct ngx_http_waf_regex_s {
+    ngx_regex_t            *regex;
+    ngx_uint_t              match_limit;  /* 0: the pcre default */
+    ngx_uint_t              depth_limit;
+#if (NGX_PCRE2)
+    pcre2_match_context    *mctx;
+#else
+    pcre_extra             *extra;  /* the forced jit, maybe null */
+#endif
+};
+
+#define NGX_HTTP_WAF_REGEX_LIMIT_CLOSED  0
+#define NGX_HTTP_WAF_REGEX_LIMIT_OPEN    1
+
+#define NGX_HTTP_WAF_JIT_STACK_MIN  (32 * 1024)
+#define NGX_HTTP_WAF_JIT_STACK_MAX  (1024 * 1024)
+
+
 typedef struct ngx_http_waf_zone_s {
     ngx_uint_t      flag;    /* match zone types */
     ngx_str_t       name;    /* the specify variable for match zone */
-    ngx_regex_t    *regex;
+    ngx_http_waf_regex_t   *regex;
     // ngx_str_t     spec_url_suffix;  // TODO
 } ngx_http_waf_zone_t;
 
@@ -244,6 +340,8 @@ typedef struct ngx_http_waf_rule_opt_s {
     ngx_http_waf_public_rule_t   *p_rule;
     ngx_array_t                  *wl_ids;    /* ngx_int_t */
     ngx_array_t                  *m_zones;   /* ngx_http_waf_zone_t */
+    ngx_uint_t                    match_limit;
+    ngx_uint_t                    depth_limit;
 } ngx_http_waf_rule_opt_t;
 
 
@@ -252,12 +350,234 @@ struct ngx_http_waf_rule_s {
     ngx_http_waf_zone_t           *m_zone;        /* opt->m_zones[x] */
     ngx_array_t                   *wl_zones;      /* ngx_http_waf_zone_t */
     ngx_array_t                   *score_checks;  /* ngx_http_waf_check_t*/
+    ngx_http_waf_matcher_t        *matcher;       /* maybe null */
+    ngx_uint_t                     mid;           /* matcher->rules index */
     // rule status: 
     //include rule invalid, rule action, rule withelist type ...
     ngx_uint_t                     sts;
 };
 
 
+// the rules of a zone array compiled into one automaton.
+// a single pass over the value reports every matching rule.
+struct ngx_http_waf_matcher_s {
+    ngx_uint_t                     idx;      /* ctx->matches index */
+    ngx_array_t                    rules;    /* ngx_http_waf_public_rule_t* */
+    ngx_http_waf_engine_t         *engine;
+    void                          *data;     /* the compiled automaton */
+    ngx_flag_t                     lower;    /* a rule takes lowercase */
+};
+
+
+// the matcher backend. the engines are tried in order, every engine
+// takes the rules it is able to match which are not taken yet.
+struct ngx_http_waf_engine_s {
+    ngx_str_t                      name;
+    ngx_uint_t                     min;      /* the least rules of a matcher */
+    ngx_int_t                    (*able)(ngx_http_waf_public_rule_t *pr);
+
+    // NGX_DECLINED leaves the rules to the next engines.
+    ngx_int_t                    (*compile)(ngx_conf_t *cf,
+                                            ngx_http_waf_matcher_t *m);
+    ngx_http_waf_matcher_exec_pt   exec;
+
+    // maybe null. the worker private data, e.g. the scratch.
+    ngx_int_t                    (*init_process)(ngx_cycle_t *cycle,
+                                                 ngx_http_waf_matcher_t *m);
+
+    // a hit is a candidate only, the rule handler decides.
+    ngx_flag_t                     prefilter;
+
+    // maybe null. the chunk of a value, the state is carried over them.
+    ngx_http_waf_matcher_stream_pt stream;
+};
+
+
+// the matcher over the chunks of a value, e.g. the raw body as it arrives.
+struct ngx_http_waf_stream_s {
+    ngx_http_waf_matcher_t        *matcher;
+    u_char                        *hits;     /* up to the chunk */
+    uint32_t                       state;    /* of the aho-corasick */
+    void                          *data;     /* of the other engines */
+    unsigned                       started:1;
+};
+
+
+// the aho-corasick automaton of the str:ct@ rules
+typedef struct {
+    ngx_uint_t      ncls;
+    ngx_uint_t      nstates;
+    u_char          cls[256];  /* case folded byte classes */
+    uint32_t       *delta;     /* row offset of next state | OUT flag */
+    uint32_t       *dict;      /* next state with outputs by fail links */
+    uint32_t       *first;     /* ids[first[s]]...ids[first[s+1]-1] */
+    uint32_t       *ids;       /* matcher->rules index */
+} ngx_http_waf_ac_t;
+
+#define NGX_HTTP_WAF_AC_OUT       0x80000000
+#define NGX_HTTP_WAF_AC_OFFSET    0x7FFFFFFF
+
+// the trie of the str:sw@ or the reversed str:ew@ rules, no fail links.
+typedef struct {
+    ngx_uint_t      ncls;
+    u_char          cls[256];  /* case folded byte classes */
+    uint32_t       *go;        /* row offset of next state | OUT flag */
+    uint32_t       *first;     /* ids[first[s]]...ids[first[s+1]-1] */
+    uint32_t       *ids;       /* matcher->rules index */
+} ngx_http_waf_trie_t;
+
+// the sha256 state, the buf has the bytes of a block not full yet.
+typedef struct {
+    uint32_t                  st[8];
+    uint64_t                  len;
+    u_char                    buf[64];
+} ngx_http_waf_sha256_t;
+
+// the digest of a value over the chunks.
+typedef union {
+    ngx_md5_t                 md5;
+    ngx_http_waf_sha256_t     sha256;
+    uint32_t                  crc32;
+} ngx_http_waf_digest_ctx_t;
+
+// the open addressing set of the digests of one algorithm.
+typedef struct {
+    ngx_http_waf_hash_alg_t  *alg;
+    ngx_uint_t                mask;
+    u_char                   *keys;   /* [mask + 1] digests */
+    uint32_t                 *ids;    /* matcher->rules index + 1, 0 empty */
+} ngx_http_waf_digest_set_t;
+
+// the hash: rules of a zone, a field is digested once per algorithm.
+typedef struct {
+    ngx_http_waf_digest_set_t  *sets;
+    ngx_uint_t                  nsets;
+    uint32_t                   *nots;   /* the negated rules */
+    ngx_uint_t                  nnots;
+} ngx_http_waf_digests_t;
+
+// the digests of a value over the chunks, of the sets.
+typedef struct {
+    off_t                        len;
+    ngx_http_waf_digest_ctx_t   *ctx;    /* [nsets] */
+} ngx_http_waf_digests_stream_t;
+
+// the regex subset of the rx@ rules.
+#define NGX_HTTP_WAF_RE_EMPTY        0
+#define NGX_HTTP_WAF_RE_SET          1   /* one byte of set */
+#define NGX_HTTP_WAF_RE_CAT          2
+#define NGX_HTTP_WAF_RE_ALT          3
+#define NGX_HTTP_WAF_RE_REPEAT       4
+#define NGX_HTTP_WAF_RE_BOL          5   /* ^ \A */
+#define NGX_HTTP_WAF_RE_EOL          6   /* $ \Z */
+#define NGX_HTTP_WAF_RE_EOS          7   /* \z */
+#define NGX_HTTP_WAF_RE_OPAQUE       8   /* only pcre knows */
+
+#define NGX_HTTP_WAF_RE_INF          ((ngx_uint_t) -1)
+#define NGX_HTTP_WAF_RE_MAX_INSTS    4096
+#define NGX_HTTP_WAF_RE_MAX_DEPTH    64
+
+typedef struct ngx_http_waf_re_node_s  ngx_http_waf_re_node_t;
+
+struct ngx_http_waf_re_node_s {
+    ngx_uint_t                type;
+    ngx_uint_t                min;
+    ngx_uint_t                max;
+    u_char                   *set;    /* 256 bits, case folded */
+    ngx_http_waf_re_node_t   *left;
+    ngx_http_waf_re_node_t   *right;
+};
+
+
+struct ngx_http_waf_re_s {
+    ngx_http_waf_re_node_t   *root;   /* null if unsupported syntax */
+    ngx_uint_t                ninsts;
+    char                     *pcre;   /* why pcre is needed, or null */
+    ngx_array_t              *lits;   /* the pcre prefilter. maybe null */
+};
+
+
+// the nfa instructions
+#define NGX_HTTP_WAF_NFA_SET         0
+#define NGX_HTTP_WAF_NFA_SPLIT       1
+#define NGX_HTTP_WAF_NFA_BOL         2
+#define NGX_HTTP_WAF_NFA_EOL         3
+#define NGX_HTTP_WAF_NFA_EOS         4
+#define NGX_HTTP_WAF_NFA_MATCH       5
+
+typedef struct {
+    ngx_uint_t      op;
+    uint32_t        x;     /* next, or the rule of MATCH */
+    uint32_t        y;     /* SPLIT next, or the rule of EOL and EOS */
+    u_char         *set;
+} ngx_http_waf_nfa_inst_t;
+
+
+typedef struct ngx_http_waf_dfa_state_s  ngx_http_waf_dfa_state_t;
+
+struct ngx_http_waf_dfa_state_s {
+    ngx_http_waf_dfa_state_t  **next;    /* [ncls], null if not built */
+    uint32_t                   *kernel;  /* sorted nfa instructions */
+    ngx_uint_t                  nkernel;
+    ngx_uint_t                  hash;
+    uint32_t                   *out;     /* acc, end, nl rules */
+    ngx_uint_t                  nacc;    /* matched here */
+    ngx_uint_t                  nend;    /* matched at the end */
+    ngx_uint_t                  nnl;     /* matched before the last \n */
+    ngx_http_waf_dfa_state_t   *hnext;
+    ngx_http_waf_dfa_state_t   *link;
+};
+
+
+// the lazy dfa of the rx@ rules. the states are built by the worker
+// on demand, and flushed when the cache is full.
+typedef struct {
+    ngx_http_waf_nfa_inst_t    *insts;
+    ngx_uint_t                  ninsts;
+    uint32_t                   *starts;  /* [nrules] */
+    ngx_uint_t                  nrules;
+    ngx_uint_t                  ncls;
+    u_char                      cls[256];
+    u_char                      rep[256]; /* a byte of the class */
+
+    ngx_http_waf_dfa_state_t   *start;
+    ngx_http_waf_dfa_state_t  **buckets;
+    ngx_uint_t                  nbuckets;
+    ngx_http_waf_dfa_state_t   *states;
+    size_t                      size;
+    uint32_t                   *mark;
+    uint32_t                    gen;
+    uint32_t                   *stack;
+    uint32_t                   *work;
+    ngx_uint_t                  flushes;
+} ngx_http_waf_dfa_t;
+
+// the dfa over the chunks. the state may be freed by a flush between
+// them, it is built again by its kernel.
+typedef struct {
+    ngx_http_waf_dfa_state_t   *st;
+    ngx_uint_t                  flushes; /* of the dfa when st was saved */
+    uint32_t                   *kernel;  /* [ninsts] */
+    ngx_uint_t                  nkernel;
+    ngx_uint_t                  left;
+    u_char                     *ends;    /* matched if the value ends here */
+    ngx_flag_t                  failed;  /* no memory for the states */
+} ngx_http_waf_dfa_stream_t;
+
+#define NGX_HTTP_WAF_DFA_CACHE_SIZE  (1024 * 1024)
+
+#define ngx_http_waf_re_set_has(set, c)             \
+    ((set)[(c) >> 3] & (1 << ((c) & 7)))
+#define ngx_http_waf_re_set_add(set, c)             \
+    ((set)[(c) >> 3] |= (u_char) (1 << ((c) & 7)))
+
+
+#define ngx_http_waf_hit(hits, n)                   \
+    ((hits)[(n) >> 3] & (1 << ((n) & 7)))
+#define ngx_http_waf_set_hit(hits, n)               \
+    ((hits)[(n) >> 3] |= (u_char) (1 << ((n) & 7)))
+
+
 typedef struct ngx_http_waf_whitelist_s {
     ngx_int_t     id;         /* opt->wl_ids[x] */
     ngx_array_t  *url_zones;  /* ngx_http_waf_zone_t* */
@@ -274,6 +594,18 @@ typedef struct {
     ngx_uint_t       hash_max_size;
     ngx_uint_t       hash_bucket_size;
 
+    // compiled ngx_http_waf_matcher_t*, shared by the same rules.
+    ngx_array_t     *matchers;
+
+    // ngx_array_t*, the distinct decode chains of the rules.
+    ngx_array_t     *decodes;
+
+    // ngx_http_waf_regex_t*
+    ngx_array_t     *regexes;
+    ngx_flag_t       regex_jit;
+    ngx_uint_t       regex_match_limit;
+    ngx_uint_t       regex_depth_limit;
+
     // ngx_http_waf_rule_t
     // general and regex
     ngx_array_t     *url;
@@ -281,7 +613,9 @@ typedef struct {
     ngx_array_t     *headers;
     ngx_array_t     *body;
     ngx_array_t     *raw_body;
+    ngx_array_t     *raw_body_stream;  /* follows the raw_body */
     ngx_array_t     *body_file;
+    ngx_array_t     *body_file_stream;  /* follows the body_file */
 
     // ngx_http_waf_rule_t
     // specify variable
@@ -305,6 +639,12 @@ typedef struct {
     ngx_flag_t           security_waf;
     ngx_http_waf_log_t  *log;
     ngx_msec_t           security_timeout;
+    ngx_uint_t           regex_limit_action;
+    ngx_uint_t           body_depth_limit;  /* of the json and xml body */
+    ngx_uint_t           body_key_limit;
+#if (NGX_THREADS)
+    ngx_thread_pool_t   *thread_pool;  /* reads the body file */
+#endif
 
     ngx_array_t         *check_rules;  /* ngx_http_waf_check_t */
     ngx_array_t         *whitelists;  /* ngx_http_waf_whitelist_t */
@@ -316,7 +656,9 @@ typedef struct {
     ngx_array_t        *headers;
     ngx_array_t        *body;
     ngx_array_t        *body_file;
+    ngx_array_t        *body_file_stream;  /* follows the body_file */
     ngx_array_t        *raw_body;
+    ngx_array_t        *raw_body_stream;  /* follows the raw_body */
 
     // ngx_http_waf_rule_t
     // only specify variable rules
@@ -328,20 +670,169 @@ typedef struct {
     ngx_hash_t          headers_var_hash;
     ngx_array_t        *body_var;
     ngx_hash_t          body_var_hash;
+
+    ngx_uint_t          nmatchers;
+
+    // the rx@ rules matched by pcre, for the startup log.
+    ngx_uint_t          nprefiltered;
+    ngx_uint_t          nunfiltered;
 } ngx_http_waf_loc_conf_t;
 
 
 
+// the scratch memory of the decoded values. the values of a field are
+// allocated from it and the next field resets it, so a request needs
+// the most of a single field.
+typedef struct {
+    u_char         *start;
+    u_char         *pos;
+    u_char         *end;
+    u_char         *retired;  /* the blocks outgrown by the field */
+    size_t          used;     /* by the field */
+    size_t          peak;
+} ngx_http_waf_arena_t;
+
+
+// the json body parser. the path is the dotted keys of the value, an
+// array element has the path of the array.
+typedef struct {
+    ngx_str_t       path;
+    size_t          path_size;
+    u_char         *buf;        /* a string with escapes */
+    size_t          buf_size;
+    u_char         *open;       /* '{' or '[' of a depth */
+    size_t         *path_len;   /* the path of a depth */
+    ngx_uint_t      depth;
+    ngx_uint_t      keys;
+    off_t           offset;     /* of the bytes parsed */
+} ngx_http_waf_json_t;
+
+
+// the xml body parser. the names of the open elements are copied to the
+// names, one after another.
+typedef struct {
+    u_char         *names;
+    size_t          names_size;
+    size_t         *name_end;   /* in the names, of a depth */
+    ngx_uint_t      depth;
+    ngx_uint_t      keys;
+    off_t           offset;     /* of the bytes parsed */
+} ngx_http_waf_xml_t;
+
+
+// the field decoded by a decode chain.
+typedef struct {
+    ngx_uint_t      field;   /* ctx->field of the value */
+    ngx_str_t       value;
+    ngx_int_t       rc;      /* NGX_OK, or NGX_ABORT of a decode error */
+} ngx_http_waf_decoded_t;
+
+
+// the matcher result of current field.
+typedef struct {
+    ngx_uint_t      field;   /* ctx->field of the hits */
+    ngx_str_t       value;   /* the decoded field */
+    u_char         *hits;    /* bitmap of ngx_http_waf_rule_t->mid */
+} ngx_http_waf_match_t;
+
+
+// a field of the request tokenized once, the hash is of the lowercase key.
+typedef struct {
+    ngx_uint_t      zone;    /* NGX_HTTP_WAF_FIELD_* */
+    ngx_str_t       key;
+    ngx_str_t       val;
+    ngx_uint_t      hash;
+    ngx_uint_t      flags;
+} ngx_http_waf_field_t;
+
+
+// the body matched by the request body filter as it arrives. a field
+// over two chunks is copied to the buf, the key first, and so is a json
+// or xml token.
+typedef struct {
+    ngx_uint_t      type;       /* NGX_HTTP_WAF_BODY_* */
+    ngx_uint_t      state;      /* of the body parser */
+    u_char         *buf;
+    size_t          len;
+    size_t          size;
+    size_t          key_len;    /* of the key in the buf */
+    ngx_array_t    *streams;    /* ngx_http_waf_stream_t of raw_body_stream */
+    u_char         *once;       /* the raw_body_stream rules matched */
+    ngx_str_t       delim;      /* CRLF "--" boundary */
+    u_short        *shift;      /* of the delimiter bytes */
+    u_char         *cross;      /* a delimiter over two chunks */
+    ngx_str_t       filename;   /* of the file uploaded */
+    ngx_array_t    *file_streams; /* of body_file_stream */
+    u_char         *file_once;  /* the body_file_stream rules matched */
+    size_t          emitted;    /* the bytes of the part kept, matched */
+    void           *doc;        /* ngx_http_waf_json_t or ngx_http_waf_xml_t */
+    unsigned        started:1;
+    unsigned        streamed:1; /* up to the last buf */
+    unsigned        headed:1;   /* the headers of the part parsed */
+    unsigned        upload:1;   /* the file is over a window */
+    unsigned        truncated:1; /* the part over the bytes kept */
+    unsigned        skipped:1;  /* the headers of the part not ended */
+    unsigned        stopped:1;  /* the json or xml over a limit or invalid */
+} ngx_http_waf_body_t;
+
+
+// the body file mapped with a page of zeros after it.
+typedef struct {
+    u_char         *addr;
+    size_t          size;
+} ngx_http_waf_body_map_t;
+
+
+#if (NGX_THREADS)
+
+// a window of the body file read by a thread, or the pages of its map.
+typedef struct {
+    ngx_fd_t        fd;
+    off_t           offset;
+    size_t          size;
+    u_char         *buf;
+    ssize_t         n;       /* the bytes read, -1 on an error */
+    ngx_err_t       err;
+} ngx_http_waf_body_read_t;
+
+#endif
+
+
 typedef struct ngx_http_waf_ctx_s {
     ngx_array_t             *scores; /* ngx_http_waf_score_t */
     ngx_http_waf_log_ctx_t  *logc;
     ngx_uint_t               status;
+    ngx_uint_t               field;   /* the key and value being matched */
+    ngx_http_waf_match_t    *matches; /* [matcher->idx * 2 + (key:0 val:1)] */
+    ngx_http_waf_decoded_t  *decoded; /* [(decode - 1) * 2 + (key:0 val:1)] */
+    ngx_http_waf_decoded_t  *lowered; /* [decode * 2 + (key:0 val:1)] */
+    ngx_uint_t               decode_hits;
+    ngx_http_waf_arena_t     arena;
+    ngx_array_t             *fields;  /* ngx_http_waf_field_t */
+    ngx_uint_t               zones[NGX_HTTP_WAF_FIELD_ZONES + 1];
+    ngx_http_waf_body_t      body;
+    ngx_str_t                file;    /* the map of the body file */
+#if (NGX_THREADS)
+    ngx_thread_task_t       *task;    /* reads the body file */
+#endif
+    u_char                  *once;    /* maybe null. the rules matched */
+    unsigned                 transient:1; /* the strings of the chunks */
+    unsigned                 head_done:1;
     unsigned                 wait_body:1;
     unsigned                 check_done:1;
     unsigned                 interrupt:1;
+    unsigned                 file_feed:1;   /* the body fed from the file */
+    unsigned                 file_mapped:1;
 } ngx_http_waf_ctx_t;
 
 
+// a parser of the json or xml body. it is called with the chunks, *pos
+// is set to a token not ended in them. NGX_DECLINED stops the parse.
+typedef ngx_int_t (*ngx_http_waf_body_parse_pt)(ngx_http_request_t *r,
+    ngx_http_waf_loc_conf_t *wlcf, ngx_http_waf_ctx_t *ctx, u_char **pos,
+    u_char *e, ngx_uint_t last);
+
+
 typedef struct ngx_http_waf_add_rule_s {
     ngx_uint_t   flag;
     ngx_uint_t   offset;
@@ -360,12 +851,50 @@ typedef struct ngx_http_waf_add_wl_part_s {
 } ngx_http_waf_add_wl_part_t;
 
 
+// a stage of a decode chain. the handler takes the input in chunks and
+// returns the end of its output, the flush ends the input. both return
+// NULL on the invalid data. a stage never outputs more than its input
+// but the bytes it held from the chunks before.
+// the scan of the whole input returns NGX_DECLINED if the stage would not
+// change it, NGX_ERROR if the stage would fail.
 typedef struct ngx_http_waf_rule_decode_s {
     ngx_str_t                    suffix;
     ngx_http_waf_rule_decode_pt  handler;
+    ngx_http_waf_rule_flush_pt   flush;
+    ngx_http_waf_rule_scan_pt    scan;
 } ngx_http_waf_rule_decode_t;
 
 
+// the state of a stage between the chunks.
+struct ngx_http_waf_decode_state_s {
+    ngx_uint_t   state;
+    ngx_uint_t   n;         /* the base64 or the held characters */
+    u_char       saved[NGX_HTTP_WAF_DECODE_HOLD];
+};
+
+
+typedef struct {
+    ngx_str_t    name;
+    u_char       ch;
+} ngx_http_waf_html_entity_t;
+
+
+// the hash: function and the form of its constants. the digest of a
+// value is at once, the init, update and final ones are of its chunks.
+struct ngx_http_waf_hash_alg_s {
+    ngx_str_t        name;
+    size_t           size;    /* the binary digest */
+    ngx_flag_t       hex;     /* hex or decimal constants */
+    void           (*digest)(u_char *dst, ngx_str_t *s);
+    void           (*init)(ngx_http_waf_digest_ctx_t *ctx);
+    void           (*update)(ngx_http_waf_digest_ctx_t *ctx, u_char *p,
+                             size_t len);
+    void           (*final)(u_char *dst, ngx_http_waf_digest_ctx_t *ctx);
+};
+
+#define NGX_HTTP_WAF_DIGEST_MAX  32
+
+
 typedef struct ngx_http_waf_rule_parser_s ngx_http_waf_rule_parser_t;
 typedef ngx_int_t (*ngx_http_waf_rule_item_parse_pt)(ngx_conf_t *cf,
     ngx_str_t *str, ngx_http_waf_rule_parser_t *parser,
@@ -409,10 +938,16 @@ struct ngx_http_waf_rule_parser_s {
 )
 
 static ngx_int_t ngx_http_waf_init(ngx_conf_t *cf);
+static ngx_int_t ngx_http_waf_init_process(ngx_cycle_t *cycle);
+static void ngx_http_waf_exit_process(ngx_cycle_t *cycle);
 static ngx_int_t ngx_http_waf_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_waf_request_body_filter(ngx_http_request_t *r,
+    ngx_chain_t *in);
 static void *ngx_http_waf_create_main_conf(ngx_conf_t *cf);
 static char *ngx_http_waf_init_main_conf(ngx_conf_t *cf, void *conf);
 static void *ngx_http_waf_create_loc_conf(ngx_conf_t *cf);
+static ngx_int_t ngx_http_waf_regex_init(ngx_conf_t *cf,
+    ngx_http_waf_main_conf_t *wmcf);
 // static char *ngx_http_waf_init_main_conf(ngx_conf_t *cf, void *conf);
 static char *ngx_http_waf_merge_loc_conf(ngx_conf_t *cf,
     void *parent, void *child);
@@ -422,16 +957,47 @@ static char *ngx_http_waf_loc_rule(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_waf_check_rule(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_waf_set_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static char *ngx_http_waf_set_log(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static void ngx_http_waf_syslog_writer(ngx_http_waf_log_t *log,
     u_char *buf, size_t len);
 static ngx_int_t ngx_http_waf_parse_rule(ngx_conf_t *cf,
     ngx_http_waf_rule_opt_t *opt);
-static ngx_int_t ngx_http_waf_decode_base64(ngx_http_request_t *r,
-    ngx_str_t *dst, ngx_str_t *src, ngx_uint_t destory);
-static ngx_int_t ngx_http_waf_decode_url(ngx_http_request_t *r,
-    ngx_str_t *dst, ngx_str_t *src, ngx_uint_t destory);
+static u_char *ngx_http_waf_decode_base64(ngx_http_waf_decode_state_t *st,
+    u_char *d, u_char *p, u_char *e);
+static u_char *ngx_http_waf_decode_base64url(ngx_http_waf_decode_state_t *st,
+    u_char *d, u_char *p, u_char *e);
+static u_char *ngx_http_waf_decode_base64_flush(
+    ngx_http_waf_decode_state_t *st, u_char *d);
+static u_char *ngx_http_waf_decode_url(ngx_http_waf_decode_state_t *st,
+    u_char *d, u_char *p, u_char *e);
+static u_char *ngx_http_waf_decode_url_flush(ngx_http_waf_decode_state_t *st,
+    u_char *d);
+static ngx_int_t ngx_http_waf_decode_base64_scan(u_char *p, u_char *e);
+static ngx_int_t ngx_http_waf_decode_base64url_scan(u_char *p, u_char *e);
+static ngx_int_t ngx_http_waf_decode_url_scan(u_char *p, u_char *e);
+static u_char *ngx_http_waf_decode_html(ngx_http_waf_decode_state_t *st,
+    u_char *d, u_char *p, u_char *e);
+static u_char *ngx_http_waf_decode_html_flush(ngx_http_waf_decode_state_t *st,
+    u_char *d);
+static ngx_int_t ngx_http_waf_decode_html_scan(u_char *p, u_char *e);
+static u_char *ngx_http_waf_decode_unicode(ngx_http_waf_decode_state_t *st,
+    u_char *d, u_char *p, u_char *e);
+static u_char *ngx_http_waf_decode_unicode_flush(
+    ngx_http_waf_decode_state_t *st, u_char *d);
+static ngx_int_t ngx_http_waf_decode_unicode_scan(u_char *p, u_char *e);
+static u_char *ngx_http_waf_decode_comments(ngx_http_waf_decode_state_t *st,
+    u_char *d, u_char *p, u_char *e);
+static u_char *ngx_http_waf_decode_comments_flush(
+    ngx_http_waf_decode_state_t *st, u_char *d);
+static ngx_int_t ngx_http_waf_decode_comments_scan(u_char *p, u_char *e);
+static u_char *ngx_http_waf_decode_ws(ngx_http_waf_decode_state_t *st,
+    u_char *d, u_char *p, u_char *e);
+static u_char *ngx_http_waf_decode_ws_flush(ngx_http_waf_decode_state_t *st,
+    u_char *d);
+static ngx_int_t ngx_http_waf_decode_ws_scan(u_char *p, u_char *e);
 static ngx_int_t ngx_http_waf_parse_rule_id(ngx_conf_t *cf, ngx_str_t *str,
     ngx_http_waf_rule_parser_t *parser,
     ngx_http_waf_rule_opt_t *opt);
@@ -456,9 +1022,19 @@ static ngx_int_t ngx_http_waf_parse_rule_libinj(ngx_conf_t *cf,
 static ngx_int_t  ngx_http_waf_parse_rule_hash(ngx_conf_t *cf,
     ngx_str_t *str, ngx_http_waf_rule_parser_t *parser,
     ngx_http_waf_rule_opt_t *opt);
+static ngx_int_t ngx_http_waf_parse_digest(ngx_http_waf_hash_alg_t *alg,
+    u_char *p, u_char *e, u_char *dst);
+static ngx_int_t ngx_http_waf_parse_rule_hash_file(ngx_conf_t *cf,
+    ngx_http_waf_public_rule_t *pr, ngx_str_t *name);
+static ngx_int_t  ngx_http_waf_parse_rule_limit(ngx_conf_t *cf,
+    ngx_str_t *str, ngx_http_waf_rule_parser_t *parser,
+    ngx_http_waf_rule_opt_t *opt);
 static ngx_int_t  ngx_http_waf_add_rule_handler(ngx_conf_t *cf,
     ngx_http_waf_public_rule_t *pr, ngx_http_waf_zone_t *mz,
     void *conf, ngx_uint_t offset);
+static ngx_int_t  ngx_http_waf_add_stream_handler(ngx_conf_t *cf,
+    ngx_http_waf_public_rule_t *pr, ngx_http_waf_zone_t *mz,
+    void *conf, ngx_uint_t offset);
 static ngx_int_t ngx_http_waf_add_wl_part_handler(ngx_conf_t *cf,
     ngx_http_waf_zone_t *mz, void *wl, ngx_uint_t offset);
 static ngx_int_t ngx_http_waf_rule_str_ge_handler(
@@ -479,12 +1055,27 @@ static ngx_int_t ngx_http_waf_rule_str_sqli_handler(
     ngx_http_waf_public_rule_t *pr, ngx_str_t *s);
 static ngx_int_t ngx_http_waf_rule_str_xss_handler(
     ngx_http_waf_public_rule_t *pr, ngx_str_t *s);
-static ngx_int_t ngx_http_waf_rule_hash_md5_handler(
-    ngx_http_waf_public_rule_t *pr, ngx_str_t *s);
-static ngx_int_t ngx_http_waf_rule_hash_crc32_short_handler(
-    ngx_http_waf_public_rule_t *pr, ngx_str_t *s);
-static ngx_int_t ngx_http_waf_rule_hash_crc32_long_handler(
+static ngx_int_t ngx_http_waf_rule_hash_handler(
     ngx_http_waf_public_rule_t *pr, ngx_str_t *s);
+static void ngx_http_waf_digest_md5(u_char *dst, ngx_str_t *s);
+static void ngx_http_waf_digest_sha256(u_char *dst, ngx_str_t *s);
+static void ngx_http_waf_digest_crc32_short(u_char *dst, ngx_str_t *s);
+static void ngx_http_waf_digest_crc32_long(u_char *dst, ngx_str_t *s);
+static void ngx_http_waf_md5_init(ngx_http_waf_digest_ctx_t *ctx);
+static void ngx_http_waf_md5_update(ngx_http_waf_digest_ctx_t *ctx,
+    u_char *p, size_t len);
+static void ngx_http_waf_md5_final(u_char *dst,
+    ngx_http_waf_digest_ctx_t *ctx);
+static void ngx_http_waf_sha256_init(ngx_http_waf_digest_ctx_t *ctx);
+static void ngx_http_waf_sha256_update(ngx_http_waf_digest_ctx_t *ctx,
+    u_char *p, size_t len);
+static void ngx_http_waf_sha256_final(u_char *dst,
+    ngx_http_waf_digest_ctx_t *ctx);
+static void ngx_http_waf_crc32_init(ngx_http_waf_digest_ctx_t *ctx);
+static void ngx_http_waf_crc32_update(ngx_http_waf_digest_ctx_t *ctx,
+    u_char *p, size_t len);
+static void ngx_http_waf_crc32_final(u_char *dst,
+    ngx_http_waf_digest_ctx_t *ctx);
 static ngx_int_t ngx_http_waf_check_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 
@@ -577,6 +1168,13 @@ static ngx_conf_bitmask_t  ngx_http_waf_rule_zone_item[] = {
 
 
 
+static ngx_conf_enum_t  ngx_http_waf_regex_limit_actions[] = {
+    { ngx_string("closed"), NGX_HTTP_WAF_REGEX_LIMIT_CLOSED },
+    { ngx_string("open"),   NGX_HTTP_WAF_REGEX_LIMIT_OPEN },
+    { ngx_null_string, 0 }
+};
+
+
 static ngx_http_waf_add_rule_t  ngx_http_waf_conf_add_rules[] = {
 
     { NGX_HTTP_WAF_MZ_G_URL|NGX_HTTP_WAF_MZ_X_URL,
@@ -602,12 +1200,12 @@ static ngx_http_waf_add_rule_t  ngx_http_waf_conf_add_rules[] = {
     { NGX_HTTP_WAF_MZ_G_RAW_BODY,
       offsetof(ngx_http_waf_main_conf_t, raw_body),
       offsetof(ngx_http_waf_loc_conf_t, raw_body),
-      ngx_http_waf_add_rule_handler },
+      ngx_http_waf_add_stream_handler },
 
     { NGX_HTTP_WAF_MZ_G_FILE_BODY|NGX_HTTP_WAF_MZ_X_FILE_BODY,
       offsetof(ngx_http_waf_main_conf_t, body_file),
       offsetof(ngx_http_waf_loc_conf_t, body_file),
-      ngx_http_waf_add_rule_handler },
+      ngx_http_waf_add_stream_handler },
 
     { NGX_HTTP_WAF_MZ_VAR_URL,
       offsetof(ngx_http_waf_main_conf_t, url_var),
@@ -661,11 +1259,51 @@ static ngx_http_waf_add_wl_part_t  ngx_http_waf_conf_add_wl[] = {
 };
 
 
+// the base64url is before the base64 which is its prefix.
 static ngx_http_waf_rule_decode_t  ngx_http_waf_rule_decode[] = {
-    {ngx_string("base64"),    ngx_http_waf_decode_base64},
-    {ngx_string("url"),       ngx_http_waf_decode_url},
+    {ngx_string("base64url"), ngx_http_waf_decode_base64url,
+                              ngx_http_waf_decode_base64_flush,
+                              ngx_http_waf_decode_base64url_scan},
+    {ngx_string("base64"),    ngx_http_waf_decode_base64,
+                              ngx_http_waf_decode_base64_flush,
+                              ngx_http_waf_decode_base64_scan},
+    {ngx_string("url"),       ngx_http_waf_decode_url,
+                              ngx_http_waf_decode_url_flush,
+                              ngx_http_waf_decode_url_scan},
+    {ngx_string("html"),      ngx_http_waf_decode_html,
+                              ngx_http_waf_decode_html_flush,
+                              ngx_http_waf_decode_html_scan},
+    {ngx_string("unicode"),   ngx_http_waf_decode_unicode,
+                              ngx_http_waf_decode_unicode_flush,
+                              ngx_http_waf_decode_unicode_scan},
+    {ngx_string("strip_comments"),
+                              ngx_http_waf_decode_comments,
+                              ngx_http_waf_decode_comments_flush,
+                              ngx_http_waf_decode_comments_scan},
+    {ngx_string("compress_ws"),
+                              ngx_http_waf_decode_ws,
+                              ngx_http_waf_decode_ws_flush,
+                              ngx_http_waf_decode_ws_scan},
+
+    {ngx_null_string,         NULL, NULL, NULL}
+};
+
 
-    {ngx_null_string,         NULL}
+static ngx_http_waf_hash_alg_t  ngx_http_waf_hash_algs[] = {
+    {ngx_string("md5@"),         16, 1, ngx_http_waf_digest_md5,
+     ngx_http_waf_md5_init, ngx_http_waf_md5_update,
+     ngx_http_waf_md5_final},
+    {ngx_string("sha256@"),      32, 1, ngx_http_waf_digest_sha256,
+     ngx_http_waf_sha256_init, ngx_http_waf_sha256_update,
+     ngx_http_waf_sha256_final},
+    {ngx_string("crc32@"),        4, 0, ngx_http_waf_digest_crc32_short,
+     ngx_http_waf_crc32_init, ngx_http_waf_crc32_update,
+     ngx_http_waf_crc32_final},
+    {ngx_string("crc32_long@"),   4, 0, ngx_http_waf_digest_crc32_long,
+     ngx_http_waf_crc32_init, ngx_http_waf_crc32_update,
+     ngx_http_waf_crc32_final},
+
+    {ngx_null_string, 0, 0, NULL, NULL, NULL, NULL}
 };
 
 
@@ -678,6 +1316,7 @@ static ngx_http_waf_rule_parser_t  ngx_http_waf_rule_parser_item[] = {
     {ngx_string("z:"),      ngx_http_waf_parse_rule_zone},
     {ngx_string("wl:"),     ngx_http_waf_parse_rule_whitelist},
     {ngx_string("note:"),   ngx_http_waf_parse_rule_note},
+    {ngx_string("limit:"),  ngx_http_waf_parse_rule_limit},
 
     {ngx_null_string, NULL}
 };
@@ -699,6 +1338,27 @@ static ngx_command_t  ngx_http_waf_commands[] = {
       offsetof(ngx_http_waf_main_conf_t, hash_bucket_size),
       NULL },
 
+    { ngx_string("security_regex_jit"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_waf_main_conf_t, regex_jit),
+      NULL },
+
+    { ngx_string("security_regex_match_limit"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_waf_main_conf_t, regex_match_limit),
+      NULL },
+
+    { ngx_string("security_regex_depth_limit"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_waf_main_conf_t, regex_depth_limit),
+      NULL },
+
     { ngx_string("security_rule"),
       NGX_HTTP_MAIN_CONF|NGX_CONF_1MORE,
       ngx_http_waf_main_rule,
@@ -741,6 +1401,34 @@ static ngx_command_t  ngx_http_waf_commands[] = {
       offsetof(ngx_http_waf_loc_conf_t, security_timeout),
       NULL },
 
+    { ngx_string("security_regex_limit_action"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LMT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_waf_loc_conf_t, regex_limit_action),
+      &ngx_http_waf_regex_limit_actions },
+
+    { ngx_string("security_body_depth_limit"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LMT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_waf_loc_conf_t, body_depth_limit),
+      NULL },
+
+    { ngx_string("security_body_key_limit"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LMT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_waf_loc_conf_t, body_key_limit),
+      NULL },
+
+    { ngx_string("security_body_thread_pool"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LMT_CONF|NGX_CONF_TAKE1,
+      ngx_http_waf_set_thread_pool,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -767,15 +1455,18 @@ ngx_module_t  ngx_http_waf_module = {
     NGX_HTTP_MODULE,                 /* module type */
     NULL,                            /* init master */
     NULL,                            /* init module */
-    NULL,                            /* init process */
+    ngx_http_waf_init_process,       /* init process */
     NULL,                            /* init thread */
     NULL,                            /* exit thread */
-    NULL,                            /* exit process */
+    ngx_http_waf_exit_process,       /* exit process */
     NULL,                            /* exit master */
     NGX_MODULE_V1_PADDING
 };
 
 
+static ngx_http_request_body_filter_pt   ngx_http_next_request_body_filter;
+
+
 //-- init -------------------
 static void *
 ngx_http_waf_create_main_conf(ngx_conf_t *cf)
@@ -789,6 +1480,9 @@ ngx_http_waf_create_main_conf(ngx_conf_t *cf)
 
     wmcf->hash_max_size = NGX_CONF_UNSET_UINT;
     wmcf->hash_bucket_size = NGX_CONF_UNSET_UINT;
+    wmcf->regex_jit = NGX_CONF_UNSET;
+    wmcf->regex_match_limit = NGX_CONF_UNSET_UINT;
+    wmcf->regex_depth_limit = NGX_CONF_UNSET_UINT;
 
     return wmcf;
 }
@@ -804,6 +1498,15 @@ ngx_http_waf_init_main_conf(ngx_conf_t *cf, void *conf)
 
     wmcf->hash_bucket_size = ngx_align(wmcf->hash_bucket_size, ngx_cacheline_size);
 
+    ngx_conf_init_value(wmcf->regex_jit, 0);
+    ngx_conf_init_uint_value(wmcf->regex_match_limit, 0);
+    ngx_conf_init_uint_value(wmcf->regex_depth_limit, 0);
+
+    // all the rules are parsed, the security_regex_* are known now.
+    if (ngx_http_waf_regex_init(cf, wmcf) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
     return NGX_CONF_OK;
 }
 
@@ -820,6 +1523,12 @@ ngx_http_waf_create_loc_conf(ngx_conf_t *cf)
 
     wlcf->security_waf = NGX_CONF_UNSET;
     wlcf->security_timeout = NGX_CONF_UNSET_MSEC;
+    wlcf->regex_limit_action = NGX_CONF_UNSET_UINT;
+    wlcf->body_depth_limit = NGX_CONF_UNSET_UINT;
+    wlcf->body_key_limit = NGX_CONF_UNSET_UINT;
+#if (NGX_THREADS)
+    wlcf->thread_pool = NGX_CONF_UNSET_PTR;
+#endif
     wlcf->log = NULL;
 
     return wlcf;
@@ -843,875 +1552,8833 @@ ngx_strpbrk(u_char *b, u_char *e, char *s) {
 }
 
 
-static u_char *
-ngx_memnstr(u_char *s1, char *s2, size_t len)
-{
-    u_char  c1, c2;
-    size_t  n;
+// 77 is not a base64 character.
+static u_char  ngx_http_waf_basis64[] = {
+    77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77,
+    77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77,
+    77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 62, 77, 77, 77, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 77, 77, 77, 77, 77, 77,
+    77,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 77, 77, 77, 77, 77,
+    77, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 77, 77, 77, 77, 77,
+
+    77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77,
+    77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77,
+    77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77,
+    77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77,
+    77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77,
+    77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77,
+    77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77,
+    77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77
+};
 
-    c2 = *(u_char *) s2++;
+static u_char  ngx_http_waf_basis64url[] = {
+    77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77,
+    77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77,
+    77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 62, 77, 77,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 77, 77, 77, 77, 77, 77,
+    77,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 77, 77, 77, 77, 63,
+    77, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 77, 77, 77, 77, 77,
+
+    77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77,
+    77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77,
+    77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77,
+    77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77,
+    77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77,
+    77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77,
+    77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77,
+    77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77, 77
+};
 
-    n = ngx_strlen(s2);
 
-    do {
-        do {
-            if (len-- == 0) {
-                return NULL;
-            }
+// the NGX_HTTP_WAF_NORM_ classes of the bytes, the space, the tab, the
+// line breaks and the no-break space are the white space.
+static u_char  ngx_http_waf_norm[] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x01, 0x00, 0x00, 0x00, 0x00, 0x04, 0x02, 0x00,
+    0x00, 0x00, 0x80, 0x00, 0x00, 0x00, 0x00, 0x08,
+    0x70, 0x70, 0x70, 0x70, 0x70, 0x70, 0x70, 0x70,
+    0x70, 0x70, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x40,
+    0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40,
+    0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40,
+    0x40, 0x40, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x50, 0x50, 0x50, 0x50, 0x50, 0x50, 0x40,
+    0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40,
+    0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40,
+    0x40, 0x40, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00,
+
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
 
-            c1 = *s1++;
 
-        } while (c1 != c2);
+static ngx_http_waf_html_entity_t  ngx_http_waf_html_entities[] = {
+    { ngx_string("quot"), '"' },
+    { ngx_string("amp"),  '&' },
+    { ngx_string("apos"), '\'' },
+    { ngx_string("lt"),   '<' },
+    { ngx_string("gt"),   '>' },
+    { ngx_string("nbsp"), 0xa0 },
+    { ngx_null_string,    0 }
+};
+
+
+// the string kernels of the str: rules and the multipart body, selected
+// by the cpu at the worker start. the first and the last bytes of the
+// needle filter the candidates by vectors, the bytes between are compared
+// by the scalar. the needles of casestr and casecmp are lowercase.
+// urlscan finds the first '%' or '+', b64scan the first byte out of the
+// base64 alphabet, both return e if none. urlcopy copies up to the first
+// '%' with the '+' as a space, b64dec decodes the whole vectors of the
+// valid characters, the rest is left to the decode stage. both move *s
+// and return the end of the output, they may write a vector past it.
+// upscan finds the first uppercase letter or returns e, lowcase is as
+// ngx_strlow(). chrscan finds the first c or returns e, it splits the args
+// and the urlencoded body by '=' and '&'.
+typedef struct {
+    char         *name;
+    u_char     *(*casestr)(u_char *s, u_char *e, u_char *lc, size_t n);
+    ngx_int_t   (*casecmp)(u_char *s, u_char *lc, size_t n);
+    u_char     *(*memstr)(u_char *s, u_char *e, u_char *p, size_t n);
+    u_char     *(*urlscan)(u_char *s, u_char *e);
+    u_char     *(*b64scan)(u_char *s, u_char *e, ngx_uint_t url);
+    u_char     *(*urlcopy)(u_char *d, u_char **s, u_char *e);
+    u_char     *(*b64dec)(u_char *d, u_char **s, u_char *e, ngx_uint_t url);
+    u_char     *(*upscan)(u_char *s, u_char *e);
+    void        (*lowcase)(u_char *d, u_char *s, size_t n);
+    u_char     *(*chrscan)(u_char *s, u_char *e, u_char c);
+} ngx_http_waf_str_kernels_t;
 
-        if (n > len) {
-            return NULL;
-        }
 
-    } while (ngx_memcmp((char *)s1, s2, n) != 0);
+static u_char *
+ngx_http_waf_casestr_scalar(u_char *s, u_char *e, u_char *lc, size_t n)
+{
+    if ((size_t) (e - s) < n) {
+        return NULL;
+    }
 
-    return --s1;
+    return ngx_strlcasestrn(s, e, lc, n - 1);
 }
 
 
-static void
-ngx_http_waf_unescape_uri(u_char **dst, u_char **src, size_t size,
-    ngx_uint_t type)
+static ngx_int_t
+ngx_http_waf_casecmp_scalar(u_char *s, u_char *lc, size_t n)
 {
-    u_char  *d, *s, ch, c, decoded;
-    enum {
-        sw_usual = 0,
-        sw_quoted,
-        sw_quoted_second
-    } state;
+    return ngx_strncasecmp(s, lc, n);
+}
 
-    d = *dst;
-    s = *src;
 
-    state = 0;
-    decoded = 0;
+static u_char *
+ngx_http_waf_memstr_scalar(u_char *s, u_char *e, u_char *p, size_t n)
+{
+    u_char  c;
 
-    while (size--) {
+    c = *p++;
+    n--;
 
-        ch = *s++;
+    for (/* void */; (size_t) (e - s) > n; s++) {
+        if (*s == c && ngx_memcmp(s + 1, p, n) == 0) {
+            return s;
+        }
+    }
 
-        switch (state) {
-        case sw_usual:
-            if (ch == '?'
-                && (type & (NGX_UNESCAPE_URI|NGX_UNESCAPE_REDIRECT)))
-            {
-                *d++ = ch;
-                goto done;
-            }
+    return NULL;
+}
 
-            if (ch == '%') {
-                state = sw_quoted;
-                break;
-            }
 
-            if (ch == '+') {
-                *d++ = ' ';
-                break;
-            }
+static u_char *
+ngx_http_waf_urlscan_scalar(u_char *s, u_char *e)
+{
+    while (s < e && *s != '%' && *s != '+') {
+        s++;
+    }
 
-            *d++ = ch;
-            break;
+    return s;
+}
 
-        case sw_quoted:
 
-            if (ch >= '0' && ch <= '9') {
-                decoded = (u_char) (ch - '0');
-                state = sw_quoted_second;
-                break;
-            }
+static u_char *
+ngx_http_waf_b64scan_scalar(u_char *s, u_char *e, ngx_uint_t url)
+{
+    u_char  *basis;
 
-            c = (u_char) (ch | 0x20);
-            if (c >= 'a' && c <= 'f') {
-                decoded = (u_char) (c - 'a' + 10);
-                state = sw_quoted_second;
-                break;
-            }
+    basis = url ? ngx_http_waf_basis64url : ngx_http_waf_basis64;
 
-            /* the invalid quoted character */
+    while (s < e && basis[*s] != 77) {
+        s++;
+    }
 
-            state = sw_usual;
+    return s;
+}
 
-            *d++ = ch;
 
-            break;
+static u_char *
+ngx_http_waf_urlcopy_scalar(u_char *d, u_char **s, u_char *e)
+{
+    u_char  *p;
 
-        case sw_quoted_second:
+    for (p = *s; p < e && *p != '%'; p++) {
+        *d++ = (*p == '+') ? ' ' : *p;
+    }
 
-            state = sw_usual;
+    *s = p;
 
-            if (ch >= '0' && ch <= '9') {
-                ch = (u_char) ((decoded << 4) + ch - '0');
+    return d;
+}
 
-                if (type & NGX_UNESCAPE_REDIRECT) {
-                    if (ch > '%' && ch < 0x7f) {
-                        *d++ = ch;
-                        break;
-                    }
 
-                    *d++ = '%'; *d++ = *(s - 2); *d++ = *(s - 1);
-                    break;
-                }
+static u_char *
+ngx_http_waf_b64dec_scalar(u_char *d, u_char **s, u_char *e, ngx_uint_t url)
+{
+    return d;
+}
 
-                *d++ = ch;
 
-                break;
-            }
+static u_char *
+ngx_http_waf_upscan_scalar(u_char *s, u_char *e)
+{
+    while (s < e && (*s < 'A' || *s > 'Z')) {
+        s++;
+    }
 
-            c = (u_char) (ch | 0x20);
-            if (c >= 'a' && c <= 'f') {
-                ch = (u_char) ((decoded << 4) + c - 'a' + 10);
+    return s;
+}
 
-                if (type & NGX_UNESCAPE_URI) {
-                    if (ch == '?') {
-                        *d++ = ch;
-                        goto done;
-                    }
 
-                    *d++ = ch;
-                    break;
-                }
+static void
+ngx_http_waf_lowcase_scalar(u_char *d, u_char *s, size_t n)
+{
+    ngx_strlow(d, s, n);
+}
 
-                if (type & NGX_UNESCAPE_REDIRECT) {
-                    if (ch == '?') {
-                        *d++ = ch;
-                        goto done;
-                    }
 
-                    if (ch > '%' && ch < 0x7f) {
-                        *d++ = ch;
-                        break;
-                    }
+static u_char *
+ngx_http_waf_chrscan_scalar(u_char *s, u_char *e, u_char c)
+{
+    while (s < e && *s != c) {
+        s++;
+    }
 
-                    *d++ = '%'; *d++ = *(s - 2); *d++ = *(s - 1);
-                    break;
-                }
+    return s;
+}
 
-                *d++ = ch;
 
-                break;
-            }
+#if (NGX_HTTP_WAF_X86_SIMD)
 
-            /* the invalid quoted character */
+__attribute__((target("sse2")))
+static u_char *
+ngx_http_waf_casestr_sse2(u_char *s, u_char *e, u_char *lc, size_t n)
+{
+    u_char    *p;
+    unsigned   bits, k;
+    __m128i    f0, f1, l0, l1, a, b;
 
-            break;
-        }
+    if (n < 2) {
+        return ngx_http_waf_casestr_scalar(s, e, lc, n);
     }
 
-done:
-
-    *dst = d;
-    *src = s;
-}
+    f0 = _mm_set1_epi8((char) lc[0]);
+    f1 = _mm_set1_epi8((char) ngx_toupper(lc[0]));
+    l0 = _mm_set1_epi8((char) lc[n - 1]);
+    l1 = _mm_set1_epi8((char) ngx_toupper(lc[n - 1]));
 
+    for (p = s; (size_t) (e - p) >= n - 1 + 16; p += 16) {
+        a = _mm_loadu_si128((__m128i *) p);
+        b = _mm_loadu_si128((__m128i *) (p + n - 1));
 
-static u_char*
-ngx_http_waf_score_tag(u_char *b, u_char *e, char *s) {
-    u_char *p = b;
+        a = _mm_or_si128(_mm_cmpeq_epi8(a, f0), _mm_cmpeq_epi8(a, f1));
+        b = _mm_or_si128(_mm_cmpeq_epi8(b, l0), _mm_cmpeq_epi8(b, l1));
 
-    while (p < e) {
-        if (ngx_strchr(s, *p) != NULL) {
-            return p;
-        }
-        if (!( (*p >= 'a' && *p <= 'z') || *p == '_' 
-            || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') )) {
-            return NULL;
+        for (bits = _mm_movemask_epi8(_mm_and_si128(a, b));
+             bits != 0;
+             bits &= bits - 1)
+        {
+            k = __builtin_ctz(bits);
+            if (ngx_strncasecmp(p + k + 1, lc + 1, n - 2) == 0) {
+                return p + k;
+            }
         }
-        p++;
     }
 
-    return NULL;
+    return ngx_http_waf_casestr_scalar(p, e, lc, n);
 }
 
 
+__attribute__((target("sse2")))
 static ngx_int_t
-ngx_array_binary_search(const ngx_array_t *a, void *v,
-    ngx_int_t (*cmp)(const void *, const void *))
+ngx_http_waf_casecmp_sse2(u_char *s, u_char *lc, size_t n)
 {
-    ngx_int_t       l, r, m, rc;
-    u_char         *t;
+    __m128i  a, t;
 
-    l = 0;
-    r = a->nelts;
-    m = -1;
+    for (/* void */; n >= 16; n -= 16, s += 16, lc += 16) {
+        a = _mm_loadu_si128((__m128i *) s);
 
-    t = a->elts;
-    while (l <= r) {
-        m = l + ((r-l) >> 1);
-        rc = cmp((void*)(t + m*a->size), v);
-        if (rc < 0) {
-            l = m + 1;
-        } else if (rc > 0) {
-            r = m - 1;
-        } else {
-            return m;
+        // 'A' - 'Z' to lowercase
+        t = _mm_sub_epi8(a, _mm_set1_epi8('A'));
+        t = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(25)), t);
+        a = _mm_or_si128(a, _mm_and_si128(t, _mm_set1_epi8(0x20)));
+
+        t = _mm_cmpeq_epi8(a, _mm_loadu_si128((__m128i *) lc));
+        if (_mm_movemask_epi8(t) != 0xffff) {
+            return 1;
         }
     }
 
-    return NGX_ERROR;
+    return ngx_strncasecmp(s, lc, n);
 }
 
-static ngx_int_t ngx_libc_cdecl
-ngx_http_waf_whitelist_cmp_id(const void *wl, const void *id)
+
+__attribute__((target("sse2")))
+static u_char *
+ngx_http_waf_memstr_sse2(u_char *s, u_char *e, u_char *m, size_t n)
 {
-    ngx_int_t                 *n;
-    ngx_http_waf_whitelist_t  *w;
+    u_char    *p;
+    unsigned   bits, k;
+    __m128i    f, l, a, b;
 
-    n = (ngx_int_t *)id;
-    w = (ngx_http_waf_whitelist_t *) wl;
+    if (n < 2) {
+        return ngx_http_waf_memstr_scalar(s, e, m, n);
+    }
 
-    return w->id - *n;
-}
+    f = _mm_set1_epi8((char) m[0]);
+    l = _mm_set1_epi8((char) m[n - 1]);
 
-static int ngx_libc_cdecl
-ngx_http_waf_cmp_whitelist_id(const void *one, const void *two)
-{
-    ngx_http_waf_whitelist_t  *first, *second;
+    for (p = s; (size_t) (e - p) >= n - 1 + 16; p += 16) {
+        a = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *) p), f);
+        b = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *) (p + n - 1)), l);
 
-    first = (ngx_http_waf_whitelist_t *) one;
-    second = (ngx_http_waf_whitelist_t *) two;
+        for (bits = _mm_movemask_epi8(_mm_and_si128(a, b));
+             bits != 0;
+             bits &= bits - 1)
+        {
+            k = __builtin_ctz(bits);
+            if (ngx_memcmp(p + k + 1, m + 1, n - 2) == 0) {
+                return p + k;
+            }
+        }
+    }
 
-    return first->id - second->id;
+    return ngx_http_waf_memstr_scalar(p, e, m, n);
 }
 
-// search whitelist in array.
-static ngx_http_waf_whitelist_t *
-ngx_http_waf_search_whitelist(const ngx_array_t *wl, ngx_int_t id)
+
+__attribute__((target("sse2")))
+static u_char *
+ngx_http_waf_urlscan_sse2(u_char *s, u_char *e)
 {
-    ngx_int_t                  i;
-    ngx_http_waf_whitelist_t  *a;
+    unsigned  bits;
+    __m128i   a;
 
-    if (wl == NULL) {
-        return NULL;
-    }
+    for (/* void */; e - s >= 16; s += 16) {
+        a = _mm_loadu_si128((__m128i *) s);
+        a = _mm_or_si128(_mm_cmpeq_epi8(a, _mm_set1_epi8('%')),
+                         _mm_cmpeq_epi8(a, _mm_set1_epi8('+')));
 
-    // TODO: id < 0
-    a = wl->elts;
-    i = ngx_array_binary_search(wl, &id, ngx_http_waf_whitelist_cmp_id);
-    if (i == NGX_ERROR) {
-        id = 0;
-        i = ngx_array_binary_search(wl, &id, ngx_http_waf_whitelist_cmp_id);
-        if (i == NGX_ERROR) {
-            return NULL;
+        bits = _mm_movemask_epi8(a);
+        if (bits != 0) {
+            return s + __builtin_ctz(bits);
         }
     }
 
-    return &a[i];
+    return ngx_http_waf_urlscan_scalar(s, e);
 }
 
 
-static ngx_int_t
-ngx_http_waf_score_timeout(ngx_http_request_t *r,
-    ngx_http_waf_loc_conf_t *wlcf)
+// the signed compares are enough, the alphabet is ascii.
+__attribute__((target("sse2")))
+static u_char *
+ngx_http_waf_b64scan_sse2(u_char *s, u_char *e, ngx_uint_t url)
 {
-    ngx_time_t      *tp;
-    ngx_msec_t       ms;
+    unsigned  bits;
+    __m128i   a, l, v, c62, c63;
+
+    c62 = _mm_set1_epi8(url ? '-' : '+');
+    c63 = _mm_set1_epi8(url ? '_' : '/');
+
+    for (/* void */; e - s >= 16; s += 16) {
+        a = _mm_loadu_si128((__m128i *) s);
+        l = _mm_or_si128(a, _mm_set1_epi8(0x20));
+
+        v = _mm_and_si128(_mm_cmpgt_epi8(l, _mm_set1_epi8('a' - 1)),
+                          _mm_cmplt_epi8(l, _mm_set1_epi8('z' + 1)));
+        v = _mm_or_si128(v,
+                _mm_and_si128(_mm_cmpgt_epi8(a, _mm_set1_epi8('0' - 1)),
+                              _mm_cmplt_epi8(a, _mm_set1_epi8('9' + 1))));
+        v = _mm_or_si128(v, _mm_cmpeq_epi8(a, c62));
+        v = _mm_or_si128(v, _mm_cmpeq_epi8(a, c63));
+
+        bits = _mm_movemask_epi8(v) ^ 0xffff;
+        if (bits != 0) {
+            return s + __builtin_ctz(bits);
+        }
+    }
 
-    tp = ngx_timeofday();
+    return ngx_http_waf_b64scan_scalar(s, e, url);
+}
 
-    ms = (tp->sec - r->start_sec) * 1000 + (tp->msec - r->start_msec);
 
-    if (ms > wlcf->security_timeout) {
-        return NGX_OK;
+__attribute__((target("sse2")))
+static u_char *
+ngx_http_waf_urlcopy_sse2(u_char *d, u_char **s, u_char *e)
+{
+    u_char    *p;
+    unsigned   bits;
+    __m128i    a, t;
+
+    for (p = *s; e - p >= 16; p += 16, d += 16) {
+        a = _mm_loadu_si128((__m128i *) p);
+        t = _mm_cmpeq_epi8(a, _mm_set1_epi8('+'));
+        a = _mm_xor_si128(a, _mm_and_si128(t, _mm_set1_epi8('+' ^ ' ')));
+
+        _mm_storeu_si128((__m128i *) d, a);
+
+        bits = _mm_movemask_epi8(_mm_cmpeq_epi8(a, _mm_set1_epi8('%')));
+        if (bits != 0) {
+            bits = __builtin_ctz(bits);
+            *s = p + bits;
+            return d + bits;
+        }
     }
 
-    return NGX_ERROR;
+    *s = p;
+
+    return ngx_http_waf_urlcopy_scalar(d, s, e);
 }
 
 
-static ngx_int_t
-ngx_http_waf_vars_in_hash(ngx_conf_t *cf, ngx_array_t *a,
-    ngx_hash_t *h)
+__attribute__((target("sse2")))
+static u_char *
+ngx_http_waf_upscan_sse2(u_char *s, u_char *e)
 {
-    ngx_uint_t              i;
-    ngx_array_t             vars;
-    ngx_hash_key_t         *hk;
-    ngx_hash_init_t         hash;
-    ngx_http_waf_rule_t    *rules;
-    ngx_http_waf_main_conf_t *wmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_waf_module);
+    unsigned  bits;
+    __m128i   t;
 
-    if (ngx_array_init(&vars, cf->temp_pool, 32, sizeof(ngx_hash_key_t))
-        != NGX_OK)
-    {
-        return NGX_ERROR;
-    }
+    for (/* void */; e - s >= 16; s += 16) {
+        t = _mm_sub_epi8(_mm_loadu_si128((__m128i *) s), _mm_set1_epi8('A'));
+        t = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(25)), t);
 
-    rules = a->elts;
-    for (i = 0; i < a->nelts; i++) {
-        hk = ngx_array_push(&vars);
-        if (hk == NULL) {
-            return NGX_ERROR;
+        bits = _mm_movemask_epi8(t);
+        if (bits != 0) {
+            return s + __builtin_ctz(bits);
         }
-
-        hk->key = rules[i].m_zone->name;
-        hk->key_hash = ngx_hash_key_lc(hk->key.data, hk->key.len);
-        hk->value = &rules[i];
     }
 
-    hash.hash = h;
-    hash.key = ngx_hash_key_lc;
-    hash.max_size = wmcf->hash_max_size;
-    hash.bucket_size = wmcf->hash_bucket_size;
-    hash.name = "waf_vars_in_hash";
-    hash.pool = cf->pool;
-    hash.temp_pool = NULL;
+    return ngx_http_waf_upscan_scalar(s, e);
+}
 
-    if (ngx_hash_init(&hash, vars.elts, vars.nelts) != NGX_OK) {
-        return NGX_ERROR;
+
+__attribute__((target("sse2")))
+static u_char *
+ngx_http_waf_chrscan_sse2(u_char *s, u_char *e, u_char c)
+{
+    unsigned  bits;
+    __m128i   v;
+
+    v = _mm_set1_epi8((char) c);
+
+    for (/* void */; e - s >= 16; s += 16) {
+        bits = _mm_movemask_epi8(
+                   _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *) s), v));
+        if (bits != 0) {
+            return s + __builtin_ctz(bits);
+        }
     }
 
-    return NGX_OK;
+    return ngx_http_waf_chrscan_scalar(s, e, c);
 }
 
-// exec regex zone
-// return NGX_OK matched, else NGX_ERROR.
-static ngx_int_t
-ngx_http_waf_zone_regex_exec(ngx_http_waf_zone_t *z, ngx_str_t *s)
-{
-    ngx_int_t     rc;
 
-    rc = NGX_REGEX_NO_MATCHED;
+__attribute__((target("sse2")))
+static void
+ngx_http_waf_lowcase_sse2(u_char *d, u_char *s, size_t n)
+{
+    __m128i  a, t;
 
-    if (z->regex == NULL) {
-        return NGX_ERROR;
-    }
+    for (/* void */; n >= 16; n -= 16, s += 16, d += 16) {
+        a = _mm_loadu_si128((__m128i *) s);
 
-    rc = ngx_regex_exec(z->regex, s, NULL, 0);
+        t = _mm_sub_epi8(a, _mm_set1_epi8('A'));
+        t = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(25)), t);
+        a = _mm_or_si128(a, _mm_and_si128(t, _mm_set1_epi8(0x20)));
 
-    if (rc == NGX_REGEX_NO_MATCHED) {
-        return NGX_ERROR;
+        _mm_storeu_si128((__m128i *) d, a);
     }
 
-    return NGX_OK;
+    ngx_strlow(d, s, n);
 }
 
 
-// -- parse -----
-static ngx_int_t
-ngx_http_waf_merge_rule_array(ngx_conf_t *cf, const ngx_array_t *wl,
-    const ngx_array_t *checks, const ngx_array_t *prev, ngx_array_t **conf)
+__attribute__((target("avx2")))
+static u_char *
+ngx_http_waf_casestr_avx2(u_char *s, u_char *e, u_char *lc, size_t n)
 {
-    ngx_uint_t                     i, j, k, n;
-    ngx_http_waf_rule_t           *prev_rules, *rule, *rules;
-    ngx_http_waf_zone_t           *zones;
-    ngx_http_waf_score_t          *ss;
-    ngx_http_waf_check_t          *cs, *c;
-    ngx_http_waf_whitelist_t      *wl_rule;
+    u_char    *p;
+    unsigned   bits, k;
+    __m256i    f0, f1, l0, l1, a, b;
 
-    if (*conf == NULL) {
-        *conf = ngx_array_create(cf->pool, 10,
-            sizeof(ngx_http_waf_rule_t));
-
-        if (*conf == NULL) {
-            return NGX_ERROR;
-        }
+    if (n < 2) {
+        return ngx_http_waf_casestr_scalar(s, e, lc, n);
     }
 
-    // local config rules size.
-    n = (*conf)->nelts;
+    f0 = _mm256_set1_epi8((char) lc[0]);
+    f1 = _mm256_set1_epi8((char) ngx_toupper(lc[0]));
+    l0 = _mm256_set1_epi8((char) lc[n - 1]);
+    l1 = _mm256_set1_epi8((char) ngx_toupper(lc[n - 1]));
 
-    // merge rule
-    if (prev != NULL) {
-        prev_rules = prev->elts;
-        for (i = 0; i < prev->nelts; i++) {
-            rule = ngx_array_push(*conf);
-            if (rule == NULL) {
-                return NGX_ERROR;
-            }
+    for (p = s; (size_t) (e - p) >= n - 1 + 32; p += 32) {
+        a = _mm256_loadu_si256((__m256i *) p);
+        b = _mm256_loadu_si256((__m256i *) (p + n - 1));
 
-            ngx_memzero(rule, sizeof(ngx_http_waf_rule_t));
+        a = _mm256_or_si256(_mm256_cmpeq_epi8(a, f0),
+                            _mm256_cmpeq_epi8(a, f1));
+        b = _mm256_or_si256(_mm256_cmpeq_epi8(b, l0),
+                            _mm256_cmpeq_epi8(b, l1));
 
-            rule->p_rule = prev_rules[i].p_rule;
-            rule->m_zone = prev_rules[i].m_zone;
+        for (bits = _mm256_movemask_epi8(_mm256_and_si256(a, b));
+             bits != 0;
+             bits &= bits - 1)
+        {
+            k = __builtin_ctz(bits);
+            if (ngx_strncasecmp(p + k + 1, lc + 1, n - 2) == 0) {
+                return p + k;
+            }
         }
     }
 
-    // add whitelist zones
-    // flag the scores
-    rules = (*conf)->elts;
-    for (i = 0; i < (*conf)->nelts; i++) {
-        rule = &rules[i];
+    return ngx_http_waf_casestr_sse2(p, e, lc, n);
+}
 
-        wl_rule = NULL;
-        if (i >= n) {
-            // location config rule don't match whitelist.
-            wl_rule = ngx_http_waf_search_whitelist(wl, rule->p_rule->id);
+
+__attribute__((target("avx2")))
+static ngx_int_t
+ngx_http_waf_casecmp_avx2(u_char *s, u_char *lc, size_t n)
+{
+    __m256i  a, t;
+
+    for (/* void */; n >= 32; n -= 32, s += 32, lc += 32) {
+        a = _mm256_loadu_si256((__m256i *) s);
+
+        t = _mm256_sub_epi8(a, _mm256_set1_epi8('A'));
+        t = _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(25)), t);
+        a = _mm256_or_si256(a, _mm256_and_si256(t, _mm256_set1_epi8(0x20)));
+
+        t = _mm256_cmpeq_epi8(a, _mm256_loadu_si256((__m256i *) lc));
+        if ((unsigned) _mm256_movemask_epi8(t) != 0xffffffff) {
+            return 1;
         }
+    }
 
-        // add whitelist zones
-        if (wl_rule != NULL) {
-            if (wl_rule->all_zones) {
-                ngx_http_waf_rule_set_wl_invalid(rule->sts);
-            } else {
-                for (j = 0; ngx_http_waf_conf_add_wl[j].flag != 0; j++) {
+    return ngx_http_waf_casecmp_sse2(s, lc, n);
+}
 
-                    if (rule->m_zone->flag & ngx_http_waf_conf_add_wl[j].flag) {
 
-                        rule->wl_zones = *((ngx_array_t**)((char*)wl_rule
-                            + ngx_http_waf_conf_add_wl[j].offset));
-                        if (rule->wl_zones == NULL
-                            || rule->wl_zones->nelts == 0)
-                        {
-                            break;
-                        }
+__attribute__((target("avx2")))
+static u_char *
+ngx_http_waf_memstr_avx2(u_char *s, u_char *e, u_char *m, size_t n)
+{
+    u_char    *p;
+    unsigned   bits, k;
+    __m256i    f, l, a, b;
 
-                        zones = rule->wl_zones->elts;
-                        for (k = 0; k < rule->wl_zones->nelts; k++) {
-                            if (zones[k].regex != NULL) {
-                                continue;
-                            }
+    if (n < 2) {
+        return ngx_http_waf_memstr_scalar(s, e, m, n);
+    }
 
-                            if (ngx_http_waf_wl_mz(&zones[k],
-                                rule->m_zone))
-                            {
-                                ngx_http_waf_wl_copy_mz(rule->sts,
-                                    zones[k].flag);
-                                continue;
-                            }
+    f = _mm256_set1_epi8((char) m[0]);
+    l = _mm256_set1_epi8((char) m[n - 1]);
 
-                            if (ngx_http_waf_mz_ge(&zones[k], rule->m_zone)) {
-                                ngx_http_waf_rule_set_wl_invalid(rule->sts);
-                                break;
-                            }
-                        }
+    for (p = s; (size_t) (e - p) >= n - 1 + 32; p += 32) {
+        a = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i *) p), f);
+        b = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i *) (p + n - 1)), l);
 
-                        break;
-                    }
-                }
+        for (bits = _mm256_movemask_epi8(_mm256_and_si256(a, b));
+             bits != 0;
+             bits &= bits - 1)
+        {
+            k = __builtin_ctz(bits);
+            if (ngx_memcmp(p + k + 1, m + 1, n - 2) == 0) {
+                return p + k;
             }
         }
+    }
 
-        if (ngx_http_waf_rule_invalid(rule->sts)) {
-            continue;
-        }
+    return ngx_http_waf_memstr_sse2(p, e, m, n);
+}
 
-        // socres
-        if (rule->p_rule->scores == NULL || rule->p_rule->scores->nelts == 0) {
-            ngx_http_waf_sts_act_set_block(rule->sts);
-            continue;
-        }
 
-        if (checks == NULL || checks->nelts == 0) {
-            ngx_http_waf_rule_set_sc_invalid(rule->sts);
-            continue;
+__attribute__((target("avx2")))
+static u_char *
+ngx_http_waf_urlscan_avx2(u_char *s, u_char *e)
+{
+    unsigned  bits;
+    __m256i   a;
+
+    for (/* void */; e - s >= 32; s += 32) {
+        a = _mm256_loadu_si256((__m256i *) s);
+        a = _mm256_or_si256(_mm256_cmpeq_epi8(a, _mm256_set1_epi8('%')),
+                            _mm256_cmpeq_epi8(a, _mm256_set1_epi8('+')));
+
+        bits = _mm256_movemask_epi8(a);
+        if (bits != 0) {
+            return s + __builtin_ctz(bits);
+        }
+    }
+
+    return ngx_http_waf_urlscan_sse2(s, e);
+}
+
+
+__attribute__((target("avx2")))
+static u_char *
+ngx_http_waf_b64scan_avx2(u_char *s, u_char *e, ngx_uint_t url)
+{
+    unsigned  bits;
+    __m256i   a, l, v, c62, c63;
+
+    c62 = _mm256_set1_epi8(url ? '-' : '+');
+    c63 = _mm256_set1_epi8(url ? '_' : '/');
+
+    for (/* void */; e - s >= 32; s += 32) {
+        a = _mm256_loadu_si256((__m256i *) s);
+        l = _mm256_or_si256(a, _mm256_set1_epi8(0x20));
+
+        v = _mm256_and_si256(
+                _mm256_cmpgt_epi8(l, _mm256_set1_epi8('a' - 1)),
+                _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), l));
+        v = _mm256_or_si256(v, _mm256_and_si256(
+                _mm256_cmpgt_epi8(a, _mm256_set1_epi8('0' - 1)),
+                _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), a)));
+        v = _mm256_or_si256(v, _mm256_cmpeq_epi8(a, c62));
+        v = _mm256_or_si256(v, _mm256_cmpeq_epi8(a, c63));
+
+        bits = ~(unsigned) _mm256_movemask_epi8(v);
+        if (bits != 0) {
+            return s + __builtin_ctz(bits);
+        }
+    }
+
+    return ngx_http_waf_b64scan_sse2(s, e, url);
+}
+
+
+__attribute__((target("avx2")))
+static u_char *
+ngx_http_waf_urlcopy_avx2(u_char *d, u_char **s, u_char *e)
+{
+    u_char    *p;
+    unsigned   bits;
+    __m256i    a, t;
+
+    for (p = *s; e - p >= 32; p += 32, d += 32) {
+        a = _mm256_loadu_si256((__m256i *) p);
+        t = _mm256_cmpeq_epi8(a, _mm256_set1_epi8('+'));
+        a = _mm256_xor_si256(a,
+                _mm256_and_si256(t, _mm256_set1_epi8('+' ^ ' ')));
+
+        _mm256_storeu_si256((__m256i *) d, a);
+
+        bits = _mm256_movemask_epi8(
+                   _mm256_cmpeq_epi8(a, _mm256_set1_epi8('%')));
+        if (bits != 0) {
+            bits = __builtin_ctz(bits);
+            *s = p + bits;
+            return d + bits;
+        }
+    }
+
+    *s = p;
+
+    return ngx_http_waf_urlcopy_sse2(d, s, e);
+}
+
+
+// the characters are mapped to 6 bits by the ranges, the groups of four
+// are packed to three bytes by the multiply adds and a shuffle.
+__attribute__((target("avx2")))
+static u_char *
+ngx_http_waf_b64dec_avx2(u_char *d, u_char **s, u_char *e, ngx_uint_t url)
+{
+    u_char   *p;
+    __m256i   a, t, m, v, ok, c62, c63;
+
+    c62 = _mm256_set1_epi8(url ? '-' : '+');
+    c63 = _mm256_set1_epi8(url ? '_' : '/');
+
+    for (p = *s; e - p >= 32; p += 32, d += 24) {
+        a = _mm256_loadu_si256((__m256i *) p);
+
+        t = _mm256_sub_epi8(a, _mm256_set1_epi8('A'));
+        ok = _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(25)), t);
+        v = _mm256_and_si256(ok, t);
+
+        t = _mm256_sub_epi8(a, _mm256_set1_epi8('a'));
+        m = _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(25)), t);
+        v = _mm256_or_si256(v, _mm256_and_si256(m,
+                _mm256_add_epi8(t, _mm256_set1_epi8(26))));
+        ok = _mm256_or_si256(ok, m);
+
+        t = _mm256_sub_epi8(a, _mm256_set1_epi8('0'));
+        m = _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(9)), t);
+        v = _mm256_or_si256(v, _mm256_and_si256(m,
+                _mm256_add_epi8(t, _mm256_set1_epi8(52))));
+        ok = _mm256_or_si256(ok, m);
+
+        m = _mm256_cmpeq_epi8(a, c62);
+        v = _mm256_or_si256(v, _mm256_and_si256(m, _mm256_set1_epi8(62)));
+        ok = _mm256_or_si256(ok, m);
+
+        m = _mm256_cmpeq_epi8(a, c63);
+        v = _mm256_or_si256(v, _mm256_and_si256(m, _mm256_set1_epi8(63)));
+        ok = _mm256_or_si256(ok, m);
+
+        if ((unsigned) _mm256_movemask_epi8(ok) != 0xffffffff) {
+            break;
+        }
+
+        v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+        v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+        v = _mm256_shuffle_epi8(v, _mm256_setr_epi8(
+                2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+        v = _mm256_permutevar8x32_epi32(v,
+                _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+
+        _mm_storeu_si128((__m128i *) d, _mm256_castsi256_si128(v));
+        _mm_storel_epi64((__m128i *) (d + 16), _mm256_extracti128_si256(v, 1));
+    }
+
+    *s = p;
+
+    return d;
+}
+
+
+__attribute__((target("avx2")))
+static u_char *
+ngx_http_waf_upscan_avx2(u_char *s, u_char *e)
+{
+    unsigned  bits;
+    __m256i   t;
+
+    for (/* void */; e - s >= 32; s += 32) {
+        t = _mm256_sub_epi8(_mm256_loadu_si256((__m256i *) s),
+                            _mm256_set1_epi8('A'));
+        t = _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(25)), t);
+
+        bits = _mm256_movemask_epi8(t);
+        if (bits != 0) {
+            return s + __builtin_ctz(bits);
+        }
+    }
+
+    return ngx_http_waf_upscan_sse2(s, e);
+}
+
+
+__attribute__((target("avx2")))
+static u_char *
+ngx_http_waf_chrscan_avx2(u_char *s, u_char *e, u_char c)
+{
+    unsigned  bits;
+    __m256i   v;
+
+    v = _mm256_set1_epi8((char) c);
+
+    for (/* void */; e - s >= 32; s += 32) {
+        bits = _mm256_movemask_epi8(
+                   _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i *) s), v));
+        if (bits != 0) {
+            return s + __builtin_ctz(bits);
+        }
+    }
+
+    return ngx_http_waf_chrscan_sse2(s, e, c);
+}
+
+
+__attribute__((target("avx2")))
+static void
+ngx_http_waf_lowcase_avx2(u_char *d, u_char *s, size_t n)
+{
+    __m256i  a, t;
+
+    for (/* void */; n >= 32; n -= 32, s += 32, d += 32) {
+        a = _mm256_loadu_si256((__m256i *) s);
+
+        t = _mm256_sub_epi8(a, _mm256_set1_epi8('A'));
+        t = _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(25)), t);
+        a = _mm256_or_si256(a, _mm256_and_si256(t, _mm256_set1_epi8(0x20)));
+
+        _mm256_storeu_si256((__m256i *) d, a);
+    }
+
+    ngx_http_waf_lowcase_sse2(d, s, n);
+}
+
+#endif
+
+
+#if (NGX_HTTP_WAF_NEON)
+
+static u_char *
+ngx_http_waf_casestr_neon(u_char *s, u_char *e, u_char *lc, size_t n)
+{
+    u_char       *p, hits[16];
+    ngx_uint_t    k;
+    uint8x16_t    f0, f1, l0, l1, a, b;
+
+    if (n < 2) {
+        return ngx_http_waf_casestr_scalar(s, e, lc, n);
+    }
+
+    f0 = vdupq_n_u8(lc[0]);
+    f1 = vdupq_n_u8(ngx_toupper(lc[0]));
+    l0 = vdupq_n_u8(lc[n - 1]);
+    l1 = vdupq_n_u8(ngx_toupper(lc[n - 1]));
+
+    for (p = s; (size_t) (e - p) >= n - 1 + 16; p += 16) {
+        a = vld1q_u8(p);
+        b = vld1q_u8(p + n - 1);
+
+        a = vorrq_u8(vceqq_u8(a, f0), vceqq_u8(a, f1));
+        b = vorrq_u8(vceqq_u8(b, l0), vceqq_u8(b, l1));
+        a = vandq_u8(a, b);
+
+        if (vmaxvq_u8(a) == 0) {
+            continue;
+        }
+
+        vst1q_u8(hits, a);
+
+        for (k = 0; k < 16; k++) {
+            if (hits[k] && ngx_strncasecmp(p + k + 1, lc + 1, n - 2) == 0) {
+                return p + k;
+            }
+        }
+    }
+
+    return ngx_http_waf_casestr_scalar(p, e, lc, n);
+}
+
+
+static ngx_int_t
+ngx_http_waf_casecmp_neon(u_char *s, u_char *lc, size_t n)
+{
+    uint8x16_t  a, t;
+
+    for (/* void */; n >= 16; n -= 16, s += 16, lc += 16) {
+        a = vld1q_u8(s);
+
+        t = vcltq_u8(vsubq_u8(a, vdupq_n_u8('A')), vdupq_n_u8(26));
+        a = vorrq_u8(a, vandq_u8(t, vdupq_n_u8(0x20)));
+
+        if (vminvq_u8(vceqq_u8(a, vld1q_u8(lc))) != 0xff) {
+            return 1;
+        }
+    }
+
+    return ngx_strncasecmp(s, lc, n);
+}
+
+
+static u_char *
+ngx_http_waf_memstr_neon(u_char *s, u_char *e, u_char *m, size_t n)
+{
+    u_char       *p, hits[16];
+    ngx_uint_t    k;
+    uint8x16_t    f, l, a;
+
+    if (n < 2) {
+        return ngx_http_waf_memstr_scalar(s, e, m, n);
+    }
+
+    f = vdupq_n_u8(m[0]);
+    l = vdupq_n_u8(m[n - 1]);
+
+    for (p = s; (size_t) (e - p) >= n - 1 + 16; p += 16) {
+        a = vandq_u8(vceqq_u8(vld1q_u8(p), f),
+                     vceqq_u8(vld1q_u8(p + n - 1), l));
+
+        if (vmaxvq_u8(a) == 0) {
+            continue;
+        }
+
+        vst1q_u8(hits, a);
+
+        for (k = 0; k < 16; k++) {
+            if (hits[k] && ngx_memcmp(p + k + 1, m + 1, n - 2) == 0) {
+                return p + k;
+            }
+        }
+    }
+
+    return ngx_http_waf_memstr_scalar(p, e, m, n);
+}
+
+
+// the vector with the byte is left to the scalar.
+static u_char *
+ngx_http_waf_urlscan_neon(u_char *s, u_char *e)
+{
+    uint8x16_t  a;
+
+    for (/* void */; e - s >= 16; s += 16) {
+        a = vld1q_u8(s);
+        a = vorrq_u8(vceqq_u8(a, vdupq_n_u8('%')),
+                     vceqq_u8(a, vdupq_n_u8('+')));
+
+        if (vmaxvq_u8(a) != 0) {
+            break;
+        }
+    }
+
+    return ngx_http_waf_urlscan_scalar(s, e);
+}
+
+
+static u_char *
+ngx_http_waf_b64scan_neon(u_char *s, u_char *e, ngx_uint_t url)
+{
+    uint8x16_t  a, l, v, c62, c63;
+
+    c62 = vdupq_n_u8(url ? '-' : '+');
+    c63 = vdupq_n_u8(url ? '_' : '/');
+
+    for (/* void */; e - s >= 16; s += 16) {
+        a = vld1q_u8(s);
+        l = vorrq_u8(a, vdupq_n_u8(0x20));
+
+        v = vcltq_u8(vsubq_u8(l, vdupq_n_u8('a')), vdupq_n_u8(26));
+        v = vorrq_u8(v, vcltq_u8(vsubq_u8(a, vdupq_n_u8('0')),
+                                 vdupq_n_u8(10)));
+        v = vorrq_u8(v, vceqq_u8(a, c62));
+        v = vorrq_u8(v, vceqq_u8(a, c63));
+
+        if (vminvq_u8(v) == 0) {
+            break;
+        }
+    }
+
+    return ngx_http_waf_b64scan_scalar(s, e, url);
+}
+
+
+static u_char *
+ngx_http_waf_urlcopy_neon(u_char *d, u_char **s, u_char *e)
+{
+    u_char      *p;
+    uint8x16_t   a;
+
+    for (p = *s; e - p >= 16; p += 16, d += 16) {
+        a = vld1q_u8(p);
+
+        if (vmaxvq_u8(vceqq_u8(a, vdupq_n_u8('%'))) != 0) {
+            break;
+        }
+
+        a = vbslq_u8(vceqq_u8(a, vdupq_n_u8('+')), vdupq_n_u8(' '), a);
+        vst1q_u8(d, a);
+    }
+
+    *s = p;
+
+    return ngx_http_waf_urlcopy_scalar(d, s, e);
+}
+
+
+// the 6 bits of the characters, 0xff out of the alphabet.
+static uint8x16_t
+ngx_http_waf_b64map_neon(uint8x16_t a, uint8x16_t c62, uint8x16_t c63)
+{
+    uint8x16_t  t, m, v, ok;
+
+    t = vsubq_u8(a, vdupq_n_u8('A'));
+    ok = vcltq_u8(t, vdupq_n_u8(26));
+    v = vandq_u8(ok, t);
+
+    t = vsubq_u8(a, vdupq_n_u8('a'));
+    m = vcltq_u8(t, vdupq_n_u8(26));
+    v = vorrq_u8(v, vandq_u8(m, vaddq_u8(t, vdupq_n_u8(26))));
+    ok = vorrq_u8(ok, m);
+
+    t = vsubq_u8(a, vdupq_n_u8('0'));
+    m = vcltq_u8(t, vdupq_n_u8(10));
+    v = vorrq_u8(v, vandq_u8(m, vaddq_u8(t, vdupq_n_u8(52))));
+    ok = vorrq_u8(ok, m);
+
+    m = vceqq_u8(a, c62);
+    v = vorrq_u8(v, vandq_u8(m, vdupq_n_u8(62)));
+    ok = vorrq_u8(ok, m);
+
+    m = vceqq_u8(a, c63);
+    v = vorrq_u8(v, vandq_u8(m, vdupq_n_u8(63)));
+    ok = vorrq_u8(ok, m);
+
+    return vorrq_u8(v, vmvnq_u8(ok));
+}
+
+
+// the groups are deinterleaved by the load and interleaved by the store.
+static u_char *
+ngx_http_waf_b64dec_neon(u_char *d, u_char **s, u_char *e, ngx_uint_t url)
+{
+    u_char        *p;
+    uint8x16_t     c62, c63;
+    uint8x16x4_t   a;
+    uint8x16x3_t   o;
+
+    c62 = vdupq_n_u8(url ? '-' : '+');
+    c63 = vdupq_n_u8(url ? '_' : '/');
+
+    for (p = *s; e - p >= 64; p += 64, d += 48) {
+        a = vld4q_u8(p);
+
+        a.val[0] = ngx_http_waf_b64map_neon(a.val[0], c62, c63);
+        a.val[1] = ngx_http_waf_b64map_neon(a.val[1], c62, c63);
+        a.val[2] = ngx_http_waf_b64map_neon(a.val[2], c62, c63);
+        a.val[3] = ngx_http_waf_b64map_neon(a.val[3], c62, c63);
+
+        if (vmaxvq_u8(vorrq_u8(vorrq_u8(a.val[0], a.val[1]),
+                               vorrq_u8(a.val[2], a.val[3])))
+            > 63)
+        {
+            break;
+        }
+
+        o.val[0] = vorrq_u8(vshlq_n_u8(a.val[0], 2), vshrq_n_u8(a.val[1], 4));
+        o.val[1] = vorrq_u8(vshlq_n_u8(a.val[1], 4), vshrq_n_u8(a.val[2], 2));
+        o.val[2] = vorrq_u8(vshlq_n_u8(a.val[2], 6), a.val[3]);
+
+        vst3q_u8(d, o);
+    }
+
+    *s = p;
+
+    return d;
+}
+
+
+static u_char *
+ngx_http_waf_upscan_neon(u_char *s, u_char *e)
+{
+    uint8x16_t  t;
+
+    for (/* void */; e - s >= 16; s += 16) {
+        t = vsubq_u8(vld1q_u8(s), vdupq_n_u8('A'));
+
+        if (vmaxvq_u8(vcltq_u8(t, vdupq_n_u8(26))) != 0) {
+            break;
+        }
+    }
+
+    return ngx_http_waf_upscan_scalar(s, e);
+}
+
+
+static u_char *
+ngx_http_waf_chrscan_neon(u_char *s, u_char *e, u_char c)
+{
+    uint8x16_t  v;
+
+    v = vdupq_n_u8(c);
+
+    for (/* void */; e - s >= 16; s += 16) {
+        if (vmaxvq_u8(vceqq_u8(vld1q_u8(s), v)) != 0) {
+            break;
+        }
+    }
+
+    return ngx_http_waf_chrscan_scalar(s, e, c);
+}
+
+
+static void
+ngx_http_waf_lowcase_neon(u_char *d, u_char *s, size_t n)
+{
+    uint8x16_t  a, t;
+
+    for (/* void */; n >= 16; n -= 16, s += 16, d += 16) {
+        a = vld1q_u8(s);
+
+        t = vcltq_u8(vsubq_u8(a, vdupq_n_u8('A')), vdupq_n_u8(26));
+        vst1q_u8(d, vorrq_u8(a, vandq_u8(t, vdupq_n_u8(0x20))));
+    }
+
+    ngx_strlow(d, s, n);
+}
+
+#endif
+
+
+static ngx_http_waf_str_kernels_t  ngx_http_waf_str_kernels[] = {
+#if (NGX_HTTP_WAF_X86_SIMD)
+    { "avx2", ngx_http_waf_casestr_avx2, ngx_http_waf_casecmp_avx2,
+      ngx_http_waf_memstr_avx2, ngx_http_waf_urlscan_avx2,
+      ngx_http_waf_b64scan_avx2, ngx_http_waf_urlcopy_avx2,
+      ngx_http_waf_b64dec_avx2, ngx_http_waf_upscan_avx2,
+      ngx_http_waf_lowcase_avx2, ngx_http_waf_chrscan_avx2 },
+
+    // no byte shuffle, the base64 is decoded by the scalar.
+    { "sse2", ngx_http_waf_casestr_sse2, ngx_http_waf_casecmp_sse2,
+      ngx_http_waf_memstr_sse2, ngx_http_waf_urlscan_sse2,
+      ngx_http_waf_b64scan_sse2, ngx_http_waf_urlcopy_sse2,
+      ngx_http_waf_b64dec_scalar, ngx_http_waf_upscan_sse2,
+      ngx_http_waf_lowcase_sse2, ngx_http_waf_chrscan_sse2 },
+#endif
+
+#if (NGX_HTTP_WAF_NEON)
+    { "neon", ngx_http_waf_casestr_neon, ngx_http_waf_casecmp_neon,
+      ngx_http_waf_memstr_neon, ngx_http_waf_urlscan_neon,
+      ngx_http_waf_b64scan_neon, ngx_http_waf_urlcopy_neon,
+      ngx_http_waf_b64dec_neon, ngx_http_waf_upscan_neon,
+      ngx_http_waf_lowcase_neon, ngx_http_waf_chrscan_neon },
+#endif
+
+    { "scalar", ngx_http_waf_casestr_scalar, ngx_http_waf_casecmp_scalar,
+      ngx_http_waf_memstr_scalar, ngx_http_waf_urlscan_scalar,
+      ngx_http_waf_b64scan_scalar, ngx_http_waf_urlcopy_scalar,
+      ngx_http_waf_b64dec_scalar, ngx_http_waf_upscan_scalar,
+      ngx_http_waf_lowcase_scalar, ngx_http_waf_chrscan_scalar }
+};
+
+// the master parses the configuration with the scalar kernels.
+static ngx_http_waf_str_kernels_t  *ngx_http_waf_str =
+    &ngx_http_waf_str_kernels[sizeof(ngx_http_waf_str_kernels)
+                              / sizeof(ngx_http_waf_str_kernels_t) - 1];
+
+
+static void
+ngx_http_waf_str_init_process(ngx_cycle_t *cycle)
+{
+    ngx_http_waf_str_kernels_t  *k;
+
+    k = ngx_http_waf_str_kernels;
+
+#if (NGX_HTTP_WAF_X86_SIMD)
+    __builtin_cpu_init();
+
+    if (!__builtin_cpu_supports("avx2")) {
+        k++;
+
+        if (!__builtin_cpu_supports("sse2")) {
+            k++;
+        }
+    }
+#endif
+
+    ngx_http_waf_str = k;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, cycle->log, 0,
+                   "http waf string kernels: %s", k->name);
+}
+
+
+static u_char *
+ngx_memnstr(u_char *s1, char *s2, size_t len)
+{
+    return ngx_http_waf_str->memstr(s1, s1 + len, (u_char *) s2,
+                                    ngx_strlen(s2));
+}
+
+
+static u_char*
+ngx_http_waf_score_tag(u_char *b, u_char *e, char *s) {
+    u_char *p = b;
+
+    while (p < e) {
+        if (ngx_strchr(s, *p) != NULL) {
+            return p;
+        }
+        if (!( (*p >= 'a' && *p <= 'z') || *p == '_' 
+            || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') )) {
+            return NULL;
+        }
+        p++;
+    }
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_array_binary_search(const ngx_array_t *a, void *v,
+    ngx_int_t (*cmp)(const void *, const void *))
+{
+    ngx_int_t       l, r, m, rc;
+    u_char         *t;
+
+    l = 0;
+    r = a->nelts;
+    m = -1;
+
+    t = a->elts;
+    while (l <= r) {
+        m = l + ((r-l) >> 1);
+        rc = cmp((void*)(t + m*a->size), v);
+        if (rc < 0) {
+            l = m + 1;
+        } else if (rc > 0) {
+            r = m - 1;
+        } else {
+            return m;
+        }
+    }
+
+    return NGX_ERROR;
+}
+
+static ngx_int_t ngx_libc_cdecl
+ngx_http_waf_whitelist_cmp_id(const void *wl, const void *id)
+{
+    ngx_int_t                 *n;
+    ngx_http_waf_whitelist_t  *w;
+
+    n = (ngx_int_t *)id;
+    w = (ngx_http_waf_whitelist_t *) wl;
+
+    return w->id - *n;
+}
+
+static int ngx_libc_cdecl
+ngx_http_waf_cmp_whitelist_id(const void *one, const void *two)
+{
+    ngx_http_waf_whitelist_t  *first, *second;
+
+    first = (ngx_http_waf_whitelist_t *) one;
+    second = (ngx_http_waf_whitelist_t *) two;
+
+    return first->id - second->id;
+}
+
+// search whitelist in array.
+static ngx_http_waf_whitelist_t *
+ngx_http_waf_search_whitelist(const ngx_array_t *wl, ngx_int_t id)
+{
+    ngx_int_t                  i;
+    ngx_http_waf_whitelist_t  *a;
+
+    if (wl == NULL) {
+        return NULL;
+    }
+
+    // TODO: id < 0
+    a = wl->elts;
+    i = ngx_array_binary_search(wl, &id, ngx_http_waf_whitelist_cmp_id);
+    if (i == NGX_ERROR) {
+        id = 0;
+        i = ngx_array_binary_search(wl, &id, ngx_http_waf_whitelist_cmp_id);
+        if (i == NGX_ERROR) {
+            return NULL;
+        }
+    }
+
+    return &a[i];
+}
+
+
+static ngx_int_t
+ngx_http_waf_score_timeout(ngx_http_request_t *r,
+    ngx_http_waf_loc_conf_t *wlcf)
+{
+    ngx_time_t      *tp;
+    ngx_msec_t       ms;
+
+    tp = ngx_timeofday();
+
+    ms = (tp->sec - r->start_sec) * 1000 + (tp->msec - r->start_msec);
+
+    if (ms > wlcf->security_timeout) {
+        return NGX_OK;
+    }
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_waf_vars_in_hash(ngx_conf_t *cf, ngx_array_t *a,
+    ngx_hash_t *h)
+{
+    ngx_uint_t              i;
+    ngx_array_t             vars;
+    ngx_hash_key_t         *hk;
+    ngx_hash_init_t         hash;
+    ngx_http_waf_rule_t    *rules;
+    ngx_http_waf_main_conf_t *wmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_waf_module);
+
+    if (ngx_array_init(&vars, cf->temp_pool, 32, sizeof(ngx_hash_key_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    rules = a->elts;
+    for (i = 0; i < a->nelts; i++) {
+        hk = ngx_array_push(&vars);
+        if (hk == NULL) {
+            return NGX_ERROR;
+        }
+
+        hk->key = rules[i].m_zone->name;
+        hk->key_hash = ngx_hash_key_lc(hk->key.data, hk->key.len);
+        hk->value = &rules[i];
+    }
+
+    hash.hash = h;
+    hash.key = ngx_hash_key_lc;
+    hash.max_size = wmcf->hash_max_size;
+    hash.bucket_size = wmcf->hash_bucket_size;
+    hash.name = "waf_vars_in_hash";
+    hash.pool = cf->pool;
+    hash.temp_pool = NULL;
+
+    if (ngx_hash_init(&hash, vars.elts, vars.nelts) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+// -- regex -----
+// the pcre runs with the limits, a pathological rx@ can not pin a worker.
+static ngx_uint_t  ngx_http_waf_regex_limits;  /* the limit hits in worker */
+
+#if (NGX_PCRE2)
+static pcre2_match_data  *ngx_http_waf_match_data;
+static pcre2_jit_stack   *ngx_http_waf_jit_stack;
+#elif (NGX_HAVE_PCRE_JIT)
+static pcre_jit_stack    *ngx_http_waf_jit_stack;
+#endif
+
+
+static ngx_http_waf_regex_t *
+ngx_http_waf_regex_compile(ngx_conf_t *cf, ngx_str_t *pattern)
+{
+    u_char                      errstr[NGX_MAX_CONF_ERRSTR];
+    ngx_regex_compile_t         rc;
+    ngx_http_waf_regex_t       *rx, **prx;
+    ngx_http_waf_main_conf_t   *wmcf;
+
+    wmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_waf_module);
+
+    if (wmcf->regexes == NULL) {
+        wmcf->regexes = ngx_array_create(cf->pool, 16,
+            sizeof(ngx_http_waf_regex_t *));
+        if (wmcf->regexes == NULL) {
+            return NULL;
+        }
+    }
+
+    ngx_memzero(&rc, sizeof(ngx_regex_compile_t));
+
+    rc.pool = cf->pool;
+    rc.err.len = NGX_MAX_CONF_ERRSTR;
+    rc.err.data = errstr;
+
+    rc.options = NGX_REGEX_CASELESS;
+    rc.pattern = *pattern;
+
+    if (ngx_regex_compile(&rc) != NGX_OK) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "%V", &rc.err);
+        return NULL;
+    }
+
+    rx = ngx_pcalloc(cf->pool, sizeof(ngx_http_waf_regex_t));
+    if (rx == NULL) {
+        return NULL;
+    }
+
+    rx->regex = rc.regex;
+
+    prx = ngx_array_push(wmcf->regexes);
+    if (prx == NULL) {
+        return NULL;
+    }
+
+    *prx = rx;
+
+    return rx;
+}
+
+
+#if (NGX_PCRE2)
+
+static void
+ngx_http_waf_regex_cleanup(void *data)
+{
+    pcre2_match_context_free(data);
+}
+
+#elif (NGX_HAVE_PCRE_JIT)
+
+static void
+ngx_http_waf_regex_cleanup(void *data)
+{
+    pcre_free_study(data);
+}
+
+#endif
+
+
+// the limits and the jit of every regex, after all the rules are parsed.
+static ngx_int_t
+ngx_http_waf_regex_init(ngx_conf_t *cf, ngx_http_waf_main_conf_t *wmcf)
+{
+    ngx_uint_t                  i;
+    ngx_http_waf_regex_t      **rxs, *rx;
+#if (NGX_PCRE2)
+    int                         n;
+    ngx_pool_cleanup_t         *cln;
+#elif (NGX_HAVE_PCRE_JIT)
+    int                         jit;
+    const char                 *err;
+    ngx_pool_cleanup_t         *cln;
+#endif
+
+    if (wmcf->regexes == NULL) {
+        return NGX_OK;
+    }
+
+#if !(NGX_PCRE2 || NGX_HAVE_PCRE_JIT)
+    if (wmcf->regex_jit) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+            "\"security_regex_jit\" is ignored, "
+            "the pcre library is built without jit");
+    }
+#endif
+
+    rxs = wmcf->regexes->elts;
+    for (i = 0; i < wmcf->regexes->nelts; i++) {
+        rx = rxs[i];
+
+        if (rx->match_limit == 0) {
+            rx->match_limit = wmcf->regex_match_limit;
+        }
+
+        if (rx->depth_limit == 0) {
+            rx->depth_limit = wmcf->regex_depth_limit;
+        }
+
+#if (NGX_PCRE2)
+        if (wmcf->regex_jit) {
+            n = pcre2_jit_compile(rx->regex->code, PCRE2_JIT_COMPLETE);
+            if (n != 0) {
+                ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                    "pcre2_jit_compile() failed: %d, the regex is "
+                    "interpreted", n);
+            }
+        }
+
+        if (!wmcf->regex_jit && rx->match_limit == 0
+            && rx->depth_limit == 0)
+        {
+            continue;
+        }
+
+        rx->mctx = pcre2_match_context_create(NULL);
+        if (rx->mctx == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln = ngx_pool_cleanup_add(cf->pool, 0);
+        if (cln == NULL) {
+            pcre2_match_context_free(rx->mctx);
+            return NGX_ERROR;
+        }
+
+        cln->handler = ngx_http_waf_regex_cleanup;
+        cln->data = rx->mctx;
+
+        if (rx->match_limit) {
+            pcre2_set_match_limit(rx->mctx, (uint32_t) rx->match_limit);
+        }
+
+        if (rx->depth_limit) {
+            pcre2_set_depth_limit(rx->mctx, (uint32_t) rx->depth_limit);
+        }
+#else
+        if (!wmcf->regex_jit) {
+            continue;
+        }
+
+#if (NGX_HAVE_PCRE_JIT)
+        // our own study, nginx overrides rx->regex->extra with pcre_jit.
+        err = NULL;
+        rx->extra = pcre_study(rx->regex->code, PCRE_STUDY_JIT_COMPILE, &err);
+        if (err != NULL) {
+            ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                "pcre_study() failed: %s, the regex is interpreted", err);
+        }
+
+        if (rx->extra == NULL) {
+            continue;
+        }
+
+        cln = ngx_pool_cleanup_add(cf->pool, 0);
+        if (cln == NULL) {
+            pcre_free_study(rx->extra);
+            return NGX_ERROR;
+        }
+
+        cln->handler = ngx_http_waf_regex_cleanup;
+        cln->data = rx->extra;
+
+        jit = 0;
+        if (pcre_fullinfo(rx->regex->code, rx->extra, PCRE_INFO_JIT, &jit) != 0
+            || jit != 1)
+        {
+            ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                "jit compiler does not support the regex, it is interpreted");
+        }
+#endif
+#endif
+    }
+
+    return NGX_OK;
+}
+
+
+// return NGX_OK matched, NGX_DECLINED not matched,
+// NGX_BUSY the limits are hit, else NGX_ERROR.
+static ngx_int_t
+ngx_http_waf_regex_exec(ngx_http_waf_regex_t *rx, ngx_str_t *s)
+{
+    int           rc;
+#if !(NGX_PCRE2)
+    pcre_extra   *extra, limited;
+#endif
+
+#if (NGX_PCRE2)
+    if (ngx_http_waf_match_data == NULL) {
+        ngx_http_waf_match_data = pcre2_match_data_create(1, NULL);
+        if (ngx_http_waf_match_data == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    rc = pcre2_match(rx->regex->code, s->data, s->len, 0, 0,
+        ngx_http_waf_match_data, rx->mctx);
+
+    if (rc >= 0) {
+        return NGX_OK;
+    }
+
+    switch (rc) {
+    case PCRE2_ERROR_NOMATCH:
+        return NGX_DECLINED;
+
+    case PCRE2_ERROR_MATCHLIMIT:
+    case PCRE2_ERROR_DEPTHLIMIT:
+#ifdef PCRE2_ERROR_HEAPLIMIT
+    case PCRE2_ERROR_HEAPLIMIT:
+#endif
+    case PCRE2_ERROR_JIT_STACKLIMIT:
+        ngx_http_waf_regex_limits++;
+        return NGX_BUSY;
+    }
+#else
+    extra = rx->extra;
+    if (extra == NULL) {
+        extra = rx->regex->extra;
+    }
+
+    if (rx->match_limit || rx->depth_limit) {
+        if (extra != NULL) {
+            limited = *extra;
+        } else {
+            ngx_memzero(&limited, sizeof(pcre_extra));
+        }
+
+        if (rx->match_limit) {
+            limited.flags |= PCRE_EXTRA_MATCH_LIMIT;
+            limited.match_limit = rx->match_limit;
+        }
+
+        if (rx->depth_limit) {
+            limited.flags |= PCRE_EXTRA_MATCH_LIMIT_RECURSION;
+            limited.match_limit_recursion = rx->depth_limit;
+        }
+
+        extra = &limited;
+    }
+
+    rc = pcre_exec(rx->regex->code, extra, (const char *) s->data, s->len,
+        0, 0, NULL, 0);
+
+    if (rc >= 0) {
+        return NGX_OK;
+    }
+
+    switch (rc) {
+    case PCRE_ERROR_NOMATCH:
+        return NGX_DECLINED;
+
+    case PCRE_ERROR_MATCHLIMIT:
+    case PCRE_ERROR_RECURSIONLIMIT:
+#ifdef PCRE_ERROR_JIT_STACKLIMIT
+    case PCRE_ERROR_JIT_STACKLIMIT:
+#endif
+        ngx_http_waf_regex_limits++;
+        return NGX_BUSY;
+    }
+#endif
+
+    return NGX_ERROR;
+}
+
+
+// the worker jit stack and match data, a first run of every regex faults in
+// the jit code before the first request.
+static void
+ngx_http_waf_regex_init_process(ngx_cycle_t *cycle,
+    ngx_http_waf_main_conf_t *wmcf)
+{
+    ngx_str_t                   empty;
+    ngx_uint_t                  i;
+    ngx_http_waf_regex_t      **rxs;
+
+    if (wmcf->regexes == NULL) {
+        return;
+    }
+
+#if (NGX_PCRE2)
+    ngx_http_waf_match_data = pcre2_match_data_create(1, NULL);
+
+    if (wmcf->regex_jit) {
+        ngx_http_waf_jit_stack = pcre2_jit_stack_create(
+            NGX_HTTP_WAF_JIT_STACK_MIN, NGX_HTTP_WAF_JIT_STACK_MAX, NULL);
+        if (ngx_http_waf_jit_stack == NULL) {
+            ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                "pcre2_jit_stack_create() failed");
+        }
+    }
+#elif (NGX_HAVE_PCRE_JIT)
+    if (wmcf->regex_jit) {
+        ngx_http_waf_jit_stack = pcre_jit_stack_alloc(
+            NGX_HTTP_WAF_JIT_STACK_MIN, NGX_HTTP_WAF_JIT_STACK_MAX);
+        if (ngx_http_waf_jit_stack == NULL) {
+            ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                "pcre_jit_stack_alloc() failed");
+        }
+    }
+#endif
+
+    ngx_str_set(&empty, "");
+
+    rxs = wmcf->regexes->elts;
+    for (i = 0; i < wmcf->regexes->nelts; i++) {
+#if (NGX_PCRE2)
+        if (rxs[i]->mctx != NULL && ngx_http_waf_jit_stack != NULL) {
+            pcre2_jit_stack_assign(rxs[i]->mctx, NULL,
+                ngx_http_waf_jit_stack);
+        }
+#elif (NGX_HAVE_PCRE_JIT)
+        if (rxs[i]->extra != NULL && ngx_http_waf_jit_stack != NULL) {
+            pcre_assign_jit_stack(rxs[i]->extra, NULL,
+                ngx_http_waf_jit_stack);
+        }
+#endif
+
+        (void) ngx_http_waf_regex_exec(rxs[i], &empty);
+    }
+}
+
+
+static void
+ngx_http_waf_regex_exit_process(ngx_cycle_t *cycle)
+{
+#if (NGX_PCRE2)
+    if (ngx_http_waf_match_data != NULL) {
+        pcre2_match_data_free(ngx_http_waf_match_data);
+        ngx_http_waf_match_data = NULL;
+    }
+
+    if (ngx_http_waf_jit_stack != NULL) {
+        pcre2_jit_stack_free(ngx_http_waf_jit_stack);
+        ngx_http_waf_jit_stack = NULL;
+    }
+#elif (NGX_HAVE_PCRE_JIT)
+    if (ngx_http_waf_jit_stack != NULL) {
+        pcre_jit_stack_free(ngx_http_waf_jit_stack);
+        ngx_http_waf_jit_stack = NULL;
+    }
+#endif
+
+    if (ngx_http_waf_regex_limits) {
+        ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+            "ngx http waf regex limits are hit %ui times",
+            ngx_http_waf_regex_limits);
+    }
+}
+
+
+// the rule handler returns NGX_DECLINED if the limits are hit.
+static ngx_int_t
+ngx_http_waf_regex_limited(ngx_http_request_t *r,
+    ngx_http_waf_public_rule_t *pr)
+{
+    ngx_http_waf_loc_conf_t  *wlcf;
+
+    wlcf = ngx_http_get_module_loc_conf(r, ngx_http_waf_module);
+
+    ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+        "ngx http waf rule id:%i hit the regex limits, fail %s, "
+        "%ui hits in this worker", pr->id,
+        wlcf->regex_limit_action == NGX_HTTP_WAF_REGEX_LIMIT_OPEN
+        ? "open" : "closed", ngx_http_waf_regex_limits);
+
+    return wlcf->regex_limit_action == NGX_HTTP_WAF_REGEX_LIMIT_OPEN
+           ? NGX_ERROR : NGX_OK;
+}
+
+
+// exec regex zone
+// return NGX_OK matched, else NGX_ERROR.
+static ngx_int_t
+ngx_http_waf_zone_regex_exec(ngx_http_waf_zone_t *z, ngx_str_t *s)
+{
+    if (z->regex == NULL) {
+        return NGX_ERROR;
+    }
+
+    // the limits and the errors match the zone like before.
+    if (ngx_http_waf_regex_exec(z->regex, s) == NGX_DECLINED) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+// -- matcher -----
+// the rules with the same decode functions can be matched together.
+static ngx_int_t
+ngx_http_waf_decode_equal(ngx_array_t *one, ngx_array_t *two)
+{
+    if (one->nelts != two->nelts) {
+        return 0;
+    }
+
+    return ngx_memcmp(one->elts, two->elts,
+        one->nelts * sizeof(ngx_http_waf_rule_decode_t *)) == 0;
+}
+
+
+// the engine failed, the rules are matched one by one.
+static void
+ngx_http_waf_matcher_exec_rules(ngx_http_waf_matcher_t *m, ngx_str_t *s,
+    ngx_str_t *lc, u_char *hits)
+{
+    ngx_uint_t                    i;
+    ngx_http_waf_public_rule_t  **prs;
+
+    prs = m->rules.elts;
+    for (i = 0; i < m->rules.nelts; i++) {
+        if (!ngx_http_waf_hit(hits, i)
+            && prs[i]->handler(prs[i], prs[i]->lower ? lc : s) == NGX_OK)
+        {
+            ngx_http_waf_set_hit(hits, i);
+        }
+    }
+}
+
+
+// the automaton of the lowercase strings, ids[i] is reported for strs[i].
+static ngx_http_waf_ac_t *
+ngx_http_waf_ac_build(ngx_conf_t *cf, ngx_str_t *strs, uint32_t *ids,
+    ngx_uint_t n)
+{
+    u_char              *p, *e, used[256];
+    uint32_t            *go, *fail, *queue, *head, *next, *dict;
+    ngx_uint_t           i, k, c, len, st, t, f, ncls, nst, qh, qt;
+    ngx_http_waf_ac_t   *ac;
+
+    ac = ngx_pcalloc(cf->pool, sizeof(ngx_http_waf_ac_t));
+    if (ac == NULL) {
+        return NULL;
+    }
+
+    // byte classes
+    ngx_memzero(used, sizeof(used));
+    len = 0;
+    for (i = 0; i < n; i++) {
+        len += strs[i].len;
+        for (k = 0; k < strs[i].len; k++) {
+            used[strs[i].data[k]] = 1;
+        }
+    }
+
+    ncls = 1;
+    for (c = 0; c < 256; c++) {
+        if (used[c]) {
+            ac->cls[c] = (u_char) ncls++;
+        }
+    }
+
+    for (c = 'A'; c <= 'Z'; c++) {
+        ac->cls[c] = ac->cls[c | 0x20];
+    }
+
+    // the trie
+    go = ngx_pcalloc(cf->temp_pool, (len + 1) * ncls * sizeof(uint32_t));
+    fail = ngx_pcalloc(cf->temp_pool, (len + 1) * sizeof(uint32_t));
+    queue = ngx_pcalloc(cf->temp_pool, (len + 1) * sizeof(uint32_t));
+    head = ngx_pcalloc(cf->temp_pool, (len + 1) * sizeof(uint32_t));
+    next = ngx_pcalloc(cf->temp_pool, n * sizeof(uint32_t));
+    dict = ngx_pcalloc(cf->pool, (len + 1) * sizeof(uint32_t));
+    if (go == NULL || fail == NULL || queue == NULL || head == NULL
+        || next == NULL || dict == NULL)
+    {
+        return NULL;
+    }
+
+    if ((len + 1) * ncls > NGX_HTTP_WAF_AC_OFFSET) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+            "too many str:ct@ or rx@ literals in one zone");
+        return NULL;
+    }
+
+    nst = 1;
+    for (i = 0; i < n; i++) {
+        st = 0;
+        p = strs[i].data;
+        e = p + strs[i].len;
+
+        for (/* void */; p < e; p++) {
+            k = st * ncls + ac->cls[*p];
+            if (go[k] == 0) {
+                go[k] = nst++;
+            }
+            st = go[k];
+        }
+
+        // the output list, ids + 1
+        next[i] = head[st];
+        head[st] = i + 1;
+    }
+
+    // the fail links, turn the trie to dfa.
+    qh = qt = 0;
+    for (c = 0; c < ncls; c++) {
+        if (go[c] != 0) {
+            queue[qt++] = go[c];
+        }
+    }
+
+    while (qh < qt) {
+        st = queue[qh++];
+
+        for (c = 0; c < ncls; c++) {
+            t = go[st * ncls + c];
+            f = go[fail[st] * ncls + c];
+
+            if (t == 0) {
+                go[st * ncls + c] = f;
+                continue;
+            }
+
+            fail[t] = f;
+            dict[t] = head[f] ? f : dict[f];
+            queue[qt++] = t;
+        }
+    }
+
+    ac->ncls = ncls;
+    ac->nstates = nst;
+    ac->dict = dict;
+
+    ac->delta = ngx_pnalloc(cf->pool, nst * ncls * sizeof(uint32_t));
+    ac->first = ngx_pnalloc(cf->pool, (nst + 1) * sizeof(uint32_t));
+    ac->ids = ngx_pnalloc(cf->pool, n * sizeof(uint32_t));
+    if (ac->delta == NULL || ac->first == NULL || ac->ids == NULL) {
+        return NULL;
+    }
+
+    for (k = 0; k < nst * ncls; k++) {
+        t = go[k];
+        ac->delta[k] = t * ncls;
+
+        if (head[t] || dict[t]) {
+            ac->delta[k] |= NGX_HTTP_WAF_AC_OUT;
+        }
+    }
+
+    k = 0;
+    for (st = 0; st < nst; st++) {
+        ac->first[st] = k;
+        for (t = head[st]; t != 0; t = next[t - 1]) {
+            ac->ids[k++] = ids[t - 1];
+        }
+    }
+    ac->first[nst] = k;
+
+    return ac;
+}
+
+
+static ngx_int_t
+ngx_http_waf_ac_compile(ngx_conf_t *cf, ngx_http_waf_matcher_t *m)
+{
+    uint32_t                     *ids;
+    ngx_str_t                    *strs;
+    ngx_uint_t                    i;
+    ngx_http_waf_public_rule_t  **prs;
+
+    prs = m->rules.elts;
+
+    // the rule strings are lowercase.
+    strs = ngx_pnalloc(cf->temp_pool, m->rules.nelts * sizeof(ngx_str_t));
+    ids = ngx_pnalloc(cf->temp_pool, m->rules.nelts * sizeof(uint32_t));
+    if (strs == NULL || ids == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < m->rules.nelts; i++) {
+        strs[i] = prs[i]->str;
+        ids[i] = i;
+    }
+
+    m->data = ngx_http_waf_ac_build(cf, strs, ids, m->rules.nelts);
+    if (m->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+// return the state after the bytes.
+static uint32_t
+ngx_http_waf_ac_scan(ngx_http_waf_ac_t *ac, uint32_t st, u_char *p, u_char *e,
+    u_char *hits)
+{
+    uint32_t  x, i;
+
+    for (/* void */; p < e; p++) {
+        st = ac->delta[(st & NGX_HTTP_WAF_AC_OFFSET) + ac->cls[*p]];
+
+        if (!(st & NGX_HTTP_WAF_AC_OUT)) {
+            continue;
+        }
+
+        // the state and its suffixes
+        x = (st & NGX_HTTP_WAF_AC_OFFSET) / ac->ncls;
+        for (/* void */; x != 0; x = ac->dict[x]) {
+            for (i = ac->first[x]; i < ac->first[x + 1]; i++) {
+                ngx_http_waf_set_hit(hits, ac->ids[i]);
+            }
+        }
+    }
+
+    return st;
+}
+
+
+static void
+ngx_http_waf_ac_exec(ngx_http_waf_matcher_t *m, ngx_str_t *s, ngx_str_t *lc,
+    u_char *hits)
+{
+    (void) ngx_http_waf_ac_scan(m->data, 0, s->data, s->data + s->len, hits);
+}
+
+
+static ngx_int_t
+ngx_http_waf_ac_stream(ngx_pool_t *pool, ngx_http_waf_stream_t *ss, u_char *p,
+    u_char *e, ngx_uint_t last)
+{
+    if (!ss->started) {
+        ss->state = 0;
+        ss->started = 1;
+    }
+
+    ss->state = ngx_http_waf_ac_scan(ss->matcher->data, ss->state, p, e,
+                                     ss->hits);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_waf_ac_able(ngx_http_waf_public_rule_t *pr)
+{
+    return pr->handler == ngx_http_waf_rule_str_ct_handler && !pr->not;
+}
+
+// the eq@ rules are keys of one ngx_hash, a field is one probe.
+static ngx_int_t
+ngx_http_waf_eq_compile(ngx_conf_t *cf, ngx_http_waf_matcher_t *m)
+{
+    ngx_uint_t                    i;
+    ngx_array_t                   keys;
+    ngx_hash_t                   *h;
+    ngx_hash_key_t               *hk;
+    ngx_hash_init_t               hash;
+    ngx_http_waf_main_conf_t     *wmcf;
+    ngx_http_waf_public_rule_t  **prs;
+
+    wmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_waf_module);
+
+    if (ngx_array_init(&keys, cf->temp_pool, m->rules.nelts,
+        sizeof(ngx_hash_key_t)) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    // the same strings are kept, every rule is hit.
+    prs = m->rules.elts;
+    for (i = 0; i < m->rules.nelts; i++) {
+        hk = ngx_array_push(&keys);
+        if (hk == NULL) {
+            return NGX_ERROR;
+        }
+
+        hk->key = prs[i]->str;
+        hk->key_hash = ngx_hash_key_lc(hk->key.data, hk->key.len);
+        hk->value = &prs[i];
+    }
+
+    h = ngx_pcalloc(cf->pool, sizeof(ngx_hash_t));
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    hash.hash = h;
+    hash.key = ngx_hash_key_lc;
+    hash.max_size = wmcf->hash_max_size;
+    hash.bucket_size = wmcf->hash_bucket_size;
+    hash.name = "security_hash";
+    hash.pool = cf->pool;
+    hash.temp_pool = NULL;
+
+    if (ngx_hash_init(&hash, keys.elts, keys.nelts) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    m->data = h;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_waf_eq_exec(ngx_http_waf_matcher_t *m, ngx_str_t *s, ngx_str_t *lc,
+    u_char *hits)
+{
+    ngx_hash_t                   *h;
+    ngx_hash_elt_t               *elt;
+    ngx_http_waf_public_rule_t  **prs;
+
+    h = m->data;
+    prs = m->rules.elts;
+
+    elt = h->buckets[ngx_hash_key(lc->data, lc->len) % h->size];
+    if (elt == NULL) {
+        return;
+    }
+
+    for (/* void */; elt->value != NULL;
+         elt = (ngx_hash_elt_t *) ngx_align_ptr(&elt->name[0] + elt->len,
+                                                sizeof(void *)))
+    {
+        if (lc->len == (size_t) elt->len
+            && ngx_memcmp(lc->data, elt->name, lc->len) == 0)
+        {
+            ngx_http_waf_set_hit(hits,
+                (ngx_http_waf_public_rule_t **) elt->value - prs);
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_http_waf_eq_able(ngx_http_waf_public_rule_t *pr)
+{
+    return pr->handler == ngx_http_waf_rule_str_eq_handler && !pr->not;
+}
+
+// the trie of the sw@ rules, or of the reversed ew@ rules.
+static ngx_int_t
+ngx_http_waf_trie_compile(ngx_conf_t *cf, ngx_http_waf_matcher_t *m,
+    ngx_uint_t reverse)
+{
+    u_char                       *p, used[256];
+    uint32_t                     *go, *head, *next;
+    ngx_uint_t                    i, j, k, c, n, len, st, t, ncls, nst;
+    ngx_http_waf_trie_t          *trie;
+    ngx_http_waf_public_rule_t  **prs;
+
+    prs = m->rules.elts;
+    n = m->rules.nelts;
+
+    trie = ngx_pcalloc(cf->pool, sizeof(ngx_http_waf_trie_t));
+    if (trie == NULL) {
+        return NGX_ERROR;
+    }
+
+    // byte classes. the rule strings are lowercase.
+    ngx_memzero(used, sizeof(used));
+    len = 0;
+    for (i = 0; i < n; i++) {
+        len += prs[i]->str.len;
+        for (k = 0; k < prs[i]->str.len; k++) {
+            used[prs[i]->str.data[k]] = 1;
+        }
+    }
+
+    ncls = 1;
+    for (c = 0; c < 256; c++) {
+        if (used[c]) {
+            trie->cls[c] = (u_char) ncls++;
+        }
+    }
+
+    for (c = 'A'; c <= 'Z'; c++) {
+        trie->cls[c] = trie->cls[c | 0x20];
+    }
+
+    if ((len + 1) * ncls > NGX_HTTP_WAF_AC_OFFSET) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+            "too many str:%s@ rules in one zone", reverse ? "ew" : "sw");
+        return NGX_ERROR;
+    }
+
+    go = ngx_pcalloc(cf->temp_pool, (len + 1) * ncls * sizeof(uint32_t));
+    head = ngx_pcalloc(cf->temp_pool, (len + 1) * sizeof(uint32_t));
+    next = ngx_pcalloc(cf->temp_pool, n * sizeof(uint32_t));
+    if (go == NULL || head == NULL || next == NULL) {
+        return NGX_ERROR;
+    }
+
+    nst = 1;
+    for (i = 0; i < n; i++) {
+        st = 0;
+        p = prs[i]->str.data;
+
+        for (j = 0; j < prs[i]->str.len; j++) {
+            c = reverse ? p[prs[i]->str.len - 1 - j] : p[j];
+            k = st * ncls + trie->cls[c];
+            if (go[k] == 0) {
+                go[k] = nst++;
+            }
+            st = go[k];
+        }
+
+        // the output list, ids + 1
+        next[i] = head[st];
+        head[st] = i + 1;
+    }
+
+    trie->go = ngx_pnalloc(cf->pool, nst * ncls * sizeof(uint32_t));
+    trie->first = ngx_pnalloc(cf->pool, (nst + 1) * sizeof(uint32_t));
+    trie->ids = ngx_pnalloc(cf->pool, n * sizeof(uint32_t));
+    if (trie->go == NULL || trie->first == NULL || trie->ids == NULL) {
+        return NGX_ERROR;
+    }
+
+    // the root is never a target, 0 is no edge.
+    for (k = 0; k < nst * ncls; k++) {
+        t = go[k];
+        trie->go[k] = t * ncls;
+
+        if (head[t]) {
+            trie->go[k] |= NGX_HTTP_WAF_AC_OUT;
+        }
+    }
+
+    k = 0;
+    for (st = 0; st < nst; st++) {
+        trie->first[st] = k;
+        for (t = head[st]; t != 0; t = next[t - 1]) {
+            trie->ids[k++] = t - 1;
+        }
+    }
+    trie->first[nst] = k;
+
+    trie->ncls = ncls;
+
+    m->data = trie;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_waf_trie_hits(ngx_http_waf_trie_t *trie, uint32_t st, u_char *hits)
+{
+    uint32_t  i;
+
+    st = (st & NGX_HTTP_WAF_AC_OFFSET) / trie->ncls;
+
+    for (i = trie->first[st]; i < trie->first[st + 1]; i++) {
+        ngx_http_waf_set_hit(hits, trie->ids[i]);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_waf_sw_compile(ngx_conf_t *cf, ngx_http_waf_matcher_t *m)
+{
+    return ngx_http_waf_trie_compile(cf, m, 0);
+}
+
+
+// the rules shorter than the field, like the startwith handler.
+static void
+ngx_http_waf_sw_exec(ngx_http_waf_matcher_t *m, ngx_str_t *s, ngx_str_t *lc,
+    u_char *hits)
+{
+    u_char                *p, *e;
+    uint32_t               st;
+    ngx_http_waf_trie_t   *trie;
+
+    trie = m->data;
+
+    st = 0;
+    e = s->data + s->len - 1;
+
+    for (p = s->data; p < e; p++) {
+        st = trie->go[(st & NGX_HTTP_WAF_AC_OFFSET) + trie->cls[*p]];
+        if (st == 0) {
+            return;
+        }
+
+        if (st & NGX_HTTP_WAF_AC_OUT) {
+            ngx_http_waf_trie_hits(trie, st, hits);
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_http_waf_sw_able(ngx_http_waf_public_rule_t *pr)
+{
+    return pr->handler == ngx_http_waf_rule_str_startwith_handler && !pr->not;
+}
+
+
+static ngx_int_t
+ngx_http_waf_ew_compile(ngx_conf_t *cf, ngx_http_waf_matcher_t *m)
+{
+    return ngx_http_waf_trie_compile(cf, m, 1);
+}
+
+
+static void
+ngx_http_waf_ew_exec(ngx_http_waf_matcher_t *m, ngx_str_t *s, ngx_str_t *lc,
+    u_char *hits)
+{
+    u_char                *p;
+    uint32_t               st;
+    ngx_http_waf_trie_t   *trie;
+
+    trie = m->data;
+
+    st = 0;
+
+    for (p = s->data + s->len - 1; p > s->data; p--) {
+        st = trie->go[(st & NGX_HTTP_WAF_AC_OFFSET) + trie->cls[*p]];
+        if (st == 0) {
+            return;
+        }
+
+        if (st & NGX_HTTP_WAF_AC_OUT) {
+            ngx_http_waf_trie_hits(trie, st, hits);
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_http_waf_ew_able(ngx_http_waf_public_rule_t *pr)
+{
+    return pr->handler == ngx_http_waf_rule_str_endwith_handler && !pr->not;
+}
+
+
+// the digests of the hash: rules are binary keys of one set per algorithm,
+// e.g. a md5@file: feed of many digests is still one probe.
+static ngx_int_t
+ngx_http_waf_digests_compile(ngx_conf_t *cf, ngx_http_waf_matcher_t *m)
+{
+    u_char                       *p, *e, *key;
+    uint32_t                      k;
+    ngx_uint_t                    i, j, n, slots;
+    ngx_http_waf_digests_t       *ds;
+    ngx_http_waf_hash_alg_t      *alg;
+    ngx_http_waf_digest_set_t    *set;
+    ngx_http_waf_public_rule_t  **prs;
+
+    prs = m->rules.elts;
+
+    ds = ngx_pcalloc(cf->pool, sizeof(ngx_http_waf_digests_t));
+    if (ds == NULL) {
+        return NGX_ERROR;
+    }
+
+    ds->sets = ngx_pcalloc(cf->pool, sizeof(ngx_http_waf_digest_set_t)
+                           * m->rules.nelts);
+    ds->nots = ngx_pcalloc(cf->pool, sizeof(uint32_t) * m->rules.nelts);
+    if (ds->sets == NULL || ds->nots == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < m->rules.nelts; i++) {
+        if (prs[i]->not) {
+            ds->nots[ds->nnots++] = i;
+        }
+
+        for (j = 0; j < ds->nsets; j++) {
+            if (ds->sets[j].alg == prs[i]->hash) {
+                break;
+            }
+        }
+
+        if (j == ds->nsets) {
+            ds->sets[ds->nsets++].alg = prs[i]->hash;
+        }
+    }
+
+    for (j = 0; j < ds->nsets; j++) {
+        set = &ds->sets[j];
+        alg = set->alg;
+
+        n = 0;
+        for (i = 0; i < m->rules.nelts; i++) {
+            if (prs[i]->hash == alg) {
+                n += prs[i]->digests.len / alg->size;
+            }
+        }
+
+        // at most half full.
+        for (slots = 16; slots < 2 * n; slots <<= 1) { /* void */ }
+
+        set->mask = slots - 1;
+        set->keys = ngx_palloc(cf->pool, slots * alg->size);
+        set->ids = ngx_pcalloc(cf->pool, slots * sizeof(uint32_t));
+        if (set->keys == NULL || set->ids == NULL) {
+            return NGX_ERROR;
+        }
+
+        for (i = 0; i < m->rules.nelts; i++) {
+            if (prs[i]->hash != alg) {
+                continue;
+            }
+
+            p = prs[i]->digests.data;
+            e = p + prs[i]->digests.len;
+
+            for (/* void */; p < e; p += alg->size) {
+                ngx_memcpy(&k, p, sizeof(uint32_t));
+
+                for (k &= set->mask; set->ids[k]; k = (k + 1) & set->mask) {
+                    key = set->keys + k * alg->size;
+                    if (set->ids[k] == i + 1
+                        && ngx_memcmp(key, p, alg->size) == 0)
+                    {
+                        break;
+                    }
+                }
+
+                ngx_memcpy(set->keys + k * alg->size, p, alg->size);
+                set->ids[k] = i + 1;
+            }
+        }
+    }
+
+    m->data = ds;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_waf_digests_probe(ngx_http_waf_digest_set_t *set, u_char *digest,
+    u_char *hits)
+{
+    uint32_t  k;
+
+    ngx_memcpy(&k, digest, sizeof(uint32_t));
+
+    for (k &= set->mask; set->ids[k]; k = (k + 1) & set->mask) {
+        if (ngx_memcmp(set->keys + k * set->alg->size, digest,
+                       set->alg->size) == 0)
+        {
+            ngx_http_waf_set_hit(hits, set->ids[k] - 1);
+        }
+    }
+}
+
+
+static void
+ngx_http_waf_digests_exec(ngx_http_waf_matcher_t *m, ngx_str_t *s,
+    ngx_str_t *lc, u_char *hits)
+{
+    u_char                      digest[NGX_HTTP_WAF_DIGEST_MAX];
+    ngx_uint_t                  i;
+    ngx_http_waf_digests_t     *ds;
+
+    ds = m->data;
+
+    for (i = 0; i < ds->nsets; i++) {
+        ds->sets[i].alg->digest(digest, s);
+        ngx_http_waf_digests_probe(&ds->sets[i], digest, hits);
+    }
+
+    for (i = 0; i < ds->nnots; i++) {
+        hits[ds->nots[i] >> 3] ^= (u_char) (1 << (ds->nots[i] & 7));
+    }
+}
+
+
+// the digests are updated by the chunks and probed with the last one.
+static ngx_int_t
+ngx_http_waf_digests_stream(ngx_pool_t *pool, ngx_http_waf_stream_t *ss,
+    u_char *p, u_char *e, ngx_uint_t last)
+{
+    u_char                          digest[NGX_HTTP_WAF_DIGEST_MAX];
+    ngx_uint_t                      i;
+    ngx_http_waf_digests_t         *ds;
+    ngx_http_waf_digests_stream_t  *dss;
+
+    ds = ss->matcher->data;
+    dss = ss->data;
+
+    if (dss == NULL) {
+        dss = ngx_palloc(pool, sizeof(ngx_http_waf_digests_stream_t));
+        if (dss == NULL) {
+            return NGX_ERROR;
+        }
+
+        dss->ctx = ngx_palloc(pool,
+                              ds->nsets * sizeof(ngx_http_waf_digest_ctx_t));
+        if (dss->ctx == NULL) {
+            return NGX_ERROR;
+        }
+
+        ss->data = dss;
+    }
+
+    if (!ss->started) {
+        ss->started = 1;
+        dss->len = 0;
+
+        for (i = 0; i < ds->nsets; i++) {
+            ds->sets[i].alg->init(&dss->ctx[i]);
+        }
+    }
+
+    if (p < e) {
+        dss->len += e - p;
+
+        for (i = 0; i < ds->nsets; i++) {
+            ds->sets[i].alg->update(&dss->ctx[i], p, e - p);
+        }
+    }
+
+    // an empty value has no digest, as of the rule handler.
+    if (!last || dss->len == 0) {
+        return NGX_OK;
+    }
+
+    for (i = 0; i < ds->nsets; i++) {
+        ds->sets[i].alg->final(digest, &dss->ctx[i]);
+        ngx_http_waf_digests_probe(&ds->sets[i], digest, ss->hits);
+    }
+
+    for (i = 0; i < ds->nnots; i++) {
+        ss->hits[ds->nots[i] >> 3] ^= (u_char) (1 << (ds->nots[i] & 7));
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_waf_digests_able(ngx_http_waf_public_rule_t *pr)
+{
+    return pr->hash != NULL;
+}
+
+
+
+
+// -- regex set -----
+// the rx@ rules in the regex subset are compiled into a lazy dfa,
+// backreferences, lookaround, word boundaries ... are left to pcre.
+typedef struct {
+    u_char         *p;
+    u_char         *e;
+    ngx_pool_t     *pool;
+    char           *pcre;   /* the first feature only pcre knows */
+    ngx_uint_t      depth;
+} ngx_http_waf_re_parser_t;
+
+
+static ngx_http_waf_re_node_t *ngx_http_waf_re_parse_alt(
+    ngx_http_waf_re_parser_t *ps);
+
+
+static ngx_http_waf_re_node_t *
+ngx_http_waf_re_node(ngx_http_waf_re_parser_t *ps, ngx_uint_t type)
+{
+    ngx_http_waf_re_node_t  *n;
+
+    n = ngx_pcalloc(ps->pool, sizeof(ngx_http_waf_re_node_t));
+    if (n == NULL) {
+        return NULL;
+    }
+
+    n->type = type;
+
+    if (type == NGX_HTTP_WAF_RE_SET) {
+        n->set = ngx_pcalloc(ps->pool, 32);
+        if (n->set == NULL) {
+            return NULL;
+        }
+    }
+
+    return n;
+}
+
+
+static ngx_http_waf_re_node_t *
+ngx_http_waf_re_opaque(ngx_http_waf_re_parser_t *ps, char *feature)
+{
+    if (ps->pcre == NULL) {
+        ps->pcre = feature;
+    }
+
+    return ngx_http_waf_re_node(ps, NGX_HTTP_WAF_RE_OPAQUE);
+}
+
+
+// caseless, the ascii letters only like pcre without utf.
+static void
+ngx_http_waf_re_set_fold(u_char *set)
+{
+    ngx_uint_t  c;
+
+    for (c = 'a'; c <= 'z'; c++) {
+        if (ngx_http_waf_re_set_has(set, c)
+            || ngx_http_waf_re_set_has(set, c - 0x20))
+        {
+            ngx_http_waf_re_set_add(set, c);
+            ngx_http_waf_re_set_add(set, c - 0x20);
+        }
+    }
+}
+
+
+static void
+ngx_http_waf_re_set_range(u_char *set, ngx_uint_t lo, ngx_uint_t hi)
+{
+    for (/* void */; lo <= hi; lo++) {
+        ngx_http_waf_re_set_add(set, lo);
+    }
+}
+
+
+static void
+ngx_http_waf_re_set_negate(u_char *set)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < 32; i++) {
+        set[i] = (u_char) ~set[i];
+    }
+}
+
+
+// \d \w \s and the posix classes of the default pcre tables.
+static ngx_int_t
+ngx_http_waf_re_set_class(u_char *set, u_char *name, size_t len)
+{
+    u_char      tmp[32];
+    ngx_uint_t  neg;
+
+    ngx_memzero(tmp, sizeof(tmp));
+
+    neg = 0;
+    if (len > 0 && name[0] == '^') {
+        neg = 1;
+        name++;
+        len--;
+    }
+
+#define ngx_http_waf_re_class_is(s)                                           \
+    (len == sizeof(s) - 1 && ngx_strncmp(name, s, len) == 0)
+
+    if (ngx_http_waf_re_class_is("d") || ngx_http_waf_re_class_is("digit")) {
+        ngx_http_waf_re_set_range(tmp, '0', '9');
+
+    } else if (ngx_http_waf_re_class_is("w")
+               || ngx_http_waf_re_class_is("word"))
+    {
+        ngx_http_waf_re_set_range(tmp, '0', '9');
+        ngx_http_waf_re_set_range(tmp, 'A', 'Z');
+        ngx_http_waf_re_set_range(tmp, 'a', 'z');
+        ngx_http_waf_re_set_add(tmp, '_');
+
+    } else if (ngx_http_waf_re_class_is("s")
+               || ngx_http_waf_re_class_is("space"))
+    {
+        ngx_http_waf_re_set_range(tmp, '\t', '\r');
+        ngx_http_waf_re_set_add(tmp, ' ');
+
+    } else if (ngx_http_waf_re_class_is("alpha")) {
+        ngx_http_waf_re_set_range(tmp, 'A', 'Z');
+        ngx_http_waf_re_set_range(tmp, 'a', 'z');
+
+    } else if (ngx_http_waf_re_class_is("alnum")) {
+        ngx_http_waf_re_set_range(tmp, '0', '9');
+        ngx_http_waf_re_set_range(tmp, 'A', 'Z');
+        ngx_http_waf_re_set_range(tmp, 'a', 'z');
+
+    } else if (ngx_http_waf_re_class_is("upper")) {
+        ngx_http_waf_re_set_range(tmp, 'A', 'Z');
+
+    } else if (ngx_http_waf_re_class_is("lower")) {
+        ngx_http_waf_re_set_range(tmp, 'a', 'z');
+
+    } else if (ngx_http_waf_re_class_is("xdigit")) {
+        ngx_http_waf_re_set_range(tmp, '0', '9');
+        ngx_http_waf_re_set_range(tmp, 'A', 'F');
+        ngx_http_waf_re_set_range(tmp, 'a', 'f');
+
+    } else if (ngx_http_waf_re_class_is("blank")) {
+        ngx_http_waf_re_set_add(tmp, '\t');
+        ngx_http_waf_re_set_add(tmp, ' ');
+
+    } else if (ngx_http_waf_re_class_is("cntrl")) {
+        ngx_http_waf_re_set_range(tmp, 0, 0x1f);
+        ngx_http_waf_re_set_add(tmp, 0x7f);
+
+    } else if (ngx_http_waf_re_class_is("print")) {
+        ngx_http_waf_re_set_range(tmp, 0x20, 0x7e);
+
+    } else if (ngx_http_waf_re_class_is("graph")) {
+        ngx_http_waf_re_set_range(tmp, 0x21, 0x7e);
+
+    } else if (ngx_http_waf_re_class_is("punct")) {
+        ngx_http_waf_re_set_range(tmp, 0x21, 0x2f);
+        ngx_http_waf_re_set_range(tmp, 0x3a, 0x40);
+        ngx_http_waf_re_set_range(tmp, 0x5b, 0x60);
+        ngx_http_waf_re_set_range(tmp, 0x7b, 0x7e);
+
+    } else if (ngx_http_waf_re_class_is("ascii")) {
+        ngx_http_waf_re_set_range(tmp, 0, 0x7f);
+
+    } else {
+        return NGX_ERROR;
+    }
+
+#undef ngx_http_waf_re_class_is
+
+    // the case folding goes first, [^[:lower:]] matches no letter.
+    ngx_http_waf_re_set_fold(tmp);
+    if (neg) {
+        ngx_http_waf_re_set_negate(tmp);
+    }
+
+    for (len = 0; len < 32; len++) {
+        set[len] |= tmp[len];
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_waf_re_hex(u_char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+
+    c = (u_char) (c | 0x20);
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+
+    return NGX_ERROR;
+}
+
+
+// the escape after '\'.
+// a byte returns NGX_OK and *ch, \d \w \s ... returns NGX_OK and the set,
+// the others return NGX_DONE and the node type, NGX_ERROR unsupported syntax.
+static ngx_int_t
+ngx_http_waf_re_parse_escape(ngx_http_waf_re_parser_t *ps, u_char *set,
+    ngx_int_t *ch, ngx_uint_t *type, ngx_uint_t in_class)
+{
+    u_char      c, name[2];
+    ngx_int_t   n, v, i;
+
+    *ch = -1;
+
+    if (ps->p >= ps->e) {
+        return NGX_ERROR;
+    }
+
+    c = *ps->p++;
+
+    switch (c) {
+
+    case 'd': case 'w': case 's':
+    case 'D': case 'W': case 'S':
+        name[0] = '^';
+        name[1] = (u_char) (c | 0x20);
+
+        return ngx_http_waf_re_set_class(set, (c & 0x20) ? &name[1] : name,
+                                         (c & 0x20) ? 1 : 2);
+
+    case 't': *ch = '\t'; return NGX_OK;
+    case 'n': *ch = '\n'; return NGX_OK;
+    case 'r': *ch = '\r'; return NGX_OK;
+    case 'f': *ch = '\f'; return NGX_OK;
+    case 'e': *ch = 0x1b; return NGX_OK;
+    case 'a': *ch = 0x07; return NGX_OK;
+
+    case 'x':
+        v = 0;
+
+        if (ps->p < ps->e && *ps->p == '{') {
+            for (ps->p++; ps->p < ps->e && *ps->p != '}'; ps->p++) {
+                n = ngx_http_waf_re_hex(*ps->p);
+                if (n == NGX_ERROR || v > 0xf) {
+                    return NGX_ERROR;
+                }
+                v = v * 16 + n;
+            }
+
+            if (ps->p >= ps->e) {
+                return NGX_ERROR;
+            }
+
+            ps->p++;
+            *ch = v;
+            return NGX_OK;
+        }
+
+        for (i = 0; i < 2 && ps->p < ps->e; i++, ps->p++) {
+            n = ngx_http_waf_re_hex(*ps->p);
+            if (n == NGX_ERROR) {
+                break;
+            }
+            v = v * 16 + n;
+        }
+
+        *ch = v;
+        return NGX_OK;
+
+    case '0':
+        v = 0;
+        for (i = 0; i < 2 && ps->p < ps->e; i++, ps->p++) {
+            if (*ps->p < '0' || *ps->p > '7') {
+                break;
+            }
+            v = v * 8 + (*ps->p - '0');
+        }
+
+        *ch = v;
+        return NGX_OK;
+
+    case 'b':
+        if (in_class) {
+            *ch = 0x08;
+            return NGX_OK;
+        }
+
+        /* fall through */
+
+    case 'B':
+        if (in_class) {
+            return NGX_ERROR;
+        }
+
+        if (ps->pcre == NULL) {
+            ps->pcre = "word boundary";
+        }
+
+        *type = NGX_HTTP_WAF_RE_OPAQUE;
+        return NGX_DONE;
+
+    case 'A': case 'G':
+        *type = NGX_HTTP_WAF_RE_BOL;
+        return in_class ? NGX_ERROR : NGX_DONE;
+
+    case 'Z':
+        *type = NGX_HTTP_WAF_RE_EOL;
+        return in_class ? NGX_ERROR : NGX_DONE;
+
+    case 'z':
+        *type = NGX_HTTP_WAF_RE_EOS;
+        return in_class ? NGX_ERROR : NGX_DONE;
+
+    default:
+        break;
+    }
+
+    if (c >= '1' && c <= '9' && !in_class) {
+        while (ps->p < ps->e && *ps->p >= '0' && *ps->p <= '9') {
+            ps->p++;
+        }
+
+        if (ps->pcre == NULL) {
+            ps->pcre = "backreference";
+        }
+
+        *type = NGX_HTTP_WAF_RE_OPAQUE;
+        return NGX_DONE;
+    }
+
+    // \h \v \p \Q ... are not here.
+    if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z')
+        || (c >= 'A' && c <= 'Z'))
+    {
+        return NGX_ERROR;
+    }
+
+    *ch = c;
+    return NGX_OK;
+}
+
+
+// [...]
+static ngx_http_waf_re_node_t *
+ngx_http_waf_re_parse_class(ngx_http_waf_re_parser_t *ps)
+{
+    u_char                  *s, tmp[32];
+    ngx_int_t                lo, hi, rc;
+    ngx_uint_t               neg, first, type, i;
+    ngx_http_waf_re_node_t  *n;
+
+    n = ngx_http_waf_re_node(ps, NGX_HTTP_WAF_RE_SET);
+    if (n == NULL) {
+        return NULL;
+    }
+
+    neg = 0;
+    if (ps->p < ps->e && *ps->p == '^') {
+        neg = 1;
+        ps->p++;
+    }
+
+    for (first = 1; /* void */; first = 0) {
+        if (ps->p >= ps->e) {
+            return NULL;
+        }
+
+        if (*ps->p == ']' && !first) {
+            ps->p++;
+            break;
+        }
+
+        // [:alpha:]
+        if (*ps->p == '[' && ps->p + 1 < ps->e
+            && (ps->p[1] == ':' || ps->p[1] == '.' || ps->p[1] == '='))
+        {
+            if (ps->p[1] != ':') {
+                return NULL;
+            }
+
+            for (s = ps->p + 2; s + 1 < ps->e; s++) {
+                if (s[0] == ':' && s[1] == ']') {
+                    break;
+                }
+            }
+
+            if (s + 1 >= ps->e || ngx_http_waf_re_set_class(n->set, ps->p + 2,
+                    s - (ps->p + 2)) != NGX_OK)
+            {
+                return NULL;
+            }
+
+            ps->p = s + 2;
+            continue;
+        }
+
+        ngx_memzero(tmp, sizeof(tmp));
+
+        if (*ps->p == '\\') {
+            ps->p++;
+            rc = ngx_http_waf_re_parse_escape(ps, tmp, &lo, &type, 1);
+            if (rc != NGX_OK) {
+                return NULL;
+            }
+
+        } else {
+            lo = *ps->p++;
+        }
+
+        // a-z
+        if (lo >= 0 && ps->p + 1 < ps->e && ps->p[0] == '-'
+            && ps->p[1] != ']')
+        {
+            ps->p++;
+
+            if (*ps->p == '[') {
+                return NULL;
+            }
+
+            if (*ps->p == '\\') {
+                ps->p++;
+                rc = ngx_http_waf_re_parse_escape(ps, tmp, &hi, &type, 1);
+                if (rc != NGX_OK || hi < 0) {
+                    return NULL;
+                }
+
+            } else {
+                hi = *ps->p++;
+            }
+
+            if (hi < lo) {
+                return NULL;
+            }
+
+            ngx_http_waf_re_set_range(n->set, lo, hi);
+            continue;
+        }
+
+        if (lo >= 0) {
+            ngx_http_waf_re_set_add(n->set, lo);
+            continue;
+        }
+
+        for (i = 0; i < 32; i++) {
+            n->set[i] |= tmp[i];
+        }
+    }
+
+    ngx_http_waf_re_set_fold(n->set);
+    if (neg) {
+        ngx_http_waf_re_set_negate(n->set);
+    }
+
+    return n;
+}
+
+
+static ngx_http_waf_re_node_t *
+ngx_http_waf_re_cat(ngx_http_waf_re_parser_t *ps, ngx_http_waf_re_node_t *l,
+    ngx_http_waf_re_node_t *r)
+{
+    ngx_http_waf_re_node_t  *n;
+
+    if (l == NULL) {
+        return r;
+    }
+
+    n = ngx_http_waf_re_node(ps, NGX_HTTP_WAF_RE_CAT);
+    if (n == NULL) {
+        return NULL;
+    }
+
+    n->left = l;
+    n->right = r;
+
+    return n;
+}
+
+
+static ngx_http_waf_re_node_t *
+ngx_http_waf_re_parse_group(ngx_http_waf_re_parser_t *ps)
+{
+    u_char                  *p;
+    char                    *feature;
+    ngx_http_waf_re_node_t  *n;
+
+    feature = NULL;
+
+    p = ps->p;
+    if (p < ps->e && *p == '?') {
+        p++;
+
+        if (p >= ps->e) {
+            return NULL;
+        }
+
+        switch (*p) {
+
+        case ':':
+            p++;
+            break;
+
+        case '=': case '!':
+            p++;
+            feature = "lookaround";
+            break;
+
+        case '>':
+            p++;
+            feature = "atomic group";
+            break;
+
+        case '#':
+            while (p < ps->e && *p != ')') {
+                p++;
+            }
+
+            if (p >= ps->e) {
+                return NULL;
+            }
+
+            ps->p = p + 1;
+            return ngx_http_waf_re_node(ps, NGX_HTTP_WAF_RE_EMPTY);
+
+        case 'i':
+            // the rule is caseless already.
+            if (p + 1 < ps->e && (p[1] == ')' || p[1] == ':')) {
+                ps->p = p + 2;
+
+                if (p[1] == ')') {
+                    return ngx_http_waf_re_node(ps, NGX_HTTP_WAF_RE_EMPTY);
+                }
+
+                p += 2;
+                break;
+            }
+
+            return NULL;
+
+        case '<':
+            if (p + 1 < ps->e && (p[1] == '=' || p[1] == '!')) {
+                p += 2;
+                feature = "lookaround";
+                break;
+            }
+
+            /* fall through */
+
+        case 'P': case '\'':
+            // the named group
+            if (*p == 'P') {
+                p++;
+                if (p >= ps->e || *p != '<') {
+                    return NULL;
+                }
+            }
+
+            for (p++; p < ps->e && *p != '>' && *p != '\''; p++) {
+                if (!((*p >= '0' && *p <= '9') || *p == '_'
+                    || ((*p | 0x20) >= 'a' && (*p | 0x20) <= 'z')))
+                {
+                    return NULL;
+                }
+            }
+
+            if (p >= ps->e) {
+                return NULL;
+            }
+
+            p++;
+            break;
+
+        default:
+            return NULL;
+        }
+    }
+
+    ps->p = p;
+
+    if (++ps->depth > NGX_HTTP_WAF_RE_MAX_DEPTH) {
+        return NULL;
+    }
+
+    n = ngx_http_waf_re_parse_alt(ps);
+    if (n == NULL || ps->p >= ps->e || *ps->p != ')') {
+        return NULL;
+    }
+
+    ps->depth--;
+    ps->p++;
+
+    if (feature != NULL) {
+        return ngx_http_waf_re_opaque(ps, feature);
+    }
+
+    return n;
+}
+
+
+static ngx_http_waf_re_node_t *
+ngx_http_waf_re_parse_atom(ngx_http_waf_re_parser_t *ps)
+{
+    u_char                  *p;
+    ngx_int_t                ch, rc;
+    ngx_uint_t               type;
+    ngx_http_waf_re_node_t  *n, *r;
+
+    p = ps->p++;
+
+    switch (*p) {
+
+    case '(':
+        return ngx_http_waf_re_parse_group(ps);
+
+    case '[':
+        return ngx_http_waf_re_parse_class(ps);
+
+    case '.':
+        n = ngx_http_waf_re_node(ps, NGX_HTTP_WAF_RE_SET);
+        if (n == NULL) {
+            return NULL;
+        }
+
+        ngx_memset(n->set, 0xff, 32);
+        n->set['\n' >> 3] &= (u_char) ~(1 << ('\n' & 7));
+        return n;
+
+    case '^':
+        return ngx_http_waf_re_node(ps, NGX_HTTP_WAF_RE_BOL);
+
+    case '$':
+        return ngx_http_waf_re_node(ps, NGX_HTTP_WAF_RE_EOL);
+
+    case '*': case '+': case '?':
+        return NULL;
+
+    case '\\':
+        // \Q...\E
+        if (ps->p < ps->e && *ps->p == 'Q') {
+            n = ngx_http_waf_re_node(ps, NGX_HTTP_WAF_RE_EMPTY);
+
+            for (ps->p++; n != NULL && ps->p < ps->e; ps->p++) {
+                if (*ps->p == '\\' && ps->p + 1 < ps->e && ps->p[1] == 'E') {
+                    ps->p += 2;
+                    break;
+                }
+
+                r = ngx_http_waf_re_node(ps, NGX_HTTP_WAF_RE_SET);
+                if (r == NULL) {
+                    return NULL;
+                }
+
+                ngx_http_waf_re_set_add(r->set, *ps->p);
+                ngx_http_waf_re_set_fold(r->set);
+                n = ngx_http_waf_re_cat(ps, n, r);
+            }
+
+            return n;
+        }
+
+        n = ngx_http_waf_re_node(ps, NGX_HTTP_WAF_RE_SET);
+        if (n == NULL) {
+            return NULL;
+        }
+
+        type = NGX_HTTP_WAF_RE_SET;
+        rc = ngx_http_waf_re_parse_escape(ps, n->set, &ch, &type, 0);
+        if (rc == NGX_ERROR) {
+            return NULL;
+        }
+
+        if (rc == NGX_DONE) {
+            n->type = type;
+            return n;
+        }
+
+        if (ch >= 0) {
+            ngx_http_waf_re_set_add(n->set, ch);
+        }
+
+        ngx_http_waf_re_set_fold(n->set);
+        return n;
+
+    default:
+        n = ngx_http_waf_re_node(ps, NGX_HTTP_WAF_RE_SET);
+        if (n == NULL) {
+            return NULL;
+        }
+
+        ngx_http_waf_re_set_add(n->set, *p);
+        ngx_http_waf_re_set_fold(n->set);
+        return n;
+    }
+}
+
+
+// {n} {n,} {n,m}, return NGX_DECLINED if '{' is a literal.
+static ngx_int_t
+ngx_http_waf_re_parse_bound(ngx_http_waf_re_parser_t *ps, ngx_uint_t *min,
+    ngx_uint_t *max)
+{
+    u_char      *p, *s;
+
+    p = ps->p + 1;
+
+    for (s = p; p < ps->e && *p >= '0' && *p <= '9'; p++) { /* void */ }
+
+    if (p == s || p >= ps->e) {
+        return NGX_DECLINED;
+    }
+
+    *min = ngx_atoi(s, p - s);
+    *max = *min;
+
+    if (*p == ',') {
+        for (s = ++p; p < ps->e && *p >= '0' && *p <= '9'; p++) { /* void */ }
+
+        *max = (p == s) ? NGX_HTTP_WAF_RE_INF : (ngx_uint_t) ngx_atoi(s, p - s);
+    }
+
+    if (p >= ps->e || *p != '}') {
+        return NGX_DECLINED;
+    }
+
+    if (*min > 65535 || (*max != NGX_HTTP_WAF_RE_INF
+        && (*max > 65535 || *max < *min)))
+    {
+        return NGX_ERROR;
+    }
+
+    ps->p = p + 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_http_waf_re_node_t *
+ngx_http_waf_re_parse_repeat(ngx_http_waf_re_parser_t *ps)
+{
+    ngx_int_t                rc;
+    ngx_uint_t               min, max;
+    ngx_http_waf_re_node_t  *atom, *n;
+
+    atom = ngx_http_waf_re_parse_atom(ps);
+    if (atom == NULL || ps->p >= ps->e) {
+        return atom;
+    }
+
+    switch (*ps->p) {
+
+    case '*':
+        min = 0;
+        max = NGX_HTTP_WAF_RE_INF;
+        ps->p++;
+        break;
+
+    case '+':
+        min = 1;
+        max = NGX_HTTP_WAF_RE_INF;
+        ps->p++;
+        break;
+
+    case '?':
+        min = 0;
+        max = 1;
+        ps->p++;
+        break;
+
+    case '{':
+        rc = ngx_http_waf_re_parse_bound(ps, &min, &max);
+        if (rc == NGX_ERROR) {
+            return NULL;
+        }
+
+        if (rc == NGX_DECLINED) {
+            return atom;
+        }
+
+        break;
+
+    default:
+        return atom;
+    }
+
+    if (atom->type == NGX_HTTP_WAF_RE_BOL || atom->type == NGX_HTTP_WAF_RE_EOL
+        || atom->type == NGX_HTTP_WAF_RE_EOS)
+    {
+        return NULL;
+    }
+
+    n = ngx_http_waf_re_node(ps, NGX_HTTP_WAF_RE_REPEAT);
+    if (n == NULL) {
+        return NULL;
+    }
+
+    n->min = min;
+    n->max = max;
+    n->left = atom;
+
+    if (ps->p < ps->e) {
+        // the lazy one matches the same strings.
+        if (*ps->p == '?') {
+            ps->p++;
+
+        } else if (*ps->p == '+') {
+            ps->p++;
+            n = ngx_http_waf_re_opaque(ps, "possessive quantifier");
+        }
+    }
+
+    if (ps->p < ps->e && (*ps->p == '*' || *ps->p == '+' || *ps->p == '?'
+        || (*ps->p == '{'
+            && ngx_http_waf_re_parse_bound(ps, &min, &max) != NGX_DECLINED)))
+    {
+        return NULL;
+    }
+
+    return n;
+}
+
+
+static ngx_http_waf_re_node_t *
+ngx_http_waf_re_parse_cat(ngx_http_waf_re_parser_t *ps)
+{
+    ngx_http_waf_re_node_t  *n, *r;
+
+    n = NULL;
+
+    while (ps->p < ps->e && *ps->p != '|' && *ps->p != ')') {
+        r = ngx_http_waf_re_parse_repeat(ps);
+        if (r == NULL) {
+            return NULL;
+        }
+
+        n = ngx_http_waf_re_cat(ps, n, r);
+        if (n == NULL) {
+            return NULL;
+        }
+    }
+
+    if (n == NULL) {
+        return ngx_http_waf_re_node(ps, NGX_HTTP_WAF_RE_EMPTY);
+    }
+
+    return n;
+}
+
+
+static ngx_http_waf_re_node_t *
+ngx_http_waf_re_parse_alt(ngx_http_waf_re_parser_t *ps)
+{
+    ngx_http_waf_re_node_t  *n, *r, *alt;
+
+    n = ngx_http_waf_re_parse_cat(ps);
+
+    while (n != NULL && ps->p < ps->e && *ps->p == '|') {
+        ps->p++;
+
+        r = ngx_http_waf_re_parse_cat(ps);
+        if (r == NULL) {
+            return NULL;
+        }
+
+        alt = ngx_http_waf_re_node(ps, NGX_HTTP_WAF_RE_ALT);
+        if (alt == NULL) {
+            return NULL;
+        }
+
+        alt->left = n;
+        alt->right = r;
+        n = alt;
+    }
+
+    return n;
+}
+
+
+// the nfa instructions of the node.
+static ngx_uint_t
+ngx_http_waf_re_size(ngx_http_waf_re_node_t *n)
+{
+    ngx_uint_t  l, r;
+
+    switch (n->type) {
+
+    case NGX_HTTP_WAF_RE_EMPTY:
+        return 0;
+
+    case NGX_HTTP_WAF_RE_CAT:
+    case NGX_HTTP_WAF_RE_ALT:
+        l = ngx_http_waf_re_size(n->left);
+        r = ngx_http_waf_re_size(n->right);
+        l = l + r + (n->type == NGX_HTTP_WAF_RE_ALT);
+        break;
+
+    case NGX_HTTP_WAF_RE_REPEAT:
+        r = ngx_http_waf_re_size(n->left);
+        l = n->min * r;
+
+        if (n->max == NGX_HTTP_WAF_RE_INF) {
+            l += r + 1;
+        } else {
+            l += (n->max - n->min) * (r + 1);
+        }
+        break;
+
+    default:
+        return 1;
+    }
+
+    return ngx_min(l, NGX_HTTP_WAF_RE_MAX_INSTS + 1);
+}
+
+
+// emit the node before the next instruction, return the entry.
+static uint32_t
+ngx_http_waf_re_emit(ngx_http_waf_nfa_inst_t *insts, ngx_uint_t *n,
+    ngx_http_waf_re_node_t *node, uint32_t next, ngx_uint_t rule)
+{
+    uint32_t                  body, cur;
+    ngx_uint_t                i;
+    ngx_http_waf_nfa_inst_t  *in;
+
+    switch (node->type) {
+
+    case NGX_HTTP_WAF_RE_EMPTY:
+        return next;
+
+    case NGX_HTTP_WAF_RE_CAT:
+        next = ngx_http_waf_re_emit(insts, n, node->right, next, rule);
+        return ngx_http_waf_re_emit(insts, n, node->left, next, rule);
+
+    case NGX_HTTP_WAF_RE_ALT:
+        body = ngx_http_waf_re_emit(insts, n, node->left, next, rule);
+        cur = ngx_http_waf_re_emit(insts, n, node->right, next, rule);
+
+        in = &insts[*n];
+        in->op = NGX_HTTP_WAF_NFA_SPLIT;
+        in->x = body;
+        in->y = cur;
+        return (uint32_t) (*n)++;
+
+    case NGX_HTTP_WAF_RE_REPEAT:
+        cur = next;
+
+        if (node->max == NGX_HTTP_WAF_RE_INF) {
+            in = &insts[*n];
+            cur = (uint32_t) (*n)++;
+
+            in->op = NGX_HTTP_WAF_NFA_SPLIT;
+            in->y = next;
+            in->x = ngx_http_waf_re_emit(insts, n, node->left, cur, rule);
+
+        } else {
+            for (i = node->min; i < node->max; i++) {
+                body = ngx_http_waf_re_emit(insts, n, node->left, cur, rule);
+
+                in = &insts[*n];
+                in->op = NGX_HTTP_WAF_NFA_SPLIT;
+                in->x = body;
+                in->y = next;
+                cur = (uint32_t) (*n)++;
+            }
+        }
+
+        for (i = 0; i < node->min; i++) {
+            cur = ngx_http_waf_re_emit(insts, n, node->left, cur, rule);
+        }
+
+        return cur;
+
+    default:
+        in = &insts[*n];
+        in->x = next;
+        in->y = (uint32_t) rule;
+        in->set = node->set;
+
+        in->op = (node->type == NGX_HTTP_WAF_RE_SET) ? NGX_HTTP_WAF_NFA_SET
+               : (node->type == NGX_HTTP_WAF_RE_BOL) ? NGX_HTTP_WAF_NFA_BOL
+               : (node->type == NGX_HTTP_WAF_RE_EOL) ? NGX_HTTP_WAF_NFA_EOL
+               : NGX_HTTP_WAF_NFA_EOS;
+
+        return (uint32_t) (*n)++;
+    }
+}
+
+
+// $ and \z are supported at the end of the pattern only.
+static ngx_int_t
+ngx_http_waf_re_check_anchors(ngx_conf_t *cf, ngx_http_waf_re_t *re)
+{
+    uint32_t                  pc, *stack;
+    ngx_uint_t                i, n, top;
+    u_char                   *seen;
+    ngx_http_waf_nfa_inst_t  *insts;
+
+    insts = ngx_pcalloc(cf->temp_pool,
+        (re->ninsts + 1) * sizeof(ngx_http_waf_nfa_inst_t));
+    stack = ngx_pnalloc(cf->temp_pool,
+        (2 * re->ninsts + 3) * sizeof(uint32_t));
+    seen = ngx_pnalloc(cf->temp_pool, re->ninsts + 1);
+    if (insts == NULL || stack == NULL || seen == NULL) {
+        return NGX_ERROR;
+    }
+
+    insts[0].op = NGX_HTTP_WAF_NFA_MATCH;
+    n = 1;
+    (void) ngx_http_waf_re_emit(insts, &n, re->root, 0, 0);
+
+    for (i = 0; i < n; i++) {
+        if (insts[i].op != NGX_HTTP_WAF_NFA_EOL
+            && insts[i].op != NGX_HTTP_WAF_NFA_EOS)
+        {
+            continue;
+        }
+
+        ngx_memzero(seen, n);
+        top = 0;
+        stack[top++] = insts[i].x;
+
+        while (top > 0) {
+            pc = stack[--top];
+            if (seen[pc]) {
+                continue;
+            }
+            seen[pc] = 1;
+
+            if (insts[pc].op == NGX_HTTP_WAF_NFA_SPLIT) {
+                stack[top++] = insts[pc].x;
+                stack[top++] = insts[pc].y;
+
+            } else if (insts[pc].op != NGX_HTTP_WAF_NFA_MATCH) {
+                return NGX_DECLINED;
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_http_waf_re_t *
+ngx_http_waf_re_parse(ngx_conf_t *cf, ngx_str_t *pattern)
+{
+    ngx_int_t                  rc;
+    ngx_http_waf_re_t         *re;
+    ngx_http_waf_re_parser_t   ps;
+
+    re = ngx_pcalloc(cf->pool, sizeof(ngx_http_waf_re_t));
+    if (re == NULL) {
+        return NULL;
+    }
+
+    ngx_memzero(&ps, sizeof(ngx_http_waf_re_parser_t));
+    ps.p = pattern->data;
+    ps.e = pattern->data + pattern->len;
+    ps.pool = cf->pool;
+
+    re->root = ngx_http_waf_re_parse_alt(&ps);
+    if (re->root == NULL || ps.p != ps.e) {
+        re->root = NULL;
+        re->pcre = "unsupported syntax";
+        return re;
+    }
+
+    re->ninsts = ngx_http_waf_re_size(re->root);
+
+    if (ps.pcre != NULL) {
+        re->pcre = ps.pcre;
+
+    } else if (re->ninsts > NGX_HTTP_WAF_RE_MAX_INSTS) {
+        re->pcre = "too large";
+
+    } else {
+        rc = ngx_http_waf_re_check_anchors(cf, re);
+        if (rc == NGX_ERROR) {
+            return NULL;
+        }
+
+        if (rc == NGX_DECLINED) {
+            re->pcre = "anchor not at the end";
+        }
+    }
+
+    return re;
+}
+
+
+// one of the literals is in every match of the rx@, pcre is run only
+// when the field has one of them.
+#define NGX_HTTP_WAF_RE_MAX_LITS     16
+#define NGX_HTTP_WAF_RE_MIN_LIT      3
+
+typedef struct {
+    ngx_array_t    *exact;  /* ngx_str_t, every match is one of them */
+    ngx_array_t    *any;    /* ngx_str_t, one of them is in every match */
+} ngx_http_waf_re_lits_t;
+
+
+static ngx_array_t *
+ngx_http_waf_re_lits_empty(ngx_pool_t *pool)
+{
+    ngx_str_t    *s;
+    ngx_array_t  *a;
+
+    a = ngx_array_create(pool, 1, sizeof(ngx_str_t));
+    if (a == NULL) {
+        return NULL;
+    }
+
+    s = ngx_array_push(a);
+    if (s == NULL) {
+        return NULL;
+    }
+
+    ngx_str_null(s);
+
+    return a;
+}
+
+
+// the shortest literal, 0 if none is required.
+static size_t
+ngx_http_waf_re_lits_score(ngx_array_t *a)
+{
+    size_t       min;
+    ngx_str_t   *s;
+    ngx_uint_t   i;
+
+    if (a == NULL || a->nelts == 0) {
+        return 0;
+    }
+
+    s = a->elts;
+    min = s[0].len;
+    for (i = 1; i < a->nelts; i++) {
+        min = ngx_min(min, s[i].len);
+    }
+
+    return min;
+}
+
+
+static ngx_array_t *
+ngx_http_waf_re_lits_required(ngx_http_waf_re_lits_t *l)
+{
+    return l->exact != NULL ? l->exact : l->any;
+}
+
+
+static ngx_array_t *
+ngx_http_waf_re_lits_union(ngx_pool_t *pool, ngx_array_t *a, ngx_array_t *b)
+{
+    ngx_str_t    *s;
+    ngx_array_t  *u;
+
+    if (a->nelts + b->nelts > NGX_HTTP_WAF_RE_MAX_LITS) {
+        return NULL;
+    }
+
+    u = ngx_array_create(pool, a->nelts + b->nelts, sizeof(ngx_str_t));
+    if (u == NULL) {
+        return NULL;
+    }
+
+    s = ngx_array_push_n(u, a->nelts + b->nelts);
+    if (s == NULL) {
+        return NULL;
+    }
+
+    ngx_memcpy(s, a->elts, a->nelts * sizeof(ngx_str_t));
+    ngx_memcpy(s + a->nelts, b->elts, b->nelts * sizeof(ngx_str_t));
+
+    return u;
+}
+
+
+static ngx_array_t *
+ngx_http_waf_re_lits_cross(ngx_pool_t *pool, ngx_array_t *a, ngx_array_t *b)
+{
+    ngx_str_t    *x, *y, *s;
+    ngx_uint_t    i, j;
+    ngx_array_t  *c;
+
+    c = ngx_array_create(pool, a->nelts * b->nelts, sizeof(ngx_str_t));
+    if (c == NULL) {
+        return NULL;
+    }
+
+    x = a->elts;
+    y = b->elts;
+
+    for (i = 0; i < a->nelts; i++) {
+        for (j = 0; j < b->nelts; j++) {
+            s = ngx_array_push(c);
+            if (s == NULL) {
+                return NULL;
+            }
+
+            s->len = x[i].len + y[j].len;
+            s->data = ngx_pnalloc(pool, s->len + 1);
+            if (s->data == NULL) {
+                return NULL;
+            }
+
+            ngx_memcpy(ngx_cpymem(s->data, x[i].data, x[i].len),
+                       y[j].data, y[j].len);
+        }
+    }
+
+    return c;
+}
+
+
+// the lowercase bytes of a small set, the rule is caseless.
+static ngx_int_t
+ngx_http_waf_re_lits_set(ngx_pool_t *pool, u_char *set,
+    ngx_http_waf_re_lits_t *l)
+{
+    u_char       seen[256];
+    ngx_str_t   *s;
+    ngx_uint_t   c, n;
+
+    ngx_memzero(seen, sizeof(seen));
+    n = 0;
+
+    for (c = 0; c < 256; c++) {
+        if (ngx_http_waf_re_set_has(set, c) && !seen[ngx_tolower(c)]) {
+            seen[ngx_tolower(c)] = 1;
+            n++;
+        }
+    }
+
+    if (n == 0 || n > NGX_HTTP_WAF_RE_MAX_LITS / 4) {
+        return NGX_OK;
+    }
+
+    l->exact = ngx_array_create(pool, n, sizeof(ngx_str_t));
+    if (l->exact == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (c = 0; c < 256; c++) {
+        if (!seen[c]) {
+            continue;
+        }
+
+        s = ngx_array_push(l->exact);
+        if (s == NULL) {
+            return NGX_ERROR;
+        }
+
+        s->len = 1;
+        s->data = ngx_pnalloc(pool, 1);
+        if (s->data == NULL) {
+            return NGX_ERROR;
+        }
+
+        s->data[0] = (u_char) c;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t ngx_http_waf_re_lits(ngx_pool_t *pool,
+    ngx_http_waf_re_node_t *n, ngx_http_waf_re_lits_t *l);
+
+
+static ngx_int_t
+ngx_http_waf_re_lits_flat(ngx_array_t *nodes, ngx_http_waf_re_node_t *n)
+{
+    ngx_http_waf_re_node_t  **p;
+
+    if (n->type == NGX_HTTP_WAF_RE_CAT) {
+        if (ngx_http_waf_re_lits_flat(nodes, n->left) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        return ngx_http_waf_re_lits_flat(nodes, n->right);
+    }
+
+    p = ngx_array_push(nodes);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    *p = n;
+
+    return NGX_OK;
+}
+
+
+// the runs of exact items of a concatenation are joined, the best run
+// or the best required literals of an item is kept.
+static ngx_int_t
+ngx_http_waf_re_lits_cat(ngx_pool_t *pool, ngx_http_waf_re_node_t *n,
+    ngx_http_waf_re_lits_t *l)
+{
+    ngx_uint_t                i;
+    ngx_array_t               nodes, *run, *req;
+    ngx_http_waf_re_lits_t    x;
+    ngx_http_waf_re_node_t  **items;
+
+    if (ngx_array_init(&nodes, pool, 8, sizeof(ngx_http_waf_re_node_t *))
+        != NGX_OK
+        || ngx_http_waf_re_lits_flat(&nodes, n) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    run = ngx_http_waf_re_lits_empty(pool);
+    if (run == NULL) {
+        return NGX_ERROR;
+    }
+
+    l->exact = run;
+    l->any = NULL;
+
+    items = nodes.elts;
+    for (i = 0; i < nodes.nelts; i++) {
+        if (ngx_http_waf_re_lits(pool, items[i], &x) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (x.exact != NULL
+            && run->nelts * x.exact->nelts <= NGX_HTTP_WAF_RE_MAX_LITS)
+        {
+            run = ngx_http_waf_re_lits_cross(pool, run, x.exact);
+            if (run == NULL) {
+                return NGX_ERROR;
+            }
+
+            if (l->exact != NULL) {
+                l->exact = run;
+            }
+
+            continue;
+        }
+
+        // the run ends here.
+        l->exact = NULL;
+
+        req = ngx_http_waf_re_lits_required(&x);
+
+        if (ngx_http_waf_re_lits_score(run)
+            > ngx_http_waf_re_lits_score(l->any))
+        {
+            l->any = run;
+        }
+
+        if (ngx_http_waf_re_lits_score(req)
+            > ngx_http_waf_re_lits_score(l->any))
+        {
+            l->any = req;
+        }
+
+        run = x.exact != NULL ? x.exact : ngx_http_waf_re_lits_empty(pool);
+        if (run == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    if (l->exact == NULL
+        && ngx_http_waf_re_lits_score(run) > ngx_http_waf_re_lits_score(l->any))
+    {
+        l->any = run;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_waf_re_lits(ngx_pool_t *pool, ngx_http_waf_re_node_t *n,
+    ngx_http_waf_re_lits_t *l)
+{
+    ngx_array_t             *a, *b;
+    ngx_http_waf_re_lits_t   x, y;
+
+    l->exact = NULL;
+    l->any = NULL;
+
+    switch (n->type) {
+
+    case NGX_HTTP_WAF_RE_EMPTY:
+    case NGX_HTTP_WAF_RE_BOL:
+    case NGX_HTTP_WAF_RE_EOL:
+    case NGX_HTTP_WAF_RE_EOS:
+        l->exact = ngx_http_waf_re_lits_empty(pool);
+        return l->exact != NULL ? NGX_OK : NGX_ERROR;
+
+    case NGX_HTTP_WAF_RE_SET:
+        return ngx_http_waf_re_lits_set(pool, n->set, l);
+
+    case NGX_HTTP_WAF_RE_CAT:
+        return ngx_http_waf_re_lits_cat(pool, n, l);
+
+    case NGX_HTTP_WAF_RE_ALT:
+        if (ngx_http_waf_re_lits(pool, n->left, &x) != NGX_OK
+            || ngx_http_waf_re_lits(pool, n->right, &y) != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        if (x.exact != NULL && y.exact != NULL) {
+            l->exact = ngx_http_waf_re_lits_union(pool, x.exact, y.exact);
+            if (l->exact != NULL) {
+                return NGX_OK;
+            }
+        }
+
+        // every branch needs a literal.
+        a = ngx_http_waf_re_lits_required(&x);
+        b = ngx_http_waf_re_lits_required(&y);
+
+        if (ngx_http_waf_re_lits_score(a) != 0
+            && ngx_http_waf_re_lits_score(b) != 0)
+        {
+            l->any = ngx_http_waf_re_lits_union(pool, a, b);
+        }
+
+        return NGX_OK;
+
+    case NGX_HTTP_WAF_RE_REPEAT:
+        if (n->min == 0) {
+            return NGX_OK;
+        }
+
+        if (ngx_http_waf_re_lits(pool, n->left, &x) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (n->min == 1 && n->max == 1) {
+            *l = x;
+
+        } else {
+            l->any = ngx_http_waf_re_lits_required(&x);
+        }
+
+        return NGX_OK;
+
+    default:
+        // pcre only, nothing is known.
+        return NGX_OK;
+    }
+}
+
+
+// the required literals of the rx@ matched by pcre, re->lits is null
+// if none is long enough.
+static ngx_int_t
+ngx_http_waf_re_factors(ngx_conf_t *cf, ngx_http_waf_re_t *re)
+{
+    ngx_str_t               *s, *d;
+    ngx_uint_t               i;
+    ngx_array_t             *a;
+    ngx_http_waf_re_lits_t   l;
+
+    if (re->root == NULL) {
+        return NGX_OK;
+    }
+
+    if (ngx_http_waf_re_lits(cf->temp_pool, re->root, &l) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    a = ngx_http_waf_re_lits_required(&l);
+    if (ngx_http_waf_re_lits_score(a) < NGX_HTTP_WAF_RE_MIN_LIT) {
+        return NGX_OK;
+    }
+
+    re->lits = ngx_array_create(cf->pool, a->nelts, sizeof(ngx_str_t));
+    if (re->lits == NULL) {
+        return NGX_ERROR;
+    }
+
+    s = a->elts;
+    for (i = 0; i < a->nelts; i++) {
+        d = ngx_array_push(re->lits);
+        if (d == NULL) {
+            return NGX_ERROR;
+        }
+
+        d->len = s[i].len;
+        d->data = ngx_pstrdup(cf->pool, &s[i]);
+        if (d->data == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_waf_dfa_able(ngx_http_waf_public_rule_t *pr)
+{
+    return pr->handler == ngx_http_waf_rule_str_rx_handler && !pr->not
+        && pr->re != NULL && pr->re->pcre == NULL;
+}
+
+
+static ngx_int_t
+ngx_http_waf_dfa_compile(ngx_conf_t *cf, ngx_http_waf_matcher_t *m)
+{
+    ngx_uint_t                    map[512];
+    ngx_uint_t                    i, c, n, ncls;
+    ngx_http_waf_dfa_t           *dfa;
+    ngx_http_waf_nfa_inst_t      *in;
+    ngx_http_waf_public_rule_t  **prs;
+
+    prs = m->rules.elts;
+
+    dfa = ngx_pcalloc(cf->pool, sizeof(ngx_http_waf_dfa_t));
+    if (dfa == NULL) {
+        return NGX_ERROR;
+    }
+
+    n = m->rules.nelts;
+    for (i = 0; i < m->rules.nelts; i++) {
+        n += prs[i]->re->ninsts;
+    }
+
+    dfa->nrules = m->rules.nelts;
+    dfa->insts = ngx_pcalloc(cf->pool, n * sizeof(ngx_http_waf_nfa_inst_t));
+    dfa->starts = ngx_pnalloc(cf->pool, dfa->nrules * sizeof(uint32_t));
+    dfa->mark = ngx_pcalloc(cf->pool, n * sizeof(uint32_t));
+    dfa->stack = ngx_pnalloc(cf->pool, (2 * n + 1) * sizeof(uint32_t));
+    dfa->work = ngx_pnalloc(cf->pool, n * sizeof(uint32_t));
+    if (dfa->insts == NULL || dfa->starts == NULL || dfa->mark == NULL
+        || dfa->stack == NULL || dfa->work == NULL)
+    {
+        return NGX_ERROR;
+    }
+
+    n = 0;
+    for (i = 0; i < dfa->nrules; i++) {
+        in = &dfa->insts[n];
+        in->op = NGX_HTTP_WAF_NFA_MATCH;
+        in->x = (uint32_t) i;
+        c = n++;
+
+        dfa->starts[i] = ngx_http_waf_re_emit(dfa->insts, &n, prs[i]->re->root,
+            (uint32_t) c, i);
+    }
+    dfa->ninsts = n;
+
+    // the byte classes, split by every set.
+    ncls = 1;
+    for (i = 0; i < dfa->ninsts; i++) {
+        in = &dfa->insts[i];
+        if (in->op != NGX_HTTP_WAF_NFA_SET) {
+            continue;
+        }
+
+        ngx_memzero(map, sizeof(map));
+        ncls = 0;
+
+        for (c = 0; c < 256; c++) {
+            n = dfa->cls[c] * 2 + (ngx_http_waf_re_set_has(in->set, c) != 0);
+            if (map[n] == 0) {
+                map[n] = ++ncls;
+            }
+            dfa->cls[c] = (u_char) (map[n] - 1);
+        }
+    }
+
+    dfa->ncls = ncls;
+    for (c = 256; c-- > 0; /* void */) {
+        dfa->rep[dfa->cls[c]] = (u_char) c;
+    }
+
+    dfa->nbuckets = 1024;
+    dfa->buckets = ngx_pcalloc(cf->pool,
+        dfa->nbuckets * sizeof(ngx_http_waf_dfa_state_t *));
+    if (dfa->buckets == NULL) {
+        return NGX_ERROR;
+    }
+
+    m->data = dfa;
+
+    return NGX_OK;
+}
+
+
+// add the instructions reached by pc to dfa->work.
+static ngx_uint_t
+ngx_http_waf_dfa_closure(ngx_http_waf_dfa_t *dfa, uint32_t pc, ngx_uint_t n,
+    ngx_uint_t bol)
+{
+    ngx_uint_t                top;
+    ngx_http_waf_nfa_inst_t  *in;
+
+    top = 0;
+    dfa->stack[top++] = pc;
+
+    while (top > 0) {
+        pc = dfa->stack[--top];
+        if (dfa->mark[pc] == dfa->gen) {
+            continue;
+        }
+        dfa->mark[pc] = dfa->gen;
+
+        in = &dfa->insts[pc];
+
+        switch (in->op) {
+
+        case NGX_HTTP_WAF_NFA_SPLIT:
+            dfa->stack[top++] = in->y;
+            dfa->stack[top++] = in->x;
+            break;
+
+        case NGX_HTTP_WAF_NFA_BOL:
+            if (bol) {
+                dfa->stack[top++] = in->x;
+            }
+            break;
+
+        default:
+            dfa->work[n++] = pc;
+            break;
+        }
+    }
+
+    return n;
+}
+
+
+static void
+ngx_http_waf_dfa_gen(ngx_http_waf_dfa_t *dfa)
+{
+    if (++dfa->gen == 0) {
+        ngx_memzero(dfa->mark, dfa->ninsts * sizeof(uint32_t));
+        dfa->gen = 1;
+    }
+}
+
+
+static int ngx_libc_cdecl
+ngx_http_waf_dfa_cmp(const void *one, const void *two)
+{
+    uint32_t  a = *(uint32_t *) one;
+    uint32_t  b = *(uint32_t *) two;
+
+    return (a > b) - (a < b);
+}
+
+
+static void
+ngx_http_waf_dfa_flush(ngx_http_waf_dfa_t *dfa)
+{
+    ngx_http_waf_dfa_state_t  *st, *next;
+
+    for (st = dfa->states; st != NULL; st = next) {
+        next = st->link;
+        ngx_free(st);
+    }
+
+    ngx_memzero(dfa->buckets,
+        dfa->nbuckets * sizeof(ngx_http_waf_dfa_state_t *));
+
+    dfa->states = NULL;
+    dfa->start = NULL;
+    dfa->size = 0;
+    dfa->flushes++;
+}
+
+
+// the state of the n instructions in dfa->work.
+// *linkable is cleared if the cache was flushed.
+static ngx_http_waf_dfa_state_t *
+ngx_http_waf_dfa_state(ngx_http_waf_dfa_t *dfa, ngx_uint_t n,
+    ngx_uint_t *linkable)
+{
+    size_t                     size;
+    uint32_t                  *out;
+    ngx_uint_t                 i, hash, a, e, l;
+    ngx_http_waf_dfa_state_t  *st, **b;
+    ngx_http_waf_nfa_inst_t   *in;
+
+    ngx_qsort(dfa->work, n, sizeof(uint32_t), ngx_http_waf_dfa_cmp);
+
+    hash = ngx_hash_key((u_char *) dfa->work, n * sizeof(uint32_t));
+
+    b = &dfa->buckets[hash & (dfa->nbuckets - 1)];
+    for (st = *b; st != NULL; st = st->hnext) {
+        if (st->hash == hash && st->nkernel == n
+            && ngx_memcmp(st->kernel, dfa->work, n * sizeof(uint32_t)) == 0)
+        {
+            return st;
+        }
+    }
+
+    size = sizeof(ngx_http_waf_dfa_state_t)
+           + dfa->ncls * sizeof(ngx_http_waf_dfa_state_t *)
+           + 2 * n * sizeof(uint32_t);
+
+    if (dfa->size + size > NGX_HTTP_WAF_DFA_CACHE_SIZE) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+            "ngx http waf dfa cache flush");
+
+        ngx_http_waf_dfa_flush(dfa);
+        *linkable = 0;
+    }
+
+    st = ngx_alloc(size, ngx_cycle->log);
+    if (st == NULL) {
+        return NULL;
+    }
+
+    ngx_memzero(st, sizeof(ngx_http_waf_dfa_state_t));
+
+    st->next = (ngx_http_waf_dfa_state_t **) (st + 1);
+    st->kernel = (uint32_t *) (st->next + dfa->ncls);
+    st->out = st->kernel + n;
+    st->nkernel = n;
+    st->hash = hash;
+
+    ngx_memzero(st->next, dfa->ncls * sizeof(ngx_http_waf_dfa_state_t *));
+    ngx_memcpy(st->kernel, dfa->work, n * sizeof(uint32_t));
+
+    // the matched rules: acc, end and nl.
+    a = e = l = 0;
+    for (i = 0; i < n; i++) {
+        in = &dfa->insts[st->kernel[i]];
+
+        switch (in->op) {
+        case NGX_HTTP_WAF_NFA_MATCH:
+            a++;
+            break;
+        case NGX_HTTP_WAF_NFA_EOL:
+            l++;
+            break;
+        case NGX_HTTP_WAF_NFA_EOS:
+            e++;
+            break;
+        }
+    }
+
+    st->nacc = a;
+    st->nend = e + l;
+    st->nnl = l;
+
+    // [acc][eos][eol], the eol rules end both lists.
+    out = st->out;
+    for (i = 0; i < n; i++) {
+        in = &dfa->insts[st->kernel[i]];
+
+        switch (in->op) {
+        case NGX_HTTP_WAF_NFA_MATCH:
+            out[--a] = in->x;
+            break;
+        case NGX_HTTP_WAF_NFA_EOS:
+            out[st->nacc + --e] = in->y;
+            break;
+        case NGX_HTTP_WAF_NFA_EOL:
+            out[st->nacc + st->nend - st->nnl + --l] = in->y;
+            break;
+        }
+    }
+
+    st->hnext = *b;
+    *b = st;
+    st->link = dfa->states;
+    dfa->states = st;
+    dfa->size += size;
+
+    return st;
+}
+
+
+static ngx_http_waf_dfa_state_t *
+ngx_http_waf_dfa_start(ngx_http_waf_dfa_t *dfa)
+{
+    ngx_uint_t  i, n, linkable;
+
+    ngx_http_waf_dfa_gen(dfa);
+
+    n = 0;
+    for (i = 0; i < dfa->nrules; i++) {
+        n = ngx_http_waf_dfa_closure(dfa, dfa->starts[i], n, 1);
+    }
+
+    linkable = 1;
+    dfa->start = ngx_http_waf_dfa_state(dfa, n, &linkable);
+
+    return dfa->start;
+}
+
+
+static ngx_http_waf_dfa_state_t *
+ngx_http_waf_dfa_next(ngx_http_waf_dfa_t *dfa, ngx_http_waf_dfa_state_t *st,
+    ngx_uint_t c)
+{
+    u_char                     b;
+    ngx_uint_t                 i, n, linkable;
+    ngx_http_waf_nfa_inst_t   *in;
+    ngx_http_waf_dfa_state_t  *next;
+
+    b = dfa->rep[c];
+
+    ngx_http_waf_dfa_gen(dfa);
+
+    n = 0;
+    for (i = 0; i < st->nkernel; i++) {
+        in = &dfa->insts[st->kernel[i]];
+
+        if (in->op == NGX_HTTP_WAF_NFA_SET
+            && ngx_http_waf_re_set_has(in->set, b))
+        {
+            n = ngx_http_waf_dfa_closure(dfa, in->x, n, 0);
+        }
+    }
+
+    // unanchored, every rule starts again.
+    for (i = 0; i < dfa->nrules; i++) {
+        n = ngx_http_waf_dfa_closure(dfa, dfa->starts[i], n, 0);
+    }
+
+    linkable = 1;
+    next = ngx_http_waf_dfa_state(dfa, n, &linkable);
+
+    if (next != NULL && linkable) {
+        st->next[c] = next;
+    }
+
+    return next;
+}
+
+
+static ngx_uint_t
+ngx_http_waf_dfa_hits(u_char *hits, uint32_t *rules, ngx_uint_t n,
+    ngx_uint_t left)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < n; i++) {
+        if (!ngx_http_waf_hit(hits, rules[i])) {
+            ngx_http_waf_set_hit(hits, rules[i]);
+            left--;
+        }
+    }
+
+    return left;
+}
+
+
+static void
+ngx_http_waf_dfa_exec(ngx_http_waf_matcher_t *m, ngx_str_t *s, ngx_str_t *lc,
+    u_char *hits)
+{
+    u_char                       *p, *e;
+    ngx_uint_t                    left;
+    ngx_http_waf_dfa_t           *dfa;
+    ngx_http_waf_dfa_state_t     *st, *next;
+
+    dfa = m->data;
+    left = dfa->nrules;
+
+    st = dfa->start;
+    if (st == NULL) {
+        st = ngx_http_waf_dfa_start(dfa);
+        if (st == NULL) {
+            goto failed;
+        }
+    }
+
+    if (st->nacc) {
+        left = ngx_http_waf_dfa_hits(hits, st->out, st->nacc, left);
+    }
+
+    p = s->data;
+    e = s->data + s->len;
+
+    for (/* void */; p < e && left > 0; p++) {
+        // $ before the last newline
+        if (p + 1 == e && *p == '\n' && st->nnl) {
+            left = ngx_http_waf_dfa_hits(hits,
+                st->out + st->nacc + st->nend - st->nnl, st->nnl, left);
+        }
+
+        next = st->next[dfa->cls[*p]];
+        if (next == NULL) {
+            next = ngx_http_waf_dfa_next(dfa, st, dfa->cls[*p]);
+            if (next == NULL) {
+                goto failed;
+            }
+        }
+
+        st = next;
+
+        if (st->nacc) {
+            left = ngx_http_waf_dfa_hits(hits, st->out, st->nacc, left);
+        }
+    }
+
+    if (p == e && st->nend) {
+        (void) ngx_http_waf_dfa_hits(hits, st->out + st->nacc, st->nend,
+            left);
+    }
+
+    return;
+
+failed:
+
+    // no memory for the states.
+    ngx_http_waf_matcher_exec_rules(m, s, lc, hits);
+}
+
+
+// the ends are the rules matched if the value ends with the chunk, they
+// hit with the last one.
+static ngx_int_t
+ngx_http_waf_dfa_stream(ngx_pool_t *pool, ngx_http_waf_stream_t *ss,
+    u_char *p, u_char *e, ngx_uint_t last)
+{
+    size_t                      n;
+    ngx_str_t                   s;
+    ngx_uint_t                  i, linkable;
+    ngx_http_waf_dfa_t         *dfa;
+    ngx_http_waf_dfa_state_t   *st, *next;
+    ngx_http_waf_dfa_stream_t  *ds;
+
+    dfa = ss->matcher->data;
+    ds = ss->data;
+    n = (dfa->nrules + 7) / 8;
+
+    s.data = p;
+    s.len = e - p;
+
+    if (ds == NULL) {
+        ds = ngx_palloc(pool, sizeof(ngx_http_waf_dfa_stream_t));
+        if (ds == NULL) {
+            return NGX_ERROR;
+        }
+
+        ds->kernel = ngx_pnalloc(pool, dfa->ninsts * sizeof(uint32_t));
+        ds->ends = ngx_pnalloc(pool, n);
+        if (ds->kernel == NULL || ds->ends == NULL) {
+            return NGX_ERROR;
+        }
+
+        ss->data = ds;
+    }
+
+    if (!ss->started) {
+        ss->started = 1;
+        ds->failed = 0;
+        ds->left = dfa->nrules;
+        ngx_memzero(ds->ends, n);
+
+        st = dfa->start;
+        if (st == NULL) {
+            st = ngx_http_waf_dfa_start(dfa);
+            if (st == NULL) {
+                goto failed;
+            }
+        }
+
+        if (st->nacc) {
+            ds->left = ngx_http_waf_dfa_hits(ss->hits, st->out, st->nacc,
+                                             ds->left);
+        }
+
+    } else if (ds->failed) {
+        goto failed;
+
+    } else if (ds->flushes == dfa->flushes) {
+        st = ds->st;
+
+    } else {
+        ngx_memcpy(dfa->work, ds->kernel, ds->nkernel * sizeof(uint32_t));
+
+        linkable = 1;
+        st = ngx_http_waf_dfa_state(dfa, ds->nkernel, &linkable);
+        if (st == NULL) {
+            goto failed;
+        }
+    }
+
+    if (p < e && ds->left > 0) {
+        ngx_memzero(ds->ends, n);
+
+        for (/* void */; p < e && ds->left > 0; p++) {
+            // $ before the last newline
+            if (p + 1 == e && *p == '\n' && st->nnl) {
+                (void) ngx_http_waf_dfa_hits(ds->ends,
+                    st->out + st->nacc + st->nend - st->nnl, st->nnl,
+                    dfa->nrules);
+            }
+
+            next = st->next[dfa->cls[*p]];
+            if (next == NULL) {
+                next = ngx_http_waf_dfa_next(dfa, st, dfa->cls[*p]);
+                if (next == NULL) {
+                    goto failed;
+                }
+            }
+
+            st = next;
+
+            if (st->nacc) {
+                ds->left = ngx_http_waf_dfa_hits(ss->hits, st->out,
+                                                 st->nacc, ds->left);
+            }
+        }
+
+        if (p == e && st->nend) {
+            (void) ngx_http_waf_dfa_hits(ds->ends, st->out + st->nacc,
+                                         st->nend, dfa->nrules);
+        }
+    }
+
+    ds->st = st;
+    ds->flushes = dfa->flushes;
+    ds->nkernel = st->nkernel;
+    ngx_memcpy(ds->kernel, st->kernel, st->nkernel * sizeof(uint32_t));
+
+    if (last) {
+        for (i = 0; i < n; i++) {
+            ss->hits[i] |= ds->ends[i];
+        }
+    }
+
+    return NGX_OK;
+
+failed:
+
+    // no memory for the states, the rules match the chunk.
+    ds->failed = 1;
+
+    ngx_http_waf_matcher_exec_rules(ss->matcher, &s, &s, ss->hits);
+
+    return NGX_OK;
+}
+
+// the start state and its transitions are built before the first request.
+static ngx_int_t
+ngx_http_waf_dfa_init_process(ngx_cycle_t *cycle, ngx_http_waf_matcher_t *m)
+{
+    ngx_uint_t                  c;
+    ngx_http_waf_dfa_t         *dfa;
+    ngx_http_waf_dfa_state_t   *st;
+
+    dfa = m->data;
+
+    st = dfa->start;
+    if (st == NULL) {
+        st = ngx_http_waf_dfa_start(dfa);
+        if (st == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    for (c = 0; c < dfa->ncls; c++) {
+        if (st->next[c] == NULL && ngx_http_waf_dfa_next(dfa, st, c) == NULL) {
+            return NGX_ERROR;
+        }
+
+        // the cache is flushed.
+        if (dfa->start != st) {
+            return NGX_OK;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+// the rx@ rules left to pcre are prefiltered by their required literals,
+// one scan of the field for all of them.
+static ngx_int_t
+ngx_http_waf_prefilter_able(ngx_http_waf_public_rule_t *pr)
+{
+    return pr->handler == ngx_http_waf_rule_str_rx_handler && !pr->not
+        && pr->re != NULL && pr->re->lits != NULL;
+}
+
+
+static ngx_int_t
+ngx_http_waf_prefilter_compile(ngx_conf_t *cf, ngx_http_waf_matcher_t *m)
+{
+    uint32_t                     *ids;
+    ngx_str_t                    *strs, *lits;
+    ngx_uint_t                    i, k, n;
+    ngx_http_waf_public_rule_t  **prs;
+
+    prs = m->rules.elts;
+
+    n = 0;
+    for (i = 0; i < m->rules.nelts; i++) {
+        n += prs[i]->re->lits->nelts;
+    }
+
+    strs = ngx_pnalloc(cf->temp_pool, n * sizeof(ngx_str_t));
+    ids = ngx_pnalloc(cf->temp_pool, n * sizeof(uint32_t));
+    if (strs == NULL || ids == NULL) {
+        return NGX_ERROR;
+    }
+
+    n = 0;
+    for (i = 0; i < m->rules.nelts; i++) {
+        lits = prs[i]->re->lits->elts;
+        for (k = 0; k < prs[i]->re->lits->nelts; k++) {
+            strs[n] = lits[k];
+            ids[n++] = i;
+        }
+    }
+
+    m->data = ngx_http_waf_ac_build(cf, strs, ids, n);
+    if (m->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+
+#if (NGX_HTTP_WAF_HYPERSCAN)
+
+// -- hyperscan -----
+// the block mode database of the str:ct@ and str:rx@ rules.
+// the scratch is allocated once per worker for all databases.
+static hs_scratch_t  *ngx_http_waf_hs_scratch;
+
+
+static ngx_int_t
+ngx_http_waf_hs_able(ngx_http_waf_public_rule_t *pr)
+{
+    return ngx_http_waf_ac_able(pr) || ngx_http_waf_dfa_able(pr);
+}
+
+
+static void
+ngx_http_waf_hs_cleanup(void *data)
+{
+    hs_free_database(data);
+}
+
+
+static ngx_int_t
+ngx_http_waf_hs_compile(ngx_conf_t *cf, ngx_http_waf_matcher_t *m)
+{
+    u_char                       *p;
+    char                        **exprs;
+    ngx_uint_t                    i, k, n;
+    unsigned int                 *flags, *ids;
+    hs_database_t                *db;
+    hs_compile_error_t           *err;
+    ngx_pool_cleanup_t           *cln;
+    ngx_http_waf_public_rule_t  **prs;
+
+    static u_char  hex[] = "0123456789abcdef";
+
+    prs = m->rules.elts;
+    n = m->rules.nelts;
+
+    exprs = ngx_pnalloc(cf->temp_pool, n * sizeof(char *));
+    flags = ngx_pnalloc(cf->temp_pool, n * sizeof(unsigned int));
+    ids = ngx_pnalloc(cf->temp_pool, n * sizeof(unsigned int));
+    if (exprs == NULL || flags == NULL || ids == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < n; i++) {
+        ids[i] = (unsigned int) i;
+        flags[i] = HS_FLAG_CASELESS|HS_FLAG_SINGLEMATCH;
+
+        if (prs[i]->handler == ngx_http_waf_rule_str_rx_handler) {
+            // str is null terminated.
+            exprs[i] = (char *) prs[i]->str.data;
+            flags[i] |= HS_FLAG_ALLOWEMPTY;
+            continue;
+        }
+
+        // the literal, \xHH...
+        p = ngx_pnalloc(cf->temp_pool, prs[i]->str.len * 4 + 1);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        exprs[i] = (char *) p;
+        for (k = 0; k < prs[i]->str.len; k++) {
+            *p++ = '\\';
+            *p++ = 'x';
+            *p++ = hex[prs[i]->str.data[k] >> 4];
+            *p++ = hex[prs[i]->str.data[k] & 0xf];
+        }
+        *p = '\0';
+    }
+
+    if (hs_compile_multi((const char * const *) exprs, flags, ids,
+            (unsigned int) n, HS_MODE_BLOCK, NULL, &db, &err)
+        != HS_SUCCESS)
+    {
+        if (err->expression >= 0) {
+            ngx_conf_log_error(NGX_LOG_NOTICE, cf, 0,
+                "hyperscan declined rule id:%i, %s",
+                prs[err->expression]->id, err->message);
+        } else {
+            ngx_conf_log_error(NGX_LOG_NOTICE, cf, 0,
+                "hyperscan declined %ui rules, %s", n, err->message);
+        }
+
+        hs_free_compile_error(err);
+        return NGX_DECLINED;
+    }
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        hs_free_database(db);
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_http_waf_hs_cleanup;
+    cln->data = db;
+
+    m->data = db;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_waf_hs_init_process(ngx_cycle_t *cycle, ngx_http_waf_matcher_t *m)
+{
+    // the scratch grows to fit every database.
+    if (hs_alloc_scratch(m->data, &ngx_http_waf_hs_scratch) != HS_SUCCESS) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, 0,
+            "hyperscan alloc scratch failed");
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static int
+ngx_http_waf_hs_on_match(unsigned int id, unsigned long long from,
+    unsigned long long to, unsigned int flags, void *ctx)
+{
+    ngx_http_waf_set_hit((u_char *) ctx, id);
+
+    return 0;
+}
+
+
+static void
+ngx_http_waf_hs_exec(ngx_http_waf_matcher_t *m, ngx_str_t *s, ngx_str_t *lc,
+    u_char *hits)
+{
+    if (ngx_http_waf_hs_scratch == NULL
+        || hs_scan(m->data, (const char *) s->data, (unsigned int) s->len, 0,
+                   ngx_http_waf_hs_scratch, ngx_http_waf_hs_on_match, hits)
+           != HS_SUCCESS)
+    {
+        ngx_http_waf_matcher_exec_rules(m, s, lc, hits);
+    }
+}
+
+#endif
+
+
+// the same rules in other location have been compiled.
+static ngx_http_waf_matcher_t *
+ngx_http_waf_matcher_lookup(ngx_array_t *matchers, ngx_http_waf_matcher_t *m)
+{
+    ngx_uint_t                i;
+    ngx_http_waf_matcher_t  **ms;
+
+    if (matchers == NULL) {
+        return NULL;
+    }
+
+    ms = matchers->elts;
+    for (i = 0; i < matchers->nelts; i++) {
+        if (ms[i]->engine == m->engine
+            && ms[i]->rules.nelts == m->rules.nelts
+            && ngx_memcmp(ms[i]->rules.elts, m->rules.elts,
+                m->rules.nelts * sizeof(ngx_http_waf_public_rule_t *)) == 0)
+        {
+            return ms[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+static ngx_http_waf_engine_t  ngx_http_waf_engines[] = {
+#if (NGX_HTTP_WAF_HYPERSCAN)
+    { ngx_string("hyperscan"), 1, ngx_http_waf_hs_able,
+      ngx_http_waf_hs_compile, ngx_http_waf_hs_exec,
+      ngx_http_waf_hs_init_process, 0, NULL },
+#endif
+
+    { ngx_string("hash"), 2, ngx_http_waf_eq_able,
+      ngx_http_waf_eq_compile, ngx_http_waf_eq_exec, NULL, 0, NULL },
+
+    { ngx_string("prefix-trie"), 2, ngx_http_waf_sw_able,
+      ngx_http_waf_sw_compile, ngx_http_waf_sw_exec, NULL, 0, NULL },
+
+    { ngx_string("suffix-trie"), 2, ngx_http_waf_ew_able,
+      ngx_http_waf_ew_compile, ngx_http_waf_ew_exec, NULL, 0, NULL },
+
+    // a field is digested once, even for one rule of a feed.
+    { ngx_string("hash-set"), 1, ngx_http_waf_digests_able,
+      ngx_http_waf_digests_compile, ngx_http_waf_digests_exec, NULL, 0, NULL },
+
+    { ngx_string("aho-corasick"), 2, ngx_http_waf_ac_able,
+      ngx_http_waf_ac_compile, ngx_http_waf_ac_exec, NULL, 0, NULL },
+
+    // the dfa is linear, even for one rule.
+    { ngx_string("dfa"), 1, ngx_http_waf_dfa_able,
+      ngx_http_waf_dfa_compile, ngx_http_waf_dfa_exec,
+      ngx_http_waf_dfa_init_process, 0, NULL },
+
+    { ngx_string("prefilter"), 1, ngx_http_waf_prefilter_able,
+      ngx_http_waf_prefilter_compile, ngx_http_waf_ac_exec, NULL, 1,
+      NULL },
+
+    { ngx_null_string, 0, NULL, NULL, NULL, NULL, 0, NULL }
+};
+
+
+// the engines of the values matched by chunks, e.g. the raw body.
+static ngx_http_waf_engine_t  ngx_http_waf_stream_engines[] = {
+    { ngx_string("aho-corasick"), 1, ngx_http_waf_ac_able,
+      ngx_http_waf_ac_compile, ngx_http_waf_ac_exec, NULL, 0,
+      ngx_http_waf_ac_stream },
+
+    { ngx_string("dfa"), 1, ngx_http_waf_dfa_able,
+      ngx_http_waf_dfa_compile, ngx_http_waf_dfa_exec,
+      ngx_http_waf_dfa_init_process, 0, ngx_http_waf_dfa_stream },
+
+    // the digests are finished with the value.
+    { ngx_string("hash-set"), 1, ngx_http_waf_digests_able,
+      ngx_http_waf_digests_compile, ngx_http_waf_digests_exec, NULL, 0,
+      ngx_http_waf_digests_stream },
+
+    { ngx_null_string, 0, NULL, NULL, NULL, NULL, 0, NULL }
+};
+
+
+// the rules keep their order, the matcher only replaces the handler.
+static ngx_int_t
+ngx_http_waf_compile_matcher(ngx_conf_t *cf, ngx_http_waf_loc_conf_t *wlcf,
+    ngx_array_t *a, ngx_http_waf_engine_t *t)
+{
+    u_char                        *declined;
+    ngx_int_t                      rc;
+    ngx_uint_t                     i, j, n;
+    ngx_http_waf_rule_t           *rules;
+    ngx_http_waf_matcher_t        *m, *cm, **pm;
+    ngx_http_waf_main_conf_t      *wmcf;
+    ngx_http_waf_public_rule_t   **pr;
+
+    wmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_waf_module);
+
+    declined = ngx_pcalloc(cf->temp_pool, a->nelts + 1);
+    if (declined == NULL) {
+        return NGX_ERROR;
+    }
+
+#define ngx_http_waf_matcher_take(i, j)                                       \
+    (rules[j].matcher == NULL && !declined[j] && t->able(rules[j].p_rule)     \
+     && ngx_http_waf_decode_equal(rules[i].p_rule->decode_handlers,           \
+                                  rules[j].p_rule->decode_handlers))
+
+    rules = a->elts;
+    for (i = 0; i < a->nelts; i++) {
+        if (!ngx_http_waf_matcher_take(i, i)) {
+            continue;
+        }
+
+        n = 0;
+        for (j = i; j < a->nelts; j++) {
+            if (ngx_http_waf_matcher_take(i, j)) {
+                n++;
+            }
+        }
+
+        if (n < t->min) {
+            continue;
+        }
+
+        m = ngx_pcalloc(cf->pool, sizeof(ngx_http_waf_matcher_t));
+        if (m == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (ngx_array_init(&m->rules, cf->pool, n,
+            sizeof(ngx_http_waf_public_rule_t *)) != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        for (j = i; j < a->nelts; j++) {
+            if (ngx_http_waf_matcher_take(i, j)) {
+                pr = ngx_array_push(&m->rules);
+                if (pr == NULL) {
+                    return NGX_ERROR;
+                }
+
+                *pr = rules[j].p_rule;
+                rules[j].matcher = m;
+                rules[j].mid = m->rules.nelts - 1;
+
+                if (rules[j].p_rule->lower) {
+                    m->lower = 1;
+                }
+            }
+        }
+
+        m->engine = t;
+
+        // the class maps of the automata fold the case themselves.
+        if (t->exec == ngx_http_waf_ac_exec || t->exec == ngx_http_waf_sw_exec
+            || t->exec == ngx_http_waf_ew_exec)
+        {
+            m->lower = 0;
+        }
+
+        // the same rules in other location.
+        cm = ngx_http_waf_matcher_lookup(wmcf->matchers, m);
+        if (cm != NULL) {
+            m->data = cm->data;
+            rc = (m->data != NULL) ? NGX_OK : NGX_DECLINED;
+
+        } else {
+            rc = t->compile(cf, m);
+            if (rc == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+
+            if (wmcf->matchers == NULL) {
+                wmcf->matchers = ngx_array_create(cf->pool, 4,
+                    sizeof(ngx_http_waf_matcher_t *));
+                if (wmcf->matchers == NULL) {
+                    return NGX_ERROR;
+                }
+            }
+
+            // the declined one is kept too, its data is null.
+            pm = ngx_array_push(wmcf->matchers);
+            if (pm == NULL) {
+                return NGX_ERROR;
+            }
+            *pm = m;
+        }
+
+        if (rc == NGX_DECLINED) {
+            m->data = NULL;
+
+            for (j = i; j < a->nelts; j++) {
+                if (rules[j].matcher == m) {
+                    rules[j].matcher = NULL;
+                    declined[j] = 1;
+                }
+            }
+
+            continue;
+        }
+
+        m->idx = wlcf->nmatchers++;
+    }
+
+#undef ngx_http_waf_matcher_take
+
+    return NGX_OK;
+}
+
+
+// compile the str:eq@, sw@, ew@, ct@, rx@ and hash: rules of the zone array.
+static ngx_int_t
+ngx_http_waf_compile_matchers(ngx_conf_t *cf, ngx_http_waf_loc_conf_t *wlcf,
+    ngx_array_t *a)
+{
+    ngx_uint_t               i;
+    ngx_http_waf_rule_t     *rules;
+    ngx_http_waf_engine_t   *t;
+
+    for (t = ngx_http_waf_engines; t->able != NULL; t++) {
+        if (ngx_http_waf_compile_matcher(cf, wlcf, a, t) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    rules = a->elts;
+    for (i = 0; i < a->nelts; i++) {
+        if (rules[i].p_rule->handler != ngx_http_waf_rule_str_rx_handler) {
+            continue;
+        }
+
+        if (rules[i].matcher == NULL) {
+            wlcf->nunfiltered++;
+
+        } else if (rules[i].matcher->engine->prefilter) {
+            wlcf->nprefiltered++;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+// the rules of a value matched by chunks carry the state of the automaton
+// over them. a rule no engine streams is moved to the whole value ones.
+static ngx_int_t
+ngx_http_waf_compile_streams(ngx_conf_t *cf, ngx_http_waf_loc_conf_t *wlcf,
+    ngx_array_t *a, ngx_array_t *whole)
+{
+    ngx_uint_t               i, n;
+    ngx_http_waf_rule_t     *rules, *rule;
+    ngx_http_waf_engine_t   *t;
+
+    for (t = ngx_http_waf_stream_engines; t->able != NULL; t++) {
+        if (ngx_http_waf_compile_matcher(cf, wlcf, a, t) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    n = 0;
+    rules = a->elts;
+
+    for (i = 0; i < a->nelts; i++) {
+        if (rules[i].matcher != NULL) {
+            rules[n++] = rules[i];
+            continue;
+        }
+
+        rule = ngx_array_push(whole);
+        if (rule == NULL) {
+            return NGX_ERROR;
+        }
+
+        *rule = rules[i];
+    }
+
+    a->nelts = n;
+
+    return NGX_OK;
+}
+
+
+// the rule is able to be matched by the chunks of the value.
+static ngx_flag_t
+ngx_http_waf_stream_able(ngx_http_waf_public_rule_t *pr)
+{
+    ngx_http_waf_engine_t  *t;
+
+    if (pr->decode != 0) {
+        return 0;
+    }
+
+    for (t = ngx_http_waf_stream_engines; t->able != NULL; t++) {
+        if (t->able(pr)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+// -- parse -----
+static ngx_int_t
+ngx_http_waf_merge_rule_array(ngx_conf_t *cf, const ngx_array_t *wl,
+    const ngx_array_t *checks, const ngx_array_t *prev, ngx_array_t **conf)
+{
+    ngx_uint_t                     i, j, k, n;
+    ngx_http_waf_rule_t           *prev_rules, *rule, *rules;
+    ngx_http_waf_zone_t           *zones;
+    ngx_http_waf_score_t          *ss;
+    ngx_http_waf_check_t          *cs, *c;
+    ngx_http_waf_whitelist_t      *wl_rule;
+
+    if (*conf == NULL) {
+        *conf = ngx_array_create(cf->pool, 10,
+            sizeof(ngx_http_waf_rule_t));
+
+        if (*conf == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    // local config rules size.
+    n = (*conf)->nelts;
+
+    // merge rule
+    if (prev != NULL) {
+        prev_rules = prev->elts;
+        for (i = 0; i < prev->nelts; i++) {
+            rule = ngx_array_push(*conf);
+            if (rule == NULL) {
+                return NGX_ERROR;
+            }
+
+            ngx_memzero(rule, sizeof(ngx_http_waf_rule_t));
+
+            rule->p_rule = prev_rules[i].p_rule;
+            rule->m_zone = prev_rules[i].m_zone;
+        }
+    }
+
+    // add whitelist zones
+    // flag the scores
+    rules = (*conf)->elts;
+    for (i = 0; i < (*conf)->nelts; i++) {
+        rule = &rules[i];
+
+        wl_rule = NULL;
+        if (i >= n) {
+            // location config rule don't match whitelist.
+            wl_rule = ngx_http_waf_search_whitelist(wl, rule->p_rule->id);
+        }
+
+        // add whitelist zones
+        if (wl_rule != NULL) {
+            if (wl_rule->all_zones) {
+                ngx_http_waf_rule_set_wl_invalid(rule->sts);
+            } else {
+                for (j = 0; ngx_http_waf_conf_add_wl[j].flag != 0; j++) {
+
+                    if (rule->m_zone->flag & ngx_http_waf_conf_add_wl[j].flag) {
+
+                        rule->wl_zones = *((ngx_array_t**)((char*)wl_rule
+                            + ngx_http_waf_conf_add_wl[j].offset));
+                        if (rule->wl_zones == NULL
+                            || rule->wl_zones->nelts == 0)
+                        {
+                            break;
+                        }
+
+                        zones = rule->wl_zones->elts;
+                        for (k = 0; k < rule->wl_zones->nelts; k++) {
+                            if (zones[k].regex != NULL) {
+                                continue;
+                            }
+
+                            if (ngx_http_waf_wl_mz(&zones[k],
+                                rule->m_zone))
+                            {
+                                ngx_http_waf_wl_copy_mz(rule->sts,
+                                    zones[k].flag);
+                                continue;
+                            }
+
+                            if (ngx_http_waf_mz_ge(&zones[k], rule->m_zone)) {
+                                ngx_http_waf_rule_set_wl_invalid(rule->sts);
+                                break;
+                            }
+                        }
+
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (ngx_http_waf_rule_invalid(rule->sts)) {
+            continue;
+        }
+
+        // socres
+        if (rule->p_rule->scores == NULL || rule->p_rule->scores->nelts == 0) {
+            ngx_http_waf_sts_act_set_block(rule->sts);
+            continue;
+        }
+
+        if (checks == NULL || checks->nelts == 0) {
+            ngx_http_waf_rule_set_sc_invalid(rule->sts);
+            continue;
         }
 
         rule->score_checks = ngx_array_create(cf->pool, 1,
             sizeof(ngx_http_waf_check_t));
-        if (rule->score_checks == NULL) {
+        if (rule->score_checks == NULL) {
+            return NGX_ERROR;
+        }
+
+        ss = rule->p_rule->scores->elts;
+        for (j = 0; j < rule->p_rule->scores->nelts; j++) {
+
+            cs = checks->elts;
+            for (k = 0; k < checks->nelts; k++) {
+                if (cs[k].tag.len != ss[j].tag.len || ngx_strncmp(
+                    cs[k].tag.data, ss[j].tag.data, cs[k].tag.len) != 0)
+                {
+                    continue;
+                }
+
+                c = ngx_array_push(rule->score_checks);
+                if (c == NULL) {
+                    return NGX_ERROR;
+                }
+
+                c->idx = cs[k].idx;
+                c->tag = cs[k].tag;
+                c->threshold = cs[k].threshold;
+                c->action_flag = cs[k].action_flag;
+                c->score = ss[j].score;
+
+                break;
+            }
+        }
+
+        if (rule->score_checks == NULL || rule->score_checks->nelts == 0) {
+            ngx_http_waf_rule_set_sc_invalid(rule->sts);
+        }
+
+    }
+
+    return NGX_OK;
+}
+
+
+#if 0
+static char *
+ngx_http_waf_init_main_conf(ngx_conf_t *cf, void *conf)
+{
+    ngx_http_waf_main_conf_t  *wmcf = conf;
+
+    if (wmcf->whitelists == NULL) {
+        return NGX_CONF_OK;
+    }
+
+    // quick sort the whitelist array
+    ngx_qsort(wmcf->whitelists->elts, (size_t)wmcf->whitelists->nelts,
+        sizeof(ngx_http_waf_whitelist_t), ngx_http_waf_cmp_whitelist_id);
+
+    return NGX_CONF_OK;
+}
+#endif
+
+
+/*
+ * 白名单不会继承
+ * 基础规则会继承并合并
+ */
+static char *
+ngx_http_waf_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_waf_loc_conf_t    *prev = parent;
+    ngx_http_waf_loc_conf_t    *conf = child;
+    ngx_http_waf_main_conf_t   *wmcf;
+    ngx_http_core_loc_conf_t   *clcf;
+    ngx_array_t                *pr_array;  /* parent rules */
+
+    // NGX_CONF_UNSET
+    ngx_conf_merge_uint_value(conf->regex_limit_action,
+                              prev->regex_limit_action,
+                              NGX_HTTP_WAF_REGEX_LIMIT_CLOSED);
+
+    ngx_conf_merge_value(conf->security_waf, prev->security_waf, 0);
+    if (1 != conf->security_waf) {
+        conf->security_waf = 0;
+        return NGX_CONF_OK;
+    }
+
+    ngx_conf_merge_msec_value(conf->security_timeout,
+                              prev->security_timeout, 60000);
+
+    ngx_conf_merge_uint_value(conf->body_depth_limit,
+                              prev->body_depth_limit, 32);
+    ngx_conf_merge_uint_value(conf->body_key_limit,
+                              prev->body_key_limit, 4096);
+
+#if (NGX_THREADS)
+    ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, NULL);
+#endif
+
+    wmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_waf_module);
+    if (wmcf == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (conf->whitelists == NULL) conf->whitelists = prev->whitelists;
+    if (conf->whitelists != NULL) {
+        ngx_qsort(conf->whitelists->elts, (size_t)conf->whitelists->nelts,
+            sizeof(ngx_http_waf_whitelist_t), ngx_http_waf_cmp_whitelist_id);
+    }
+
+    if (conf->check_rules == NULL) conf->check_rules = prev->check_rules;
+
+    pr_array = wmcf->url;
+    if (prev->url != NULL) {
+        pr_array = prev->url;
+    }
+
+    if (ngx_http_waf_merge_rule_array(cf, conf->whitelists, conf->check_rules,
+        pr_array, &conf->url) != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_http_waf_compile_matchers(cf, conf, conf->url) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    pr_array = wmcf->url_var;
+    if (prev->url_var != NULL) {
+        pr_array = prev->url_var;
+    }
+
+    if (ngx_http_waf_merge_rule_array(cf, conf->whitelists, conf->check_rules,
+        pr_array, &conf->url_var) != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_http_waf_compile_matchers(cf, conf, conf->url_var) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_http_waf_vars_in_hash(cf, conf->url_var,
+        &conf->url_var_hash) != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    pr_array = wmcf->args;
+    if (prev->args != NULL) {
+        pr_array = prev->args;
+    }
+
+    if (ngx_http_waf_merge_rule_array(cf, conf->whitelists, conf->check_rules,
+        pr_array, &conf->args) != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_http_waf_compile_matchers(cf, conf, conf->args) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    pr_array = wmcf->args_var;
+    if (prev->args_var != NULL) {
+        pr_array = prev->args_var;
+    }
+
+    if (ngx_http_waf_merge_rule_array(cf, conf->whitelists, conf->check_rules,
+        pr_array, &conf->args_var) != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_http_waf_compile_matchers(cf, conf, conf->args_var) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_http_waf_vars_in_hash(cf, conf->args_var,
+        &conf->args_var_hash) != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    pr_array = wmcf->headers;
+    if (prev->headers != NULL) {
+        pr_array = prev->headers;
+    }
+
+    if (ngx_http_waf_merge_rule_array(cf, conf->whitelists, conf->check_rules,
+        pr_array, &conf->headers) != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_http_waf_compile_matchers(cf, conf, conf->headers) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    pr_array = wmcf->headers_var;
+    if (prev->headers_var != NULL) {
+        pr_array = prev->headers_var;
+    }
+
+    if (ngx_http_waf_merge_rule_array(cf, conf->whitelists, conf->check_rules,
+        pr_array, &conf->headers_var) != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_http_waf_compile_matchers(cf, conf, conf->headers_var) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_http_waf_vars_in_hash(cf, conf->headers_var,
+        &conf->headers_var_hash) != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    pr_array = wmcf->body;
+    if (prev->body != NULL) {
+        pr_array = prev->body;
+    }
+
+    if (ngx_http_waf_merge_rule_array(cf, conf->whitelists, conf->check_rules,
+        pr_array, &conf->body) != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_http_waf_compile_matchers(cf, conf, conf->body) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    pr_array = wmcf->raw_body;
+    if (prev->raw_body != NULL) {
+        pr_array = prev->raw_body;
+    }
+
+    if (ngx_http_waf_merge_rule_array(cf, conf->whitelists, conf->check_rules,
+        pr_array, &conf->raw_body) != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    pr_array = wmcf->raw_body_stream;
+    if (prev->raw_body_stream != NULL) {
+        pr_array = prev->raw_body_stream;
+    }
+
+    if (ngx_http_waf_merge_rule_array(cf, conf->whitelists, conf->check_rules,
+        pr_array, &conf->raw_body_stream) != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_http_waf_compile_streams(cf, conf, conf->raw_body_stream,
+                                     conf->raw_body)
+        != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_http_waf_compile_matchers(cf, conf, conf->raw_body) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    pr_array = wmcf->body_var;
+    if (prev->body_var != NULL) {
+        pr_array = prev->body_var;
+    }
+
+    if (ngx_http_waf_merge_rule_array(cf, conf->whitelists, conf->check_rules,
+        pr_array, &conf->body_var) != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_http_waf_compile_matchers(cf, conf, conf->body_var) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_http_waf_vars_in_hash(cf, conf->body_var,
+        &conf->body_var_hash) != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    pr_array = wmcf->body_file;
+    if (prev->body_file != NULL) {
+        pr_array = prev->body_file;
+    }
+
+    if (ngx_http_waf_merge_rule_array(cf, conf->whitelists, conf->check_rules,
+        pr_array, &conf->body_file) != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    pr_array = wmcf->body_file_stream;
+    if (prev->body_file_stream != NULL) {
+        pr_array = prev->body_file_stream;
+    }
+
+    if (ngx_http_waf_merge_rule_array(cf, conf->whitelists, conf->check_rules,
+        pr_array, &conf->body_file_stream) != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_http_waf_compile_streams(cf, conf, conf->body_file_stream,
+                                     conf->body_file)
+        != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_http_waf_compile_matchers(cf, conf, conf->body_file) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (conf->nprefiltered || conf->nunfiltered) {
+        clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+
+        ngx_conf_log_error(NGX_LOG_NOTICE, cf, 0,
+            "location \"%V\" rx@ rules by pcre: %ui prefiltered, "
+            "%ui unfiltered", &clcf->name, conf->nprefiltered,
+            conf->nunfiltered);
+    }
+
+    if (conf->log != NULL) {
+        return NGX_CONF_OK;
+    }
+
+    conf->log = prev->log;
+
+    return NGX_CONF_OK;
+}
+
+
+// the same decode chains of the rules get the same index, a request
+// decodes a field once per chain.
+static ngx_int_t
+ngx_http_waf_parse_rule_decodes(ngx_conf_t *cf, ngx_http_waf_public_rule_t *pr)
+{
+    ngx_uint_t                  i;
+    ngx_array_t               **chains, **chain;
+    ngx_http_waf_main_conf_t   *wmcf;
+
+    if (pr->decode_handlers->nelts == 0) {
+        return NGX_OK;
+    }
+
+    wmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_waf_module);
+
+    if (wmcf->decodes == NULL) {
+        wmcf->decodes = ngx_array_create(cf->pool, 4, sizeof(ngx_array_t *));
+        if (wmcf->decodes == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    chains = wmcf->decodes->elts;
+    for (i = 0; i < wmcf->decodes->nelts; i++) {
+        if (ngx_http_waf_decode_equal(chains[i], pr->decode_handlers)) {
+            pr->decode = i + 1;
+            return NGX_OK;
+        }
+    }
+
+    chain = ngx_array_push(wmcf->decodes);
+    if (chain == NULL) {
+        return NGX_ERROR;
+    }
+
+    *chain = pr->decode_handlers;
+    pr->decode = wmcf->decodes->nelts;
+
+    return NGX_OK;
+}
+
+
+// parse the rule item
+// include public rule and customer zones and whitelist.
+static ngx_int_t
+ngx_http_waf_parse_rule(ngx_conf_t *cf, ngx_http_waf_rule_opt_t *opt)
+{
+    ngx_int_t                    rc;
+    ngx_str_t                   *value;
+    ngx_flag_t                   vailid;
+    ngx_uint_t                   i, j;
+    ngx_http_waf_rule_parser_t  *parser;
+
+    value = cf->args->elts;
+
+    opt->p_rule = ngx_pcalloc(cf->pool, sizeof(ngx_http_waf_public_rule_t));
+    if (opt->p_rule == NULL) {
+        return NGX_ERROR;
+    }
+
+    opt->p_rule->decode_handlers = ngx_array_create(cf->pool, 2,
+        sizeof(ngx_http_waf_rule_decode_t *));
+    if (opt->p_rule->decode_handlers == NULL) {
+        return NGX_ERROR;
+    }
+
+    for(i = 1; i < cf->args->nelts; i++) {
+        vailid = 0;
+        for (j = 0; ngx_http_waf_rule_parser_item[j].prefix.data != NULL; j++) {
+            parser = &ngx_http_waf_rule_parser_item[j];
+            if (ngx_strncmp(value[i].data, parser->prefix.data,
+                parser->prefix.len) == 0) {
+                vailid = 1;
+                rc = parser->handler(cf, &value[i], parser, opt);
+                if (rc != NGX_OK) {
+                    return rc;
+                }
+            }
+        }
+
+        if (!vailid) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid arguments \"%s\" in \"%s\" directive",
+                               value[i].data, value[0].data);
+            return NGX_ERROR;
+        }
+    }
+
+    if (ngx_http_waf_parse_rule_decodes(cf, opt->p_rule) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (opt->match_limit || opt->depth_limit) {
+        if (opt->p_rule->regex == NULL) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"limit:\" needs a rx@ rule in \"%V\"",
+                               &value[0]);
+            return NGX_ERROR;
+        }
+
+        opt->p_rule->regex->match_limit = opt->match_limit;
+        opt->p_rule->regex->depth_limit = opt->depth_limit;
+    }
+
+    if (opt->p_rule->re != NULL) {
+        if (ngx_http_waf_dfa_able(opt->p_rule)) {
+            ngx_conf_log_error(NGX_LOG_NOTICE, cf, 0,
+                "rule id:%i rx@ is accelerated by dfa", opt->p_rule->id);
+        } else {
+            ngx_conf_log_error(NGX_LOG_NOTICE, cf, 0,
+                "rule id:%i rx@ is matched by pcre%s, %s", opt->p_rule->id,
+                ngx_http_waf_prefilter_able(opt->p_rule)
+                    ? " after its literals" : "",
+                opt->p_rule->not ? "negated" : opt->p_rule->re->pcre);
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_waf_add_rule_handler(ngx_conf_t *cf, ngx_http_waf_public_rule_t *pr,
+    ngx_http_waf_zone_t *mz, void *conf, ngx_uint_t offset)
+{
+    char  *p = conf;
+
+    ngx_array_t           **a;
+    ngx_http_waf_rule_t    *r;
+
+    // maybe the rule is whiterlist.
+    if (pr == NULL) {
+        return NGX_OK;
+    }
+
+    a = (ngx_array_t **)(p + offset);
+
+    if (*a == NULL) {
+        *a = ngx_array_create(cf->pool, 3, sizeof(ngx_http_waf_rule_t));
+        if (*a == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    r = ngx_array_push(*a);
+    if (r == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(r, sizeof(ngx_http_waf_rule_t));
+
+    r->m_zone = mz;
+    r->p_rule = pr;
+
+    return NGX_OK;
+}
+
+
+// the raw body and the file rules of an engine with the state over the
+// chunks are matched as the body arrives. the rest need the whole value,
+// e.g. the decoded, the pcre and the length rules.
+static ngx_int_t
+ngx_http_waf_add_stream_handler(ngx_conf_t *cf,
+    ngx_http_waf_public_rule_t *pr, ngx_http_waf_zone_t *mz,
+    void *conf, ngx_uint_t offset)
+{
+    if (pr != NULL && ngx_http_waf_stream_able(pr)) {
+        offset += sizeof(ngx_array_t *);
+    }
+
+    return ngx_http_waf_add_rule_handler(cf, pr, mz, conf, offset);
+}
+
+
+static ngx_int_t
+ngx_http_waf_add_wl_part_handler(ngx_conf_t *cf,
+    ngx_http_waf_zone_t *mz, void *wl, ngx_uint_t offset)
+{
+    char *p = wl;
+
+    ngx_array_t                **a;
+    ngx_http_waf_zone_t         *z;
+
+    a = (ngx_array_t **)(p + offset);
+
+    if (*a == NULL) {
+        *a = ngx_array_create(cf->pool, 2, sizeof(ngx_http_waf_zone_t));
+        if (*a == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    z = ngx_array_push(*a);
+    if (z == NULL) {
+        return NGX_ERROR;
+    }
+    *z = *mz;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_waf_add_whitelist(ngx_conf_t *cf, ngx_http_waf_rule_opt_t *opt,
+    ngx_array_t **a)
+{
+    ngx_int_t                   *id, rc;
+    ngx_flag_t                   vailid;
+    ngx_uint_t                   i, j, k;
+    ngx_http_waf_whitelist_t    *wl;
+    ngx_http_waf_zone_t         *zones;
+    ngx_http_waf_add_wl_part_t  *add_wl;
+
+    if (opt->wl_ids == NULL) return NGX_OK;
+
+    if (*a == NULL) {
+        *a = ngx_array_create(cf->pool, 3, sizeof(ngx_http_waf_whitelist_t));
+        if (*a == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    id = opt->wl_ids->elts;
+    for (i = 0; i < opt->wl_ids->nelts; i++) {
+        wl = ngx_array_push(*a);
+        if (wl == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memzero(wl, sizeof(ngx_http_waf_whitelist_t));
+
+        wl->id = id[i];
+        if (opt->m_zones == NULL || opt->m_zones->nelts == 0) {
+            wl->all_zones = 1;
+            continue;
+        }
+
+        zones = opt->m_zones->elts;
+        for (j = 0; j < opt->m_zones->nelts; j++) {
+            vailid = 0;
+            for (k = 0; ngx_http_waf_conf_add_wl[k].flag !=0; k++) {
+
+                add_wl = &ngx_http_waf_conf_add_wl[k];
+                if (!(zones[j].flag & add_wl->flag)) {
+                    continue;
+                }
+
+                vailid = 1;
+                rc = add_wl->handler(cf, &zones[j], wl, add_wl->offset);
+                if (rc != NGX_OK) {
+                    return NGX_ERROR;
+                }
+                break;
+            }
+
+            if (!vailid) {
+                 ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid whitelist zone");
+                 return NGX_ERROR;
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static char *
+ngx_http_waf_main_rule(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_int_t                        rc;
+    ngx_flag_t                       vailid;
+    ngx_uint_t                       i, j;
+    ngx_http_waf_main_conf_t        *wmcf = conf;
+    ngx_http_waf_rule_opt_t          opt;
+    ngx_http_waf_zone_t             *zone;
+
+    ngx_memzero(&opt, sizeof(ngx_http_waf_rule_opt_t));
+    if (ngx_http_waf_parse_rule(cf, &opt) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (opt.p_rule == NULL || opt.p_rule->id == 0) {
+        return "the rule error";
+    }
+
+    // http block is not allowed whitelist.
+    if (opt.wl_ids != NULL) {
+        return "the whitelist is not allowed here";
+    }
+
+    if (opt.m_zones == NULL || opt.m_zones->nelts == 0) {
+        return "the rule lack of zone";
+    }
+
+    zone = opt.m_zones->elts;
+    for (i = 0; i < opt.m_zones->nelts; i++) {
+        vailid = 0;
+        for (j = 0; ngx_http_waf_conf_add_rules[j].flag != 0; j++) {
+            if (!(ngx_http_waf_conf_add_rules[j].flag & zone[i].flag)) {
+                continue;
+            }
+
+            rc = ngx_http_waf_conf_add_rules[j].handler(cf, opt.p_rule,
+                &zone[i], wmcf, ngx_http_waf_conf_add_rules[j].offset);
+
+            if (rc != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+            vailid = 1;
+            break;
+        }
+
+        if (!vailid) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid mask zone \"%d\"", zone[i].flag);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_waf_loc_rule(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_int_t                        rc;
+    ngx_flag_t                       vailid;
+    ngx_uint_t                       i, j;
+    ngx_http_waf_loc_conf_t         *wlcf = conf;
+    ngx_http_waf_rule_opt_t          opt;
+    ngx_http_waf_zone_t             *zones;
+
+    ngx_memzero(&opt, sizeof(ngx_http_waf_rule_opt_t));
+    if (ngx_http_waf_parse_rule(cf, &opt) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (opt.wl_ids == NULL && opt.m_zones->nelts == 0) {
+        return "lack of zone";
+    }
+
+    // add whitelist
+    rc = ngx_http_waf_add_whitelist(cf, &opt, &wlcf->whitelists);
+    if (rc != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (opt.p_rule->id > 0) {
+
+        zones = opt.m_zones->elts;
+        for (i = 0; i < opt.m_zones->nelts; i++) {
+            vailid = 0;
+            for (j = 0; ngx_http_waf_conf_add_rules[j].flag != 0; j++) {
+                if (!(ngx_http_waf_conf_add_rules[j].flag & zones[i].flag)) {
+                    continue;
+                }
+
+                rc = ngx_http_waf_conf_add_rules[j].handler(cf, opt.p_rule,
+                    &zones[i], wlcf, ngx_http_waf_conf_add_rules[j].loc_offset);
+
+                if (rc != NGX_OK) {
+                    return NGX_CONF_ERROR;
+                }
+                vailid = 1;
+                break;
+            }
+
+            if (!vailid) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid mask zone \"%d\"", zones[i].flag);
+                return NGX_CONF_ERROR;
+            }
+        }
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+// "$LABLE >=  4" or "$LABLE>=4"
+static ngx_int_t
+ngx_http_waf_parse_check(ngx_str_t *itm, ngx_http_waf_check_t *c)
+{
+    u_char        *p, *s, *e;
+
+    e = itm->data + itm->len;
+    p = itm->data;
+
+    if (*p != '$') {
+        return NGX_ERROR;
+    }
+    p++;
+
+    // tag. separator: '>' or ' '
+    s = ngx_http_waf_score_tag(p, e, "> ");
+    if (s == NULL) {
+        return NGX_ERROR;
+    }
+    c->tag.data = p;
+    c->tag.len  = s - p;
+
+    while (*s == ' ' || *s == '>') s++;
+
+    c->threshold = ngx_atoi(s, e - s);
+    if (c->threshold == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static char *
+ngx_http_waf_check_rule(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_waf_loc_conf_t         *wlcf = conf;
+    ngx_http_waf_check_t            *check;
+    ngx_http_variable_t             *var;
+    ngx_conf_bitmask_t              *m;
+    ngx_str_t                       *value, v;
+    ngx_int_t                        i;
+
+    value = cf->args->elts;
+
+    if (wlcf->check_rules == NULL) {
+
+        wlcf->check_rules = ngx_array_create(cf->pool, 3,
+            sizeof(ngx_http_waf_check_t));
+        if (wlcf->check_rules == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    check = ngx_array_push(wlcf->check_rules);
+    if (check == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_memzero(check, sizeof(ngx_http_waf_check_t));
+
+    check->idx = wlcf->check_rules->nelts - 1;
+
+    if (ngx_http_waf_parse_check(&value[1], check) != NGX_OK) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+            "invalid arguments \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    m = cmd->post;
+    for (i = 0; m[i].name.len != 0; i++) {
+        if (value[2].len == m[i].name.len
+            && ngx_strncmp(value[2].data, m[i].name.data, m[i].name.len) == 0) {
+
+            check->action_flag = m[i].mask;
+            return NGX_CONF_OK;
+        }
+    }
+
+    v = value[2];
+    if (v.data[0] == '$') {
+        ngx_http_waf_act_set_var_block(check->action_flag);
+        v.data += 1;
+        v.len -= 1;
+        var = ngx_http_add_variable(cf, &v,
+            NGX_HTTP_VAR_CHANGEABLE
+            |NGX_HTTP_VAR_NOCACHEABLE
+            |NGX_HTTP_VAR_NOHASH);
+
+        var->get_handler = ngx_http_waf_check_variable;
+
+        return NGX_CONF_OK;
+    }
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+            "invalid arguments \"%V\"", &value[2]);
+
+    return NGX_CONF_ERROR;
+}
+
+
+// the thread pool of the body files as "aio threads=pool", "off" reads
+// them in the worker.
+static char *
+ngx_http_waf_set_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+#if (NGX_THREADS)
+    ngx_http_waf_loc_conf_t    *wlcf = conf;
+
+    ngx_str_t                  *value;
+
+    if (wlcf->thread_pool != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        wlcf->thread_pool = NULL;
+        return NGX_CONF_OK;
+    }
+
+    wlcf->thread_pool = ngx_thread_pool_add(cf, &value[1]);
+    if (wlcf->thread_pool == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+
+#else
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "\"security_body_thread_pool\" is unsupported "
+                       "on this platform");
+    return NGX_CONF_ERROR;
+
+#endif
+}
+
+
+static char *
+ngx_http_waf_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_waf_loc_conf_t    *wlcf = conf;
+
+    ngx_str_t                  *value;
+    ngx_syslog_peer_t          *peer;
+
+    value = cf->args->elts;
+
+    if (wlcf->log != NULL) {
+        return "is duplicate";
+    }
+
+    wlcf->log = ngx_pcalloc(cf->pool, sizeof(ngx_http_waf_log_t));
+    if (wlcf->log == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_strncmp(value[1].data, "off", 3) == 0) {
+        wlcf->log->off = 1;
+
+    } else if (ngx_strncmp(value[1].data, "syslog:", 7) == 0) {
+        peer = ngx_pcalloc(cf->pool, sizeof(ngx_syslog_peer_t));
+        if (peer == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        if (ngx_syslog_process_conf(cf, peer) != NGX_CONF_OK) {
+            return NGX_CONF_ERROR;
+        }
+
+        wlcf->log->writer = ngx_http_waf_syslog_writer;
+        wlcf->log->wdata = peer;
+        wlcf->log->off = 0;
+
+    } else {
+        wlcf->log->file = ngx_conf_open_file(cf->cycle, &value[1]);
+        if (wlcf->log->file == NULL) {
+            return NGX_CONF_ERROR;
+        }
+        wlcf->log->off = 0;
+    }
+
+    wlcf->log->flat = 1;
+    if (cf->args->nelts == 3 && ngx_strncmp(value[2].data, "unflat", 6) == 0) {
+        wlcf->log->flat = 0;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+// as ngx_decode_base64() and ngx_decode_base64url(), the data ends at the
+// first '='. the vectors take the whole groups from a group boundary.
+static u_char *
+ngx_http_waf_decode_b64(ngx_http_waf_decode_state_t *st, u_char *d,
+    u_char *p, u_char *e, ngx_uint_t url)
+{
+    u_char      c, *s, *q, *basis;
+    ngx_uint_t  vec;
+
+    if (st->state) {
+        return d;
+    }
+
+    basis = url ? ngx_http_waf_basis64url : ngx_http_waf_basis64;
+    s = st->saved;
+    vec = 1;
+
+    for ( /* void */ ; p < e; p++) {
+        if (vec && (st->n & 3) == 0) {
+            vec = 0;
+            q = p;
+
+            d = ngx_http_waf_str->b64dec(d, &p, e, url);
+            st->n += p - q;
+
+            if (p == e) {
+                break;
+            }
+        }
+
+        if (*p == '=') {
+            st->state = 1;
+            return d;
+        }
+
+        c = basis[*p];
+        if (c == 77) {
+            return NULL;
+        }
+
+        s[st->n++ & 3] = c;
+
+        if ((st->n & 3) == 0) {
+            *d++ = (u_char) (s[0] << 2 | s[1] >> 4);
+            *d++ = (u_char) (s[1] << 4 | s[2] >> 2);
+            *d++ = (u_char) (s[2] << 6 | s[3]);
+        }
+    }
+
+    return d;
+}
+
+
+static u_char *
+ngx_http_waf_decode_base64(ngx_http_waf_decode_state_t *st, u_char *d,
+    u_char *p, u_char *e)
+{
+    return ngx_http_waf_decode_b64(st, d, p, e, 0);
+}
+
+
+static u_char *
+ngx_http_waf_decode_base64url(ngx_http_waf_decode_state_t *st, u_char *d,
+    u_char *p, u_char *e)
+{
+    return ngx_http_waf_decode_b64(st, d, p, e, 1);
+}
+
+
+static u_char *
+ngx_http_waf_decode_base64_flush(ngx_http_waf_decode_state_t *st, u_char *d)
+{
+    u_char  *s;
+
+    s = st->saved;
+
+    switch (st->n & 3) {
+    case 1:
+        return NULL;
+
+    case 2:
+        *d++ = (u_char) (s[0] << 2 | s[1] >> 4);
+        break;
+
+    case 3:
+        *d++ = (u_char) (s[0] << 2 | s[1] >> 4);
+        *d++ = (u_char) (s[1] << 4 | s[2] >> 2);
+        break;
+    }
+
+    return d;
+}
+
+
+// the data out of the alphabet before the '=' or a single character of
+// the last group fails the decode.
+static ngx_int_t
+ngx_http_waf_decode_b64_scan(u_char *p, u_char *e, ngx_uint_t url)
+{
+    u_char  *q;
+
+    if (p == e) {
+        return NGX_DECLINED;
+    }
+
+    q = ngx_http_waf_str->b64scan(p, e, url);
+
+    if ((q != e && *q != '=') || (q - p) % 4 == 1) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_waf_decode_base64_scan(u_char *p, u_char *e)
+{
+    return ngx_http_waf_decode_b64_scan(p, e, 0);
+}
+
+
+static ngx_int_t
+ngx_http_waf_decode_base64url_scan(u_char *p, u_char *e)
+{
+    return ngx_http_waf_decode_b64_scan(p, e, 1);
+}
+
+
+// as ngx_unescape_uri() of the args, and the '+' is a space.
+static u_char *
+ngx_http_waf_decode_url(ngx_http_waf_decode_state_t *st, u_char *d,
+    u_char *p, u_char *e)
+{
+    u_char  ch, c;
+    enum {
+        sw_usual = 0,
+        sw_quoted,
+        sw_quoted_second
+    };
+
+    for ( /* void */ ; p < e; p++) {
+
+        ch = *p;
+
+        switch (st->state) {
+        case sw_usual:
+            d = ngx_http_waf_str->urlcopy(d, &p, e);
+            if (p == e) {
+                return d;
+            }
+
+            /* the '%' */
+
+            st->state = sw_quoted;
+            break;
+
+        case sw_quoted:
+
+            if (ch >= '0' && ch <= '9') {
+                st->saved[0] = (u_char) (ch - '0');
+                st->state = sw_quoted_second;
+                break;
+            }
+
+            c = (u_char) (ch | 0x20);
+            if (c >= 'a' && c <= 'f') {
+                st->saved[0] = (u_char) (c - 'a' + 10);
+                st->state = sw_quoted_second;
+                break;
+            }
+
+            /* the invalid quoted character */
+
+            st->state = sw_usual;
+
+            *d++ = ch;
+
+            break;
+
+        case sw_quoted_second:
+
+            st->state = sw_usual;
+
+            if (ch >= '0' && ch <= '9') {
+                *d++ = (u_char) ((st->saved[0] << 4) + ch - '0');
+                break;
+            }
+
+            c = (u_char) (ch | 0x20);
+            if (c >= 'a' && c <= 'f') {
+                *d++ = (u_char) ((st->saved[0] << 4) + c - 'a' + 10);
+                break;
+            }
+
+            /* the invalid quoted character */
+
+            break;
+        }
+    }
+
+    return d;
+}
+
+
+static ngx_int_t
+ngx_http_waf_decode_url_scan(u_char *p, u_char *e)
+{
+    return ngx_http_waf_str->urlscan(p, e) == e ? NGX_DECLINED : NGX_OK;
+}
+
+
+// an unfinished escape at the end is dropped.
+static u_char *
+ngx_http_waf_decode_url_flush(ngx_http_waf_decode_state_t *st, u_char *d)
+{
+    return d;
+}
+
+
+// the run of the bytes out of the classes is copied, *s moves to the
+// first byte of them.
+static u_char *
+ngx_http_waf_norm_copy(u_char *d, u_char **s, u_char *e, ngx_uint_t cls)
+{
+    u_char  *p;
+
+    for (p = *s; p < e && !(ngx_http_waf_norm[*p] & cls); p++) {
+        *d++ = *p;
+    }
+
+    *s = p;
+
+    return d;
+}
+
+
+static u_char *
+ngx_http_waf_norm_find(u_char *p, u_char *e, ngx_uint_t cls)
+{
+    while (p < e && !(ngx_http_waf_norm[*p] & cls)) {
+        p++;
+    }
+
+    return p;
+}
+
+
+// the character c continues the entity of the n held ones.
+static ngx_int_t
+ngx_http_waf_html_take(u_char *s, ngx_uint_t n, u_char c)
+{
+    if (n == NGX_HTTP_WAF_DECODE_HOLD) {
+        return 0;
+    }
+
+    if (n == 0) {
+        return c == '#'
+               || ((ngx_http_waf_norm[c] & NGX_HTTP_WAF_NORM_ALNUM)
+                   && !(ngx_http_waf_norm[c] & NGX_HTTP_WAF_NORM_DIGIT));
+    }
+
+    if (s[0] != '#') {
+        return ngx_http_waf_norm[c] & NGX_HTTP_WAF_NORM_ALNUM;
+    }
+
+    if (n == 1 && (c | 0x20) == 'x') {
+        return 1;
+    }
+
+    if (n > 1 && (s[1] | 0x20) == 'x') {
+        return ngx_http_waf_norm[c] & NGX_HTTP_WAF_NORM_HEX;
+    }
+
+    return ngx_http_waf_norm[c] & NGX_HTTP_WAF_NORM_DIGIT;
+}
+
+
+// the character of the held entity, a numeric one is its low byte.
+static ngx_int_t
+ngx_http_waf_html_entity(u_char *s, ngx_uint_t n)
+{
+    u_char                      c;
+    ngx_uint_t                  i, v, hex;
+    ngx_http_waf_html_entity_t  *ent;
+
+    if (n > 0 && s[0] == '#') {
+        hex = (n > 1 && (s[1] | 0x20) == 'x');
+
+        i = hex ? 2 : 1;
+        if (i == n) {
+            return NGX_ERROR;
+        }
+
+        for (v = 0; i < n; i++) {
+            c = (u_char) (s[i] | 0x20);
+            v = hex ? (v << 4) + (c >= 'a' ? c - 'a' + 10 : c - '0')
+                    : v * 10 + (c - '0');
+        }
+
+        return v & 0xff;
+    }
+
+    for (ent = ngx_http_waf_html_entities; ent->name.len; ent++) {
+        if (n == ent->name.len
+            && ngx_strncasecmp(s, ent->name.data, n) == 0)
+        {
+            return ent->ch;
+        }
+    }
+
+    return NGX_ERROR;
+}
+
+
+// the named entities of the table and the numeric ones, with or without
+// the ';'. an unknown entity is kept as is.
+static u_char *
+ngx_http_waf_decode_html(ngx_http_waf_decode_state_t *st, u_char *d,
+    u_char *p, u_char *e)
+{
+    u_char     c;
+    ngx_int_t  ch;
+    enum {
+        sw_usual = 0,
+        sw_entity
+    };
+
+    while (p < e) {
+        if (st->state == sw_usual) {
+            d = ngx_http_waf_norm_copy(d, &p, e, NGX_HTTP_WAF_NORM_HTML);
+            if (p == e) {
+                break;
+            }
+
+            /* the '&' */
+
+            p++;
+            st->state = sw_entity;
+            st->n = 0;
+            continue;
+        }
+
+        c = *p;
+
+        if (ngx_http_waf_html_take(st->saved, st->n, c)) {
+            st->saved[st->n++] = c;
+            p++;
+            continue;
+        }
+
+        /* the end of the entity, c is the next character but the ';' */
+
+        st->state = sw_usual;
+
+        ch = ngx_http_waf_html_entity(st->saved, st->n);
+        if (ch == NGX_ERROR) {
+            *d++ = '&';
+            d = ngx_cpymem(d, st->saved, st->n);
+            continue;
+        }
+
+        *d++ = (u_char) ch;
+
+        if (c == ';') {
+            p++;
+        }
+    }
+
+    return d;
+}
+
+
+static u_char *
+ngx_http_waf_decode_html_flush(ngx_http_waf_decode_state_t *st, u_char *d)
+{
+    ngx_int_t  ch;
+
+    if (st->state == 0) {
+        return d;
+    }
+
+    ch = ngx_http_waf_html_entity(st->saved, st->n);
+    if (ch == NGX_ERROR) {
+        *d++ = '&';
+        return ngx_cpymem(d, st->saved, st->n);
+    }
+
+    *d++ = (u_char) ch;
+
+    return d;
+}
+
+
+static ngx_int_t
+ngx_http_waf_decode_html_scan(u_char *p, u_char *e)
+{
+    return ngx_http_waf_norm_find(p, e, NGX_HTTP_WAF_NORM_HTML) == e
+           ? NGX_DECLINED : NGX_OK;
+}
+
+
+// the %uXXXX of IIS, a full width ASCII character is the ASCII one, the
+// rest is the low byte. the other '%' are kept.
+static u_char *
+ngx_http_waf_decode_unicode(ngx_http_waf_decode_state_t *st, u_char *d,
+    u_char *p, u_char *e)
+{
+    u_char      c, *s;
+    ngx_uint_t  v;
+    enum {
+        sw_usual = 0,
+        sw_escape
+    };
+
+    s = st->saved;
+
+    while (p < e) {
+        if (st->state == sw_usual) {
+            d = ngx_http_waf_norm_copy(d, &p, e, NGX_HTTP_WAF_NORM_UNICODE);
+            if (p == e) {
+                break;
+            }
+
+            /* the '%' */
+
+            p++;
+            st->state = sw_escape;
+            st->n = 0;
+            continue;
+        }
+
+        c = *p;
+
+        if (st->n == 0 ? (c | 0x20) == 'u'
+                       : ngx_http_waf_norm[c] & NGX_HTTP_WAF_NORM_HEX)
+        {
+            s[st->n++] = c;
+            p++;
+
+            if (st->n < 5) {
+                continue;
+            }
+
+            st->state = sw_usual;
+
+            v = ngx_hextoi(&s[1], 4);
+            *d++ = (u_char) ((v >= 0xff01 && v <= 0xff5e) ? v - 0xfee0 : v);
+            continue;
+        }
+
+        /* not an escape, c is the next character */
+
+        st->state = sw_usual;
+
+        *d++ = '%';
+        d = ngx_cpymem(d, s, st->n);
+    }
+
+    return d;
+}
+
+
+static u_char *
+ngx_http_waf_decode_unicode_flush(ngx_http_waf_decode_state_t *st,
+    u_char *d)
+{
+    if (st->state == 0) {
+        return d;
+    }
+
+    *d++ = '%';
+
+    return ngx_cpymem(d, st->saved, st->n);
+}
+
+
+static ngx_int_t
+ngx_http_waf_decode_unicode_scan(u_char *p, u_char *e)
+{
+    for ( /* void */ ; p < e; p++) {
+        p = ngx_http_waf_norm_find(p, e, NGX_HTTP_WAF_NORM_UNICODE);
+        if (p == e) {
+            break;
+        }
+
+        if (e - p > 1 && (p[1] | 0x20) == 'u') {
+            return NGX_OK;
+        }
+    }
+
+    return NGX_DECLINED;
+}
+
+
+// the states of the comments stage, the flush needs them too.
+enum {
+    ngx_http_waf_cm_usual = 0,
+    ngx_http_waf_cm_slash,
+    ngx_http_waf_cm_open,
+    ngx_http_waf_cm_comment,
+    ngx_http_waf_cm_comment_star,
+    ngx_http_waf_cm_version,
+    ngx_http_waf_cm_exec_star
+};
+
+
+// a /* */ comment is a space, an unclosed one runs to the end. the text
+// of a /*! */ one of MySQL is kept, without the version.
+static u_char *
+ngx_http_waf_decode_comments(ngx_http_waf_decode_state_t *st, u_char *d,
+    u_char *p, u_char *e)
+{
+    u_char  c;
+
+    while (p < e) {
+        c = *p;
+
+        switch (st->state) {
+        case ngx_http_waf_cm_usual:
+            // st->n is set in the text of a /*! */ comment.
+            d = ngx_http_waf_norm_copy(d, &p, e, NGX_HTTP_WAF_NORM_COMMENT
+                                       | (st->n ? NGX_HTTP_WAF_NORM_STAR : 0));
+            if (p == e) {
+                break;
+            }
+
+            st->state = (*p == '/') ? ngx_http_waf_cm_slash
+                                    : ngx_http_waf_cm_exec_star;
+            p++;
+            break;
+
+        case ngx_http_waf_cm_slash:
+            if (c == '*') {
+                st->state = ngx_http_waf_cm_open;
+                p++;
+                break;
+            }
+
+            st->state = ngx_http_waf_cm_usual;
+            *d++ = '/';
+            break;
+
+        case ngx_http_waf_cm_open:
+            if (c == '!' && !st->n) {
+                st->n = 1;
+                st->state = ngx_http_waf_cm_version;
+                p++;
+                break;
+            }
+
+            st->state = ngx_http_waf_cm_comment;
+            break;
+
+        case ngx_http_waf_cm_comment:
+            p = ngx_strlchr(p, e, '*');
+            if (p == NULL) {
+                p = e;
+                break;
+            }
+
+            st->state = ngx_http_waf_cm_comment_star;
+            p++;
+            break;
+
+        case ngx_http_waf_cm_comment_star:
+            if (c == '/') {
+                st->state = ngx_http_waf_cm_usual;
+                *d++ = ' ';
+
+            } else if (c != '*') {
+                st->state = ngx_http_waf_cm_comment;
+            }
+
+            p++;
+            break;
+
+        case ngx_http_waf_cm_version:
+            if (ngx_http_waf_norm[c] & NGX_HTTP_WAF_NORM_DIGIT) {
+                p++;
+                break;
+            }
+
+            st->state = ngx_http_waf_cm_usual;
+            break;
+
+        case ngx_http_waf_cm_exec_star:
+            st->state = ngx_http_waf_cm_usual;
+
+            if (c == '/') {
+                st->n = 0;
+                *d++ = ' ';
+                p++;
+                break;
+            }
+
+            *d++ = '*';
+            break;
+        }
+    }
+
+    return d;
+}
+
+
+static u_char *
+ngx_http_waf_decode_comments_flush(ngx_http_waf_decode_state_t *st,
+    u_char *d)
+{
+    switch (st->state) {
+    case ngx_http_waf_cm_slash:
+        *d++ = '/';
+        break;
+
+    case ngx_http_waf_cm_open:
+    case ngx_http_waf_cm_comment:
+    case ngx_http_waf_cm_comment_star:
+        *d++ = ' ';
+        break;
+
+    case ngx_http_waf_cm_exec_star:
+        *d++ = '*';
+        break;
+    }
+
+    return d;
+}
+
+
+static ngx_int_t
+ngx_http_waf_decode_comments_scan(u_char *p, u_char *e)
+{
+    for ( /* void */ ; p < e; p++) {
+        p = ngx_http_waf_norm_find(p, e, NGX_HTTP_WAF_NORM_COMMENT);
+        if (p == e) {
+            break;
+        }
+
+        if (e - p > 1 && p[1] == '*') {
+            return NGX_OK;
+        }
+    }
+
+    return NGX_DECLINED;
+}
+
+
+// a run of the white space is a space.
+static u_char *
+ngx_http_waf_decode_ws(ngx_http_waf_decode_state_t *st, u_char *d,
+    u_char *p, u_char *e)
+{
+    while (p < e) {
+        if (ngx_http_waf_norm[*p] & NGX_HTTP_WAF_NORM_WS) {
+            if (!st->state) {
+                st->state = 1;
+                *d++ = ' ';
+            }
+
+            p++;
+            continue;
+        }
+
+        st->state = 0;
+        d = ngx_http_waf_norm_copy(d, &p, e, NGX_HTTP_WAF_NORM_WS);
+    }
+
+    return d;
+}
+
+
+static u_char *
+ngx_http_waf_decode_ws_flush(ngx_http_waf_decode_state_t *st, u_char *d)
+{
+    return d;
+}
+
+
+static ngx_int_t
+ngx_http_waf_decode_ws_scan(u_char *p, u_char *e)
+{
+    for ( /* void */ ; p < e; p++) {
+        p = ngx_http_waf_norm_find(p, e, NGX_HTTP_WAF_NORM_WS);
+        if (p == e) {
+            break;
+        }
+
+        if (*p != ' ' || (e - p > 1
+                          && ngx_http_waf_norm[p[1]] & NGX_HTTP_WAF_NORM_WS))
+        {
+            return NGX_OK;
+        }
+    }
+
+    return NGX_DECLINED;
+}
+
+
+static ngx_int_t
+ngx_http_waf_parse_rule_id(ngx_conf_t *cf, ngx_str_t *str,
+    ngx_http_waf_rule_parser_t *parser, ngx_http_waf_rule_opt_t *opt)
+{
+    opt->p_rule->id = ngx_atoi(str->data + parser->prefix.len,
+        str->len - parser->prefix.len);
+
+    if (opt->p_rule->id == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid arguments \"%V\"", str);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_waf_parse_rule_decode(ngx_conf_t *cf, ngx_array_t *decode_handlers,
+    u_char *p, u_char *e)
+{
+    ngx_uint_t                    i, offset, invalid;
+    ngx_str_t                     str, decode_prefix = ngx_string("decode_");
+    ngx_http_waf_rule_decode_t  **decode;
+
+    str.data = p;
+    str.len = e - p;
+    offset = 0;
+
+    while (p < e) {
+        if (ngx_strncmp(p + offset, decode_prefix.data, decode_prefix.len) != 0)
+        {
+            return offset;
+        }
+
+        if (decode_handlers->nelts == NGX_HTTP_WAF_DECODE_STAGES) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                "too many decode functions in arguments \"%V\"", &str);
+            return NGX_ERROR;
+        }
+
+        invalid = 0;
+        offset += decode_prefix.len;
+
+        for (i = 0; ngx_http_waf_rule_decode[i].handler != NULL; i++) {
+            invalid = 1;
+            if (ngx_strncmp(p + offset, ngx_http_waf_rule_decode[i].suffix.data,
+                ngx_http_waf_rule_decode[i].suffix.len) != 0)
+            {
+                continue;
+            }
+
+            decode = ngx_array_push(decode_handlers);
+            if (decode == NULL) {
+                return NGX_ERROR;
+            }
+
+            invalid = 0;
+            *decode = &ngx_http_waf_rule_decode[i];
+            offset += ngx_http_waf_rule_decode[i].suffix.len;
+
+            if (*(p + offset) != '|') {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                    "invalid decode format in arguments \"%V\"", str);
+                return NGX_ERROR;
+            }
+
+            offset += 1;
+            break;
+        }
+
+        if (invalid) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                "invalid decode function in arguments \"%V\"", str);
+            return NGX_ERROR;
+        }
+    }
+
+    return offset;
+}
+
+
+static ngx_int_t
+ngx_http_waf_parse_rule_str(ngx_conf_t *cf, ngx_str_t *str,
+    ngx_http_waf_rule_parser_t *parser, ngx_http_waf_rule_opt_t *opt)
+{
+    u_char                       *p, *e;
+    ngx_int_t                     offset;
+
+    p = str->data + parser->prefix.len;
+    e = str->data + str->len;
+
+    offset = ngx_http_waf_parse_rule_decode(cf, opt->p_rule->decode_handlers,
+        p, e - 3);
+    if (offset == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    p += offset;
+
+    if (*p == '!') {
+        p++;
+        opt->p_rule->not = 1;
+    }
+
+    // ct@xyz ne@xyz eq@xyz sw@xyz ew@xyz rx@xyz...
+    if (p + 3 >= e || p[2] != '@') {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                "invalid str in arguments \"%V\"", str);
+        return NGX_ERROR;
+    }
+
+    opt->p_rule->str.len = e - (p + 3);
+    opt->p_rule->str.data = ngx_pcalloc(cf->pool,
+        opt->p_rule->str.len + 1);
+    if (opt->p_rule->str.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (p[0] == 'l' && p[1] == 'e') {
+        p += 3;
+        ngx_strlow(opt->p_rule->str.data, p, opt->p_rule->str.len);
+        opt->p_rule->handler = ngx_http_waf_rule_str_le_handler;
+    } else if (p[0] == 'g' && p[1] == 'e') {
+        p += 3;
+        ngx_strlow(opt->p_rule->str.data, p, opt->p_rule->str.len);
+        opt->p_rule->handler = ngx_http_waf_rule_str_ge_handler;
+    } else if (p[0] == 'c' && p[1] == 't') {
+        p += 3;
+        ngx_strlow(opt->p_rule->str.data, p, opt->p_rule->str.len);
+        opt->p_rule->handler = ngx_http_waf_rule_str_ct_handler;
+        opt->p_rule->lower = 1;
+    } else if (p[0] == 'e' && p[1] == 'q') {
+        p += 3;
+        ngx_strlow(opt->p_rule->str.data, p, opt->p_rule->str.len);
+        opt->p_rule->handler = ngx_http_waf_rule_str_eq_handler;
+        opt->p_rule->lower = 1;
+    } else if (p[0] == 's' && p[1] == 'w') {
+        p += 3;
+        ngx_strlow(opt->p_rule->str.data, p, opt->p_rule->str.len);
+        opt->p_rule->handler = ngx_http_waf_rule_str_startwith_handler;
+        opt->p_rule->lower = 1;
+    } else if (p[0] == 'e' && p[1] == 'w') {
+        p += 3;
+        ngx_strlow(opt->p_rule->str.data, p, opt->p_rule->str.len);
+        opt->p_rule->handler = ngx_http_waf_rule_str_endwith_handler;
+        opt->p_rule->lower = 1;
+    } else if (p[0] == 'r' && p[1] == 'x') {
+        p += 3;
+        ngx_memcpy(opt->p_rule->str.data, p, opt->p_rule->str.len);
+        opt->p_rule->handler = ngx_http_waf_rule_str_rx_handler;
+
+        opt->p_rule->regex = ngx_http_waf_regex_compile(cf,
+            &opt->p_rule->str);
+        if (opt->p_rule->regex == NULL) {
+            return NGX_ERROR;
+        }
+
+        opt->p_rule->re = ngx_http_waf_re_parse(cf, &opt->p_rule->str);
+        if (opt->p_rule->re == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (opt->p_rule->re->pcre != NULL
+            && ngx_http_waf_re_factors(cf, opt->p_rule->re) != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    } else {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                "invalid str in arguments \"%V\"", str);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+
+// s:$ATT:3,$ATT2:4
+static ngx_int_t
+ngx_http_waf_parse_rule_score(ngx_conf_t *cf, ngx_str_t *str,
+    ngx_http_waf_rule_parser_t *parser, ngx_http_waf_rule_opt_t *opt)
+{
+    u_char                *p, *s, *e;
+    ngx_http_waf_score_t  *sc;
+
+    if (opt->p_rule->scores == NULL) {
+        opt->p_rule->scores = ngx_array_create(cf->pool, 2,
+            sizeof(ngx_http_waf_score_t));
+
+        if (opt->p_rule->scores == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    e = str->data + str->len;
+    p = str->data + parser->prefix.len;
+
+    while (p < e) {
+        if (*p == ',') p++;
+
+        if (*p++ != '$') {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+            "invalid arguments \"%V\"", str);
+
+            return NGX_ERROR;
+        }
+
+        // tag
+        s = ngx_http_waf_score_tag(p, e, ":");
+        if (s == NULL || s - p <= 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                "invalid scores in arguments \"%V\"", str);
+            return NGX_ERROR;
+        }
+
+        sc = ngx_array_push(opt->p_rule->scores);
+        if (sc == NULL) {
+            return NGX_ERROR;
+        }
+
+        sc->tag.len  = s - p;
+        sc->tag.data = ngx_pcalloc(cf->pool, sc->tag.len);
+        if (sc->tag.data == NULL) {
+            return NGX_ERROR;
+        }
+        ngx_memcpy(sc->tag.data, p, sc->tag.len);
+
+        // score
+        p = s + 1;
+        s = (u_char *)ngx_strchr(p, ',');
+        if (s == NULL) {
+            s = e;
+        }
+        sc->score = ngx_atoi(p, s - p);
+        p = s + 1;
+
+        sc->log_ctx = NULL;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_waf_parse_rule_note(ngx_conf_t *cf, ngx_str_t *str,
+    ngx_http_waf_rule_parser_t *parser, ngx_http_waf_rule_opt_t *opt)
+{
+    return NGX_OK;
+}
+
+// "limit:match=10000,depth=1000"
+static ngx_int_t
+ngx_http_waf_parse_rule_limit(ngx_conf_t *cf, ngx_str_t *str,
+    ngx_http_waf_rule_parser_t *parser, ngx_http_waf_rule_opt_t *opt)
+{
+    u_char       *p, *s, *e;
+    ngx_int_t     n;
+    ngx_uint_t   *limit;
+
+    p = str->data + parser->prefix.len;
+    e = str->data + str->len;
+
+    while (p < e) {
+        s = ngx_strlchr(p, e, ',');
+        if (s == NULL) {
+            s = e;
+        }
+
+        if (s - p > 6 && ngx_strncmp(p, "match=", 6) == 0) {
+            limit = &opt->match_limit;
+            p += 6;
+        } else if (s - p > 6 && ngx_strncmp(p, "depth=", 6) == 0) {
+            limit = &opt->depth_limit;
+            p += 6;
+        } else {
+            goto invalid;
+        }
+
+        n = ngx_atoi(p, s - p);
+        if (n == NGX_ERROR || n == 0) {
+            goto invalid;
+        }
+
+        *limit = n;
+        p = s + 1;
+    }
+
+    return NGX_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid limit in arguments \"%V\"", str);
+    return NGX_ERROR;
+}
+
+
+
+// URI、V_URI、X_URI
+// ARGS V_ARGS X_ARGS
+// HEADERS V_HEADERS X_HEADERS
+//
+// "zone:ARGS|V_HEADERS:xxx|X_HEADERS:xxx"
+// "zone:@ARGS'
+// "zone:#ARGS'
+static ngx_int_t
+ngx_http_waf_parse_rule_zone(ngx_conf_t *cf, ngx_str_t *str,
+    ngx_http_waf_rule_parser_t *parser, ngx_http_waf_rule_opt_t *opt)
+{
+    u_char                        *p, *s, *e;
+    ngx_uint_t                     i, flag, all_flag;
+    ngx_http_waf_zone_t          *zone;
+
+    if (opt->m_zones == NULL) {
+        opt->m_zones = ngx_array_create(cf->pool, 3,
+            sizeof(ngx_http_waf_zone_t));
+        if (opt->m_zones == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    e = str->data + str->len;
+    p = str->data + parser->prefix.len;
+    all_flag = 0;
+
+    while (p < e) {
+        if (*p == '|') p++;
+        flag = 0;
+
+        for (i = 0; ngx_http_waf_rule_zone_item[i].name.data != NULL; i++) {
+            if (ngx_strncmp(p, ngx_http_waf_rule_zone_item[i].name.data,
+                ngx_http_waf_rule_zone_item[i].name.len) == 0) {
+
+                flag = ngx_http_waf_rule_zone_item[i].mask;
+                p += ngx_http_waf_rule_zone_item[i].name.len;
+                break;
+            }
+        }
+
+        if (flag == 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone in arguments \"%V\"", str);
+            return NGX_ERROR;
+        }
+
+        if (ngx_http_waf_mz_gt(all_flag, flag)) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "wrong zone in arguments \"%V\"", str);
+            return NGX_ERROR;
+        }
+
+        all_flag |= flag;
+
+        zone = ngx_array_push(opt->m_zones);
+        if (zone == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memzero(zone, sizeof(ngx_http_waf_zone_t));
+
+        zone->flag = flag;
+
+        if (ngx_http_waf_mz_is_general(flag)) {
+            continue;
+        }
+
+        if (*(p-1) != ':') {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid custom zone in arguments \"%V\"", str);
+            return NGX_ERROR;
+        }
+
+        s = (u_char *)ngx_strchr(p, '|');
+        if (s == NULL) {
+            s = e;
+        }
+
+        if (s == p) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "wrong custom zone in arguments \"%V\"", str);
+            return NGX_ERROR;
+        }
+
+        zone->name.data = ngx_pcalloc(cf->pool, s - p + 1);
+        if (zone->name.data == NULL) {
+            return NGX_ERROR;
+        }
+        ngx_memcpy(zone->name.data, p, s - p);
+        zone->name.len = s - p;
+
+        if (ngx_http_waf_mz_is_regex(flag)) {
+            zone->regex = ngx_http_waf_regex_compile(cf, &zone->name);
+            if (zone->regex == NULL) {
+                return NGX_ERROR;
+            }
+        }
+
+        p = s;
+    }
+
+    return NGX_OK;
+}
+
+
+// "wl:x,y..."
+// "wl:-x,-y..."
+static ngx_int_t
+ngx_http_waf_parse_rule_whitelist(ngx_conf_t *cf, ngx_str_t *str,
+    ngx_http_waf_rule_parser_t *parser, ngx_http_waf_rule_opt_t *opt)
+{
+    u_char       *p, *s, *e;
+    char          minus;
+    ngx_int_t    *a, id;
+
+    if (opt->wl_ids == NULL) {
+        opt->wl_ids = ngx_array_create(cf->pool, 3, sizeof(ngx_int_t));
+        if (opt->wl_ids == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    e = str->data + str->len;
+    p = str->data + parser->prefix.len;
+
+    while (p < e) {
+        minus = 0;
+        s = (u_char *)ngx_strchr(p , ',');
+        if (s == NULL) {
+            s = e;
+        }
+
+        if (*p == '-') {
+            p++;
+            minus = 1;
+        }
+
+        id = ngx_atoi(p, s-p);
+        if (id == NGX_ERROR) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid whitelisted id in arguments \"%V\"", str);
+            return NGX_ERROR;
+        }
+
+        a = (ngx_int_t *)ngx_array_push(opt->wl_ids);
+        if (a == NULL) {
+            return NGX_ERROR;
+        }
+        p = s + 1;
+
+        if (minus == 1) {
+            *a = 0 - id;
+            continue;
+        }
+        *a = id;
+    }
+
+    return NGX_OK;
+}
+
+
+// libinj:sql
+// libinj:xss
+static ngx_int_t
+ngx_http_waf_parse_rule_libinj(ngx_conf_t *cf, ngx_str_t *str,
+    ngx_http_waf_rule_parser_t *parser, ngx_http_waf_rule_opt_t *opt)
+{
+    u_char             *p, *e;
+    ngx_int_t           offset;
+
+    static ngx_str_t    sql = ngx_string("sql");
+    static ngx_str_t    xss = ngx_string("xss");
+
+    if (str->len - parser->prefix.len < 3) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+            "invalid libinj in arguments \"%V\"", str);
+        return NGX_ERROR;
+    }
+
+    p = str->data + parser->prefix.len;
+    e = str->data + str->len;
+
+    offset = ngx_http_waf_parse_rule_decode(cf, opt->p_rule->decode_handlers,
+        p, e - 4);
+    if (offset == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    p += offset;
+
+    if ((size_t)(e - p) == sql.len
+        && ngx_strncmp(p, sql.data, sql.len) == 0)
+    {
+        opt->p_rule->str = sql;
+        opt->p_rule->handler = ngx_http_waf_rule_str_sqli_handler;
+
+    } else if ((size_t)(e - p) == xss.len
+        && ngx_strncmp(p, xss.data, xss.len) == 0)
+    {
+        opt->p_rule->str = xss;
+        opt->p_rule->handler = ngx_http_waf_rule_str_xss_handler;
+
+    } else {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+            "invalid libinj args in arguments \"%V\"", str);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_waf_parse_rule_hash(ngx_conf_t *cf, ngx_str_t *str,
+    ngx_http_waf_rule_parser_t *parser, ngx_http_waf_rule_opt_t *opt)
+{
+    u_char                    *p, *e;
+    ngx_str_t                  name;
+    ngx_http_waf_hash_alg_t   *alg;
+    static ngx_str_t           file = ngx_string("file:");
+
+    p = str->data + parser->prefix.len;
+    e = str->data + str->len;
+
+    if (*p == '!') {
+        p++;
+        opt->p_rule->not = 1;
+    }
+
+    for (alg = ngx_http_waf_hash_algs; alg->name.len != 0; alg++) {
+        if (p + alg->name.len < e
+            && ngx_strncmp(p, alg->name.data, alg->name.len) == 0)
+        {
+            break;
+        }
+    }
+
+    if (alg->name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                "invalid hash function in arguments \"%V\"", str);
+        return NGX_ERROR;
+    }
+
+    p += alg->name.len;
+    opt->p_rule->handler = ngx_http_waf_rule_hash_handler;
+    opt->p_rule->hash = alg;
+
+    opt->p_rule->str.len  = e - p;
+    opt->p_rule->str.data = ngx_pcalloc(cf->pool,
+        opt->p_rule->str.len + 1);
+    if (opt->p_rule->str.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(opt->p_rule->str.data, p, opt->p_rule->str.len);
+
+    // "md5@file:/path", a digest per line.
+    if (p + file.len < e && ngx_strncmp(p, file.data, file.len) == 0) {
+        name.data = opt->p_rule->str.data + file.len;
+        name.len = opt->p_rule->str.len - file.len;
+
+        return ngx_http_waf_parse_rule_hash_file(cf, opt->p_rule, &name);
+    }
+
+    opt->p_rule->digests.len = alg->size;
+    opt->p_rule->digests.data = ngx_pnalloc(cf->pool, alg->size);
+    if (opt->p_rule->digests.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_http_waf_parse_digest(alg, p, e, opt->p_rule->digests.data)
+        != NGX_OK)
+    {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                "invalid hash code in arguments \"%V\"", str);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+// the hex md5, sha256 or the decimal crc32 to the binary digest.
+static ngx_int_t
+ngx_http_waf_parse_digest(ngx_http_waf_hash_alg_t *alg, u_char *p, u_char *e,
+    u_char *dst)
+{
+    uint32_t    crc;
+    ngx_int_t   n;
+    ngx_uint_t  i;
+
+    if (!alg->hex) {
+        n = ngx_atoi(p, e - p);
+        if (n == NGX_ERROR || n > 0xffffffff) {
+            return NGX_ERROR;
+        }
+
+        crc = (uint32_t) n;
+        ngx_memcpy(dst, &crc, sizeof(uint32_t));
+
+        return NGX_OK;
+    }
+
+    if ((size_t) (e - p) != 2 * alg->size) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < alg->size; i++) {
+        n = ngx_hextoi(p + 2 * i, 2);
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        dst[i] = (u_char) n;
+    }
+
+    return NGX_OK;
+}
+
+
+// the known bad digests, "# comment" and "digest  filename" lines are ok.
+static ngx_int_t
+ngx_http_waf_parse_rule_hash_file(ngx_conf_t *cf,
+    ngx_http_waf_public_rule_t *pr, ngx_str_t *name)
+{
+    u_char            *buf, *p, *e, *s, *t, *d;
+    size_t             size;
+    ssize_t            n;
+    ngx_int_t          rc;
+    ngx_uint_t         line, lines;
+    ngx_file_t         file;
+    ngx_file_info_t    fi;
+
+    if (ngx_conf_full_name(cf->cycle, name, 1) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+    file.name = *name;
+    file.log = cf->log;
+
+    file.fd = ngx_open_file(name->data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+    if (file.fd == NGX_INVALID_FILE) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_open_file_n " \"%s\" failed", name->data);
+        return NGX_ERROR;
+    }
+
+    rc = NGX_ERROR;
+    buf = NULL;
+    size = 0;
+
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_fd_info_n " \"%s\" failed", name->data);
+        goto close;
+    }
+
+    size = (size_t) ngx_file_size(&fi);
+
+    buf = ngx_pnalloc(cf->temp_pool, size + 1);
+    if (buf == NULL) {
+        goto close;
+    }
+
+    n = ngx_read_file(&file, buf, size, 0);
+    if (n == NGX_ERROR) {
+        goto close;
+    }
+
+    if ((size_t) n != size) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           ngx_read_file_n " \"%s\" returned only "
+                           "%z bytes instead of %uz", name->data, n, size);
+        goto close;
+    }
+
+    rc = NGX_OK;
+
+close:
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name->data);
+    }
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    e = buf + size;
+
+    lines = 1;
+    for (p = buf; p < e; p++) {
+        if (*p == LF) {
+            lines++;
+        }
+    }
+
+    pr->digests.data = ngx_pnalloc(cf->pool, lines * pr->hash->size);
+    if (pr->digests.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    d = pr->digests.data;
+    line = 0;
+
+    for (p = buf; p < e; p = s + 1) {
+        line++;
+
+        s = ngx_strlchr(p, e, LF);
+        if (s == NULL) {
+            s = e;
+        }
+
+        while (p < s && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+
+        if (p == s || *p == CR || *p == '#') {
+            continue;
+        }
+
+        for (t = p; t < s; t++) {
+            if (*t == ' ' || *t == '\t' || *t == CR) {
+                break;
+            }
+        }
+
+        if (ngx_http_waf_parse_digest(pr->hash, p, t, d) != NGX_OK) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid hash code in \"%s\" line %ui",
+                               name->data, line);
             return NGX_ERROR;
         }
 
-        ss = rule->p_rule->scores->elts;
-        for (j = 0; j < rule->p_rule->scores->nelts; j++) {
+        d += pr->hash->size;
+    }
+
+    pr->digests.len = d - pr->digests.data;
+
+    ngx_conf_log_error(NGX_LOG_NOTICE, cf, 0,
+                       "%uz digests are loaded from \"%s\"",
+                       pr->digests.len / pr->hash->size, name->data);
+
+    return NGX_OK;
+}
+
+
+// -- rquest deal -------
+
+static void
+ngx_http_waf_score_calc(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx,
+    ngx_http_waf_rule_t *rule, ngx_str_t str)
+{
+    u_char                    *p;
+    ngx_uint_t                 k, idx;
+    ngx_http_waf_score_t      *ss;
+    ngx_http_waf_check_t      *cs;
+    ngx_http_waf_log_ctx_t    *log;
+    ngx_http_waf_loc_conf_t   *wlcf;
+
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+        "ngx http waf score calc rule id: %i addr:%p",
+        rule->p_rule->id, rule->p_rule->scores);
+
+    ngx_http_waf_ctx_copy_act(ctx->status, rule->sts);
+
+    // the chunks of the body are reused, the log keeps a copy.
+    if (ctx->transient && str.len > 0) {
+        p = ngx_pnalloc(r->pool, str.len);
+        if (p != NULL) {
+            ngx_memcpy(p, str.data, str.len);
+            str.data = p;
+        }
+    }
+
+    if (ngx_http_waf_sts_has_block(ctx->status)) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+            "ngx http waf score calc ctx block return ...");
+
+        if (rule->p_rule->scores != NULL) {
+            return;
+        }
+
+        ctx->logc = ngx_pcalloc(r->pool, sizeof(ngx_http_waf_log_ctx_t));
+        if (ctx->logc != NULL) {
+            ctx->logc->rule = rule;
+            ctx->logc->str = str;
+        }
+
+        return;
+    }
+
+    wlcf = ngx_http_get_module_loc_conf(r, ngx_http_waf_module);
+
+    ss = ctx->scores->elts;
+    cs = rule->score_checks->elts;
+    for (k = 0; k < rule->score_checks->nelts; k++) {
+        idx = cs[k].idx;
+        ss[idx].score += cs[k].score;
+
+        // TODO: optimize >=
+        if (ss[idx].score > cs[k].threshold) {
+            ctx->status |= cs[k].action_flag;
+        }
+
+        // if (str.len > 128) {
+        //     str.len = 128;
+        // }
+        ngx_log_debug5(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+            "http waf module score calc. id:%i tag:$%V score:%i total_score:%i"
+            " str:%V",
+            rule->p_rule->id, &cs[k].tag, cs[k].score, ss[idx].score, &str);
+
+
+        if (wlcf->log == NULL || wlcf->log->off) {
+            continue;
+        }
+
+        if (ss[idx].log_ctx == NULL) {
+            ss[idx].log_ctx = ngx_array_create(r->pool, 3,
+                sizeof(ngx_http_waf_log_ctx_t));
+
+            if (ss[idx].log_ctx == NULL) {
+                continue;
+            }
+        }
+
+        log = ngx_array_push(ss[idx].log_ctx);
+        if (log == NULL) {
+            continue;
+        }
+
+        log->score = cs[k].score;
+        log->rule = rule;
+        log->str  = str;
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+            "http waf module rule %d log", rule->p_rule->id);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_waf_rule_str_ge_handler(ngx_http_waf_public_rule_t *pr,
+    ngx_str_t *s)
+{
+    ngx_uint_t        i = 0;
+    u_char           *p, *q;
+
+    if (s == NULL || s->data == NULL || s->len == 0) {
+        return NGX_ERROR;
+    }
+
+    p = s->data;
+    q = pr->str.data;
+
+    while (i < s->len && i < pr->str.len) {
+
+        if (*p < *q) {
+            return pr->not? NGX_OK: NGX_ERROR;
+
+        } else if (*p > *q) {
+            return pr->not? NGX_ERROR: NGX_OK;
+        }
+
+        i++;
+        p++;
+        q++;
+    }
+
+    if (s->len >= pr->str.len) {
+        return pr->not? NGX_ERROR: NGX_OK;
+    }
+
+    return pr->not? NGX_OK: NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_waf_rule_str_le_handler(ngx_http_waf_public_rule_t *pr,
+    ngx_str_t *s)
+{
+    ngx_uint_t      i = 0;
+    u_char         *p, *q;
+
+    if (s == NULL || s->data == NULL || s->len == 0) {
+        return NGX_ERROR;
+    }
+
+    p = s->data;
+    q = pr->str.data;
+
+    while (i < s->len && i < pr->str.len) {
+
+        if (*p > *q) {
+            return pr->not? NGX_OK: NGX_ERROR;
+
+        } else if (*p < *q) {
+            return pr->not? NGX_ERROR: NGX_OK;
+
+        }
+
+        i++;
+        p++;
+        q++;
+    }
+
+    if (s->len <= pr->str.len) {
+        return pr->not? NGX_ERROR: NGX_OK;
+    }
+
+    return pr->not? NGX_OK: NGX_ERROR;
+}
+
+
+// rule string match handler ...
+// return NGX_OK match successful, else NGX_ERROR.
+// the ct, eq, sw and ew handlers take the lowercase field.
+static ngx_int_t
+ngx_http_waf_rule_str_ct_handler(ngx_http_waf_public_rule_t *pr,
+    ngx_str_t *s)
+{
+    u_char *p, *e;
+
+    if (s == NULL || s->data == NULL || s->len == 0
+        || s->len < pr->str.len) {
+        return NGX_ERROR;
+    }
+
+    e = s->data + s->len;
+
+    p = ngx_http_waf_str->memstr(s->data, e, pr->str.data, pr->str.len);
+    if (p != NULL) {
+        return pr->not? NGX_ERROR: NGX_OK;
+    }
+
+    return pr->not? NGX_OK: NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_waf_rule_str_eq_handler(ngx_http_waf_public_rule_t *pr,
+    ngx_str_t *s)
+{
+    if (s == NULL || s->data == NULL || s->len == 0) {
+        return NGX_ERROR;
+    }
+
+    if (s->len == pr->str.len
+        && ngx_memcmp(s->data, pr->str.data, s->len) == 0)
+    {
+        return pr->not? NGX_ERROR: NGX_OK;
+    }
+
+    return pr->not? NGX_OK: NGX_ERROR;
+}
+
+
+
+static ngx_int_t
+ngx_http_waf_rule_str_startwith_handler(ngx_http_waf_public_rule_t *pr,
+    ngx_str_t *s)
+{
+    if (s == NULL || s->data == NULL || s->len == 0) {
+        return NGX_ERROR;
+    }
+
+    if (s->len > pr->str.len
+        && ngx_memcmp(s->data, pr->str.data, pr->str.len) == 0)
+    {
+        return pr->not? NGX_ERROR: NGX_OK;
+    }
+
+    return pr->not? NGX_OK: NGX_ERROR;
+}
+
+
+
+static ngx_int_t
+ngx_http_waf_rule_str_endwith_handler(ngx_http_waf_public_rule_t *pr,
+    ngx_str_t *s)
+{
+    u_char *p;
+
+    if (s == NULL || s->data == NULL || s->len == 0
+        || s->len <= pr->str.len)
+    {
+        return NGX_ERROR;
+    }
+
+    p = s->data + s->len - pr->str.len;
+    if (ngx_memcmp(p, pr->str.data, pr->str.len) == 0) {
+        return pr->not? NGX_ERROR: NGX_OK;
+    }
+
+    return pr->not? NGX_OK: NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_waf_rule_str_rx_handler(ngx_http_waf_public_rule_t *pr,
+    ngx_str_t *s)
+{
+    ngx_int_t   n;
+
+    if (s == NULL || s->data == NULL || s->len == 0) {
+        return NGX_ERROR;
+    }
+
+    n = ngx_http_waf_regex_exec(pr->regex, s);
+    if (n == NGX_DECLINED) {
+        return pr->not? NGX_OK: NGX_ERROR;
+    }
+
+    // the caller decides by security_regex_limit_action.
+    if (n == NGX_BUSY) {
+        return NGX_DECLINED;
+    }
+
+    return pr->not? NGX_ERROR: NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_waf_rule_str_sqli_handler(ngx_http_waf_public_rule_t *pr,
+    ngx_str_t *s)
+{
+    ngx_int_t                       issqli;
+    struct libinjection_sqli_state  state;
+
+    if (s == NULL || s->data == NULL || s->len == 0) {
+        return NGX_ERROR;
+    }
+
+    libinjection_sqli_init(&state, (const char *)s->data, s->len, FLAG_NONE);
+    issqli = libinjection_is_sqli(&state);
+    if (!issqli) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_waf_rule_str_xss_handler(ngx_http_waf_public_rule_t *pr,
+    ngx_str_t *s)
+{
+    ngx_int_t       isxss;
+
+    if (s == NULL || s->data == NULL || s->len == 0) {
+        return NGX_ERROR;
+    }
+
+    isxss = libinjection_xss((const char *)s->data, s->len);
+    if (!isxss) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_waf_rule_hash_handler(ngx_http_waf_public_rule_t *pr, ngx_str_t *s)
+{
+    u_char   *p, *e;
+    u_char    digest[NGX_HTTP_WAF_DIGEST_MAX];
+
+    if (s == NULL || s->data == NULL || s->len == 0) {
+        return NGX_ERROR;
+    }
+
+    pr->hash->digest(digest, s);
+
+    p = pr->digests.data;
+    e = p + pr->digests.len;
+
+    for (/* void */; p < e; p += pr->hash->size) {
+        if (ngx_memcmp(p, digest, pr->hash->size) == 0) {
+            return pr->not? NGX_ERROR: NGX_OK;
+        }
+    }
+
+    return pr->not? NGX_OK: NGX_ERROR;
+}
+
+
+static void
+ngx_http_waf_digest_md5(u_char *dst, ngx_str_t *s)
+{
+    ngx_md5_t  md5;
+
+    ngx_md5_init(&md5);
+    ngx_md5_update(&md5, s->data, s->len);
+    ngx_md5_final(dst, &md5);
+}
+
+
+static void
+ngx_http_waf_digest_crc32_short(u_char *dst, ngx_str_t *s)
+{
+    uint32_t  crc;
+
+    crc = ngx_crc32_short(s->data, s->len);
+    ngx_memcpy(dst, &crc, sizeof(uint32_t));
+}
+
+
+static void
+ngx_http_waf_digest_crc32_long(u_char *dst, ngx_str_t *s)
+{
+    uint32_t  crc;
+
+    crc = ngx_crc32_long(s->data, s->len);
+    ngx_memcpy(dst, &crc, sizeof(uint32_t));
+}
+
+
+static void
+ngx_http_waf_md5_init(ngx_http_waf_digest_ctx_t *ctx)
+{
+    ngx_md5_init(&ctx->md5);
+}
+
+
+static void
+ngx_http_waf_md5_update(ngx_http_waf_digest_ctx_t *ctx, u_char *p,
+    size_t len)
+{
+    ngx_md5_update(&ctx->md5, p, len);
+}
+
+
+static void
+ngx_http_waf_md5_final(u_char *dst, ngx_http_waf_digest_ctx_t *ctx)
+{
+    ngx_md5_final(dst, &ctx->md5);
+}
+
+
+static void
+ngx_http_waf_crc32_init(ngx_http_waf_digest_ctx_t *ctx)
+{
+    ngx_crc32_init(ctx->crc32);
+}
+
+
+static void
+ngx_http_waf_crc32_update(ngx_http_waf_digest_ctx_t *ctx, u_char *p,
+    size_t len)
+{
+    ngx_crc32_update(&ctx->crc32, p, len);
+}
+
+
+static void
+ngx_http_waf_crc32_final(u_char *dst, ngx_http_waf_digest_ctx_t *ctx)
+{
+    ngx_crc32_final(ctx->crc32);
+    ngx_memcpy(dst, &ctx->crc32, sizeof(uint32_t));
+}
+
+
+// FIPS 180-4, nginx has no sha256 without openssl.
+static uint32_t  ngx_http_waf_sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ngx_http_waf_ror(x, n)  (((x) >> (n)) | ((x) << (32 - (n))))
+
+
+static void
+ngx_http_waf_sha256_block(uint32_t *st, u_char *p)
+{
+    uint32_t    a, b, c, d, e, f, g, h, t1, t2, w[64];
+    ngx_uint_t  i;
+
+    for (i = 0; i < 16; i++) {
+        w[i] = (uint32_t) p[4 * i] << 24 | (uint32_t) p[4 * i + 1] << 16
+               | (uint32_t) p[4 * i + 2] << 8 | (uint32_t) p[4 * i + 3];
+    }
+
+    for (i = 16; i < 64; i++) {
+        t1 = ngx_http_waf_ror(w[i - 15], 7) ^ ngx_http_waf_ror(w[i - 15], 18)
+             ^ (w[i - 15] >> 3);
+        t2 = ngx_http_waf_ror(w[i - 2], 17) ^ ngx_http_waf_ror(w[i - 2], 19)
+             ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + t1 + w[i - 7] + t2;
+    }
+
+    a = st[0]; b = st[1]; c = st[2]; d = st[3];
+    e = st[4]; f = st[5]; g = st[6]; h = st[7];
+
+    for (i = 0; i < 64; i++) {
+        t1 = h + (ngx_http_waf_ror(e, 6) ^ ngx_http_waf_ror(e, 11)
+                  ^ ngx_http_waf_ror(e, 25))
+             + ((e & f) ^ (~e & g)) + ngx_http_waf_sha256_k[i] + w[i];
+        t2 = (ngx_http_waf_ror(a, 2) ^ ngx_http_waf_ror(a, 13)
+              ^ ngx_http_waf_ror(a, 22))
+             + ((a & b) ^ (a & c) ^ (b & c));
+
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    st[0] += a; st[1] += b; st[2] += c; st[3] += d;
+    st[4] += e; st[5] += f; st[6] += g; st[7] += h;
+}
+
+
+static void
+ngx_http_waf_sha256_init(ngx_http_waf_digest_ctx_t *ctx)
+{
+    static uint32_t  iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    ngx_memcpy(ctx->sha256.st, iv, sizeof(iv));
+    ctx->sha256.len = 0;
+}
+
+
+static void
+ngx_http_waf_sha256_update(ngx_http_waf_digest_ctx_t *ctx, u_char *p,
+    size_t len)
+{
+    size_t                  n, used;
+    ngx_http_waf_sha256_t  *sha;
+
+    sha = &ctx->sha256;
+    used = (size_t) (sha->len & 63);
+    sha->len += len;
+
+    if (used) {
+        n = ngx_min(len, 64 - used);
+        ngx_memcpy(sha->buf + used, p, n);
+
+        if (used + n < 64) {
+            return;
+        }
+
+        ngx_http_waf_sha256_block(sha->st, sha->buf);
+        p += n;
+        len -= n;
+    }
+
+    for (/* void */; len >= 64; len -= 64, p += 64) {
+        ngx_http_waf_sha256_block(sha->st, p);
+    }
+
+    ngx_memcpy(sha->buf, p, len);
+}
+
+
+static void
+ngx_http_waf_sha256_final(u_char *dst, ngx_http_waf_digest_ctx_t *ctx)
+{
+    u_char                  buf[128];
+    size_t                  n, last;
+    uint64_t                bits;
+    ngx_uint_t              i;
+    ngx_http_waf_sha256_t  *sha;
+
+    sha = &ctx->sha256;
+    n = (size_t) (sha->len & 63);
+
+    // the padding and the bit length, one or two blocks.
+    ngx_memcpy(buf, sha->buf, n);
+    buf[n++] = 0x80;
+
+    last = (n <= 56) ? 64 : 128;
+    ngx_memzero(buf + n, last - n);
+
+    bits = sha->len * 8;
+    for (i = 0; i < 8; i++) {
+        buf[last - 1 - i] = (u_char) (bits >> (8 * i));
+    }
+
+    ngx_http_waf_sha256_block(sha->st, buf);
+    if (last == 128) {
+        ngx_http_waf_sha256_block(sha->st, buf + 64);
+    }
+
+    for (i = 0; i < 8; i++) {
+        dst[4 * i] = (u_char) (sha->st[i] >> 24);
+        dst[4 * i + 1] = (u_char) (sha->st[i] >> 16);
+        dst[4 * i + 2] = (u_char) (sha->st[i] >> 8);
+        dst[4 * i + 3] = (u_char) sha->st[i];
+    }
+}
+
+
+static void
+ngx_http_waf_digest_sha256(u_char *dst, ngx_str_t *s)
+{
+    ngx_http_waf_digest_ctx_t  ctx;
+
+    ngx_http_waf_sha256_init(&ctx);
+    ngx_http_waf_sha256_update(&ctx, s->data, s->len);
+    ngx_http_waf_sha256_final(dst, &ctx);
+}
+
+
+// the matcher results of the field are reused by the rules of matcher.
+static ngx_http_waf_match_t *
+ngx_http_waf_match_get(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx,
+    ngx_http_waf_matcher_t *m, ngx_uint_t side)
+{
+    ngx_http_waf_match_t         *mt;
+    ngx_http_waf_loc_conf_t      *wlcf;
+
+    if (ctx->matches == NULL) {
+        wlcf = ngx_http_get_module_loc_conf(r, ngx_http_waf_module);
+
+        ctx->matches = ngx_pcalloc(r->pool,
+            2 * wlcf->nmatchers * sizeof(ngx_http_waf_match_t));
+        if (ctx->matches == NULL) {
+            return NULL;
+        }
+    }
+
+    mt = &ctx->matches[2 * m->idx + side];
+    if (mt->hits == NULL) {
+        mt->hits = ngx_pnalloc(r->pool, (m->rules.nelts + 7) / 8);
+        if (mt->hits == NULL) {
+            return NULL;
+        }
+    }
+
+    return mt;
+}
+
+
+// as ngx_pnalloc(). a block is followed by a bigger one, the outgrown
+// block is freed when the field ends, its values may be in use.
+static void *
+ngx_http_waf_arena_alloc(ngx_http_request_t *r, ngx_http_waf_arena_t *a,
+    size_t size)
+{
+    u_char  *b;
+    size_t   n;
+
+    if ((size_t) (a->end - a->pos) < size) {
+        n = ngx_max((size_t) (a->end - a->start) * 2,
+                    ngx_max(size, NGX_HTTP_WAF_ARENA_SIZE));
+
+        // the block starts with the link of the retired ones.
+        b = ngx_palloc(r->pool, sizeof(u_char *) + n);
+        if (b == NULL) {
+            return NULL;
+        }
+
+        if (a->pos != a->start) {
+            *(u_char **) (a->start - sizeof(u_char *)) = a->retired;
+            a->retired = a->start - sizeof(u_char *);
+
+        } else if (a->start != NULL) {
+            ngx_pfree(r->pool, a->start - sizeof(u_char *));
+        }
+
+        a->start = b + sizeof(u_char *);
+        a->pos = a->start;
+        a->end = a->start + n;
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http waf arena block: %uz", n);
+    }
+
+    b = a->pos;
+    a->pos += size;
+    a->used += size;
 
-            cs = checks->elts;
-            for (k = 0; k < checks->nelts; k++) {
-                if (cs[k].tag.len != ss[j].tag.len || ngx_strncmp(
-                    cs[k].tag.data, ss[j].tag.data, cs[k].tag.len) != 0)
-                {
-                    continue;
-                }
+    return b;
+}
 
-                c = ngx_array_push(rule->score_checks);
-                if (c == NULL) {
-                    return NGX_ERROR;
-                }
 
-                c->idx = cs[k].idx;
-                c->tag = cs[k].tag;
-                c->threshold = cs[k].threshold;
-                c->action_flag = cs[k].action_flag;
-                c->score = ss[j].score;
+static void
+ngx_http_waf_arena_reset(ngx_http_request_t *r, ngx_http_waf_arena_t *a)
+{
+    u_char  *b, *next;
 
-                break;
-            }
-        }
+    if (a->used > a->peak) {
+        a->peak = a->used;
 
-        if (rule->score_checks == NULL || rule->score_checks->nelts == 0) {
-            ngx_http_waf_rule_set_sc_invalid(rule->sts);
-        }
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http waf arena high-water: %uz", a->peak);
+    }
 
+    for (b = a->retired; b != NULL; b = next) {
+        next = *(u_char **) b;
+        ngx_pfree(r->pool, b);
     }
 
-    return NGX_OK;
+    a->retired = NULL;
+    a->pos = a->start;
+    a->used = 0;
 }
 
 
-#if 0
-static char *
-ngx_http_waf_init_main_conf(ngx_conf_t *cf, void *conf)
+// the chunk runs through the stages from the i-th one, a stage writes to
+// the buffer the next one reads, the last one to *d.
+static ngx_int_t
+ngx_http_waf_decode_flow(ngx_http_waf_rule_decode_t **stages,
+    ngx_http_waf_decode_state_t *st, ngx_uint_t i, ngx_uint_t n,
+    u_char *p, u_char *e, u_char **d,
+    u_char (*buf)[NGX_HTTP_WAF_DECODE_BUF])
 {
-    ngx_http_waf_main_conf_t  *wmcf = conf;
+    u_char  *o;
 
-    if (wmcf->whitelists == NULL) {
-        return NGX_CONF_OK;
+    for ( /* void */ ; i < n; i++) {
+        o = (i == n - 1) ? *d : buf[i & 1];
+
+        e = stages[i]->handler(&st[i], o, p, e);
+        if (e == NULL) {
+            return NGX_ERROR;
+        }
+
+        p = o;
     }
 
-    // quick sort the whitelist array
-    ngx_qsort(wmcf->whitelists->elts, (size_t)wmcf->whitelists->nelts,
-        sizeof(ngx_http_waf_whitelist_t), ngx_http_waf_cmp_whitelist_id);
+    *d = e;
 
-    return NGX_CONF_OK;
+    return NGX_OK;
 }
-#endif
 
 
-/*
- * 白名单不会继承
- * 基础规则会继承并合并
- */
-static char *
-ngx_http_waf_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
+// the decode functions of a chain run in one pass over the field. no stage
+// outputs more than its input but the held bytes, so the chunks fit the
+// buffers between the stages and the value fits the field length. the
+// leading stages that would not change the field are skipped, if all of
+// them the field itself is the value.
+static ngx_int_t
+ngx_http_waf_decode_chain(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx,
+    ngx_array_t *chain, ngx_str_t *s, ngx_str_t *dst)
 {
-    ngx_http_waf_loc_conf_t    *prev = parent;
-    ngx_http_waf_loc_conf_t    *conf = child;
-    ngx_http_waf_main_conf_t   *wmcf;
-    ngx_array_t                *pr_array;  /* parent rules */
+    u_char                        *d, *p, *e, *o;
+    size_t                         size;
+    ngx_int_t                      rc;
+    ngx_uint_t                     i, n;
+    ngx_http_waf_rule_decode_t   **stages;
+    ngx_http_waf_decode_state_t    st[NGX_HTTP_WAF_DECODE_STAGES];
+    u_char                         buf[2][NGX_HTTP_WAF_DECODE_BUF];
+
+    stages = chain->elts;
+    n = chain->nelts;
+
+    for (i = 0; i < n; i++) {
+        rc = stages[i]->scan(s->data, s->data + s->len);
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
 
-    // NGX_CONF_UNSET
-    ngx_conf_merge_value(conf->security_waf, prev->security_waf, 0);
-    if (1 != conf->security_waf) {
-        conf->security_waf = 0;
-        return NGX_CONF_OK;
+        if (rc == NGX_OK) {
+            break;
+        }
     }
 
-    ngx_conf_merge_msec_value(conf->security_timeout,
-                              prev->security_timeout, 60000);
+    if (i == n) {
+        *dst = *s;
+        return NGX_OK;
+    }
 
-    wmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_waf_module);
-    if (wmcf == NULL) {
-        return NGX_CONF_ERROR;
+    stages += i;
+    n -= i;
+
+    dst->data = ngx_http_waf_arena_alloc(r, &ctx->arena, s->len + 1);
+    if (dst->data == NULL) {
+        return NGX_ERROR;
     }
 
-    if (conf->whitelists == NULL) conf->whitelists = prev->whitelists;
-    if (conf->whitelists != NULL) {
-        ngx_qsort(conf->whitelists->elts, (size_t)conf->whitelists->nelts,
-            sizeof(ngx_http_waf_whitelist_t), ngx_http_waf_cmp_whitelist_id);
+    ngx_memzero(st, n * sizeof(ngx_http_waf_decode_state_t));
+
+    // a single stage writes the value directly.
+    size = (n == 1) ? s->len : NGX_HTTP_WAF_DECODE_CHUNK;
+
+    d = dst->data;
+    e = s->data + s->len;
+
+    for (p = s->data; p < e; p += size) {
+        if (ngx_http_waf_decode_flow(stages, st, 0, n, p,
+                p + ngx_min(size, (size_t) (e - p)), &d, buf)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
     }
 
-    if (conf->check_rules == NULL) conf->check_rules = prev->check_rules;
+    // the rest of a stage runs through the next ones.
+    for (i = 0; i < n; i++) {
+        o = (i == n - 1) ? d : buf[i & 1];
 
-    pr_array = wmcf->url;
-    if (prev->url != NULL) {
-        pr_array = prev->url;
+        p = stages[i]->flush(&st[i], o);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (i == n - 1) {
+            d = p;
+            break;
+        }
+
+        if (ngx_http_waf_decode_flow(stages, st, i + 1, n, o, p, &d, buf)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
     }
 
-    if (ngx_http_waf_merge_rule_array(cf, conf->whitelists, conf->check_rules,
-        pr_array, &conf->url) != NGX_OK)
-    {
-        return NGX_CONF_ERROR;
+    dst->len = d - dst->data;
+
+    return NGX_OK;
+}
+
+
+// the field is decoded once per decode chain, the rules of the same chain
+// share the value.
+static ngx_int_t
+ngx_http_waf_decode_field(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx,
+    ngx_http_waf_public_rule_t *pr, ngx_str_t *s, ngx_uint_t side,
+    ngx_str_t *dst)
+{
+    ngx_int_t                     rc;
+    ngx_http_waf_decoded_t       *dc;
+    ngx_http_waf_main_conf_t     *wmcf;
+
+    *dst = *s;
+
+    if (pr->decode == 0) {
+        return NGX_OK;
     }
 
-    pr_array = wmcf->url_var;
-    if (prev->url_var != NULL) {
-        pr_array = prev->url_var;
+    if (ctx->decoded == NULL) {
+        wmcf = ngx_http_get_module_main_conf(r, ngx_http_waf_module);
+
+        ctx->decoded = ngx_pcalloc(r->pool,
+            2 * wmcf->decodes->nelts * sizeof(ngx_http_waf_decoded_t));
+        if (ctx->decoded == NULL) {
+            return NGX_ERROR;
+        }
     }
 
-    if (ngx_http_waf_merge_rule_array(cf, conf->whitelists, conf->check_rules,
-        pr_array, &conf->url_var) != NGX_OK)
-    {
-        return NGX_CONF_ERROR;
+    dc = &ctx->decoded[2 * (pr->decode - 1) + side];
+    if (dc->field == ctx->field) {
+        ctx->decode_hits++;
+        *dst = dc->value;
+        return dc->rc;
     }
 
-    if (ngx_http_waf_vars_in_hash(cf, conf->url_var,
-        &conf->url_var_hash) != NGX_OK)
-    {
-        return NGX_CONF_ERROR;
+    rc = ngx_http_waf_decode_chain(r, ctx, pr->decode_handlers, s, dst);
+    if (rc != NGX_OK) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+            "ngx http waf decode error");
+        *dst = *s;
+        rc = NGX_ABORT;
     }
 
-    pr_array = wmcf->args;
-    if (prev->args != NULL) {
-        pr_array = prev->args;
+    dc->field = ctx->field;
+    dc->value = *dst;
+    dc->rc = rc;
+
+    return rc;
+}
+
+
+// the lowercase view of the field is built once per decode chain, on the
+// first rule that needs it. the field itself if it has no uppercase.
+static ngx_int_t
+ngx_http_waf_lower_field(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx,
+    ngx_uint_t decode, ngx_uint_t side, ngx_str_t *s, ngx_str_t *lc)
+{
+    u_char                    *p, *e;
+    ngx_uint_t                 n;
+    ngx_http_waf_decoded_t    *lw;
+    ngx_http_waf_main_conf_t  *wmcf;
+
+    if (ctx->lowered == NULL) {
+        wmcf = ngx_http_get_module_main_conf(r, ngx_http_waf_module);
+
+        n = (wmcf->decodes != NULL) ? wmcf->decodes->nelts : 0;
+
+        ctx->lowered = ngx_pcalloc(r->pool,
+            2 * (n + 1) * sizeof(ngx_http_waf_decoded_t));
+        if (ctx->lowered == NULL) {
+            return NGX_ERROR;
+        }
     }
 
-    if (ngx_http_waf_merge_rule_array(cf, conf->whitelists, conf->check_rules,
-        pr_array, &conf->args) != NGX_OK)
-    {
-        return NGX_CONF_ERROR;
+    lw = &ctx->lowered[2 * decode + side];
+    if (lw->field == ctx->field) {
+        *lc = lw->value;
+        return NGX_OK;
     }
 
-    pr_array = wmcf->args_var;
-    if (prev->args_var != NULL) {
-        pr_array = prev->args_var;
+    e = s->data + s->len;
+    p = ngx_http_waf_str->upscan(s->data, e);
+
+    *lc = *s;
+
+    if (p != e) {
+        lc->data = ngx_http_waf_arena_alloc(r, &ctx->arena, s->len);
+        if (lc->data == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(lc->data, s->data, p - s->data);
+        ngx_http_waf_str->lowcase(lc->data + (p - s->data), p, e - p);
     }
 
-    if (ngx_http_waf_merge_rule_array(cf, conf->whitelists, conf->check_rules,
-        pr_array, &conf->args_var) != NGX_OK)
-    {
-        return NGX_CONF_ERROR;
+    lw->field = ctx->field;
+    lw->value = *lc;
+
+    return NGX_OK;
+}
+
+
+// return NGX_OK matched, NGX_ABORT decode error, else NGX_ERROR.
+static ngx_int_t
+ngx_http_waf_rule_str_exec(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx,
+    ngx_http_waf_rule_t *rule, ngx_str_t *s, ngx_uint_t side)
+{
+    ngx_int_t                     rc;
+    ngx_str_t                     dst, lc, *v;
+    ngx_http_waf_match_t         *mt;
+    ngx_http_waf_matcher_t       *m;
+    ngx_http_waf_public_rule_t   *pr;
+
+    m = rule->matcher;
+    mt = NULL;
+    pr = rule->p_rule;
+
+    if (m != NULL) {
+        mt = ngx_http_waf_match_get(r, ctx, m, side);
+        if (mt == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (mt->field == ctx->field) {
+            dst = mt->value;
+            goto hit;
+        }
     }
 
-    if (ngx_http_waf_vars_in_hash(cf, conf->args_var,
-        &conf->args_var_hash) != NGX_OK)
+    if (ngx_http_waf_decode_field(r, ctx, rule->p_rule, s, side, &dst)
+        != NGX_OK)
     {
-        return NGX_CONF_ERROR;
+        return NGX_ABORT;
     }
 
-    pr_array = wmcf->headers;
-    if (prev->headers != NULL) {
-        pr_array = prev->headers;
+    v = NULL;
+
+    if ((m != NULL) ? m->lower : pr->lower) {
+        if (ngx_http_waf_lower_field(r, ctx, pr->decode, side, &dst, &lc)
+            != NGX_OK)
+        {
+            return NGX_ABORT;
+        }
+
+        v = &lc;
     }
 
-    if (ngx_http_waf_merge_rule_array(cf, conf->whitelists, conf->check_rules,
-        pr_array, &conf->headers) != NGX_OK)
-    {
-        return NGX_CONF_ERROR;
+    if (m == NULL) {
+        rc = pr->handler(pr, pr->lower ? v : &dst);
+        if (rc == NGX_DECLINED) {
+            rc = ngx_http_waf_regex_limited(r, pr);
+        }
+
+        return rc;
     }
 
-    pr_array = wmcf->headers_var;
-    if (prev->headers_var != NULL) {
-        pr_array = prev->headers_var;
+    ngx_memzero(mt->hits, (m->rules.nelts + 7) / 8);
+    if (dst.len > 0) {
+        m->engine->exec(m, &dst, v, mt->hits);
     }
+    mt->field = ctx->field;
+    mt->value = dst;
 
-    if (ngx_http_waf_merge_rule_array(cf, conf->whitelists, conf->check_rules,
-        pr_array, &conf->headers_var) != NGX_OK)
+hit:
+
+    if (!ngx_http_waf_hit(mt->hits, rule->mid)) {
+        return NGX_ERROR;
+    }
+
+    if (!m->engine->prefilter) {
+        return NGX_OK;
+    }
+
+    // the required literal is found, pcre decides.
+    rc = rule->p_rule->handler(rule->p_rule, &dst);
+    if (rc == NGX_DECLINED) {
+        rc = ngx_http_waf_regex_limited(r, rule->p_rule);
+    }
+
+    return rc;
+}
+
+
+// NGX_OK if the rule matched the key or the value.
+static ngx_int_t
+ngx_http_waf_rule_str_match(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx,
+    ngx_http_waf_rule_t *rule, ngx_str_t *key, ngx_str_t *val)
+{
+    ngx_int_t                     rc, matched;
+
+    matched = NGX_DECLINED;
+
+    // match key
+    if (key != NULL && key->len > 0
+        && ngx_http_waf_mz_key(rule->m_zone->flag)
+        && !ngx_http_waf_rule_wl_mz_key(rule->sts))
     {
-        return NGX_CONF_ERROR;
+        rc = ngx_http_waf_rule_str_exec(r, ctx, rule, key, 0);
+        if (rc == NGX_ABORT) {
+            return matched;
+        }
+
+        if (rc == NGX_OK) {
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                "ngx http waf rule str match handler id:%ui, key:%V", rule->p_rule->id, key);
+
+            ngx_http_waf_score_calc(r, ctx, rule, *key);
+            matched = NGX_OK;
+        }
     }
 
-    if (ngx_http_waf_vars_in_hash(cf, conf->headers_var,
-        &conf->headers_var_hash) != NGX_OK)
+    // match value
+    if (val != NULL && val->len > 0
+        && ngx_http_waf_mz_val(rule->m_zone->flag)
+        && !ngx_http_waf_rule_wl_mz_val(rule->sts))
     {
-        return NGX_CONF_ERROR;
+        rc = ngx_http_waf_rule_str_exec(r, ctx, rule, val, 1);
+        if (rc == NGX_ABORT) {
+            return matched;
+        }
+
+        if (rc == NGX_OK) {
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                "ngx http waf rule str match handler id:%ui, val:%V", rule->p_rule->id, val);
+
+            ngx_http_waf_score_calc(r, ctx, rule, *val);
+            matched = NGX_OK;
+        }
     }
 
-    pr_array = wmcf->body;
-    if (prev->body != NULL) {
-        pr_array = prev->body;
+    return matched;
+}
+
+
+static void
+ngx_http_waf_hash_find(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx,
+    ngx_hash_t *hash, ngx_str_t *key, ngx_str_t *val, ngx_uint_t hk)
+{
+    ngx_str_t                     lc;
+    ngx_uint_t                    k;
+    ngx_hash_elt_t               *elt;
+    ngx_http_waf_rule_t          *rule;
+    ngx_http_waf_zone_t          *mzs;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+        "ngx http waf hash find handler");
+
+    if (hash == NULL || key == NULL || hash->size == 0 || key->len == 0) {
+        return;
     }
 
-    if (ngx_http_waf_merge_rule_array(cf, conf->whitelists, conf->check_rules,
-        pr_array, &conf->body) != NGX_OK)
-    {
-        return NGX_CONF_ERROR;
+    if (ngx_http_waf_lower_field(r, ctx, 0, 0, key, &lc) != NGX_OK) {
+        return;
     }
 
-    pr_array = wmcf->raw_body;
-    if (prev->raw_body != NULL) {
-        pr_array = prev->raw_body;
+    if (hk == 0) {
+        hk = ngx_hash_key(lc.data, lc.len);
     }
+    elt = hash->buckets[hk % hash->size];
 
-    if (ngx_http_waf_merge_rule_array(cf, conf->whitelists, conf->check_rules,
-        pr_array, &conf->raw_body) != NGX_OK)
-    {
-        return NGX_CONF_ERROR;
+    if (elt == NULL) {
+        return;
     }
 
-    pr_array = wmcf->body_var;
-    if (prev->body_var != NULL) {
-        pr_array = prev->body_var;
-    }
+    while (elt->value) {
+        if (lc.len != (size_t) elt->len
+            || ngx_memcmp(lc.data, elt->name, lc.len) != 0)
+        {
+            goto next;
+        }
 
-    if (ngx_http_waf_merge_rule_array(cf, conf->whitelists, conf->check_rules,
-        pr_array, &conf->body_var) != NGX_OK)
-    {
-        return NGX_CONF_ERROR;
-    }
+        rule = elt->value;
+        if (ngx_http_waf_rule_invalid(rule->sts)) {
+            goto next;
+        }
 
-    if (ngx_http_waf_vars_in_hash(cf, conf->body_var,
-        &conf->body_var_hash) != NGX_OK)
-    {
-        return NGX_CONF_ERROR;
-    }
+        if (rule->wl_zones != NULL) {
+            mzs = rule->wl_zones->elts;
+            for (k = 0; k < rule->wl_zones->nelts; k++) {
+                if (ngx_http_waf_mz_is_regex(mzs[k].flag)) {
+                    if (ngx_http_waf_zone_regex_exec(&mzs[k], key) == NGX_OK) {
+                        goto next;
+                    }
+                } else {
+                    if (key->len == mzs[k].name.len && ngx_strncasecmp(key->data,
+                        mzs[k].name.data, key->len) == 0)
+                    {
+                        goto next;
+                    }
+                }
+            }
+        }
 
-    pr_array = wmcf->body_file;
-    if (prev->body_file != NULL) {
-        pr_array = prev->body_file;
-    }
 
-    if (ngx_http_waf_merge_rule_array(cf, conf->whitelists, conf->check_rules,
-        pr_array, &conf->body_file) != NGX_OK)
-    {
-        return NGX_CONF_ERROR;
-    }
+        ngx_http_waf_rule_str_match(r, ctx, rule, key, val);
 
-    if (conf->log != NULL) {
-        return NGX_CONF_OK;
-    }
+    next:
 
-    conf->log = prev->log;
+        elt = (ngx_hash_elt_t *) ngx_align_ptr(&elt->name[0] + elt->len,
+                                               sizeof(void *));
+        continue;
+    }
 
-    return NGX_CONF_OK;
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+        "ngx http waf hash find done");
+    return;
 }
 
 
-// parse the rule item
-// include public rule and customer zones and whitelist.
+// NGX_OK if the rule is of the zone of the key, and not whitelisted.
 static ngx_int_t
-ngx_http_waf_parse_rule(ngx_conf_t *cf, ngx_http_waf_rule_opt_t *opt)
+ngx_http_waf_rule_zone(ngx_http_waf_rule_t *rule, ngx_str_t *key)
 {
-    ngx_int_t                    rc;
-    ngx_str_t                   *value;
-    ngx_flag_t                   vailid;
-    ngx_uint_t                   i, j;
-    ngx_http_waf_rule_parser_t  *parser;
-
-    value = cf->args->elts;
-
-    opt->p_rule = ngx_pcalloc(cf->pool, sizeof(ngx_http_waf_public_rule_t));
-    if (opt->p_rule == NULL) {
-        return NGX_ERROR;
-    }
-
-    opt->p_rule->decode_handlers = ngx_array_create(cf->pool, 2,
-        sizeof(ngx_http_waf_rule_decode_pt));
-    if (opt->p_rule->decode_handlers == NULL) {
-        return NGX_ERROR;
-    }
+    ngx_uint_t              k;
+    ngx_http_waf_zone_t    *mzs;
 
-    for(i = 1; i < cf->args->nelts; i++) {
-        vailid = 0;
-        for (j = 0; ngx_http_waf_rule_parser_item[j].prefix.data != NULL; j++) {
-            parser = &ngx_http_waf_rule_parser_item[j];
-            if (ngx_strncmp(value[i].data, parser->prefix.data,
-                parser->prefix.len) == 0) {
-                vailid = 1;
-                rc = parser->handler(cf, &value[i], parser, opt);
-                if (rc != NGX_OK) {
-                    return rc;
+    // wl_zones ngx_http_waf_zone_t
+    if (rule->wl_zones != NULL) {
+        mzs = rule->wl_zones->elts;
+        for (k = 0; k < rule->wl_zones->nelts; k++) {
+            if (ngx_http_waf_mz_is_regex(mzs[k].flag)) {
+                if (ngx_http_waf_zone_regex_exec(&mzs[k], key) == NGX_OK) {
+                    return NGX_DECLINED;
+                }
+            } else {
+                if (key->len == mzs[k].name.len && ngx_strncasecmp(key->data,
+                    mzs[k].name.data, key->len) == 0)
+                {
+                    return NGX_DECLINED;
                 }
             }
         }
+    }
 
-        if (!vailid) {
-            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                               "invalid arguments \"%s\" in \"%s\" directive",
-                               value[i].data, value[0].data);
-            return NGX_ERROR;
-        }
+    if (ngx_http_waf_mz_is_general(rule->m_zone->flag)) {
+        return NGX_OK;
     }
 
-    return NGX_OK;
+    if (ngx_http_waf_mz_is_regex(rule->m_zone->flag)
+        && ngx_http_waf_zone_regex_exec(rule->m_zone, key) == NGX_OK)
+    {
+        return NGX_OK;
+    }
+
+    return NGX_DECLINED;
 }
 
 
 static ngx_int_t
-ngx_http_waf_add_rule_handler(ngx_conf_t *cf, ngx_http_waf_public_rule_t *pr,
-    ngx_http_waf_zone_t *mz, void *conf, ngx_uint_t offset)
+ngx_http_waf_rule_filter(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx,
+  ngx_hash_t *hash, ngx_array_t *rule,
+  ngx_str_t *key, ngx_str_t *val, ngx_uint_t key_hash)
 {
-    char  *p = conf;
+    ngx_int_t               rc;
+    ngx_uint_t              j;
+    ngx_http_waf_rule_t    *rs;
 
-    ngx_array_t           **a;
-    ngx_http_waf_rule_t    *r;
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+        "ngx http waf rule filter handler");
 
-    // maybe the rule is whiterlist.
-    if (pr == NULL) {
-        return NGX_OK;
+    // a new field, the matcher results and the decoded values are expired.
+    ctx->field++;
+    ngx_http_waf_arena_reset(r, &ctx->arena);
+
+    ngx_http_waf_hash_find(r, ctx, hash, key, val, key_hash);
+
+    if (rule == NULL) {
+        goto done;
     }
 
-    a = (ngx_array_t **)(p + offset);
+    rs = rule->elts;
+    for (j = 0; j < rule->nelts; j++) {
+        if (ngx_http_waf_rule_invalid(rs[j].sts)) {
+            goto nxt_rule;
+        }
 
-    if (*a == NULL) {
-        *a = ngx_array_create(cf->pool, 3, sizeof(ngx_http_waf_rule_t));
-        if (*a == NULL) {
-            return NGX_ERROR;
+        if (ctx->once != NULL && ngx_http_waf_hit(ctx->once, j)) {
+            goto nxt_rule;
         }
-    }
 
-    r = ngx_array_push(*a);
-    if (r == NULL) {
-        return NGX_ERROR;
+        if (ngx_http_waf_rule_zone(&rs[j], key) != NGX_OK) {
+            goto nxt_rule;
+        }
+
+        rc = ngx_http_waf_rule_str_match(r, ctx, &rs[j], key, val);
+
+        // the rule scores once over the chunks of the value.
+        if (rc == NGX_OK && ctx->once != NULL) {
+            ngx_http_waf_set_hit(ctx->once, j);
+        }
+
+    nxt_rule:
+
+        if (ngx_http_waf_score_is_done(ctx->status)) {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                "ngx http waf rule filter handler block");
+            return NGX_ABORT;
+        }
+
+        // if (ngx_http_waf_score_timeout())
+
+        continue;
     }
 
-    ngx_memzero(r, sizeof(ngx_http_waf_rule_t));
+done:
 
-    r->m_zone = mz;
-    r->p_rule = pr;
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+        "ngx http waf rule filter handler done");
 
     return NGX_OK;
 }
 
 
-static ngx_int_t
-ngx_http_waf_add_wl_part_handler(ngx_conf_t *cf,
-    ngx_http_waf_zone_t *mz, void *wl, ngx_uint_t offset)
+// the states of the matchers of the rules over the chunks of a value.
+static ngx_array_t *
+ngx_http_waf_stream_create(ngx_pool_t *pool, ngx_array_t *a)
 {
-    char *p = wl;
+    ngx_uint_t               i, j;
+    ngx_array_t             *streams;
+    ngx_http_waf_rule_t     *rules;
+    ngx_http_waf_stream_t   *ss;
+    ngx_http_waf_matcher_t  *m;
+
+    streams = ngx_array_create(pool, 2, sizeof(ngx_http_waf_stream_t));
+    if (streams == NULL) {
+        return NULL;
+    }
 
-    ngx_array_t                **a;
-    ngx_http_waf_zone_t         *z;
+    rules = a->elts;
+    for (j = 0; j < a->nelts; j++) {
+        m = rules[j].matcher;
 
-    a = (ngx_array_t **)(p + offset);
+        ss = streams->elts;
+        for (i = 0; i < streams->nelts; i++) {
+            if (ss[i].matcher == m) {
+                break;
+            }
+        }
 
-    if (*a == NULL) {
-        *a = ngx_array_create(cf->pool, 2, sizeof(ngx_http_waf_zone_t));
-        if (*a == NULL) {
-            return NGX_ERROR;
+        if (i < streams->nelts) {
+            continue;
         }
-    }
 
-    z = ngx_array_push(*a);
-    if (z == NULL) {
-        return NGX_ERROR;
+        ss = ngx_array_push(streams);
+        if (ss == NULL) {
+            return NULL;
+        }
+
+        ngx_memzero(ss, sizeof(ngx_http_waf_stream_t));
+        ss->matcher = m;
+
+        ss->hits = ngx_pcalloc(pool, (m->rules.nelts + 7) / 8);
+        if (ss->hits == NULL) {
+            return NULL;
+        }
     }
-    *z = *mz;
 
-    return NGX_OK;
+    return streams;
 }
 
 
-static ngx_int_t
-ngx_http_waf_add_whitelist(ngx_conf_t *cf, ngx_http_waf_rule_opt_t *opt,
-    ngx_array_t **a)
+// a new value, e.g. the next file of the body.
+static void
+ngx_http_waf_stream_reset(ngx_array_t *streams)
 {
-    ngx_int_t                   *id, rc;
-    ngx_flag_t                   vailid;
-    ngx_uint_t                   i, j, k;
-    ngx_http_waf_whitelist_t    *wl;
-    ngx_http_waf_zone_t         *zones;
-    ngx_http_waf_add_wl_part_t  *add_wl;
+    ngx_uint_t              i;
+    ngx_http_waf_stream_t  *ss;
 
-    if (opt->wl_ids == NULL) return NGX_OK;
+    ss = streams->elts;
+    for (i = 0; i < streams->nelts; i++) {
+        ngx_memzero(ss[i].hits, (ss[i].matcher->rules.nelts + 7) / 8);
+        ss[i].started = 0;
+    }
+}
 
-    if (*a == NULL) {
-        *a = ngx_array_create(cf->pool, 3, sizeof(ngx_http_waf_whitelist_t));
-        if (*a == NULL) {
+
+// the chunk of the value through the matchers of the rules. a rule hit
+// scores once for the value, with the chunk it is found in. the key is
+// matched as a field.
+static ngx_int_t
+ngx_http_waf_stream_filter(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx,
+    ngx_array_t *a, ngx_array_t *streams, u_char *once, ngx_str_t *key,
+    u_char *p, u_char *e, ngx_uint_t last)
+{
+    ngx_str_t                val;
+    ngx_uint_t               i, j;
+    ngx_http_waf_rule_t     *rules;
+    ngx_http_waf_stream_t   *ss;
+
+    ss = streams->elts;
+    for (i = 0; i < streams->nelts; i++) {
+        if (ss[i].matcher->engine->stream(r->pool, &ss[i], p, e, last)
+            != NGX_OK)
+        {
             return NGX_ERROR;
         }
     }
 
-    id = opt->wl_ids->elts;
-    for (i = 0; i < opt->wl_ids->nelts; i++) {
-        wl = ngx_array_push(*a);
-        if (wl == NULL) {
-            return NGX_ERROR;
-        }
+    val.data = p;
+    val.len = e - p;
 
-        ngx_memzero(wl, sizeof(ngx_http_waf_whitelist_t));
+    ctx->field++;
+    ngx_http_waf_arena_reset(r, &ctx->arena);
 
-        wl->id = id[i];
-        if (opt->m_zones == NULL || opt->m_zones->nelts == 0) {
-            wl->all_zones = 1;
+    rules = a->elts;
+    for (j = 0; j < a->nelts; j++) {
+        if (ngx_http_waf_rule_invalid(rules[j].sts)
+            || ngx_http_waf_hit(once, j)
+            || ngx_http_waf_rule_zone(&rules[j], key) != NGX_OK)
+        {
             continue;
         }
 
-        zones = opt->m_zones->elts;
-        for (j = 0; j < opt->m_zones->nelts; j++) {
-            vailid = 0;
-            for (k = 0; ngx_http_waf_conf_add_wl[k].flag !=0; k++) {
-
-                add_wl = &ngx_http_waf_conf_add_wl[k];
-                if (!(zones[j].flag & add_wl->flag)) {
-                    continue;
-                }
+        for (i = 0; ss[i].matcher != rules[j].matcher; i++) { /* void */ }
 
-                vailid = 1;
-                rc = add_wl->handler(cf, &zones[j], wl, add_wl->offset);
-                if (rc != NGX_OK) {
-                    return NGX_ERROR;
-                }
-                break;
-            }
+        if (ngx_http_waf_mz_val(rules[j].m_zone->flag)
+            && !ngx_http_waf_rule_wl_mz_val(rules[j].sts)
+            && ngx_http_waf_hit(ss[i].hits, rules[j].mid))
+        {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                "ngx http waf stream match id:%ui", rules[j].p_rule->id);
 
-            if (!vailid) {
-                 ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                               "invalid whitelist zone");
-                 return NGX_ERROR;
-            }
+            ngx_http_waf_score_calc(r, ctx, &rules[j], val);
+            ngx_http_waf_set_hit(once, j);
+
+        } else if (key != NULL
+                   && ngx_http_waf_rule_str_match(r, ctx, &rules[j], key,
+                                                  NULL)
+                      == NGX_OK)
+        {
+            ngx_http_waf_set_hit(once, j);
+        }
+
+        if (ngx_http_waf_score_is_done(ctx->status)) {
+            return NGX_DONE;
         }
     }
 
@@ -1719,2074 +10386,2467 @@ ngx_http_waf_add_whitelist(ngx_conf_t *cf, ngx_http_waf_rule_opt_t *opt,
 }
 
 
-static char *
-ngx_http_waf_main_rule(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+static ngx_int_t
+ngx_http_waf_field_add(ngx_http_waf_ctx_t *ctx, ngx_uint_t zone,
+    ngx_str_t *key, ngx_str_t *val, ngx_uint_t hash, ngx_uint_t flags)
 {
-    ngx_int_t                        rc;
-    ngx_flag_t                       vailid;
-    ngx_uint_t                       i, j;
-    ngx_http_waf_main_conf_t        *wmcf = conf;
-    ngx_http_waf_rule_opt_t          opt;
-    ngx_http_waf_zone_t             *zone;
+    ngx_http_waf_field_t  *fd;
 
-    ngx_memzero(&opt, sizeof(ngx_http_waf_rule_opt_t));
-    if (ngx_http_waf_parse_rule(cf, &opt) != NGX_OK) {
-        return NGX_CONF_ERROR;
+    fd = ngx_array_push(ctx->fields);
+    if (fd == NULL) {
+        return NGX_ERROR;
     }
 
-    if (opt.p_rule == NULL || opt.p_rule->id == 0) {
-        return "the rule error";
-    }
+    fd->zone = zone;
+    fd->key = *key;
+    fd->val = *val;
+    fd->hash = hash;
+    fd->flags = flags;
 
-    // http block is not allowed whitelist.
-    if (opt.wl_ids != NULL) {
-        return "the whitelist is not allowed here";
+    return NGX_OK;
+}
+
+
+// the url, args and headers in the field table, by zones. the hash of an
+// arg key is computed as it is split, the header one is of the parser.
+static ngx_int_t
+ngx_http_waf_field_table(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx)
+{
+    u_char                       *p, *t, *e;
+    ngx_str_t                     key, val;
+    ngx_uint_t                    i;
+    ngx_list_part_t              *part;
+    ngx_table_elt_t              *header;
+
+    ctx->fields = ngx_array_create(r->pool,
+        r->headers_in.headers.part.nelts + 16, sizeof(ngx_http_waf_field_t));
+    if (ctx->fields == NULL) {
+        return NGX_ERROR;
     }
 
-    if (opt.m_zones == NULL || opt.m_zones->nelts == 0) {
-        return "the rule lack of zone";
+    // url
+    ctx->zones[NGX_HTTP_WAF_FIELD_URL] = 0;
+
+    if (ngx_http_waf_field_add(ctx, NGX_HTTP_WAF_FIELD_URL, &r->uri, &r->uri,
+            ngx_hash_key_lc(r->uri.data, r->uri.len), 0)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
     }
 
-    zone = opt.m_zones->elts;
-    for (i = 0; i < opt.m_zones->nelts; i++) {
-        vailid = 0;
-        for (j = 0; ngx_http_waf_conf_add_rules[j].flag != 0; j++) {
-            if (!(ngx_http_waf_conf_add_rules[j].flag & zone[i].flag)) {
-                continue;
-            }
+    // args, as the urlencoded body: the key is up to the first '=', the
+    // value has a byte at least and is up to the next '&'. the bytes
+    // without a '=' are the value of an empty key.
+    ctx->zones[NGX_HTTP_WAF_FIELD_ARGS] = ctx->fields->nelts;
 
-            rc = ngx_http_waf_conf_add_rules[j].handler(cf, opt.p_rule,
-                &zone[i], wmcf, ngx_http_waf_conf_add_rules[j].offset);
+    p = r->args.data;
+    e = r->args.data + r->args.len;
 
-            if (rc != NGX_OK) {
-                return NGX_CONF_ERROR;
+    while (p < e) {
+        t = ngx_http_waf_str->chrscan(p, e, '=');
+
+        if (t == e) {
+            ngx_str_null(&key);
+            val.data = p;
+            val.len = e - p;
+
+            if (ngx_http_waf_field_add(ctx, NGX_HTTP_WAF_FIELD_ARGS, &key,
+                    &val, 0, NGX_HTTP_WAF_FIELD_NO_KEY)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
             }
-            vailid = 1;
+
             break;
         }
 
-        if (!vailid) {
-            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                           "invalid mask zone \"%d\"", zone[i].flag);
-            return NGX_CONF_ERROR;
-        }
-    }
+        key.data = p;
+        key.len = t - p;
 
-    return NGX_CONF_OK;
-}
+        p = t + 1;
+        if (p == e) {
+            break;
+        }
 
+        t = ngx_http_waf_str->chrscan(p + 1, e, '&');
 
-static char *
-ngx_http_waf_loc_rule(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
-{
-    ngx_int_t                        rc;
-    ngx_flag_t                       vailid;
-    ngx_uint_t                       i, j;
-    ngx_http_waf_loc_conf_t         *wlcf = conf;
-    ngx_http_waf_rule_opt_t          opt;
-    ngx_http_waf_zone_t             *zones;
+        val.data = p;
+        val.len = t - p;
 
-    ngx_memzero(&opt, sizeof(ngx_http_waf_rule_opt_t));
-    if (ngx_http_waf_parse_rule(cf, &opt) != NGX_OK) {
-        return NGX_CONF_ERROR;
-    }
+        if (ngx_http_waf_field_add(ctx, NGX_HTTP_WAF_FIELD_ARGS, &key, &val,
+                ngx_hash_key_lc(key.data, key.len), 0)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
 
-    if (opt.wl_ids == NULL && opt.m_zones->nelts == 0) {
-        return "lack of zone";
-    }
+        if (t == e) {
+            break;
+        }
 
-    // add whitelist
-    rc = ngx_http_waf_add_whitelist(cf, &opt, &wlcf->whitelists);
-    if (rc != NGX_OK) {
-        return NGX_CONF_ERROR;
+        p = t + 1;
     }
 
-    if (opt.p_rule->id > 0) {
+    // headers
+    ctx->zones[NGX_HTTP_WAF_FIELD_HEADERS] = ctx->fields->nelts;
 
-        zones = opt.m_zones->elts;
-        for (i = 0; i < opt.m_zones->nelts; i++) {
-            vailid = 0;
-            for (j = 0; ngx_http_waf_conf_add_rules[j].flag != 0; j++) {
-                if (!(ngx_http_waf_conf_add_rules[j].flag & zones[i].flag)) {
-                    continue;
-                }
+    part = &r->headers_in.headers.part;
+    header = part->elts;
 
-                rc = ngx_http_waf_conf_add_rules[j].handler(cf, opt.p_rule,
-                    &zones[i], wlcf, ngx_http_waf_conf_add_rules[j].loc_offset);
+    for (i = 0; /* void */; i++) {
 
-                if (rc != NGX_OK) {
-                    return NGX_CONF_ERROR;
-                }
-                vailid = 1;
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
                 break;
             }
 
-            if (!vailid) {
-                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                               "invalid mask zone \"%d\"", zones[i].flag);
-                return NGX_CONF_ERROR;
-            }
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        if (ngx_http_waf_field_add(ctx, NGX_HTTP_WAF_FIELD_HEADERS,
+                &header[i].key, &header[i].value, header[i].hash, 0)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
         }
     }
 
-    return NGX_CONF_OK;
+    ctx->zones[NGX_HTTP_WAF_FIELD_ZONES] = ctx->fields->nelts;
+
+    return NGX_OK;
 }
 
 
-// "$LABLE >=  4" or "$LABLE>=4"
-static ngx_int_t
-ngx_http_waf_parse_check(ngx_str_t *itm, ngx_http_waf_check_t *c)
+// the fields of a zone by the rules of it.
+static void
+ngx_http_waf_score_fields(ngx_http_request_t *r, ngx_http_waf_loc_conf_t *wlcf,
+    ngx_uint_t zone, ngx_hash_t *hash, ngx_array_t *rules)
 {
-    u_char        *p, *s, *e;
-
-    e = itm->data + itm->len;
-    p = itm->data;
+    ngx_uint_t                    i;
+    ngx_http_waf_ctx_t           *ctx;
+    ngx_http_waf_field_t         *fd;
 
-    if (*p != '$') {
-        return NGX_ERROR;
+    ctx = ngx_http_get_module_ctx(r, ngx_http_waf_module);
+    if (ctx == NULL || ctx->fields == NULL
+        || ngx_http_waf_score_is_done(ctx->status))
+    {
+        return;
     }
-    p++;
 
-    // tag. separator: '>' or ' '
-    s = ngx_http_waf_score_tag(p, e, "> ");
-    if (s == NULL) {
-        return NGX_ERROR;
+    if (ngx_http_waf_score_timeout(r, wlcf) == NGX_OK) {
+        return;
     }
-    c->tag.data = p;
-    c->tag.len  = s - p;
 
-    while (*s == ' ' || *s == '>') s++;
+    fd = ctx->fields->elts;
 
-    c->threshold = ngx_atoi(s, e - s);
-    if (c->threshold == NGX_ERROR) {
-        return NGX_ERROR;
-    }
+    for (i = ctx->zones[zone]; i < ctx->zones[zone + 1]; i++) {
 
-    return NGX_OK;
+        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+            "http waf module score field %ui key:%V val:%V",
+            zone, &fd[i].key, &fd[i].val);
+
+        ngx_http_waf_rule_filter(r, ctx, hash, rules, &fd[i].key, &fd[i].val,
+            fd[i].hash);
+
+        if (ngx_http_waf_score_is_done(ctx->status)) {
+            return;
+        }
+
+        if (ngx_http_waf_score_timeout(r, wlcf) == NGX_OK) {
+            return;
+        }
+    }
 }
 
 
-static char *
-ngx_http_waf_check_rule(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+static void
+ngx_http_waf_score_url(ngx_http_request_t *r, ngx_http_waf_loc_conf_t *wlcf)
 {
-    ngx_http_waf_loc_conf_t         *wlcf = conf;
-    ngx_http_waf_check_t            *check;
-    ngx_http_variable_t             *var;
-    ngx_conf_bitmask_t              *m;
-    ngx_str_t                       *value, v;
-    ngx_int_t                        i;
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                    "http waf module score url: %V", &r->uri);
 
-    value = cf->args->elts;
+    ngx_http_waf_score_fields(r, wlcf, NGX_HTTP_WAF_FIELD_URL,
+        &wlcf->url_var_hash, wlcf->url);
+}
 
-    if (wlcf->check_rules == NULL) {
 
-        wlcf->check_rules = ngx_array_create(cf->pool, 3,
-            sizeof(ngx_http_waf_check_t));
-        if (wlcf->check_rules == NULL) {
-            return NGX_CONF_ERROR;
-        }
-    }
+static void
+ngx_http_waf_score_args(ngx_http_request_t *r, ngx_http_waf_loc_conf_t *wlcf)
+{
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                    "http waf module score args: %V", &r->args);
 
-    check = ngx_array_push(wlcf->check_rules);
-    if (check == NULL) {
-        return NGX_CONF_ERROR;
-    }
+    ngx_http_waf_score_fields(r, wlcf, NGX_HTTP_WAF_FIELD_ARGS,
+        &wlcf->args_var_hash, wlcf->args);
+}
 
-    ngx_memzero(check, sizeof(ngx_http_waf_check_t));
 
-    check->idx = wlcf->check_rules->nelts - 1;
+static void
+ngx_http_waf_score_headers(ngx_http_request_t *r, ngx_http_waf_loc_conf_t *wlcf)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                    "http waf module score headers ...");
 
-    if (ngx_http_waf_parse_check(&value[1], check) != NGX_OK) {
-        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-            "invalid arguments \"%V\"", &value[1]);
-        return NGX_CONF_ERROR;
-    }
+    ngx_http_waf_score_fields(r, wlcf, NGX_HTTP_WAF_FIELD_HEADERS,
+        &wlcf->headers_var_hash, wlcf->headers);
+}
 
-    m = cmd->post;
-    for (i = 0; m[i].name.len != 0; i++) {
-        if (value[2].len == m[i].name.len
-            && ngx_strncmp(value[2].data, m[i].name.data, m[i].name.len) == 0) {
 
-            check->action_flag = m[i].mask;
-            return NGX_CONF_OK;
-        }
+// the buffer of the parser has room for n more bytes.
+static ngx_int_t
+ngx_http_waf_json_reserve(ngx_http_request_t *r, u_char **buf, size_t *size,
+    size_t len, size_t n)
+{
+    u_char  *p;
+    size_t   want;
+
+    if (len + n <= *size) {
+        return NGX_OK;
     }
 
-    v = value[2];
-    if (v.data[0] == '$') {
-        ngx_http_waf_act_set_var_block(check->action_flag);
-        v.data += 1;
-        v.len -= 1;
-        var = ngx_http_add_variable(cf, &v,
-            NGX_HTTP_VAR_CHANGEABLE
-            |NGX_HTTP_VAR_NOCACHEABLE
-            |NGX_HTTP_VAR_NOHASH);
+    want = ngx_max(*size * 2, len + n);
+    want = ngx_max(want, 256);
 
-        var->get_handler = ngx_http_waf_check_variable;
+    p = ngx_pnalloc(r->pool, want);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
 
-        return NGX_CONF_OK;
+    if (*buf != NULL) {
+        ngx_memcpy(p, *buf, len);
+        ngx_pfree(r->pool, *buf);
     }
 
-    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-            "invalid arguments \"%V\"", &value[2]);
+    *buf = p;
+    *size = want;
 
-    return NGX_CONF_ERROR;
+    return NGX_OK;
 }
 
 
-static char *
-ngx_http_waf_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+// the closing '"' of the string after the '"', or NULL if it is not in
+// the bytes.
+static u_char *
+ngx_http_waf_json_string_end(u_char *p, u_char *e)
 {
-    ngx_http_waf_loc_conf_t    *wlcf = conf;
+    for (/* void */; p < e && *p != '"'; p++) {
+        if (*p == '\\') {
+            p++;
+        }
+    }
 
-    ngx_str_t                  *value;
-    ngx_syslog_peer_t          *peer;
+    return (p < e) ? p : NULL;
+}
 
-    value = cf->args->elts;
 
-    if (wlcf->log != NULL) {
-        return "is duplicate";
+// the string between the '"', a slice of the body if it has no escapes,
+// else unescaped to js->buf.
+static ngx_int_t
+ngx_http_waf_json_string(ngx_http_request_t *r, ngx_http_waf_json_t *js,
+    u_char *p, u_char *q, ngx_str_t *s)
+{
+    u_char      *d, c;
+    ngx_uint_t   u, lo;
+
+    s->data = p;
+    s->len = q - p;
+
+    if (ngx_strlchr(p, q, '\\') == NULL) {
+        return NGX_OK;
     }
 
-    wlcf->log = ngx_pcalloc(cf->pool, sizeof(ngx_http_waf_log_t));
-    if (wlcf->log == NULL) {
-        return NGX_CONF_ERROR;
+    // the escapes are longer than the characters.
+    if (ngx_http_waf_json_reserve(r, &js->buf, &js->buf_size, 0, q - p)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
     }
 
-    if (ngx_strncmp(value[1].data, "off", 3) == 0) {
-        wlcf->log->off = 1;
+    d = js->buf;
 
-    } else if (ngx_strncmp(value[1].data, "syslog:", 7) == 0) {
-        peer = ngx_pcalloc(cf->pool, sizeof(ngx_syslog_peer_t));
-        if (peer == NULL) {
-            return NGX_CONF_ERROR;
+    while (p < q) {
+        if (*p != '\\') {
+            *d++ = *p++;
+            continue;
         }
 
-        if (ngx_syslog_process_conf(cf, peer) != NGX_CONF_OK) {
-            return NGX_CONF_ERROR;
-        }
+        p++;
+        c = *p++;
 
-        wlcf->log->writer = ngx_http_waf_syslog_writer;
-        wlcf->log->wdata = peer;
-        wlcf->log->off = 0;
+        switch (c) {
+        case 'b':
+            *d++ = '\b';
+            break;
+        case 'f':
+            *d++ = '\f';
+            break;
+        case 'n':
+            *d++ = '\n';
+            break;
+        case 'r':
+            *d++ = '\r';
+            break;
+        case 't':
+            *d++ = '\t';
+            break;
 
-    } else {
-        wlcf->log->file = ngx_conf_open_file(cf->cycle, &value[1]);
-        if (wlcf->log->file == NULL) {
-            return NGX_CONF_ERROR;
-        }
-        wlcf->log->off = 0;
-    }
+        case 'u':
+            if (q - p < 4 || (u = ngx_hextoi(p, 4)) == (ngx_uint_t) NGX_ERROR)
+            {
+                return NGX_ERROR;
+            }
 
-    wlcf->log->flat = 1;
-    if (cf->args->nelts == 3 && ngx_strncmp(value[2].data, "unflat", 6) == 0) {
-        wlcf->log->flat = 0;
-    }
+            p += 4;
 
-    return NGX_CONF_OK;
-}
+            // a surrogate pair
+            if (u >= 0xd800 && u <= 0xdbff && q - p >= 6
+                && p[0] == '\\' && p[1] == 'u')
+            {
+                lo = ngx_hextoi(p + 2, 4);
+                if (lo >= 0xdc00 && lo <= 0xdfff) {
+                    u = 0x10000 + ((u - 0xd800) << 10) + (lo - 0xdc00);
+                    p += 6;
+                }
+            }
 
+            if (u < 0x80) {
+                *d++ = (u_char) u;
 
-static ngx_int_t
-ngx_http_waf_decode_base64(ngx_http_request_t *r,
-    ngx_str_t *dst, ngx_str_t *src, ngx_uint_t destory)
-{
-    dst->len = ngx_base64_decoded_length(src->len);
-    dst->data = ngx_pnalloc(r->pool, dst->len + 1);
-    if (dst->data == NULL) {
-        return NGX_ERROR;
-    }
+            } else if (u < 0x800) {
+                *d++ = (u_char) (0xc0 | (u >> 6));
+                *d++ = (u_char) (0x80 | (u & 0x3f));
 
-    if (ngx_decode_base64(dst, src) != NGX_OK) {
-        return NGX_ERROR;
-    }
+            } else if (u < 0x10000) {
+                *d++ = (u_char) (0xe0 | (u >> 12));
+                *d++ = (u_char) (0x80 | ((u >> 6) & 0x3f));
+                *d++ = (u_char) (0x80 | (u & 0x3f));
+
+            } else {
+                *d++ = (u_char) (0xf0 | (u >> 18));
+                *d++ = (u_char) (0x80 | ((u >> 12) & 0x3f));
+                *d++ = (u_char) (0x80 | ((u >> 6) & 0x3f));
+                *d++ = (u_char) (0x80 | (u & 0x3f));
+            }
+
+            break;
 
-    if (destory && src->data != NULL) {
-        ngx_pfree(r->pool, src->data);
-        src->data = NULL;
-        src->len = 0;
+        default: /* '"', '\\', '/' */
+            *d++ = c;
+        }
     }
 
+    s->data = js->buf;
+    s->len = d - js->buf;
+
     return NGX_OK;
 }
 
 
+// the scalars and strings of the json body are the values of the BODY
+// zone, their dotted paths the keys. the body is walked once as it
+// arrives, no document is built and a string without escapes is not
+// copied. *pos is set to a token not ended in the bytes.
 static ngx_int_t
-ngx_http_waf_decode_url(ngx_http_request_t *r,
-    ngx_str_t *dst, ngx_str_t *src, ngx_uint_t destory)
+ngx_http_waf_json_parse(ngx_http_request_t *r, ngx_http_waf_loc_conf_t *wlcf,
+    ngx_http_waf_ctx_t *ctx, u_char **pos, u_char *e, ngx_uint_t last)
 {
-    u_char     *d, *s, *p;
+    u_char                 *p, *q, *start;
+    ngx_str_t               key, val;
+    ngx_http_waf_body_t    *b;
+    ngx_http_waf_json_t    *js;
 
-    d = ngx_pnalloc(r->pool, src->len);
-    if (d == NULL) {
-        return NGX_ERROR;
-    }
+    enum {
+        sw_value = 0,
+        sw_value_or_end,
+        sw_key,
+        sw_key_or_end,
+        sw_colon,
+        sw_next,
+        sw_done
+    };
 
-    s = src->data;
-    p = d;
+    b = &ctx->body;
+    js = b->doc;
 
-    ngx_http_waf_unescape_uri(&p, &s, src->len, 0);
+    if (js == NULL) {
+        js = ngx_pcalloc(r->pool, sizeof(ngx_http_waf_json_t));
+        if (js == NULL) {
+            return NGX_ERROR;
+        }
 
-    dst->data = d;
-    dst->len  = p - d;
+        js->open = ngx_pnalloc(r->pool, wlcf->body_depth_limit + 1);
+        js->path_len = ngx_palloc(r->pool,
+                                  (wlcf->body_depth_limit + 1)
+                                  * sizeof(size_t));
+        if (js->open == NULL || js->path_len == NULL) {
+            return NGX_ERROR;
+        }
 
-    if (destory && src->data != NULL) {
-        ngx_pfree(r->pool, src->data);
-        src->data = NULL;
-        src->len = 0;
+        b->doc = js;
+        b->state = sw_value;
     }
 
-    return NGX_OK;
-}
+    p = *pos;
+    start = p;
 
+    for ( ;; ) {
+        while (p < e && (*p == ' ' || *p == '\t' || *p == CR || *p == LF)) {
+            p++;
+        }
 
-static ngx_int_t
-ngx_http_waf_parse_rule_id(ngx_conf_t *cf, ngx_str_t *str,
-    ngx_http_waf_rule_parser_t *parser, ngx_http_waf_rule_opt_t *opt)
-{
-    opt->p_rule->id = ngx_atoi(str->data + parser->prefix.len,
-        str->len - parser->prefix.len);
+        if (p == e) {
+            break;
+        }
 
-    if (opt->p_rule->id == NGX_ERROR) {
-        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                           "invalid arguments \"%V\"", str);
-        return NGX_ERROR;
-    }
+        switch (b->state) {
 
-    return NGX_OK;
-}
+        case sw_key_or_end:
+        case sw_value_or_end:
+            if (*p == (b->state == sw_key_or_end ? '}' : ']')) {
+                goto close;
+            }
 
+            b->state = (b->state == sw_key_or_end) ? sw_key : sw_value;
+            continue;
 
-static ngx_int_t
-ngx_http_waf_parse_rule_decode(ngx_conf_t *cf, ngx_array_t *decode_handlers,
-    u_char *p, u_char *e)
-{
-    ngx_uint_t                    i, offset, invalid;
-    ngx_str_t                     str, decode_prefix = ngx_string("decode_");
-    ngx_http_waf_rule_decode_pt  *decode;
+        case sw_key:
+            if (*p != '"') {
+                goto invalid;
+            }
 
-    str.data = p;
-    str.len = e - p;
-    offset = 0;
+            q = ngx_http_waf_json_string_end(p + 1, e);
+            if (q == NULL) {
+                goto more;
+            }
 
-    while (p < e) {
-        if (ngx_strncmp(p + offset, decode_prefix.data, decode_prefix.len) != 0)
-        {
-            return offset;
-        }
+            if (ngx_http_waf_json_string(r, js, p + 1, q, &key) != NGX_OK) {
+                goto invalid;
+            }
 
-        invalid = 0;
-        offset += decode_prefix.len;
+            p = q + 1;
 
-        for (i = 0; ngx_http_waf_rule_decode[i].handler != NULL; i++) {
-            invalid = 1;
-            if (ngx_strncmp(p + offset, ngx_http_waf_rule_decode[i].suffix.data,
-                ngx_http_waf_rule_decode[i].suffix.len) != 0)
-            {
-                continue;
+            if (++js->keys > wlcf->body_key_limit) {
+                ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                    "http waf module body json over %ui keys",
+                    wlcf->body_key_limit);
+                return NGX_DECLINED;
             }
 
-            decode = ngx_array_push(decode_handlers);
-            if (decode == NULL) {
+            js->path.len = js->path_len[js->depth];
+
+            if (ngx_http_waf_json_reserve(r, &js->path.data, &js->path_size,
+                    js->path.len, key.len + 1) != NGX_OK)
+            {
                 return NGX_ERROR;
             }
 
-            invalid = 0;
-            *decode = ngx_http_waf_rule_decode[i].handler;
-            offset += ngx_http_waf_rule_decode[i].suffix.len;
+            if (js->path.len > 0) {
+                js->path.data[js->path.len++] = '.';
+            }
 
-            if (*(p + offset) != '|') {
-                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                    "invalid decode format in arguments \"%V\"", str);
-                return NGX_ERROR;
+            ngx_memcpy(js->path.data + js->path.len, key.data, key.len);
+            js->path.len += key.len;
+
+            b->state = sw_colon;
+            break;
+
+        case sw_colon:
+            if (*p++ != ':') {
+                goto invalid;
             }
 
-            offset += 1;
+            b->state = sw_value;
             break;
-        }
 
-        if (invalid) {
-            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                "invalid decode function in arguments \"%V\"", str);
-            return NGX_ERROR;
-        }
-    }
+        case sw_value:
+            if (*p == '{' || *p == '[') {
+                if (js->depth == wlcf->body_depth_limit) {
+                    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                        "http waf module body json over %ui depth",
+                        wlcf->body_depth_limit);
+                    return NGX_DECLINED;
+                }
 
-    return offset;
-}
+                b->state = (*p == '{') ? sw_key_or_end : sw_value_or_end;
 
+                js->open[++js->depth] = *p++;
+                js->path_len[js->depth] = js->path.len;
+                break;
+            }
 
-static ngx_int_t
-ngx_http_waf_parse_rule_str(ngx_conf_t *cf, ngx_str_t *str,
-    ngx_http_waf_rule_parser_t *parser, ngx_http_waf_rule_opt_t *opt)
-{
-    u_char                       *p, *e;
-    ngx_int_t                     offset;
-    u_char                        errstr[NGX_MAX_CONF_ERRSTR];
-    ngx_regex_compile_t           rc;
+            if (*p == '"') {
+                q = ngx_http_waf_json_string_end(p + 1, e);
+                if (q == NULL) {
+                    goto more;
+                }
 
-    p = str->data + parser->prefix.len;
-    e = str->data + str->len;
+                if (ngx_http_waf_json_string(r, js, p + 1, q, &val)
+                    != NGX_OK)
+                {
+                    goto invalid;
+                }
 
-    offset = ngx_http_waf_parse_rule_decode(cf, opt->p_rule->decode_handlers,
-        p, e - 3);
-    if (offset == NGX_ERROR) {
-        return NGX_ERROR;
-    }
+                p = q + 1;
 
-    p += offset;
+            } else {
+                for (q = p; q < e; q++) {
+                    if (*q == ',' || *q == '}' || *q == ']' || *q == ' '
+                        || *q == '\t' || *q == CR || *q == LF)
+                    {
+                        break;
+                    }
+                }
 
-    if (*p == '!') {
-        p++;
-        opt->p_rule->not = 1;
-    }
+                if (q == e && !last) {
+                    goto more;
+                }
 
-    // ct@xyz ne@xyz eq@xyz sw@xyz ew@xyz rx@xyz...
-    if (p + 3 >= e || p[2] != '@') {
-        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                "invalid str in arguments \"%V\"", str);
-        return NGX_ERROR;
-    }
+                if (q == p) {
+                    goto invalid;
+                }
 
-    opt->p_rule->str.len = e - (p + 3);
-    opt->p_rule->str.data = ngx_pcalloc(cf->pool,
-        opt->p_rule->str.len + 1);
-    if (opt->p_rule->str.data == NULL) {
-        return NGX_ERROR;
-    }
+                val.data = p;
+                val.len = q - p;
+                p = q;
+            }
 
-    if (p[0] == 'l' && p[1] == 'e') {
-        p += 3;
-        ngx_strlow(opt->p_rule->str.data, p, opt->p_rule->str.len);
-        opt->p_rule->handler = ngx_http_waf_rule_str_le_handler;
-    } else if (p[0] == 'g' && p[1] == 'e') {
-        p += 3;
-        ngx_strlow(opt->p_rule->str.data, p, opt->p_rule->str.len);
-        opt->p_rule->handler = ngx_http_waf_rule_str_ge_handler;
-    } else if (p[0] == 'c' && p[1] == 't') {
-        p += 3;
-        ngx_strlow(opt->p_rule->str.data, p, opt->p_rule->str.len);
-        opt->p_rule->handler = ngx_http_waf_rule_str_ct_handler;
-    } else if (p[0] == 'e' && p[1] == 'q') {
-        p += 3;
-        ngx_strlow(opt->p_rule->str.data, p, opt->p_rule->str.len);
-        opt->p_rule->handler = ngx_http_waf_rule_str_eq_handler;
-    } else if (p[0] == 's' && p[1] == 'w') {
-        p += 3;
-        ngx_strlow(opt->p_rule->str.data, p, opt->p_rule->str.len);
-        opt->p_rule->handler = ngx_http_waf_rule_str_startwith_handler;
-    } else if (p[0] == 'e' && p[1] == 'w') {
-        p += 3;
-        ngx_strlow(opt->p_rule->str.data, p, opt->p_rule->str.len);
-        opt->p_rule->handler = ngx_http_waf_rule_str_endwith_handler;
-    } else if (p[0] == 'r' && p[1] == 'x') {
-        p += 3;
-        ngx_memcpy(opt->p_rule->str.data, p, opt->p_rule->str.len);
-        opt->p_rule->handler = ngx_http_waf_rule_str_rx_handler;
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                "http waf module score body json key:%V val:%V",
+                &js->path, &val);
+
+            if (ngx_http_waf_rule_filter(r, ctx, &wlcf->body_var_hash,
+                    wlcf->body, &js->path, &val, 0) == NGX_ABORT
+                || ngx_http_waf_score_timeout(r, wlcf) == NGX_OK)
+            {
+                return NGX_DONE;
+            }
+
+            b->state = (js->depth == 0) ? sw_done : sw_next;
+            break;
+
+        case sw_next:
+            if (*p == ',') {
+                p++;
+                b->state = (js->open[js->depth] == '{') ? sw_key : sw_value;
+                break;
+            }
+
+            if (*p != (js->open[js->depth] == '{' ? '}' : ']')) {
+                goto invalid;
+            }
+
+        close:
+
+            p++;
+
+            if (--js->depth == 0) {
+                b->state = sw_done;
+                break;
+            }
+
+            js->path.len = js->path_len[js->depth];
+            b->state = sw_next;
+            break;
+
+        case sw_done:
+            goto invalid;
+        }
+    }
 
-        ngx_memzero(&rc, sizeof(ngx_regex_compile_t));
+    // an empty body is no value at all.
+    if (!last || b->state == sw_done
+        || (b->state == sw_value && js->depth == 0))
+    {
+        goto more;
+    }
 
-        rc.pool = cf->pool;
-        rc.err.len = NGX_MAX_CONF_ERRSTR;
-        rc.err.data = errstr;
+invalid:
 
-        rc.options = NGX_REGEX_CASELESS;
-        rc.pattern = opt->p_rule->str;
+    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+        "http waf module body json error at %O",
+        js->offset + (off_t) (p - start));
 
-        if (ngx_regex_compile(&rc) != NGX_OK) {
-            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "%V", &rc.err);
-            return NGX_ERROR;
-        }
+    return NGX_DECLINED;
 
-        opt->p_rule->regex = rc.regex;
-    } else {
-        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                "invalid str in arguments \"%V\"", str);
-        return NGX_ERROR;
+more:
+
+    if (p < e && last) {
+        goto invalid;
     }
 
+    js->offset += p - start;
+    *pos = p;
+
     return NGX_OK;
 }
 
 
-
-// s:$ATT:3,$ATT2:4
-static ngx_int_t
-ngx_http_waf_parse_rule_score(ngx_conf_t *cf, ngx_str_t *str,
-    ngx_http_waf_rule_parser_t *parser, ngx_http_waf_rule_opt_t *opt)
+// the end of an xml name.
+static u_char *
+ngx_http_waf_xml_name(u_char *p, u_char *e)
 {
-    u_char                *p, *s, *e;
-    ngx_http_waf_score_t  *sc;
-
-    if (opt->p_rule->scores == NULL) {
-        opt->p_rule->scores = ngx_array_create(cf->pool, 2,
-            sizeof(ngx_http_waf_score_t));
-
-        if (opt->p_rule->scores == NULL) {
-            return NGX_ERROR;
-        }
+    while (p < e && *p != '>' && *p != '/' && *p != '=' && *p != ' '
+           && *p != '\t' && *p != CR && *p != LF)
+    {
+        p++;
     }
 
-    e = str->data + str->len;
-    p = str->data + parser->prefix.len;
+    return p;
+}
 
-    while (p < e) {
-        if (*p == ',') p++;
 
-        if (*p++ != '$') {
-            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-            "invalid arguments \"%V\"", str);
+static u_char *
+ngx_http_waf_xml_space(u_char *p, u_char *e)
+{
+    while (p < e && (*p == ' ' || *p == '\t' || *p == CR || *p == LF)) {
+        p++;
+    }
 
-            return NGX_ERROR;
-        }
+    return p;
+}
 
-        // tag
-        s = ngx_http_waf_score_tag(p, e, ":");
-        if (s == NULL || s - p <= 0) {
-            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                "invalid scores in arguments \"%V\"", str);
-            return NGX_ERROR;
-        }
 
-        sc = ngx_array_push(opt->p_rule->scores);
-        if (sc == NULL) {
-            return NGX_ERROR;
-        }
+// the end of a start tag, its '>' out of the attribute values.
+static u_char *
+ngx_http_waf_xml_tag_end(u_char *p, u_char *e)
+{
+    u_char  quote;
 
-        sc->tag.len  = s - p;
-        sc->tag.data = ngx_pcalloc(cf->pool, sc->tag.len);
-        if (sc->tag.data == NULL) {
-            return NGX_ERROR;
-        }
-        ngx_memcpy(sc->tag.data, p, sc->tag.len);
+    for (quote = 0; p < e; p++) {
+        if (quote) {
+            if (*p == quote) {
+                quote = 0;
+            }
 
-        // score
-        p = s + 1;
-        s = (u_char *)ngx_strchr(p, ',');
-        if (s == NULL) {
-            s = e;
-        }
-        sc->score = ngx_atoi(p, s - p);
-        p = s + 1;
+        } else if (*p == '"' || *p == '\'') {
+            quote = *p;
 
-        sc->log_ctx = NULL;
+        } else if (*p == '>') {
+            return p + 1;
+        }
     }
 
-    return NGX_OK;
+    return NULL;
 }
 
 
+// return NGX_DONE to stop the parse.
 static ngx_int_t
-ngx_http_waf_parse_rule_note(ngx_conf_t *cf, ngx_str_t *str,
-    ngx_http_waf_rule_parser_t *parser, ngx_http_waf_rule_opt_t *opt)
+ngx_http_waf_xml_value(ngx_http_request_t *r, ngx_http_waf_loc_conf_t *wlcf,
+    ngx_http_waf_ctx_t *ctx, ngx_str_t *key, ngx_str_t *val)
 {
+    ngx_http_waf_xml_t  *xs;
+
+    xs = ctx->body.doc;
+
+    if (++xs->keys > wlcf->body_key_limit) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+            "http waf module body xml over %ui keys", wlcf->body_key_limit);
+        return NGX_DECLINED;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+        "http waf module score body xml key:%V val:%V", key, val);
+
+    if (ngx_http_waf_rule_filter(r, ctx, &wlcf->body_var_hash, wlcf->body,
+            key, val, 0) == NGX_ABORT
+        || ngx_http_waf_score_timeout(r, wlcf) == NGX_OK)
+    {
+        return NGX_DONE;
+    }
+
     return NGX_OK;
 }
 
 
-// URI、V_URI、X_URI
-// ARGS V_ARGS X_ARGS
-// HEADERS V_HEADERS X_HEADERS
-//
-// "zone:ARGS|V_HEADERS:xxx|X_HEADERS:xxx"
-// "zone:@ARGS'
-// "zone:#ARGS'
+// the text of the xml elements and the values of their attributes are
+// the values of the BODY zone, the element and the attribute names the
+// keys. the body is walked once as it arrives, the values are slices of
+// it and only the names of the open elements are kept. the entities are
+// not expanded. *pos is set to a token not ended in the bytes.
 static ngx_int_t
-ngx_http_waf_parse_rule_zone(ngx_conf_t *cf, ngx_str_t *str,
-    ngx_http_waf_rule_parser_t *parser, ngx_http_waf_rule_opt_t *opt)
+ngx_http_waf_xml_parse(ngx_http_request_t *r, ngx_http_waf_loc_conf_t *wlcf,
+    ngx_http_waf_ctx_t *ctx, u_char **pos, u_char *e, ngx_uint_t last)
 {
-    u_char                        *p, *s, *e;
-    ngx_uint_t                     i, flag, all_flag;
-    u_char                         errstr[NGX_MAX_CONF_ERRSTR];
-    ngx_regex_compile_t            rc;
-    ngx_http_waf_zone_t          *zone;
+    u_char               *p, *q, *t, *start;
+    size_t                n;
+    ngx_int_t             rc;
+    ngx_str_t             key, val;
+    ngx_http_waf_xml_t   *xs;
 
-    if (opt->m_zones == NULL) {
-        opt->m_zones = ngx_array_create(cf->pool, 3,
-            sizeof(ngx_http_waf_zone_t));
-        if (opt->m_zones == NULL) {
+    xs = ctx->body.doc;
+
+    if (xs == NULL) {
+        xs = ngx_pcalloc(r->pool, sizeof(ngx_http_waf_xml_t));
+        if (xs == NULL) {
+            return NGX_ERROR;
+        }
+
+        xs->name_end = ngx_pcalloc(r->pool,
+                                   (wlcf->body_depth_limit + 1)
+                                   * sizeof(size_t));
+        if (xs->name_end == NULL) {
             return NGX_ERROR;
         }
+
+        ctx->body.doc = xs;
     }
 
-    e = str->data + str->len;
-    p = str->data + parser->prefix.len;
-    all_flag = 0;
+    p = *pos;
+    start = p;
 
     while (p < e) {
-        if (*p == '|') p++;
-        flag = 0;
 
-        for (i = 0; ngx_http_waf_rule_zone_item[i].name.data != NULL; i++) {
-            if (ngx_strncmp(p, ngx_http_waf_rule_zone_item[i].name.data,
-                ngx_http_waf_rule_zone_item[i].name.len) == 0) {
+        if (*p != '<') {
+            q = ngx_strlchr(p, e, '<');
 
-                flag = ngx_http_waf_rule_zone_item[i].mask;
-                p += ngx_http_waf_rule_zone_item[i].name.len;
-                break;
+            // the text out of the elements is skipped as it arrives.
+            if (q == NULL) {
+                if (!last && xs->depth > 0) {
+                    goto more;
+                }
+
+                q = e;
+            }
+
+            // the text of the element, not the white space between them
+            if (xs->depth == 0 || ngx_http_waf_xml_space(p, q) == q) {
+                p = q;
+                continue;
             }
+
+            key.data = xs->names + xs->name_end[xs->depth - 1];
+            key.len = xs->name_end[xs->depth] - xs->name_end[xs->depth - 1];
+            val.data = p;
+            val.len = q - p;
+            p = q;
+
+            goto value;
         }
 
-        if (flag == 0) {
-            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                           "invalid zone in arguments \"%V\"", str);
-            return NGX_ERROR;
+        // the kind of the markup is not known yet.
+        if (!last && e - p < 9 && ngx_strlchr(p, e, '>') == NULL) {
+            goto more;
         }
 
-        if (ngx_http_waf_mz_gt(all_flag, flag)) {
-            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                           "wrong zone in arguments \"%V\"", str);
-            return NGX_ERROR;
+        if (e - p >= 4 && ngx_strncmp(p, "<!--", 4) == 0) {
+            q = ngx_http_waf_str->memstr(p + 4, e, (u_char *) "-->", 3);
+            if (q == NULL) {
+                goto incomplete;
+            }
+
+            p = q + 3;
+            continue;
         }
 
-        all_flag |= flag;
+        if (e - p >= 9 && ngx_strncmp(p, "<![CDATA[", 9) == 0) {
+            q = ngx_http_waf_str->memstr(p + 9, e, (u_char *) "]]>", 3);
+            if (q == NULL) {
+                goto incomplete;
+            }
 
-        zone = ngx_array_push(opt->m_zones);
-        if (zone == NULL) {
-            return NGX_ERROR;
+            if (xs->depth == 0) {
+                goto invalid;
+            }
+
+            key.data = xs->names + xs->name_end[xs->depth - 1];
+            key.len = xs->name_end[xs->depth] - xs->name_end[xs->depth - 1];
+            val.data = p + 9;
+            val.len = q - p - 9;
+            p = q + 3;
+
+            goto value;
         }
 
-        ngx_memzero(zone, sizeof(ngx_http_waf_zone_t));
+        // the instructions and the declarations, a doctype with the
+        // internal subset ends at the "]>".
+        if (e - p >= 2 && (p[1] == '?' || p[1] == '!')) {
+            if (p[1] == '?') {
+                q = ngx_http_waf_str->memstr(p + 2, e, (u_char *) "?>", 2);
+                n = 2;
 
-        zone->flag = flag;
+            } else {
+                q = ngx_strlchr(p, e, '>');
+                n = 1;
 
-        if (ngx_http_waf_mz_is_general(flag)) {
+                if (q != NULL && ngx_strlchr(p, q, '[') != NULL) {
+                    q = ngx_http_waf_str->memstr(p, e, (u_char *) "]>", 2);
+                    n = 2;
+                }
+            }
+
+            if (q == NULL) {
+                goto incomplete;
+            }
+
+            p = q + n;
             continue;
         }
 
-        if (*(p-1) != ':') {
-            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                           "invalid custom zone in arguments \"%V\"", str);
-            return NGX_ERROR;
+        if (e - p >= 2 && p[1] == '/') {
+            if (xs->depth == 0) {
+                goto invalid;
+            }
+
+            q = ngx_strlchr(p, e, '>');
+            if (q == NULL) {
+                goto incomplete;
+            }
+
+            xs->depth--;
+            p = q + 1;
+            continue;
         }
 
-        s = (u_char *)ngx_strchr(p, '|');
-        if (s == NULL) {
-            s = e;
+        // the start tag, matched when it is whole.
+        t = ngx_http_waf_xml_tag_end(p, e);
+        if (t == NULL) {
+            if (!last) {
+                goto more;
+            }
+
+            t = e;
         }
 
-        if (s == p) {
-            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                           "wrong custom zone in arguments \"%V\"", str);
-            return NGX_ERROR;
+        if (xs->depth == wlcf->body_depth_limit) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                "http waf module body xml over %ui depth",
+                wlcf->body_depth_limit);
+            return NGX_DECLINED;
         }
 
-        zone->name.data = ngx_pcalloc(cf->pool, s - p + 1);
-        if (zone->name.data == NULL) {
+        q = ngx_http_waf_xml_name(++p, t);
+        if (q == p) {
+            goto invalid;
+        }
+
+        n = xs->name_end[xs->depth];
+
+        if (ngx_http_waf_json_reserve(r, &xs->names, &xs->names_size, n,
+                                      q - p)
+            != NGX_OK)
+        {
             return NGX_ERROR;
         }
-        ngx_memcpy(zone->name.data, p, s - p);
-        zone->name.len = s - p;
 
-        if (ngx_http_waf_mz_is_regex(flag)) {
-            ngx_memzero(&rc, sizeof(ngx_regex_compile_t));
-            rc.pool = cf->pool;
-            rc.err.len = NGX_MAX_CONF_ERRSTR;
-            rc.err.data = errstr;
+        ngx_memcpy(xs->names + n, p, q - p);
+        xs->name_end[++xs->depth] = n + (q - p);
 
-            rc.options = NGX_REGEX_CASELESS;
-            rc.pattern = zone->name;
+        p = q;
 
-            if (ngx_regex_compile(&rc) != NGX_OK) {
-                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "%V", &rc.err);
-                return NGX_ERROR;
+        for ( ;; ) {
+            p = ngx_http_waf_xml_space(p, t);
+            if (p == t) {
+                goto invalid;
             }
 
-            zone->regex = rc.regex;
-        }
+            if (*p == '>') {
+                p++;
+                break;
+            }
 
-        p = s;
-    }
+            if (*p == '/') {
+                if (t - p < 2 || p[1] != '>') {
+                    goto invalid;
+                }
 
-    return NGX_OK;
-}
+                xs->depth--;
+                p += 2;
+                break;
+            }
 
+            // an attribute
+            q = ngx_http_waf_xml_name(p, t);
+            if (q == p) {
+                goto invalid;
+            }
 
-// "wl:x,y..."
-// "wl:-x,-y..."
-static ngx_int_t
-ngx_http_waf_parse_rule_whitelist(ngx_conf_t *cf, ngx_str_t *str,
-    ngx_http_waf_rule_parser_t *parser, ngx_http_waf_rule_opt_t *opt)
-{
-    u_char       *p, *s, *e;
-    char          minus;
-    ngx_int_t    *a, id;
+            key.data = p;
+            key.len = q - p;
 
-    if (opt->wl_ids == NULL) {
-        opt->wl_ids = ngx_array_create(cf->pool, 3, sizeof(ngx_int_t));
-        if (opt->wl_ids == NULL) {
-            return NGX_ERROR;
-        }
-    }
+            p = ngx_http_waf_xml_space(q, t);
+            if (p == t || *p != '=') {
+                goto invalid;
+            }
 
-    e = str->data + str->len;
-    p = str->data + parser->prefix.len;
+            p = ngx_http_waf_xml_space(p + 1, t);
+            if (p == t || (*p != '"' && *p != '\'')) {
+                goto invalid;
+            }
 
-    while (p < e) {
-        minus = 0;
-        s = (u_char *)ngx_strchr(p , ',');
-        if (s == NULL) {
-            s = e;
-        }
+            q = ngx_strlchr(p + 1, t, *p);
+            if (q == NULL) {
+                goto invalid;
+            }
 
-        if (*p == '-') {
-            p++;
-            minus = 1;
-        }
+            val.data = p + 1;
+            val.len = q - p - 1;
+            p = q + 1;
 
-        id = ngx_atoi(p, s-p);
-        if (id == NGX_ERROR) {
-            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                           "invalid whitelisted id in arguments \"%V\"", str);
-            return NGX_ERROR;
+            rc = ngx_http_waf_xml_value(r, wlcf, ctx, &key, &val);
+            if (rc != NGX_OK) {
+                return rc;
+            }
         }
 
-        a = (ngx_int_t *)ngx_array_push(opt->wl_ids);
-        if (a == NULL) {
-            return NGX_ERROR;
-        }
-        p = s + 1;
+        continue;
 
-        if (minus == 1) {
-            *a = 0 - id;
-            continue;
+    value:
+
+        rc = ngx_http_waf_xml_value(r, wlcf, ctx, &key, &val);
+        if (rc != NGX_OK) {
+            return rc;
         }
-        *a = id;
     }
 
+    goto more;
+
+incomplete:
+
+    if (last) {
+        goto invalid;
+    }
+
+more:
+
+    xs->offset += p - start;
+    *pos = p;
+
     return NGX_OK;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+        "http waf module body xml error at %O",
+        xs->offset + (off_t) (p - start));
+
+    return NGX_DECLINED;
 }
 
 
-// libinj:sql
-// libinj:xss
-static ngx_int_t
-ngx_http_waf_parse_rule_libinj(ngx_conf_t *cf, ngx_str_t *str,
-    ngx_http_waf_rule_parser_t *parser, ngx_http_waf_rule_opt_t *opt)
+static ngx_uint_t
+ngx_http_waf_body_type(ngx_http_request_t *r)
 {
-    u_char             *p, *e;
-    ngx_int_t           offset;
+    ngx_str_t   *type;
 
-    static ngx_str_t    sql = ngx_string("sql");
-    static ngx_str_t    xss = ngx_string("xss");
+    static ngx_str_t  ct_urlencode =
+        ngx_string("application/x-www-form-urlencoded");
+    static ngx_str_t  ct_multipart = ngx_string("multipart/form-data");
+    static ngx_str_t  ct_json      = ngx_string("application/json");
+    static ngx_str_t  ct_json_sfx  = ngx_string("+json");
+    static ngx_str_t  ct_xml       = ngx_string("application/xml");
+    static ngx_str_t  ct_xml_text  = ngx_string("text/xml");
+    static ngx_str_t  ct_xml_sfx   = ngx_string("+xml");
 
-    if (str->len - parser->prefix.len < 3) {
-        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-            "invalid libinj in arguments \"%V\"", str);
-        return NGX_ERROR;
+    if (r->headers_in.content_type == NULL) {
+        return NGX_HTTP_WAF_BODY_RAW;
     }
 
-    p = str->data + parser->prefix.len;
-    e = str->data + str->len;
+    type = &r->headers_in.content_type->value;
 
-    offset = ngx_http_waf_parse_rule_decode(cf, opt->p_rule->decode_handlers,
-        p, e - 4);
-    if (offset == NGX_ERROR) {
-        return NGX_ERROR;
-    }
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                    "ngx http waf module socore body content type:%V", type);
 
-    p += offset;
+    if (ct_urlencode.len <= type->len
+        && ngx_strncasecmp(type->data, ct_urlencode.data,
+          ct_urlencode.len) == 0)
+    {
+        return NGX_HTTP_WAF_BODY_URLENCODED;
+    }
 
-    if ((size_t)(e - p) == sql.len
-        && ngx_strncmp(p, sql.data, sql.len) == 0)
+    if (ct_multipart.len <= type->len
+        && ngx_strncasecmp(type->data, ct_multipart.data,
+          ct_multipart.len) == 0)
     {
-        opt->p_rule->str = sql;
-        opt->p_rule->handler = ngx_http_waf_rule_str_sqli_handler;
+        return NGX_HTTP_WAF_BODY_MULTIPART;
+    }
 
-    } else if ((size_t)(e - p) == xss.len
-        && ngx_strncmp(p, xss.data, xss.len) == 0)
+    if ((ct_json.len <= type->len
+         && ngx_strncasecmp(type->data, ct_json.data, ct_json.len) == 0)
+        || ngx_strlcasestrn(type->data, type->data + type->len,
+                            ct_json_sfx.data, ct_json_sfx.len - 1)
+           != NULL)
     {
-        opt->p_rule->str = xss;
-        opt->p_rule->handler = ngx_http_waf_rule_str_xss_handler;
+        return NGX_HTTP_WAF_BODY_JSON;
+    }
 
-    } else {
-        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-            "invalid libinj args in arguments \"%V\"", str);
-        return NGX_ERROR;
+    if ((ct_xml.len <= type->len
+         && ngx_strncasecmp(type->data, ct_xml.data, ct_xml.len) == 0)
+        || (ct_xml_text.len <= type->len
+            && ngx_strncasecmp(type->data, ct_xml_text.data,
+                               ct_xml_text.len) == 0)
+        || ngx_strlcasestrn(type->data, type->data + type->len,
+                            ct_xml_sfx.data, ct_xml_sfx.len - 1)
+           != NULL)
+    {
+        return NGX_HTTP_WAF_BODY_XML;
     }
 
-    return NGX_OK;
+    return NGX_HTTP_WAF_BODY_RAW;
 }
 
 
 static ngx_int_t
-ngx_http_waf_parse_rule_hash(ngx_conf_t *cf, ngx_str_t *str,
-    ngx_http_waf_rule_parser_t *parser, ngx_http_waf_rule_opt_t *opt)
+ngx_http_waf_body_save(ngx_http_request_t *r, ngx_http_waf_body_t *b,
+    u_char *p, u_char *e)
 {
-    u_char                 *p, *e;
-    static ngx_str_t        md5 = ngx_string("md5@");
-    static ngx_str_t        crc32_short = ngx_string("crc32@");
-    static ngx_str_t        crc32_long = ngx_string("crc32_long@");
+    u_char  *buf;
+    size_t   size;
 
-    p = str->data + parser->prefix.len;
-    e = str->data + str->len;
+    if (b->len + (e - p) > b->size) {
+        size = ngx_max(2 * b->size, b->len + (e - p));
+        size = ngx_max(size, NGX_HTTP_WAF_BODY_OVERLAP);
 
-    if (*p == '!') {
-        p++;
-        opt->p_rule->not = 1;
+        buf = ngx_pnalloc(r->pool, size);
+        if (buf == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (b->buf != NULL) {
+            ngx_memcpy(buf, b->buf, b->len);
+            ngx_pfree(r->pool, b->buf);
+        }
+
+        b->buf = buf;
+        b->size = size;
+    }
+
+    if (p < e) {
+        ngx_memcpy(b->buf + b->len, p, e - p);
+        b->len += e - p;
     }
 
-    if (p + md5.len < e && ngx_strncmp(p, md5.data, md5.len) == 0) {
-        p += md5.len;
-        opt->p_rule->handler = ngx_http_waf_rule_hash_md5_handler;
+    return NGX_OK;
+}
+
 
-    } else if (p + crc32_short.len < e
-        && ngx_strncmp(p, crc32_short.data, crc32_short.len) == 0) {
+// a field of the urlencoded body, the bytes of the chunks before are in
+// the buf.
+static ngx_int_t
+ngx_http_waf_body_field(ngx_http_request_t *r, ngx_http_waf_loc_conf_t *wlcf,
+    ngx_http_waf_ctx_t *ctx, ngx_flag_t carry, ngx_str_t *key,
+    u_char *p, u_char *e)
+{
+    ngx_str_t             val;
+    ngx_http_waf_body_t  *b;
 
-        p += crc32_short.len;
-        opt->p_rule->handler = ngx_http_waf_rule_hash_crc32_short_handler;
+    b = &ctx->body;
 
-    } else if (p + crc32_long.len < e
-        && ngx_strncmp(p, crc32_long.data, crc32_long.len) == 0) {
+    if (carry) {
+        if (ngx_http_waf_body_save(r, b, p, e) != NGX_OK) {
+            return NGX_ERROR;
+        }
 
-        p += crc32_long.len;
-        opt->p_rule->handler = ngx_http_waf_rule_hash_crc32_long_handler;
+        key->data = b->buf;
+        key->len = b->key_len;
+        val.data = b->buf + b->key_len;
+        val.len = b->len - b->key_len;
 
     } else {
-        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                "invalid hash function in arguments \"%V\"", str);
-        return NGX_ERROR;
+        val.data = p;
+        val.len = e - p;
     }
 
-    opt->p_rule->str.len  = e - p;
-    opt->p_rule->str.data = ngx_pcalloc(cf->pool,
-        opt->p_rule->str.len + 1);
-    if (opt->p_rule->str.data == NULL) {
-        return NGX_ERROR;
-    }
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+        "http waf module score body urlencode key:%V val:%V", key, &val);
 
-    ngx_memcpy(opt->p_rule->str.data, p, opt->p_rule->str.len);
+    ngx_http_waf_rule_filter(r, ctx, &wlcf->body_var_hash, wlcf->body,
+        key, &val, 0);
+
+    b->len = 0;
+    b->key_len = 0;
 
     return NGX_OK;
 }
 
 
-// -- rquest deal -------
-
-static void
-ngx_http_waf_score_calc(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx,
-    ngx_http_waf_rule_t *rule, ngx_str_t str)
+// the urlencoded fields of the chunks. the key is up to the first '=',
+// the value has a byte at least and is up to the next '&'. the bytes
+// without a '=' are the value of an empty key.
+static ngx_int_t
+ngx_http_waf_body_form(ngx_http_request_t *r, ngx_http_waf_loc_conf_t *wlcf,
+    ngx_http_waf_ctx_t *ctx, u_char *p, u_char *e, ngx_uint_t last)
 {
-    ngx_uint_t                 k, idx;
-    ngx_http_waf_score_t      *ss;
-    ngx_http_waf_check_t      *cs;
-    ngx_http_waf_log_ctx_t    *log;
-    ngx_http_waf_loc_conf_t   *wlcf;
+    u_char               *q, *t;
+    ngx_str_t             key;
+    ngx_flag_t            carry;
+    ngx_http_waf_body_t  *b;
 
+    enum {
+        sw_key = 0,
+        sw_val_start,
+        sw_val
+    };
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-        "ngx http waf score calc rule id: %i addr:%p",
-        rule->p_rule->id, rule->p_rule->scores);
+    b = &ctx->body;
+    carry = (b->state != sw_key || b->len > 0);
 
-    ngx_http_waf_ctx_copy_act(ctx->status, rule->sts);
+    key.data = b->buf;
+    key.len = b->key_len;
+    q = p;
 
-    if (ngx_http_waf_sts_has_block(ctx->status)) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-            "ngx http waf score calc ctx block return ...");
+    while (p < e) {
 
-        if (rule->p_rule->scores != NULL) {
-            return;
-        }
+        switch (b->state) {
 
-        ctx->logc = ngx_pcalloc(r->pool, sizeof(ngx_http_waf_log_ctx_t));
-        if (ctx->logc != NULL) {
-            ctx->logc->rule = rule;
-            ctx->logc->str = str;
-        }
+        case sw_key:
+            t = ngx_http_waf_str->chrscan(p, e, '=');
+            if (t == e) {
+                p = e;
+                break;
+            }
 
-        return;
-    }
+            if (carry) {
+                if (ngx_http_waf_body_save(r, b, q, t) != NGX_OK) {
+                    return NGX_ERROR;
+                }
 
-    wlcf = ngx_http_get_module_loc_conf(r, ngx_http_waf_module);
+                b->key_len = b->len;
 
-    ss = ctx->scores->elts;
-    cs = rule->score_checks->elts;
-    for (k = 0; k < rule->score_checks->nelts; k++) {
-        idx = cs[k].idx;
-        ss[idx].score += cs[k].score;
+            } else {
+                key.data = q;
+                key.len = t - q;
+            }
 
-        // TODO: optimize >=
-        if (ss[idx].score > cs[k].threshold) {
-            ctx->status |= cs[k].action_flag;
-        }
+            p = t + 1;
+            q = p;
+            b->state = sw_val_start;
+            break;
 
-        // if (str.len > 128) {
-        //     str.len = 128;
-        // }
-        ngx_log_debug5(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-            "http waf module score calc. id:%i tag:$%V score:%i total_score:%i"
-            " str:%V",
-            rule->p_rule->id, &cs[k].tag, cs[k].score, ss[idx].score, &str);
+        case sw_val_start:
+            p++;
+            b->state = sw_val;
+            break;
 
+        default: /* sw_val */
+            t = ngx_http_waf_str->chrscan(p, e, '&');
+            if (t == e) {
+                p = e;
+                break;
+            }
 
-        if (wlcf->log == NULL || wlcf->log->off) {
-            continue;
-        }
+            if (ngx_http_waf_body_field(r, wlcf, ctx, carry, &key, q, t)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
 
-        if (ss[idx].log_ctx == NULL) {
-            ss[idx].log_ctx = ngx_array_create(r->pool, 3,
-                sizeof(ngx_http_waf_log_ctx_t));
+            carry = 0;
+            p = t + 1;
+            q = p;
+            b->state = sw_key;
 
-            if (ss[idx].log_ctx == NULL) {
-                continue;
+            if (ngx_http_waf_score_is_done(ctx->status)
+                || ngx_http_waf_score_timeout(r, wlcf) == NGX_OK)
+            {
+                return NGX_DONE;
             }
         }
+    }
 
-        log = ngx_array_push(ss[idx].log_ctx);
-        if (log == NULL) {
-            continue;
+    if (!last) {
+        // the field goes on in the next chunk.
+        if (!carry && b->state != sw_key) {
+            if (ngx_http_waf_body_save(r, b, key.data, key.data + key.len)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            b->key_len = b->len;
         }
 
-        log->score = cs[k].score;
-        log->rule = rule;
-        log->str  = str;
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-            "http waf module rule %d log", rule->p_rule->id);
+        return (ngx_http_waf_body_save(r, b, q, e) == NGX_OK)
+               ? NGX_OK : NGX_ERROR;
+    }
+
+    if (b->state == sw_key) {
+        ngx_str_null(&key);
     }
+
+    if ((b->state == sw_key && (carry || q < e)) || b->state == sw_val) {
+        if (ngx_http_waf_body_field(r, wlcf, ctx, carry, &key, q, e)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    b->state = sw_key;
+    b->len = 0;
+    b->key_len = 0;
+
+    return NGX_OK;
 }
 
 
+// the delimiter of the multipart parts, CRLF "--" and the boundary of the
+// content type, and the shifts of its bytes for the Boyer-Moore-Horspool
+// search. https://www.ietf.org/rfc/rfc2046.txt
 static ngx_int_t
-ngx_http_waf_rule_str_ge_handler(ngx_http_waf_public_rule_t *pr,
-    ngx_str_t *s)
+ngx_http_waf_body_boundary(ngx_http_request_t *r, ngx_http_waf_body_t *b)
 {
-    ngx_uint_t        i = 0;
-    u_char           *p, *q;
-
-    if (s == NULL || s->data == NULL || s->len == 0) {
-        return NGX_ERROR;
-    }
+    u_char     *p, *e, *t;
+    size_t      len, i;
+    ngx_str_t  *type;
 
-    p = s->data;
-    q = pr->str.data;
+    static ngx_str_t  ct_multipart = ngx_string("multipart/form-data");
+    static ngx_str_t  boundary_prefix = ngx_string("boundary");
 
-    while (i < s->len && i < pr->str.len) {
+    type = &r->headers_in.content_type->value;
 
-        if (*p < *q) {
-            return pr->not? NGX_OK: NGX_ERROR;
+    t = ngx_strnstr(type->data + ct_multipart.len,
+          (char *) boundary_prefix.data,
+          type->len - ct_multipart.len);
+    if (t == NULL) {
+        goto invalid;
+    }
 
-        } else if (*p > *q) {
-            return pr->not? NGX_ERROR: NGX_OK;
-        }
+    p = t + boundary_prefix.len;
+    e = type->data + type->len;
 
-        i++;
+    while (p < e && (*p == ' ' || *p == '=' || *p == '\'' || *p == '"')) {
         p++;
-        q++;
     }
 
-    if (s->len >= pr->str.len) {
-        return pr->not? NGX_ERROR: NGX_OK;
+    while (e > p && (*(e-1) == ' ' || *(e-1) == '\'' || *(e-1) == '"')) {
+        e--;
     }
 
-    return pr->not? NGX_OK: NGX_ERROR;
-}
-
+    len = 4 + e - p;
 
-static ngx_int_t
-ngx_http_waf_rule_str_le_handler(ngx_http_waf_public_rule_t *pr,
-    ngx_str_t *s)
-{
-    ngx_uint_t      i = 0;
-    u_char         *p, *q;
+    if (p == e || len > NGX_HTTP_WAF_BODY_OVERLAP) {
+        goto invalid;
+    }
 
-    if (s == NULL || s->data == NULL || s->len == 0) {
+    b->shift = ngx_palloc(r->pool, 256 * sizeof(u_short) + 3 * len);
+    if (b->shift == NULL) {
         return NGX_ERROR;
     }
 
-    p = s->data;
-    q = pr->str.data;
+    b->delim.data = (u_char *) (b->shift + 256);
+    b->delim.len = len;
+    b->cross = b->delim.data + len;
 
-    while (i < s->len && i < pr->str.len) {
+    t = ngx_cpymem(b->delim.data, CRLF "--", 4);
+    ngx_memcpy(t, p, e - p);
 
-        if (*p > *q) {
-            return pr->not? NGX_OK: NGX_ERROR;
+    for (i = 0; i < 256; i++) {
+        b->shift[i] = (u_short) len;
+    }
 
-        } else if (*p < *q) {
-            return pr->not? NGX_ERROR: NGX_OK;
+    for (i = 0; i < len - 1; i++) {
+        b->shift[b->delim.data[i]] = (u_short) (len - 1 - i);
+    }
 
-        }
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                  "http waf module score body boundary:%V", &b->delim);
 
-        i++;
-        p++;
-        q++;
-    }
+    return NGX_OK;
 
-    if (s->len <= pr->str.len) {
-        return pr->not? NGX_ERROR: NGX_OK;
-    }
+invalid:
 
-    return pr->not? NGX_OK: NGX_ERROR;
+    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+        "http waf module multipart content type error, type:%V", type);
+
+    return NGX_DECLINED;
 }
 
 
-// rule string match handler ...
-// return NGX_OK match successful, else NGX_ERROR.
-static ngx_int_t
-ngx_http_waf_rule_str_ct_handler(ngx_http_waf_public_rule_t *pr,
-    ngx_str_t *s)
+static u_char *
+ngx_http_waf_body_delim(ngx_http_waf_body_t *b, u_char *p, u_char *e)
 {
-    u_char *p, *e;
+    u_char   c, *d;
+    size_t   len;
 
-    if (s == NULL || s->data == NULL || s->len == 0
-        || s->len < pr->str.len) {
-        return NGX_ERROR;
-    }
+    d = b->delim.data;
+    len = b->delim.len;
 
-    e = s->data + s->len;
+    while ((size_t) (e - p) >= len) {
+        c = p[len - 1];
 
-    p = ngx_strlcasestrn(s->data, e, pr->str.data, pr->str.len - 1);
-    if (p != NULL) {
-        return pr->not? NGX_ERROR: NGX_OK;
+        if (c == d[len - 1] && ngx_memcmp(p, d, len - 1) == 0) {
+            return p;
+        }
+
+        p += b->shift[c];
     }
 
-    return pr->not? NGX_OK: NGX_ERROR;
+    return NULL;
 }
 
 
-static ngx_int_t
-ngx_http_waf_rule_str_eq_handler(ngx_http_waf_public_rule_t *pr,
-    ngx_str_t *s)
+static void
+ngx_http_waf_body_param(u_char *p, u_char *e, ngx_str_t *v)
 {
-    if (s == NULL || s->data == NULL || s->len == 0) {
-        return NGX_ERROR;
+    while (p < e && *p == ' ') {
+        p++;
     }
 
-    if (s->len == pr->str.len && ngx_strncasecmp(s->data,
-        pr->str.data, s->len) == 0)
-    {
-        return pr->not? NGX_ERROR: NGX_OK;
+    while (e > p && *(e-1) == ' ') {
+        e--;
     }
 
-    return pr->not? NGX_OK: NGX_ERROR;
-}
+    if (p < e && (*p == '"' || *p == '\'')) {
+        p++;
+    }
+
+    if (e > p && (*(e-1) == '"' || *(e-1) == '\'')) {
+        e--;
+    }
 
+    v->data = p;
+    v->len = e - p;
+}
 
 
-static ngx_int_t
-ngx_http_waf_rule_str_startwith_handler(ngx_http_waf_public_rule_t *pr,
-    ngx_str_t *s)
+// the headers of a part up to an empty line, NULL if they are not ended.
+// the name and the filename are of the Content-Disposition.
+static u_char *
+ngx_http_waf_body_head(u_char *p, u_char *e, ngx_str_t *key, ngx_str_t *val,
+    ngx_flag_t *file)
 {
-    if (s == NULL || s->data == NULL || s->len == 0) {
-        return NGX_ERROR;
-    }
+    u_char  *q, *t, *v;
 
-    if (s->len > pr->str.len && ngx_strncasecmp(s->data,
-        pr->str.data, pr->str.len) == 0)
-    {
-        return pr->not? NGX_ERROR: NGX_OK;
+    static ngx_str_t  disposition = ngx_string("Content-Disposition:");
+    static ngx_str_t  filename    = ngx_string("filename=");
+    static ngx_str_t  name        = ngx_string("name=");
+
+    *file = 0;
+    ngx_str_null(key);
+    ngx_str_null(val);
+
+    // the transport padding after the delimiter.
+    p = ngx_strlchr(p, e, LF);
+    if (p == NULL) {
+        return NULL;
     }
 
-    return pr->not? NGX_OK: NGX_ERROR;
-}
+    p++;
 
+    for ( ;; ) {
+        q = ngx_strlchr(p, e, LF);
+        if (q == NULL) {
+            return NULL;
+        }
 
+        t = (q > p && *(q-1) == CR) ? q - 1 : q;
 
-static ngx_int_t
-ngx_http_waf_rule_str_endwith_handler(ngx_http_waf_public_rule_t *pr,
-    ngx_str_t *s)
-{
-    u_char *p;
+        if (t == p) {
+            return q + 1;
+        }
 
-    if (s == NULL || s->data == NULL || s->len == 0
-        || s->len <= pr->str.len)
-    {
-        return NGX_ERROR;
-    }
+        if ((size_t) (t - p) >= disposition.len
+            && ngx_strncasecmp(p, disposition.data, disposition.len) == 0)
+        {
+            for (p += disposition.len; p < t; p = v + 1) {
+                while (p < t && (*p == ' ' || *p == ';')) {
+                    p++;
+                }
 
-    p = s->data + s->len - pr->str.len;
-    if (ngx_strncasecmp(p, pr->str.data, pr->str.len) == 0) {
-        return pr->not? NGX_ERROR: NGX_OK;
-    }
+                v = ngx_strlchr(p, t, ';');
+                if (v == NULL) {
+                    v = t;
+                }
 
-    return pr->not? NGX_OK: NGX_ERROR;
+                if ((size_t) (v - p) >= filename.len
+                    && ngx_strncasecmp(p, filename.data, filename.len) == 0)
+                {
+                    ngx_http_waf_body_param(p + filename.len, v, val);
+                    *file = 1;
+
+                } else if ((size_t) (v - p) >= name.len
+                    && ngx_strncasecmp(p, name.data, name.len) == 0)
+                {
+                    ngx_http_waf_body_param(p + name.len, v, key);
+                }
+            }
+        }
+
+        p = q + 1;
+    }
 }
 
 
+// the name of an uploaded file, NGX_DONE if the score is done.
 static ngx_int_t
-ngx_http_waf_rule_str_rx_handler(ngx_http_waf_public_rule_t *pr,
-    ngx_str_t *s)
+ngx_http_waf_body_filename(ngx_http_request_t *r,
+    ngx_http_waf_loc_conf_t *wlcf, ngx_http_waf_ctx_t *ctx, ngx_str_t *key,
+    ngx_str_t *val)
 {
-    ngx_int_t   n;
-
-    if (s == NULL || s->data == NULL || s->len == 0) {
-        return NGX_ERROR;
+    if (key->len == 0 || val->len == 0) {
+        return NGX_OK;
     }
 
-    n = NGX_REGEX_NO_MATCHED;
-    n = ngx_regex_exec(pr->regex, s, NULL, 0);
-    if (n == NGX_REGEX_NO_MATCHED) {
-        return pr->not? NGX_OK: NGX_ERROR;
-    }
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+        "http waf module score body multipart "
+        "name:[%V] filename:[%V]",
+        key, val);
 
-    return pr->not? NGX_ERROR: NGX_OK;
+    ngx_http_waf_rule_filter(r, ctx, &wlcf->body_var_hash,
+        wlcf->body, key, val, 0);
+
+    return ngx_http_waf_score_is_done(ctx->status) ? NGX_DONE : NGX_OK;
+}
+
+
+// a part whose headers are not ended, the part is skipped.
+static void
+ngx_http_waf_body_head_error(ngx_http_request_t *r, ngx_http_waf_body_t *b,
+    size_t size)
+{
+    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+        "http waf module body multipart part head error, size:%uz, "
+        "skipped", size);
+
+    b->skipped = 1;
 }
 
 
+// a new uploaded file, the states of the stream rules are reset.
 static ngx_int_t
-ngx_http_waf_rule_str_sqli_handler(ngx_http_waf_public_rule_t *pr,
-    ngx_str_t *s)
+ngx_http_waf_body_file_start(ngx_http_request_t *r,
+    ngx_http_waf_loc_conf_t *wlcf, ngx_http_waf_body_t *b)
 {
-    ngx_int_t                       issqli;
-    struct libinjection_sqli_state  state;
+    size_t  n;
 
-    if (s == NULL || s->data == NULL || s->len == 0) {
-        return NGX_ERROR;
+    b->emitted = 0;
+
+    if (wlcf->body_file_stream->nelts == 0) {
+        return NGX_OK;
     }
 
-    libinjection_sqli_init(&state, (const char *)s->data, s->len, FLAG_NONE);
-    issqli = libinjection_is_sqli(&state);
-    if (!issqli) {
-        return NGX_ERROR;
+    n = (wlcf->body_file_stream->nelts + 7) / 8;
+
+    if (b->file_streams == NULL) {
+        b->file_streams = ngx_http_waf_stream_create(r->pool,
+                                                     wlcf->body_file_stream);
+        b->file_once = ngx_palloc(r->pool, n);
+        if (b->file_streams == NULL || b->file_once == NULL) {
+            return NGX_ERROR;
+        }
+
+    } else {
+        ngx_http_waf_stream_reset(b->file_streams);
     }
 
+    ngx_memzero(b->file_once, n);
+
     return NGX_OK;
 }
 
 
+// the bytes of an uploaded file after the ones matched. the stream rules
+// carry their state over them, a rule hit scores once for the file.
 static ngx_int_t
-ngx_http_waf_rule_str_xss_handler(ngx_http_waf_public_rule_t *pr,
-    ngx_str_t *s)
+ngx_http_waf_body_file(ngx_http_request_t *r, ngx_http_waf_loc_conf_t *wlcf,
+    ngx_http_waf_ctx_t *ctx, u_char *p, u_char *e, ngx_uint_t last)
 {
-    ngx_int_t       isxss;
-
-    if (s == NULL || s->data == NULL || s->len == 0) {
-        return NGX_ERROR;
+    ngx_int_t             rc;
+    ngx_http_waf_body_t  *b;
+
+    b = &ctx->body;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+        "http waf module body multipart "
+        "filename: [%V] window: %uz last: %ui",
+        &b->filename, (size_t) (e - p), last);
+
+    if (b->file_streams != NULL) {
+        rc = ngx_http_waf_stream_filter(r, ctx, wlcf->body_file_stream,
+                                        b->file_streams, b->file_once,
+                                        &b->filename, p, e, last);
+        if (rc != NGX_OK) {
+            return rc;
+        }
     }
 
-    isxss = libinjection_xss((const char *)s->data, s->len);
-    if (!isxss) {
-        return NGX_ERROR;
+    if (ngx_http_waf_score_timeout(r, wlcf) == NGX_OK) {
+        return NGX_DONE;
     }
 
     return NGX_OK;
 }
 
 
+// a part of the multipart body in the memory. the content of an uploaded
+// file is at the end of the part, its bytes in the windows before were
+// matched by the stream rules. a part over the bytes kept is matched by
+// the whole value rules up to them.
 static ngx_int_t
-ngx_http_waf_rule_hash_md5_handler(ngx_http_waf_public_rule_t *pr, ngx_str_t *s)
+ngx_http_waf_body_part(ngx_http_request_t *r, ngx_http_waf_loc_conf_t *wlcf,
+    ngx_http_waf_ctx_t *ctx, u_char *p, u_char *e)
 {
-    if (s == NULL || s->data == NULL || s->len == 0) {
-        return NGX_ERROR;
-    }
+    u_char               *q, *end;
+    ngx_int_t             rc;
+    ngx_str_t             key, val, content;
+    ngx_flag_t            file;
+    ngx_http_waf_body_t  *b;
 
-    ngx_md5_t                md5;
-    u_char                   md5_buf[16];
-    u_char                   hex_buf[2 * sizeof(md5_buf)];
+    b = &ctx->body;
 
-    ngx_md5_init(&md5);
-    ngx_md5_update(&md5, s->data, s->len);
-    ngx_md5_final(md5_buf, &md5);
+    if (b->skipped) {
+        return NGX_OK;
+    }
 
-    ngx_hex_dump(hex_buf, md5_buf, sizeof(md5_buf));
+    end = e;
 
-    if (sizeof(hex_buf) == pr->str.len
-        && ngx_strncmp(hex_buf, pr->str.data, pr->str.len) == 0)
-    {
-        return pr->not? NGX_ERROR: NGX_OK;
-    }
+    if (b->truncated) {
+        end = p + b->emitted;
 
-    return pr->not? NGX_OK: NGX_ERROR;
-}
+        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+            "http waf module body multipart part over %uz, "
+            "the rest is not inspected", b->emitted);
+    }
 
+    if (b->upload) {
+        q = p;
+        val = b->filename;
+        file = 1;
 
-static ngx_int_t
-ngx_http_waf_rule_hash_crc32_short_handler(ngx_http_waf_public_rule_t *pr,
-    ngx_str_t *s)
-{
-    uint32_t                  hash;
+    } else {
+        q = ngx_http_waf_body_head(p, end, &key, &val, &file);
+        if (q == NULL) {
+            ngx_http_waf_body_head_error(r, b, e - p);
+            return NGX_OK;
+        }
 
-    if (s == NULL || s->data == NULL || s->len == 0) {
-        return NGX_ERROR;
-    }
+        if (ngx_http_waf_body_filename(r, wlcf, ctx, &key, &val) != NGX_OK) {
+            return NGX_DONE;
+        }
 
-    hash = ngx_crc32_short(s->data, s->len);
+        if (file) {
+            b->filename = val;
 
-    if (hash == ngx_atoi(pr->str.data, pr->str.len)) {
-        return pr->not? NGX_ERROR: NGX_OK;
+            if (ngx_http_waf_body_file_start(r, wlcf, b) != NGX_OK) {
+                return NGX_ERROR;
+            }
+        }
     }
 
-    return pr->not? NGX_OK: NGX_ERROR;
-}
+    content.data = q;
+    content.len = end - q;
 
+    if (file) {
+        rc = ngx_http_waf_body_file(r, wlcf, ctx, q + b->emitted, e, 1);
+        if (rc != NGX_OK) {
+            return rc;
+        }
 
-static ngx_int_t
-ngx_http_waf_rule_hash_crc32_long_handler(ngx_http_waf_public_rule_t *pr,
-    ngx_str_t *s)
-{
+        // the buf has the file up to a window for these rules.
+        if (wlcf->body_file->nelts > 0) {
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                "http waf module body multipart "
+                "filename: [%V] file: [%V]",
+                &val, &content);
 
-    uint32_t                  hash;
+            ngx_http_waf_rule_filter(r, ctx, NULL, wlcf->body_file,
+                &val, &content, 0);
+        }
 
-    if (s == NULL || s->data == NULL || s->len == 0) {
-        return NGX_ERROR;
-    }
+    } else {
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+            "http waf module body multipart "
+            "name:[%V] val:[%V]",
+            &key, &content);
 
-    hash = ngx_crc32_long(s->data, s->len);
+        ngx_http_waf_rule_filter(r, ctx, &wlcf->body_var_hash,
+            wlcf->body, &key, &content, 0);
+    }
 
-    if (hash == ngx_atoi(pr->str.data, pr->str.len)) {
-        return pr->not? NGX_ERROR: NGX_OK;
+    if (ngx_http_waf_score_is_done(ctx->status)
+        || ngx_http_waf_score_timeout(r, wlcf) == NGX_OK)
+    {
+        return NGX_DONE;
     }
 
-    return pr->not? NGX_OK: NGX_ERROR;
+    return NGX_OK;
 }
 
 
-static void
-ngx_http_waf_rule_str_match(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx,
-    ngx_http_waf_rule_t *rule, ngx_str_t *key, ngx_str_t *val)
+// the part in the buf is over a window. the content of a file is matched
+// by the stream rules window by window, the buf keeps the bytes which may
+// start the delimiter, and the first window of the part for the whole
+// value rules, i.e. the other file rules or the field ones.
+static ngx_int_t
+ngx_http_waf_body_upload(ngx_http_request_t *r,
+    ngx_http_waf_loc_conf_t *wlcf, ngx_http_waf_ctx_t *ctx)
 {
-    ngx_int_t                     rc;
-    ngx_uint_t                    i;
-    ngx_str_t                     src, dst;
-    ngx_http_waf_rule_decode_pt  *handlers;
+    u_char               *q;
+    size_t                keep, kept;
+    ngx_int_t             rc;
+    ngx_str_t             key, val;
+    ngx_flag_t            file;
+    ngx_http_waf_body_t  *b;
+
+    b = &ctx->body;
+    keep = b->delim.len - 1;
+
+    if (!b->headed) {
+        b->headed = 1;
+
+        q = ngx_http_waf_body_head(b->buf, b->buf + b->len - keep, &key,
+                                   &val, &file);
+        if (q == NULL) {
+            ngx_http_waf_body_head_error(r, b, b->len);
+            goto trim;
+        }
 
-    // match key
-    if (key != NULL && key->len > 0
-        && ngx_http_waf_mz_key(rule->m_zone->flag)
-        && !ngx_http_waf_rule_wl_mz_key(rule->sts))
-    {
-        src.data = key->data;
-        src.len  = key->len;
-        dst = src;
-
-        handlers = rule->p_rule->decode_handlers->elts;
-        for (i = 0; i < rule->p_rule->decode_handlers->nelts; i++) {
-            src = dst;
-            rc = handlers[i](r, &dst, &src, (i != 0));
-            if (rc != NGX_OK) {
-                ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                    "ngx http waf decode error");
-                return;
-            }
+        if (ngx_http_waf_body_filename(r, wlcf, ctx, &key, &val) != NGX_OK) {
+            return NGX_DONE;
         }
 
-        if (rule->p_rule->handler(rule->p_rule, &dst) == NGX_OK) {
-            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                "ngx http waf rule str match handler id:%ui, key:%V", rule->p_rule->id, &dst);
+        if (!file) {
+            // the headers are parsed again with the value.
+            b->emitted = ngx_max((size_t) (q - b->buf),
+                                 NGX_HTTP_WAF_BODY_WINDOW);
+            goto trim;
+        }
 
-            ngx_http_waf_score_calc(r, ctx, rule, *key);
+        b->filename.len = val.len;
+        b->filename.data = ngx_pstrdup(r->pool, &val);
+        if (b->filename.data == NULL) {
+            return NGX_ERROR;
         }
-    }
 
-    // match value
-    if (val != NULL && val->len > 0
-        && ngx_http_waf_mz_val(rule->m_zone->flag)
-        && !ngx_http_waf_rule_wl_mz_val(rule->sts))
-    {
-        src.data = val->data;
-        src.len  = val->len;
-        dst = src;
-
-        handlers = rule->p_rule->decode_handlers->elts;
-        for (i = 0; i < rule->p_rule->decode_handlers->nelts; i++) {
-            src = dst;
-            rc = handlers[i](r, &dst, &src, (i != 0));
-            if (rc != NGX_OK) {
-                ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                    "ngx http waf decode error");
-                return;
-            }
+        if (ngx_http_waf_body_file_start(r, wlcf, b) != NGX_OK) {
+            return NGX_ERROR;
         }
 
-        if (rule->p_rule->handler(rule->p_rule, &dst) == NGX_OK) {
-            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                "ngx http waf rule str match handler id:%ui, val:%V", rule->p_rule->id, &dst);
+        b->len -= q - b->buf;
+        ngx_memmove(b->buf, q, b->len);
 
-            ngx_http_waf_score_calc(r, ctx, rule, *val);
-        }
+        b->upload = 1;
     }
 
-    return;
-}
+    if (!b->upload) {
+        goto trim;
+    }
 
+    if (b->len <= keep + b->emitted) {
+        return NGX_OK;
+    }
 
-static void
-ngx_http_waf_hash_find(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx,
-    ngx_hash_t *hash, ngx_str_t *key, ngx_str_t *val, ngx_uint_t hk)
-{
-    ngx_uint_t                    i, k;
-    ngx_hash_elt_t               *elt;
-    ngx_http_waf_rule_t          *rule;
-    ngx_http_waf_zone_t          *mzs;
+    rc = ngx_http_waf_body_file(r, wlcf, ctx, b->buf + b->emitted,
+                                b->buf + b->len - keep, 0);
+    if (rc != NGX_OK) {
+        return rc;
+    }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-        "ngx http waf hash find handler");
+    b->emitted = 0;
 
-    if (hash == NULL || key == NULL || hash->size == 0 || key->len == 0) {
-        return;
+    if (wlcf->body_file->nelts > 0) {
+        b->emitted = ngx_min(b->len - keep, NGX_HTTP_WAF_BODY_WINDOW);
     }
 
-    if (hk == 0) {
-        hk = ngx_hash_key_lc(key->data, key->len);
-    }
-    elt = hash->buckets[hk % hash->size];
+trim:
 
-    if (elt == NULL) {
-        return;
+    // a skipped part keeps none.
+    kept = b->skipped ? 0 : b->emitted;
+
+    if (b->len - keep > kept) {
+        ngx_memmove(b->buf + kept, b->buf + b->len - keep, keep);
+        b->len = kept + keep;
+        b->truncated = (kept > 0);
     }
 
-    while (elt->value) {
-        if (key->len != (size_t) elt->len) {
-            goto next;
-        }
+    return NGX_OK;
+}
 
-        for (i = 0; i < key->len; i++) {
-            if (ngx_tolower(key->data[i]) != elt->name[i]) {
-                goto next;
-            }
-        }
 
-        rule = elt->value;
-        if (ngx_http_waf_rule_invalid(rule->sts)) {
-            goto next;
-        }
+// the parts of the multipart body between the delimiters. a part over two
+// chunks is copied to the buf up to a window, a delimiter over them is
+// found by the last bytes of the buf and the first bytes of the chunk.
+// the body starts with a CRLF for the first delimiter.
+static ngx_int_t
+ngx_http_waf_body_multipart(ngx_http_request_t *r,
+    ngx_http_waf_loc_conf_t *wlcf, ngx_http_waf_ctx_t *ctx, u_char *p,
+    u_char *e, ngx_uint_t last)
+{
+    u_char               *q, c0, c1;
+    size_t                n, m, len;
+    ngx_int_t             rc;
+    ngx_http_waf_body_t  *b;
 
-        if (rule->wl_zones != NULL) {
-            mzs = rule->wl_zones->elts;
-            for (k = 0; k < rule->wl_zones->nelts; k++) {
-                if (ngx_http_waf_mz_is_regex(mzs[k].flag)) {
-                    if (ngx_http_waf_zone_regex_exec(&mzs[k], key) == NGX_OK) {
-                        goto next;
-                    }
-                } else {
-                    if (key->len == mzs[k].name.len && ngx_strncasecmp(key->data,
-                        mzs[k].name.data, key->len) == 0)
-                    {
-                        goto next;
-                    }
-                }
-            }
-        }
+    enum {
+        sw_preamble = 0,
+        sw_part,
+        sw_epilogue
+    };
 
+    b = &ctx->body;
 
-        ngx_http_waf_rule_str_match(r, ctx, rule, key, val);
+    if (b->delim.len == 0) {
+        if (b->state == sw_epilogue) {
+            return NGX_OK;
+        }
 
-    next:
+        rc = ngx_http_waf_body_boundary(r, b);
+        if (rc != NGX_OK) {
+            b->state = sw_epilogue;
+            return (rc == NGX_ERROR) ? NGX_ERROR : NGX_OK;
+        }
 
-        elt = (ngx_hash_elt_t *) ngx_align_ptr(&elt->name[0] + elt->len,
-                                               sizeof(void *));
-        continue;
+        if (ngx_http_waf_body_save(r, b, (u_char *) CRLF, (u_char *) CRLF + 2)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
     }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-        "ngx http waf hash find done");
-    return;
-}
+    len = b->delim.len;
 
+    while (b->state != sw_epilogue) {
 
-static ngx_int_t
-ngx_http_waf_rule_filter(ngx_http_request_t *r, ngx_http_waf_ctx_t *ctx,
-  ngx_hash_t *hash, ngx_array_t *rule,
-  ngx_str_t *key, ngx_str_t *val, ngx_uint_t key_hash)
-{
-    ngx_uint_t              j, k;
-    ngx_http_waf_rule_t    *rs;
-    ngx_http_waf_zone_t    *mzs;
+        // the close delimiter, its part is the epilogue.
+        if (b->state == sw_part && !b->headed && b->len + (e - p) >= 2) {
+            c0 = (b->len > 0) ? b->buf[0] : p[0];
+            c1 = (b->len > 1) ? b->buf[1] : p[1 - b->len];
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-        "ngx http waf rule filter handler");
+            if (c0 == '-' && c1 == '-') {
+                b->state = sw_epilogue;
+                b->len = 0;
+                break;
+            }
+        }
 
-    ngx_http_waf_hash_find(r, ctx, hash, key, val, key_hash);
+        q = NULL;
+        rc = NGX_OK;
 
-    if (rule == NULL) {
-        goto done;
-    }
+        if (b->len > 0) {
+            n = ngx_min(b->len, len - 1);
+            m = ngx_min((size_t) (e - p), len - 1);
 
-    rs = rule->elts;
-    for (j = 0; j < rule->nelts; j++) {
-        if (ngx_http_waf_rule_invalid(rs[j].sts)) {
-            goto nxt_rule;
+            ngx_memcpy(b->cross, b->buf + b->len - n, n);
+            ngx_memcpy(b->cross + n, p, m);
+
+            q = ngx_http_waf_body_delim(b, b->cross, b->cross + n + m);
+
+            if (q != NULL && q < b->cross + n) {
+                if (b->state == sw_part) {
+                    rc = ngx_http_waf_body_part(r, wlcf, ctx, b->buf,
+                             b->buf + b->len - n + (q - b->cross));
+                }
+
+                p += len - n + (q - b->cross);
+                goto next;
+            }
         }
 
-        // wl_zones ngx_http_waf_zone_t
-        if (rs[j].wl_zones != NULL) {
-            mzs = rs[j].wl_zones->elts;
-            for (k = 0; k < rs[j].wl_zones->nelts; k++) {
-                if (ngx_http_waf_mz_is_regex(mzs[k].flag)) {
-                    if (ngx_http_waf_zone_regex_exec(&mzs[k], key) == NGX_OK) {
-                        goto nxt_rule;
+        q = ngx_http_waf_body_delim(b, p, e);
+
+        if (q != NULL) {
+            if (b->state == sw_part) {
+                if (b->len > 0) {
+                    if (ngx_http_waf_body_save(r, b, p, q) != NGX_OK) {
+                        return NGX_ERROR;
                     }
+
+                    rc = ngx_http_waf_body_part(r, wlcf, ctx, b->buf,
+                                                b->buf + b->len);
+
                 } else {
-                    if (key->len == mzs[k].name.len && ngx_strncasecmp(key->data,
-                        mzs[k].name.data, key->len) == 0)
-                    {
-                        goto nxt_rule;
-                    }
+                    rc = ngx_http_waf_body_part(r, wlcf, ctx, p, q);
                 }
             }
+
+            p = q + len;
+            goto next;
         }
 
-        if(ngx_http_waf_mz_is_general(rs[j].m_zone->flag)) {
+        if (b->state == sw_preamble) {
+            // the bytes of a delimiter over the chunks.
+            if ((size_t) (e - p) >= len - 1) {
+                b->len = 0;
+                p = e - (len - 1);
+            }
+
+            if (ngx_http_waf_body_save(r, b, p, e) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            if (b->len > len - 1) {
+                ngx_memmove(b->buf, b->buf + b->len - (len - 1), len - 1);
+                b->len = len - 1;
+            }
 
-            ngx_http_waf_rule_str_match(r, ctx, &rs[j], key, val);
-        } else if (ngx_http_waf_mz_is_regex(rs[j].m_zone->flag)) {
+            break;
+        }
 
-            if (ngx_http_waf_zone_regex_exec(rs[j].m_zone, key) == NGX_OK) {
+        if (!last) {
+            if (ngx_http_waf_body_save(r, b, p, e) != NGX_OK) {
+                return NGX_ERROR;
+            }
 
-                ngx_http_waf_rule_str_match(r, ctx, &rs[j], key, val);
+            if (b->len > NGX_HTTP_WAF_BODY_WINDOW + b->emitted) {
+                return ngx_http_waf_body_upload(r, wlcf, ctx);
             }
+
+            break;
         }
 
-    nxt_rule:
+        // the part without the close delimiter.
+        if (b->len > 0) {
+            if (ngx_http_waf_body_save(r, b, p, e) != NGX_OK) {
+                return NGX_ERROR;
+            }
 
-        if (ngx_http_waf_score_is_done(ctx->status)) {
-            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                "ngx http waf rule filter handler block");
-            return NGX_ABORT;
+            rc = ngx_http_waf_body_part(r, wlcf, ctx, b->buf,
+                                        b->buf + b->len);
+
+        } else {
+            rc = ngx_http_waf_body_part(r, wlcf, ctx, p, e);
         }
 
-        // if (ngx_http_waf_score_timeout())
+        b->state = sw_epilogue;
+        b->len = 0;
+        break;
 
-        continue;
-    }
+    next:
 
-done:
+        b->state = sw_part;
+        b->len = 0;
+        b->headed = 0;
+        b->upload = 0;
+        b->truncated = 0;
+        b->skipped = 0;
+        b->emitted = 0;
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-        "ngx http waf rule filter handler done");
+        if (rc != NGX_OK) {
+            return rc;
+        }
+    }
 
     return NGX_OK;
 }
 
 
-static void
-ngx_http_waf_score_url(ngx_http_request_t *r, ngx_http_waf_loc_conf_t *wlcf)
+// the json or xml body of the chunks, parsed in place. a token over two
+// chunks is carried in the buf and completed with the bytes after it, a
+// part at a time, until the parser gets over it.
+static ngx_int_t
+ngx_http_waf_body_doc(ngx_http_request_t *r, ngx_http_waf_loc_conf_t *wlcf,
+    ngx_http_waf_ctx_t *ctx, ngx_http_waf_body_parse_pt parse,
+    u_char *p, u_char *e, ngx_uint_t last)
 {
-    ngx_http_waf_ctx_t           *ctx;
-
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                    "http waf module score url: %V", &r->uri);
-
-    ctx = ngx_http_get_module_ctx(r, ngx_http_waf_module);
-    if (ctx == NULL || ngx_http_waf_score_is_done(ctx->status)) {
-        return;
-    }
+    u_char               *q;
+    size_t                n, len;
+    ngx_int_t             rc;
+    ngx_http_waf_body_t  *b;
 
-    if (ngx_http_waf_score_timeout(r, wlcf) == NGX_OK) {
-        return;
-    }
+    b = &ctx->body;
 
-    ngx_http_waf_rule_filter(r, ctx, &wlcf->url_var_hash, wlcf->url,
-        &r->uri, &r->uri, 0);
+    while (b->len > 0) {
+        len = b->len;
+        n = ngx_min((size_t) (e - p),
+                    ngx_max(len, NGX_HTTP_WAF_BODY_OVERLAP));
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                    "http waf module score url: %V done", &r->uri);
-    return;
-}
+        if (ngx_http_waf_body_save(r, b, p, p + n) != NGX_OK) {
+            return NGX_ERROR;
+        }
 
+        p += n;
+        q = b->buf;
 
-static void
-ngx_http_waf_score_args(ngx_http_request_t *r, ngx_http_waf_loc_conf_t *wlcf)
-{
-    u_char                       *p, *q, *e;
-    ngx_str_t                     key, val;
-    ngx_http_waf_ctx_t           *ctx;
+        rc = parse(r, wlcf, ctx, &q, b->buf + b->len, last && p == e);
+        if (rc != NGX_OK) {
+            goto stop;
+        }
 
-    enum {
-        sw_key = 0,
-        sw_val
-    } state;
+        n = b->buf + b->len - q;
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                    "http waf module score args: %V", &r->args);
+        // the parser is in the chunk again.
+        if ((size_t) (q - b->buf) >= len) {
+            p -= n;
+            b->len = 0;
+            break;
+        }
 
-    ctx = ngx_http_get_module_ctx(r, ngx_http_waf_module);
-    if (ctx == NULL || ngx_http_waf_score_is_done(ctx->status)) {
-        return;
-    }
+        ngx_memmove(b->buf, q, n);
+        b->len = n;
 
-    if (ngx_http_waf_score_timeout(r, wlcf) == NGX_OK) {
-        return;
+        if (p == e) {
+            return NGX_OK;
+        }
     }
 
-#if 0
-    u_char *dst, *src;
-    src = r->args.data;
+    q = p;
 
-    dst = ngx_pnalloc(r->pool, r->args.len);
-    if (dst == NULL) {
-        return;
+    rc = parse(r, wlcf, ctx, &q, e, last);
+    if (rc != NGX_OK) {
+        goto stop;
     }
-    p = e = dst;
 
-    ngx_unescape_uri(&e, &src, r->args.len, 0);
-#else
-    p = r->args.data;
-    e = r->args.data + r->args.len;
-#endif
+    return ngx_http_waf_body_save(r, b, q, e);
 
-    key.len = 0;
-    val.len = 0;
+stop:
 
-    q = p;
-    state = sw_key;
+    if (rc == NGX_DECLINED) {
+        b->stopped = 1;
+        b->len = 0;
+        return NGX_OK;
+    }
+
+    return rc;
+}
 
-    while(p < e) {
-        if (*p == '=' && state == sw_key) {
-            key.data = q;
-            key.len  = p - q;
 
-            p++;
-            q = p;
+// the body as it arrives, NGX_DONE if the score is done.
+static ngx_int_t
+ngx_http_waf_body_feed(ngx_http_request_t *r, ngx_http_waf_loc_conf_t *wlcf,
+    ngx_http_waf_ctx_t *ctx, u_char *p, u_char *e, ngx_uint_t last)
+{
+    ngx_int_t             rc;
+    ngx_http_waf_body_t  *b;
 
-            state = sw_val;
-        } else if ( ((*(p+1) == '&' || p+1 == e) && state == sw_val)
-            || ((p+1 == e) && state == sw_key) ) {
+    b = &ctx->body;
 
-            val.data = q;
-            val.len  = p - q + 1;
+    if (!b->started) {
+        b->started = 1;
+        b->type = ngx_http_waf_body_type(r);
 
-            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                "http waf module score args key:%V val:%V", &key, &val);
+        if (wlcf->raw_body_stream->nelts > 0) {
+            b->streams = ngx_http_waf_stream_create(r->pool,
+                                                    wlcf->raw_body_stream);
+            b->once = ngx_pcalloc(r->pool,
+                                  (wlcf->raw_body_stream->nelts + 7) / 8);
+            if (b->streams == NULL || b->once == NULL) {
+                return NGX_ERROR;
+            }
+        }
+    }
 
-            ngx_http_waf_rule_filter(r, ctx, &wlcf->args_var_hash, wlcf->args,
-                &key, &val, 0);
+    if (last) {
+        b->streamed = 1;
+    }
 
-            p += 2;
-            q = p;
-            state = sw_key;
+    if (ngx_http_waf_score_is_done(ctx->status)
+        || ngx_http_waf_score_timeout(r, wlcf) == NGX_OK)
+    {
+        return NGX_DONE;
+    }
 
-            key.len = 0;
-            key.data = NULL;
-            val.len = 0;
-            val.data = NULL;
+    // the raw_body_stream rules, a match may start in the chunks before.
+    if (b->streams != NULL && (p < e || last)) {
+        rc = ngx_http_waf_stream_filter(r, ctx, wlcf->raw_body_stream,
+                                        b->streams, b->once, NULL, p, e,
+                                        last);
+        if (rc != NGX_OK) {
+            return rc;
+        }
+    }
 
-        } else {
-            p++;
+    if (b->type == NGX_HTTP_WAF_BODY_URLENCODED
+        && (wlcf->body->nelts > 0 || wlcf->body_var_hash.size > 0))
+    {
+        rc = ngx_http_waf_body_form(r, wlcf, ctx, p, e, last);
+        if (rc != NGX_OK) {
+            return rc;
         }
+    }
 
-        if (ngx_http_waf_score_is_done(ctx->status)) {
-            goto done;
+    if (b->type == NGX_HTTP_WAF_BODY_MULTIPART
+        && (wlcf->body->nelts > 0 || wlcf->body_file->nelts > 0
+            || wlcf->body_file_stream->nelts > 0
+            || wlcf->body_var_hash.size > 0))
+    {
+        rc = ngx_http_waf_body_multipart(r, wlcf, ctx, p, e, last);
+        if (rc != NGX_OK) {
+            return rc;
         }
+    }
 
-        if (ngx_http_waf_score_timeout(r, wlcf) == NGX_OK) {
-            goto done;
+    if ((b->type == NGX_HTTP_WAF_BODY_JSON || b->type == NGX_HTTP_WAF_BODY_XML)
+        && !b->stopped
+        && (wlcf->body->nelts > 0 || wlcf->body_var_hash.size > 0))
+    {
+        rc = ngx_http_waf_body_doc(r, wlcf, ctx,
+                                   (b->type == NGX_HTTP_WAF_BODY_JSON)
+                                   ? ngx_http_waf_json_parse
+                                   : ngx_http_waf_xml_parse,
+                                   p, e, last);
+        if (rc != NGX_OK) {
+            return rc;
         }
     }
 
+    return NGX_OK;
+}
+
 
-done:
-#if 0
-    ngx_pfree(r->pool, dst);
-#endif
+// the rules of the body zones.
+static ngx_flag_t
+ngx_http_waf_body_rules(ngx_http_waf_loc_conf_t *wlcf)
+{
+    return wlcf->raw_body->nelts > 0 || wlcf->raw_body_stream->nelts > 0
+           || wlcf->body->nelts > 0 || wlcf->body_file->nelts > 0
+           || wlcf->body_file_stream->nelts > 0
+           || wlcf->body_var_hash.size > 0;
+}
 
 
-    return;
+// the rules which need the whole body, besides the ones matched as it
+// arrives: the raw_body rules of a pcre, a decode or the whole value.
+static ngx_flag_t
+ngx_http_waf_body_whole(ngx_http_waf_loc_conf_t *wlcf)
+{
+    return wlcf->raw_body->nelts > 0;
 }
 
 
 static void
-ngx_http_waf_score_headers(ngx_http_request_t *r, ngx_http_waf_loc_conf_t *wlcf)
+ngx_http_waf_body_unmap(void *data)
 {
-    ngx_uint_t                    i;
-    ngx_list_part_t              *part;
-    ngx_table_elt_t              *header;
-    ngx_http_waf_ctx_t           *ctx;
-
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                    "http waf module score headers ...");
+    ngx_http_waf_body_map_t  *map = data;
 
-    ctx = ngx_http_get_module_ctx(r, ngx_http_waf_module);
-    if (ctx == NULL || ngx_http_waf_score_is_done(ctx->status)) {
-        return;
+    if (map->addr != NULL) {
+        (void) munmap(map->addr, map->size);
     }
+}
 
-    if (ngx_http_waf_score_timeout(r, wlcf) == NGX_OK) {
-        return;
-    }
 
-    part = &r->headers_in.headers.part;
-    header = part->elts;
+// the bytes of the body in the file, its bufs follow each other in it.
+static ngx_int_t
+ngx_http_waf_body_file_len(ngx_http_request_t *r, size_t *len)
+{
+    ngx_chain_t  *cl;
 
-    for (i = 0; /* void */; i++) {
+    *len = 0;
 
-        if (i >= part->nelts) {
-            if (part->next == NULL) {
-                break;
+    for (cl = r->request_body->bufs; cl; cl = cl->next) {
+        if (!cl->buf->in_file || cl->buf->file_pos != (off_t) *len) {
+            if (ngx_buf_size(cl->buf) == 0) {
+                continue;
             }
 
-            part = part->next;
-            header = part->elts;
-            i = 0;
-        }
-
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-            "http waf module score headers key:%V val:%V",
-            &header[i].key, &header[i].value);
-
-        ngx_http_waf_rule_filter(r, ctx, &wlcf->headers_var_hash, wlcf->headers,
-            &header[i].key, &header[i].value, header[i].hash);
-
-        if (ngx_http_waf_score_is_done(ctx->status)) {
-            goto done;
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http waf module body is not in the file");
+            return NGX_DECLINED;
         }
 
-        if (ngx_http_waf_score_timeout(r, wlcf) == NGX_OK) {
-            goto done;
-        }
+        *len = cl->buf->file_last;
     }
 
-done:
-    return;
+    return NGX_OK;
 }
 
 
+// the body file is mapped instead of read into the memory, its pages are
+// the page cache. the parsers may read a byte over the end, the page
+// after the body is mapped to zeros.
 static ngx_int_t
-ngx_http_waf_parse_multi_body(ngx_http_request_t *r,
-    ngx_http_waf_loc_conf_t *wlcf, u_char *s, u_char *e, ngx_str_t *b)
+ngx_http_waf_body_map(ngx_http_request_t *r, ngx_str_t *body)
 {
-    u_char                       *p, *q;
-    ngx_uint_t                    file, over;
-    ngx_str_t                     key, val, content;
-    ngx_http_waf_ctx_t           *ctx;
+    u_char                   *p;
+    size_t                    len;
+    ngx_temp_file_t          *tf;
+    ngx_pool_cleanup_t       *cln;
+    ngx_http_waf_body_map_t  *map;
 
-    ngx_str_t    disposition = ngx_string("Content-Disposition");
-    ngx_str_t    form_data   = ngx_string("form-data");
-    ngx_str_t    ct_type     = ngx_string("Content-Type:");
-    ngx_str_t    filename    = ngx_string("filename=");
-    ngx_str_t    name        = ngx_string("name=");
+    tf = r->request_body->temp_file;
 
+    if (ngx_http_waf_body_file_len(r, &len) != NGX_OK) {
+        return NGX_DECLINED;
+    }
 
-    enum {
-        sw_start = 0,
-        sw_after_boundary,
-        sw_after_disposition,
-        sw_before_name,
-        sw_after_name,
-        sw_before_content,
-        sw_after_content,
-        sw_done
-    } multi_state;
-
-    p = s;
-    file = 0;
-    over = 0;
-    multi_state = sw_start;
+    body->len = len;
+    body->data = NULL;
 
-    ctx = ngx_http_get_module_ctx(r, ngx_http_waf_module);
-    if (ctx == NULL || ngx_http_waf_score_is_done(ctx->status)) {
+    if (len == 0) {
         return NGX_OK;
     }
 
-    if (ngx_http_waf_score_timeout(r, wlcf) == NGX_OK) {
-        return NGX_OK;
+    cln = ngx_pool_cleanup_add(r->pool, sizeof(ngx_http_waf_body_map_t));
+    if (cln == NULL) {
+        return NGX_ERROR;
     }
 
-    p = ngx_memnstr(p, (char *)b->data, e - p);
-    if (p == NULL) {
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-            "http waf module parse body multipart boundary start error");
+    map = cln->data;
+    map->addr = NULL;
+    map->size = ngx_align(len, ngx_pagesize) + ngx_pagesize;
+    cln->handler = ngx_http_waf_body_unmap;
+
+    p = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE|MAP_ANON, -1, 0);
+    if (p == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                      "mmap(MAP_ANON, %uz) failed", map->size);
         return NGX_ERROR;
     }
-    p += b->len;
-    multi_state = sw_after_boundary;
 
-    while (p < e) {
-        switch (multi_state) {
-            case sw_after_boundary:
-                file = 0;
-                ngx_str_null(&key);
-                ngx_str_null(&val);
-                ngx_str_null(&content);
-
-                // while (*p != CR && *p != LF && p < e)  p++;
-                if (p[0] != CR || p[1] != LF) {
-                    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                        "http waf module body multipart boundary end error");
-                    return NGX_ERROR;
-                }
-                p += 2;
-                // while(*p == ' ' && p < e)  p++;
+    map->addr = p;
 
-                if (ngx_strncasecmp(p, disposition.data, disposition.len) == 0)
-                {
-                    p += disposition.len;
-                    while (*p == ':' || *p == ' ')  p++;
+    if (mmap(p, len, PROT_READ, MAP_PRIVATE|MAP_FIXED, tf->file.fd, 0)
+        == MAP_FAILED)
+    {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                      "mmap(\"%V\", %uz) failed", &tf->file.name, len);
+        return NGX_ERROR;
+    }
+
+    (void) madvise(p, len, MADV_SEQUENTIAL);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http waf module body file \"%V\" mapped: %uz",
+                   &tf->file.name, len);
+
+    body->data = p;
+
+    return NGX_OK;
+}
+
+
+#if (NGX_THREADS)
+
+static void
+ngx_http_waf_body_read_thread(void *data, ngx_log_t *log)
+{
+    ngx_http_waf_body_read_t  *rd = data;
+
+    size_t   len;
+    ssize_t  n;
+
+    for (len = 0; len < rd->size; len += n) {
+        n = pread(rd->fd, rd->buf + len, rd->size - len, rd->offset + len);
+
+        if (n <= 0) {
+            rd->err = (n == 0) ? 0 : ngx_errno;
+            rd->n = -1;
+            return;
+        }
+    }
+
+    rd->n = len;
+}
+
+
+// the pages of the map are read by the thread, the worker matches them
+// without the faults on the disk.
+static void
+ngx_http_waf_body_fault_thread(void *data, ngx_log_t *log)
+{
+    ngx_http_waf_body_read_t  *rd = data;
+
+    volatile u_char  *p;
+
+    for (p = rd->buf; p < rd->buf + rd->size; p += ngx_pagesize) {
+        (void) *p;
+    }
+
+    rd->n = rd->size;
+}
+
+
+static void
+ngx_http_waf_body_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_connection_t    *c;
+    ngx_http_request_t  *r;
+
+    r = ev->data;
+    c = r->connection;
 
-                    if (ngx_strncasecmp(p, form_data.data, form_data.len) == 0)
-                    {
-                        p += form_data.len;
-                        while (*p == ';' || *p == ' ')  p++;
-                    }
-                }
+    ngx_http_set_log_request(c->log, r);
 
-                multi_state = sw_before_name;
-                over = 1;
-                break;
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http waf module body file thread done");
 
-            case sw_before_name:
+    r->main->blocked--;
+    r->aio = 0;
 
-                if (ngx_strncasecmp(p, filename.data, filename.len) == 0) {
-                    p += filename.len;
-                    file = 1;
+    r->write_event_handler(r);
 
-                    while (*p == ' ')  p++;
+    ngx_http_run_posted_requests(c);
+}
 
-                    if (*p == '"' || *p == '\'') {
-                        p++;
-                    }
-                    q = p;
 
-                    p = ngx_strpbrk(p, e, "; \r");
-                    if (p == NULL) {
-                        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                            "http waf module body multipart filename error");
-                        return NGX_ERROR;
-                    }
+// the phases run again when the task is done, the handler goes on with
+// the body.
+static ngx_int_t
+ngx_http_waf_body_thread_post(ngx_http_request_t *r,
+    ngx_http_waf_loc_conf_t *wlcf, ngx_thread_task_t *task)
+{
+    task->event.data = r;
+    task->event.handler = ngx_http_waf_body_thread_event_handler;
 
-                    if (over) {
-                        over = 0;
-                        val.data = q;
-                        val.len  = p - q;
+    if (ngx_thread_task_post(wlcf->thread_pool, task) != NGX_OK) {
+        return NGX_ERROR;
+    }
 
-                        if (*(p-1) == '"' || *(p-1) == '\'') {
-                            val.len--;
-                        }
-                    }
+    r->main->blocked++;
+    r->aio = 1;
+    r->write_event_handler = ngx_http_core_run_phases;
 
-                    if (*p == ';' || *p == ' ') {
-                        if (*p == ';') {
-                            over = 1;
-                        }
+    return NGX_AGAIN;
+}
 
-                        p += 1;
-                    }
 
-                } else if (ngx_strncasecmp(p, name.data, name.len) == 0) {
-                    p += name.len;
+// the body file is read by a thread, a window at a time, and the window
+// is fed by the worker when it is read. NGX_AGAIN while a read is posted.
+static ngx_int_t
+ngx_http_waf_body_read(ngx_http_request_t *r, ngx_http_waf_loc_conf_t *wlcf,
+    ngx_http_waf_ctx_t *ctx)
+{
+    size_t                     len;
+    ngx_int_t                  rc;
+    ngx_uint_t                 last;
+    ngx_temp_file_t           *tf;
+    ngx_thread_task_t         *task;
+    ngx_http_waf_body_read_t  *rd;
 
-                    while (*p == ' ')  p++;
+    tf = r->request_body->temp_file;
 
-                    if (*p == '"' || *p == '\'') {
-                        p++;
-                    }
-                    q = p;
+    if (ngx_http_waf_body_file_len(r, &len) != NGX_OK) {
+        return NGX_DECLINED;
+    }
 
-                    p = ngx_strpbrk(p, e, "; \r");
-                    if (p == NULL) {
-                        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                            "http waf multipart body name error");
-                        return NGX_ERROR;
-                    }
+    if (len == 0) {
+        return ngx_http_waf_body_feed(r, wlcf, ctx, NULL, NULL, 1);
+    }
 
-                    key.data = q;
-                    key.len  = p - q;
+    task = ctx->task;
 
-                    if (*(p-1) == '"' || *(p-1) == '\'') {
-                        key.len--;
-                    }
+    if (task == NULL) {
+        task = ngx_thread_task_alloc(r->pool, sizeof(ngx_http_waf_body_read_t)
+                                     + NGX_HTTP_WAF_BODY_WINDOW);
+        if (task == NULL) {
+            return NGX_ERROR;
+        }
 
-                    if (*p == ';' || *p == ' ') {
-                        p += 1;
-                    }
+        rd = task->ctx;
+        rd->fd = tf->file.fd;
+        rd->offset = 0;
+        rd->buf = (u_char *) (rd + 1);
+        rd->n = 0;
 
-                } else {
-                    p++;
-                }
+        task->handler = ngx_http_waf_body_read_thread;
 
-                if (key.len > 0 && val.len > 0) {
-                    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                        "http waf module score body multipart "
-                        "name:[%V] filename:[%V]",
-                        &key, &val);
+        ctx->task = task;
+    }
 
-                    ngx_http_waf_rule_filter(r, ctx, &wlcf->body_var_hash,
-                        wlcf->body, &key, &val, 0);
-                }
+    rd = task->ctx;
 
-                if (p[0] == CR && p[1] == LF) {
-                    p += 2;
-                    multi_state = sw_after_name;
-                }
+    if (rd->n == -1) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, rd->err,
+                      "pread() \"%V\" failed", &tf->file.name);
+        return NGX_ERROR;
+    }
 
-                break;
+    if (rd->n > 0) {
+        last = ((size_t) rd->offset + rd->n == len);
 
-            case sw_after_name:
-                while (*p == ' ')  p++;
+        rc = ngx_http_waf_body_feed(r, wlcf, ctx, rd->buf, rd->buf + rd->n,
+                                    last);
 
-                if (ngx_strncasecmp(p, ct_type.data, ct_type.len) == 0) {
-                    p += ct_type.len;
+        rd->offset += rd->n;
+        rd->n = 0;
 
-                    while (*p == ' ')  p++;
-                    q = p;
-                    p = ngx_memnstr(p, CRLF, e - p);
-                    if (p == NULL) {
-                        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                            "http waf module body multipart "
-                            "file content type error");
-                        return NGX_ERROR;
-                    }
-                    p += 2;
+        if (rc != NGX_OK || last) {
+            return rc;
+        }
+    }
 
-                }
+    rd->size = ngx_min(len - (size_t) rd->offset, NGX_HTTP_WAF_BODY_WINDOW);
 
-                if (p[0] == CR && p[1] == LF) {
-                    p += 2;
-                    multi_state = sw_before_content;
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http waf module body file read: %O, %uz",
+                   rd->offset, rd->size);
 
-                } else {
-                    p++;
-                }
+    return ngx_http_waf_body_thread_post(r, wlcf, task);
+}
 
-                break;
+#endif
 
-            case sw_before_content:
-                q = p;
-                p = ngx_memnstr(p, CRLF "------", e - p);
-                if (p == NULL) {
-                    ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
-                        "http waf module body multipart content error");
-                }
 
-                if (file) {
-                    content.data = q;
-                    content.len = p - q;
+// the body read before the request body filter is fed from its file.
+static ngx_int_t
+ngx_http_waf_body_feed_file(ngx_http_request_t *r,
+    ngx_http_waf_loc_conf_t *wlcf, ngx_http_waf_ctx_t *ctx)
+{
+    ngx_int_t  rc;
 
-                    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                        "http waf module body multipart "
-                        "filename: [%V] file: [%V]",
-                        &val, &content);
+#if (NGX_THREADS)
+    if (wlcf->thread_pool != NULL) {
+        return ngx_http_waf_body_read(r, wlcf, ctx);
+    }
+#endif
 
-                    ngx_http_waf_rule_filter(r, ctx, NULL, wlcf->body_file,
-                        &val, &content, 0);
+    rc = ngx_http_waf_body_map(r, &ctx->file);
+    if (rc != NGX_OK) {
+        return rc;
+    }
 
-                } else {
-                    val.data = q;
-                    val.len = p - q;
-
-                    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                        "http waf module body multipart "
-                        "name:[%V] val:[%V]",
-                        &key, &val);
-                    ngx_http_waf_rule_filter(r, ctx, &wlcf->body_var_hash,
-                        wlcf->body, &key, &val, 0);
-                }
+    ctx->file_mapped = 1;
 
-                p += 2;
-                multi_state = sw_after_content;
+    return ngx_http_waf_body_feed(r, wlcf, ctx, ctx->file.data,
+                                  ctx->file.data + ctx->file.len, 1);
+}
 
-                break;
 
-            case sw_after_content:
-                p = ngx_memnstr(p, (char *)b->data, e - p);
-                if (p == NULL) {
-                    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                        "http waf module body multipart after content error");
-                    return NGX_ERROR;
-                }
-                p += b->len;
-                multi_state = sw_after_boundary;
+// the body file mapped for the rules of the whole body, the pages are
+// read by a thread before they are matched.
+static ngx_int_t
+ngx_http_waf_body_file_map(ngx_http_request_t *r,
+    ngx_http_waf_loc_conf_t *wlcf, ngx_http_waf_ctx_t *ctx)
+{
+    ngx_int_t                  rc;
+#if (NGX_THREADS)
+    ngx_thread_task_t         *task;
+    ngx_http_waf_body_read_t  *rd;
+#endif
 
-                if (p + 4 == e && p[0] == '-' && p[1] == '-'
-                    && p[2] == CR && p[3] == LF)
-                {
-                    p += 4;
-                    multi_state = sw_done;
-                }
+    if (ctx->file_mapped) {
+        return NGX_OK;
+    }
 
-                break;
+    rc = ngx_http_waf_body_map(r, &ctx->file);
+    if (rc != NGX_OK) {
+        return rc;
+    }
 
-            case sw_done:
-                return NGX_OK;
+    ctx->file_mapped = 1;
 
-            default:
-                p++;
+#if (NGX_THREADS)
+    if (wlcf->thread_pool != NULL && ctx->file.len > 0) {
+        task = ngx_thread_task_alloc(r->pool,
+                                     sizeof(ngx_http_waf_body_read_t));
+        if (task == NULL) {
+            return NGX_ERROR;
         }
+
+        rd = task->ctx;
+        rd->buf = ctx->file.data;
+        rd->size = ctx->file.len;
+
+        task->handler = ngx_http_waf_body_fault_thread;
+
+        return ngx_http_waf_body_thread_post(r, wlcf, task);
     }
+#endif
 
-    ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
-        "http waf module body multipart warning");
     return NGX_OK;
 }
 
 
-static void
+// the body after it is read, NGX_AGAIN while its file is read by a thread.
+static ngx_int_t
 ngx_http_waf_score_body(ngx_http_request_t *r, ngx_http_waf_loc_conf_t *wlcf)
 {
-    u_char                       *p, *q, *e, *t;
-    ngx_str_t                     body, *type, key, val, boundary;
+    u_char                       *p;
+    ngx_int_t                     rc;
+    ngx_uint_t                    n;
+    ngx_str_t                     body;
     ngx_chain_t                  *cl;
     ngx_http_waf_ctx_t           *ctx;
 
-    ngx_str_t    ct_urlencode = ngx_string("application/x-www-form-urlencoded");
-    ngx_str_t    ct_multipart = ngx_string("multipart/form-data");
-    ngx_str_t    boundary_prefix = ngx_string("boundary");
-
-    ngx_str_null(&key);
-    ngx_str_null(&val);
-    ngx_str_null(&boundary);
-
-    enum {
-        sw_key = 0,
-        sw_val
-    } state;
-
-    state = sw_key;
-
     ctx = ngx_http_get_module_ctx(r, ngx_http_waf_module);
     if (ctx == NULL || ngx_http_waf_score_is_done(ctx->status)) {
-        return;
+        return NGX_OK;
     }
 
     if (ngx_http_waf_score_timeout(r, wlcf) == NGX_OK) {
-        return;
+        return NGX_OK;
     }
 
-    if (r->request_body == NULL
-        || r->request_body->temp_file
-        || r->request_body->bufs == NULL)
-    {
+    if (r->request_body == NULL || r->request_body->bufs == NULL) {
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                     "ngx http waf module score body, body is null!");
-        return;
+        return NGX_OK;
     }
 
-    type = &r->headers_in.content_type->value;
+    ngx_str_null(&body);
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                    "ngx http waf module socore body content type:%V", type);
+    // the body was read before the request body filter.
+    if (!ctx->body.started || ctx->file_feed) {
+        ctx->transient = 1;
 
-    cl = r->request_body->bufs;
-    if (cl->next == NULL) {
-        body.data = cl->buf->pos;
-        body.len  = cl->buf->last - cl->buf->pos;
+        if (r->request_body->temp_file) {
+            ctx->file_feed = 1;
 
-    } else {
-        body.len = 0;
+            rc = ngx_http_waf_body_feed_file(r, wlcf, ctx);
 
-        for (; cl; cl = cl->next) {
-            body.len += cl->buf->last - cl->buf->pos;
-        }
+        } else {
+            rc = NGX_OK;
 
-        if (body.len > 0) {
-            body.data = ngx_pcalloc(r->pool, body.len + 1);
-            if (body.data != NULL) {
-                p = body.data;
-                for (cl = r->request_body->bufs; cl; cl = cl->next) {
-                    p = ngx_copy(p, cl->buf->pos, cl->buf->last - cl->buf->pos);
-                }
+            for (cl = r->request_body->bufs; cl && rc == NGX_OK;
+                 cl = cl->next)
+            {
+                rc = ngx_http_waf_body_feed(r, wlcf, ctx, cl->buf->pos,
+                                            cl->buf->last, cl->next == NULL);
             }
         }
-    }
-
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                    "ngx http waf module socre body file length: %d content:\n"
-                    "%V", body.len, &body);
-
-    // raw_body
-    ngx_http_waf_rule_filter(r, ctx, NULL, wlcf->raw_body, NULL, &body, 0);
-
-    if (wlcf->body->nelts == 0 && wlcf->body_file->nelts == 0
-        && wlcf->body_var_hash.size == 0)
-    {
-        return;
-    }
-
-    // parse body
-    if (ct_urlencode.len <= type->len
-        && ngx_strncasecmp(type->data, ct_urlencode.data,
-          ct_urlencode.len) == 0)
-    {
-        p = body.data;
-        e = body.data + body.len;
-        q = p;
-
-        while(p < e) {
-            if (*p == '=' && state == sw_key) {
-                key.data = q;
-                key.len  = p - q;
 
-                p++;
-                q = p;
+        ctx->transient = 0;
 
-                state = sw_val;
-            } else if ( ((*(p+1) == '&' || p+1 == e) && state == sw_val)
-                || ((p+1 == e) && state == sw_key) ) {
+        if (rc == NGX_AGAIN) {
+            return NGX_AGAIN;
+        }
 
-                val.data = q;
-                val.len  = p - q + 1;
+        ctx->file_feed = 0;
 
-                ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                    "http waf module score body urlencode key:%V val:%V", 
-                    &key, &val);
+        if (rc != NGX_OK) {
+            return NGX_OK;
+        }
+    }
 
-                ngx_http_waf_rule_filter(r, ctx, &wlcf->body_var_hash,
-                    wlcf->body, &key, &val, 0);
+    if (!ngx_http_waf_body_whole(wlcf)) {
+        return NGX_OK;
+    }
 
-                p += 2;
-                q = p;
-                state = sw_key;
+    // the whole body is mapped or copied only for the rules which need it:
+    // the raw_body rules of a pcre or a decode, the others are streamed.
+    cl = r->request_body->bufs;
+    if (r->request_body->temp_file) {
+        rc = ngx_http_waf_body_file_map(r, wlcf, ctx);
+        if (rc != NGX_OK) {
+            return (rc == NGX_AGAIN) ? NGX_AGAIN : NGX_OK;
+        }
 
-                key.len = 0;
-                key.data = NULL;
-                val.len = 0;
-                val.data = NULL;
+        body = ctx->file;
 
-            } else {
-                p++;
-            }
+    } else {
+        // the bufs in the memory are up to the client_body_buffer_size,
+        // a bigger body is in the file. they are copied to one only if
+        // more than one of them has the bytes.
+        n = 0;
 
-            if (ngx_http_waf_score_is_done(ctx->status)) {
-                goto done;
+        for (; cl; cl = cl->next) {
+            if (cl->buf->last > cl->buf->pos) {
+                body.data = cl->buf->pos;
+                n++;
             }
 
-            if (ngx_http_waf_score_timeout(r, wlcf) == NGX_OK) {
-                goto done;
-            }
+            body.len += cl->buf->last - cl->buf->pos;
         }
 
-    } else if (ct_multipart.len <= type->len && ngx_strncasecmp(
-          type->data, ct_multipart.data,
-          ct_multipart.len) == 0)
-    {
-        // https://www.ietf.org/rfc/rfc1867.txt
-        ngx_str_null(&boundary);
-
-        t = ngx_strnstr(type->data + ct_multipart.len,
-              (char *)boundary_prefix.data,
-              type->len - ct_multipart.len);
-        if (t == NULL) {
-            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                "http waf module multipart content type error, type:%V", type);
-            goto done;
-        }
+        if (n > 1) {
+            ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                          "http waf module body of %ui bufs copied: %uz",
+                          n, body.len);
 
-        p = t + boundary_prefix.len;
-        e  = type->data + type->len;
-        while (*p == ' ' || *p == '=' || *p == '\'' || *p == '"') {
-            p++;
-        }
+            body.data = ngx_pnalloc(r->pool, body.len + 1);
+            if (body.data == NULL) {
+                return NGX_OK;
+            }
 
-        while (*(e-1) == ' ' || *(e-1) == '\'' || *(e-1) == '"') {
-            e--;
-        }
+            p = body.data;
+            for (cl = r->request_body->bufs; cl; cl = cl->next) {
+                p = ngx_copy(p, cl->buf->pos, cl->buf->last - cl->buf->pos);
+            }
 
-        boundary.data = ngx_pcalloc(r->pool, 2 + e - p + 1);
-        if (boundary.data == NULL) {
-            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                "http waf module parse multipart boundary error");
-            goto done;
+            *p = '\0';
         }
-
-        boundary.data[0] = '-';
-        boundary.data[1] = '-';
-        ngx_memcpy(boundary.data + 2, p, e - p);
-        boundary.len = 2 + e - p;
-
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                      "http waf module score body boundary:%V", &boundary);
-
-        p = body.data;
-        e = body.data + body.len;
-        ngx_http_waf_parse_multi_body(r, wlcf, p, e, &boundary);
     }
 
-done:
-    if (boundary.data != NULL) {
-        ngx_pfree(r->pool, boundary.data);
-        boundary.data = NULL;
-    }
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                    "ngx http waf module socre body file length: %d content:\n"
+                    "%V", body.len, &body);
 
-    return;
+    // raw_body
+    ngx_http_waf_rule_filter(r, ctx, NULL, wlcf->raw_body, NULL, &body, 0);
+
+    return NGX_OK;
 }
 
 
@@ -3864,6 +12924,54 @@ ngx_http_waf_check(ngx_http_waf_ctx_t *ctx)
 }
 
 
+// the body is matched chunk by chunk as it is read, the request is
+// finalized with the block or the drop without reading the rest.
+static ngx_int_t
+ngx_http_waf_request_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
+{
+    ngx_int_t                   rc;
+    ngx_chain_t                *cl;
+    ngx_http_waf_ctx_t         *ctx;
+    ngx_http_waf_loc_conf_t    *wlcf;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_waf_module);
+
+    if (ctx == NULL || r != r->main || ctx->body.streamed
+        || ngx_http_waf_score_is_done(ctx->status))
+    {
+        return ngx_http_next_request_body_filter(r, in);
+    }
+
+    wlcf = ngx_http_get_module_loc_conf(r, ngx_http_waf_module);
+
+    ctx->transient = 1;
+
+    for (cl = in; cl; cl = cl->next) {
+        rc = ngx_http_waf_body_feed(r, wlcf, ctx, cl->buf->pos,
+                                    cl->buf->last, cl->buf->last_buf);
+        if (rc == NGX_ERROR) {
+            ctx->transient = 0;
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        if (rc == NGX_DONE) {
+            break;
+        }
+    }
+
+    ctx->transient = 0;
+
+    rc = ngx_http_waf_check(ctx);
+    if (rc != NGX_DECLINED) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+            "http waf request body filter reject: %i", rc);
+        return rc;
+    }
+
+    return ngx_http_next_request_body_filter(r, in);
+}
+
+
 static ngx_int_t
 ngx_http_waf_handler(ngx_http_request_t *r)
 {
@@ -3934,7 +13042,30 @@ ngx_http_waf_handler(ngx_http_request_t *r)
         ngx_http_set_ctx(r, ctx, ngx_http_waf_module);
     }
 
-    r->request_body_in_single_buf = 1;
+    // before the body, its filter goes on with their scores.
+    if (!ctx->head_done) {
+        if (ngx_http_waf_field_table(r, ctx) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        ngx_http_waf_score_url(r, wlcf);
+        ngx_http_waf_score_args(r, wlcf);
+        ngx_http_waf_score_headers(r, wlcf);
+        ctx->head_done = 1;
+    }
+
+    // the verdict of the url, args and headers, the body is not read. a
+    // blocked one is discarded by the special response.
+    if (ngx_http_waf_score_is_done(ctx->status)
+        || !ngx_http_waf_body_rules(wlcf))
+    {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+            "http waf module verdict without the body: %ui",
+            (ngx_uint_t) ngx_http_waf_score_is_done(ctx->status));
+
+        return ngx_http_waf_check(ctx);
+    }
+
     r->request_body_in_persistent_file = 1;
     r->request_body_in_clean_file = 1;
     rc = ngx_http_read_client_request_body(r, ngx_http_waf_body_handler);
@@ -3948,11 +13079,14 @@ ngx_http_waf_handler(ngx_http_request_t *r)
     }
 
     if (!ctx->check_done) {
-        ngx_http_waf_score_url(r, wlcf);
-        ngx_http_waf_score_args(r, wlcf);
-        ngx_http_waf_score_headers(r, wlcf);
-        ngx_http_waf_score_body(r, wlcf);
+        if (ngx_http_waf_score_body(r, wlcf) == NGX_AGAIN) {
+            return NGX_DONE;
+        }
+
         ctx->check_done = 1;
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+            "http waf decode cache hits: %ui", ctx->decode_hits);
     }
 
     return ngx_http_waf_check(ctx);
@@ -4171,5 +13305,57 @@ ngx_http_waf_init(ngx_conf_t *cf)
 
     *h = ngx_http_waf_log_handler;
 
+    ngx_http_next_request_body_filter = ngx_http_top_request_body_filter;
+    ngx_http_top_request_body_filter = ngx_http_waf_request_body_filter;
+
+    return NGX_OK;
+}
+
+
+// the string kernels and the worker private data of the matchers.
+static ngx_int_t
+ngx_http_waf_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                  i;
+    ngx_http_waf_matcher_t    **ms;
+    ngx_http_waf_main_conf_t   *wmcf;
+
+    ngx_http_waf_str_init_process(cycle);
+
+    wmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_waf_module);
+    if (wmcf == NULL) {
+        return NGX_OK;
+    }
+
+    ngx_http_waf_regex_init_process(cycle, wmcf);
+
+    if (wmcf->matchers == NULL) {
+        return NGX_OK;
+    }
+
+    ms = wmcf->matchers->elts;
+    for (i = 0; i < wmcf->matchers->nelts; i++) {
+        if (ms[i]->data == NULL || ms[i]->engine->init_process == NULL) {
+            continue;
+        }
+
+        // the matcher falls back to the rule handlers.
+        (void) ms[i]->engine->init_process(cycle, ms[i]);
+    }
+
     return NGX_OK;
+}
+
+
+static void
+ngx_http_waf_exit_process(ngx_cycle_t *cycle)
+{
+    ngx_http_waf_regex_exit_process(cycle);
+
+#if (NGX_HTTP_WAF_HYPERSCAN)
+    if (ngx_http_waf_hs_scratch != NULL) {
+        hs_free_scratch(ngx_http_waf_hs_scratch);
+        ngx_http_waf_hs_scratch = NULL;
+    }
+#endif
 }
\ No newline at end of file
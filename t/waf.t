@@ -12,6 +12,8 @@ use strict;
 use Test::More;
 
 use Socket qw/ CRLF /;
+use MIME::Base64 qw/ encode_base64 /;
+use Digest::MD5 qw/ md5_hex /;
 
 BEGIN { use FindBin; chdir($FindBin::Bin); }
 
@@ -52,6 +54,8 @@ http {
     security_rule id:1113 "str:!ew@testew" "z:V_ARGS:teststrnotew";
     security_rule id:1014 "str:rx@test-[a-z]{3}-done" "z:V_ARGS:teststr";
     security_rule id:1114 "str:!rx@test-[a-z]{3}-done" "z:V_ARGS:teststrnotrx";
+    security_rule id:1021 "str:rx@^(?=a)(a+)+b$" "limit:match=1000" "z:V_ARGS:testrxlimit";
+    security_rule id:1022 "str:rx@\bunion\W+select\b" "z:V_ARGS:testrxprefilter";
     security_rule id:1015 "libinj:sql" "z:V_ARGS:teststr";
     security_rule id:1016 "libinj:xss" "z:V_ARGS:teststr";
     security_rule id:1017 "str:ge@def" "z:V_ARGS:testge";
@@ -66,6 +70,8 @@ http {
     security_rule id:1502 "hash:!md5@4935f6e27eff994304a1a72768581ce5" "z:V_ARGS:testnotmd5";
     security_rule id:1503 "hash:crc32@4160194954" "z:V_ARGS:testcrc32";
     security_rule id:1504 "hash:crc32_long@800313341" "z:V_ARGS:testcrc32_long";
+    security_rule id:1505 "hash:sha256@ad6c2d91c3bc6772e312d63d0e0528518580835685a653503df38173739d65b3" "z:V_ARGS:testsha256";
+    security_rule id:1506 "hash:md5@file:%%TESTDIR%%/bad.md5" "z:V_ARGS:testmd5file";
 
     security_rule id:1601 "str:decode_url|eq@xx&yy zz" "z:V_ARGS:testdecodeurl";
     security_rule id:1602 "str:decode_base64|decode_url|eq@xx&yy zz" "z:V_ARGS:testdecodebase64url";
@@ -74,6 +80,13 @@ http {
     security_rule id:1605 "libinj:decode_base64|xss" "z:V_ARGS:testdecodebase64xss";
     security_rule id:1606 "libinj:decode_base64|decode_url|xss" "z:V_ARGS:testdecodebase64urlxss";
     security_rule id:1607 "libinj:decode_url|decode_url|xss" "z:V_ARGS:testdecodeurlurlxss";
+    security_rule id:1608 "str:decode_base64|decode_url|decode_url|eq@xx&yy zz" "z:V_ARGS:testdecodebase64urlurl";
+    security_rule id:1609 "str:decode_url|ct@x<y>z" "z:V_ARGS:testsimdurl";
+    security_rule id:1610 "str:decode_base64|ct@x<y>z" "z:V_ARGS:testsimdbase64";
+    security_rule id:1611 "str:decode_base64url|ct@x<y>z" "z:V_ARGS:testsimdbase64url";
+    security_rule id:1612 "str:decode_url|decode_html|ct@<script>" "z:V_ARGS:testdecodehtml";
+    security_rule id:1613 "str:decode_unicode|ct@<script>" "z:V_ARGS:testdecodeunicode";
+    security_rule id:1614 "str:decode_url|decode_strip_comments|decode_compress_ws|ct@union select" "z:V_ARGS:testdecodesql";
 
     security_rule id:2001 "str:eq@argskv" "z:ARGS";
     security_rule id:2002 "str:eq@argsonlyval" "z:#ARGS";
@@ -107,9 +120,13 @@ http {
     security_rule id:7001 "str:ct@testbody" "z:#RAW_BODY";
     security_rule id:7002 "str:eq@testurlencodebody" "z:V_BODY:foo";
     security_rule id:7003 "str:eq@multibar" "z:V_BODY:multifoo";
+    security_rule id:7004 "str:eq@<jsonbar>" "z:V_BODY:user.tags";
+    security_rule id:7005 "str:eq@xmlbar" "z:V_BODY:pass";
+    security_rule id:7006 "str:rx@testlong_y{300,}_done" "z:#RAW_BODY";
 
     security_rule id:8001 "str:ct@eval" "z:#FILE";
     security_rule id:8002 "str:ct@testphp" "z:X_FILE:^[a-z]{1,5}\.php$";
+    security_rule id:8003 "hash:md5@file:%%TESTDIR%%/bad.md5" "z:#FILE";
 
     security_rule id:9001 "str:eq@testscorecheck" "s:$TESTCHK:10" "z:V_ARGS:foo";
 
@@ -153,6 +170,13 @@ http {
 
                 proxy_pass http://127.0.0.1:8081/;
             }
+
+            location /openlimit/ {
+                security_waf on;
+                security_regex_limit_action open;
+
+                proxy_pass http://127.0.0.1:8081/;
+            }
         }
     }
 
@@ -172,8 +196,16 @@ http {
 
 EOF
 
+# over the 64k window of an uploaded file
+my $upload = 'testmd5upload' . ('z' x 70000);
+
+$t->write_file('bad.md5', <<'EOF' . md5_hex($upload) . "  upload\n");
+# known bad
+795f3202b17cb6bc3d4b771d8c6c9eaf  other
+9915C9021570D74D65CDDF2F102CC74F
+EOF
 
-$t->try_run('no waf')->plan(136);
+$t->try_run('no waf')->plan(183);
 
 ###############################################################################
 
@@ -189,6 +221,13 @@ like(http_get("/?TESTstr=hello TESTct world"),
     qr/403 Forbidden/, 'waf_1010: test case contain block');
 like(http_get("/?teststr=hello world"),
     qr/200 OK/, 'waf_1010: test contain ok');
+like(http(
+    "POST /?teststr=testct HTTP/1.0" . CRLF .
+    "Host: localhost" . CRLF .
+    "Content-Length: 100000" . CRLF .
+    CRLF .
+    "foo=bar"
+), qr/403 Forbidden/, 'waf_1010: test contain block before the body');
 like(http_get("/?Teststrnotct=hello world"),
     qr/403 Forbidden/, 'waf_1110: test not case contain ok');
 like(http_get("/?Teststrnotct=hello TestCT world"),
@@ -196,6 +235,8 @@ like(http_get("/?Teststrnotct=hello TestCT world"),
 
 like(http_get("/?teststr=testeq"),
     qr/403 Forbidden/, 'waf_1011: test equal block');
+like(http_get("/?TestStr=TestEQ"),
+    qr/403 Forbidden/, 'waf_1011: test case equal block');
 like(http_get("/?teststr=testequal"),
     qr/200 OK/, 'waf_1011: test equal ok');
 like(http_get("/?teststrnoteq=testeq"),
@@ -205,6 +246,8 @@ like(http_get("/?teststrNotEQ=testequal"),
 
 like(http_get("/?teststr=testsw world"),
     qr/403 Forbidden/, 'waf_1012: test startwith block');
+like(http_get("/?teststr=TESTSW World"),
+    qr/403 Forbidden/, 'waf_1012: test case startwith block');
 like(http_get("/?teststr=hello testsw world"),
     qr/200 OK/, 'waf_1012: test startwith ok');
 like(http_get("/?teststrnotsw=testsw world"),
@@ -214,6 +257,8 @@ like(http_get("/?teststrnotsw=hello testsw world"),
 
 like(http_get("/?teststr=hello testew"),
     qr/403 Forbidden/, 'waf_1013: test endwith block');
+like(http_get("/?teststr=Hello TestEW"),
+    qr/403 Forbidden/, 'waf_1013: test case endwith block');
 like(http_get("/?teststr=hello testew world"),
     qr/200 OK/, 'waf_1013: test endwith ok');
 like(http_get("/?teststrnotew=hello testew"),
@@ -230,6 +275,22 @@ like(http_get("/?teststrnotrx=test-abc-done"),
 like(http_get("/?teststrnotrx=test-abcd-done"),
     qr/403 Forbidden/, 'waf_1114: test regex block');
 
+like(http_get("/?testrxlimit=aab"),
+    qr/403 Forbidden/, 'waf_1021: test regex limit block');
+like(http_get("/?testrxlimit=xab"),
+    qr/200 OK/, 'waf_1021: test regex limit ok');
+like(http_get("/?testrxlimit=" . ("a" x 40) . "c"),
+    qr/403 Forbidden/, 'waf_1021: test regex limit fail closed');
+like(http_get("/openlimit/?testrxlimit=" . ("a" x 40) . "c"),
+    qr/200 OK/, 'waf_1021: test regex limit fail open');
+
+like(http_get("/?testrxprefilter=1+union+select+2"),
+    qr/403 Forbidden/, 'waf_1022: test regex prefilter block');
+like(http_get("/?testrxprefilter=1+union+selected"),
+    qr/200 OK/, 'waf_1022: test regex prefilter literal ok');
+like(http_get("/?testrxprefilter=1+union"),
+    qr/200 OK/, 'waf_1022: test regex prefilter no literal ok');
+
 like(http_get("/?teststr=1 or 1=1"),
     qr/403 Forbidden/, 'waf_1015: test sqli block');
 like(http_get("/?teststr=1"),
@@ -296,6 +357,16 @@ like(http_get("/?testcrc32_long=testcrc32long"),
 like(http_get("/?testcrc32_long=testcrc32longxx"),
     qr/200 OK/, 'waf_1504: test hash crc32_long ok');
 
+like(http_get("/?testsha256=testsha256"),
+    qr/403 Forbidden/, 'waf_1505: test hash sha256 block');
+like(http_get("/?testsha256=testsha256xx"),
+    qr/200 OK/, 'waf_1505: test hash sha256 ok');
+
+like(http_get("/?testmd5file=testmd5file"),
+    qr/403 Forbidden/, 'waf_1506: test hash md5 file block');
+like(http_get("/?testmd5file=testmd5filexx"),
+    qr/200 OK/, 'waf_1506: test hash md5 file ok');
+
 like(http_get("/?testdecodeurl=xx%26yy+zz"),
     qr/403 Forbidden/, 'waf_1601: test decode url block');
 like(http_get("/?testdecodeurl=xx%26yyzz"),
@@ -331,6 +402,91 @@ like(http_get("/?testdecodeurlurlxss=%253Cimg%2520src=1%2520onerror=alert(1)%253
 like(http_get("/?testdecodeurlurlxss=%253Cimg%2520src=%2520onerror%253E"),
     qr/200 OK/, 'waf_1607: test decode url url xss ok');
 
+like(http_get("/?testdecodebase64urlurl=eHglMjUyNnl5JTJCeno="),
+    qr/403 Forbidden/, 'waf_1608: test decode base64 url url block');
+like(http_get("/?testdecodebase64urlurl=eHglMjUyNnl5JTJCenk="),
+    qr/200 OK/, 'waf_1608: test decode base64 url url ok');
+
+# the vector decoders against the scalar decoder below, the values are long
+# enough for the vectors and end in their tails.
+
+my $waf_seed = 1609;
+
+sub waf_rand {
+    $waf_seed = ($waf_seed * 1103515245 + 12345) % 2147483648;
+    return $waf_seed % $_[0];
+}
+
+sub waf_unescape {
+    my ($state, $hi, $d) = (0, 0, '');
+
+    for my $ch (split //, $_[0]) {
+        if ($state == 0) {
+            if ($ch eq '%') { $state = 1; }
+            elsif ($ch eq '+') { $d .= ' '; }
+            else { $d .= $ch; }
+
+        } elsif ($state == 1) {
+            if ($ch =~ /[0-9a-f]/i) { $hi = hex($ch); $state = 2; }
+            else { $d .= $ch; $state = 0; }
+
+        } else {
+            $d .= chr($hi * 16 + hex($ch)) if $ch =~ /[0-9a-f]/i;
+            $state = 0;
+        }
+    }
+
+    return $d;
+}
+
+my @waf_url = ('a', 'Zq', '0', '%41', '%7e', '+', '%2B', '%zz', '%4', '%%41',
+    '%G1', '%3Cy', 'x%3c', 'x%3Cy%3E-', 'x%3Cy%3Fz', 'x%%3Cy%3Ez', '-_.');
+
+for my $i (1 .. 4) {
+    my $v = '';
+    $v .= $waf_url[waf_rand(scalar @waf_url)] for 1 .. 60 + waf_rand(200);
+    $v .= 'x%3Cy%3Ez' if $i % 2;
+
+    my $block = index(lc(waf_unescape($v)), 'x<y>z') >= 0;
+
+    like(http_get("/?testsimdurl=$v"), $block ? qr/403 Forbidden/
+        : qr/200 OK/, "waf_1609: test vector decode url $i");
+}
+
+for my $i (1 .. 8) {
+    my $p = '';
+    $p .= chr(waf_rand(256)) for 1 .. 40 + waf_rand(400);
+    substr($p, waf_rand(length $p), 0) = 'x<Y>z' if $i % 2;
+
+    my $v = encode_base64($p, '');
+    my $block = index(lc($p), 'x<y>z') >= 0;
+
+    if ($i > 4) {
+        $v =~ tr{+/}{-_};
+        $v =~ s/=+$// if $i % 3;
+    }
+
+    my $arg = $i > 4 ? 'testsimdbase64url' : 'testsimdbase64';
+
+    like(http_get("/?$arg=$v"), $block ? qr/403 Forbidden/ : qr/200 OK/,
+        "waf_1610: test vector decode $arg $i");
+}
+
+like(http_get("/?testdecodehtml=%26lt;script%26%2362;x%26%23x3C;/script>"),
+    qr/403 Forbidden/, 'waf_1612: test decode html block');
+like(http_get("/?testdecodehtml=%26lt;scrip%26gt;"),
+    qr/200 OK/, 'waf_1612: test decode html ok');
+
+like(http_get("/?testdecodeunicode=%u003cScript%uff1e"),
+    qr/403 Forbidden/, 'waf_1613: test decode unicode block');
+like(http_get("/?testdecodeunicode=%u003cscrip%u003e"),
+    qr/200 OK/, 'waf_1613: test decode unicode ok');
+
+like(http_get("/?testdecodesql=1%20UNION/**/%09%20/*!50000SELECT*/1"),
+    qr/403 Forbidden/, 'waf_1614: test decode strip comments block');
+like(http_get("/?testdecodesql=1%20UNION/**/ALL%20SELECT"),
+    qr/200 OK/, 'waf_1614: test decode strip comments ok');
+
 like(http_get("/?testnotle=d"),
     qr/200 OK/, 'waf_1118: test notlt ok');
 like(http_get("/?testnotle=e"),
@@ -587,6 +743,98 @@ like(http(
     "fcc=testurlencodebody&bar=test"
 ), qr/200 OK/, 'waf_7002: test body urlencode ok');
 
+my $pad = 'pad=' . ('x' x 20000);
+like(http(
+    "POST / HTTP/1.0" . CRLF .
+    "Host: localhost" . CRLF .
+    "Content-Type: application/x-www-form-urlencoded" . CRLF .
+    "Content-Length: " . (length($pad) + 22) . CRLF .
+    CRLF .
+    $pad . "&foo=testurlencodebody"
+), qr/403 Forbidden/, 'waf_7002: test large body urlencode block');
+like(http(
+    "POST / HTTP/1.0" . CRLF .
+    "Host: localhost" . CRLF .
+    "Content-Type: application/octet-stream" . CRLF .
+    "Content-Length: 100000" . CRLF .
+    CRLF .
+    $pad . "testbody"
+), qr/403 Forbidden/, 'waf_7001: test raw body block before its end');
+
+# the match is over the reads of the body and longer than any overlap.
+my $long = 'testlong_' . ('y' x 12000);
+like(http(
+    "POST / HTTP/1.0" . CRLF .
+    "Host: localhost" . CRLF .
+    "Content-Type: application/octet-stream" . CRLF .
+    "Content-Length: " . (length($long) + 5) . CRLF .
+    CRLF .
+    $long . "_done"
+), qr/403 Forbidden/, 'waf_7006: test raw body long match block');
+like(http(
+    "POST / HTTP/1.0" . CRLF .
+    "Host: localhost" . CRLF .
+    "Content-Type: application/octet-stream" . CRLF .
+    "Content-Length: " . (length($long) + 5) . CRLF .
+    CRLF .
+    $long . "_don_"
+), qr/200 OK/, 'waf_7006: test raw body long match ok');
+
+
+like(http(
+    "POST / HTTP/1.0" . CRLF .
+    "Host: localhost" . CRLF .
+    "Content-Type: application/json" . CRLF .
+    "Content-Length: 52" . CRLF .
+    CRLF .
+    '{"user": {"id": 1, "tags": ["a", "\\u003cjsonbar>"]}}'
+), qr/403 Forbidden/, 'waf_7004: test body json block');
+like(http(
+    "POST / HTTP/1.0" . CRLF .
+    "Host: localhost" . CRLF .
+    "Content-Type: application/json" . CRLF .
+    "Content-Length: 48" . CRLF .
+    CRLF .
+    '{"user": {"id": 1, "tag": ["a", "<jsonbar>"]}}  '
+), qr/200 OK/, 'waf_7004: test body json ok');
+
+my $json = '{"pad": "' . ('x' x 20000) . '", '
+    . '"user": {"id": 1, "tags": ["a", "<jsonbar>"]}}';
+like(http(
+    "POST / HTTP/1.0" . CRLF .
+    "Host: localhost" . CRLF .
+    "Content-Type: application/json" . CRLF .
+    "Content-Length: " . length($json) . CRLF .
+    CRLF .
+    $json
+), qr/403 Forbidden/, 'waf_7004: test body json in the temp file block');
+
+
+like(http(
+    "POST / HTTP/1.0" . CRLF .
+    "Host: localhost" . CRLF .
+    "Content-Type: application/soap+xml; charset=utf-8" . CRLF .
+    "Content-Length: 110" . CRLF .
+    CRLF .
+    '<?xml version="1.0"?><s:Envelope><s:Body><login user="guest"><pass>xmlbar</pass></login></s:Body></s:Envelope>'
+), qr/403 Forbidden/, 'waf_7005: test body xml element block');
+like(http(
+    "POST / HTTP/1.0" . CRLF .
+    "Host: localhost" . CRLF .
+    "Content-Type: text/xml" . CRLF .
+    "Content-Length: 110" . CRLF .
+    CRLF .
+    '<?xml version="1.0"?><s:Envelope><s:Body><login pass="xmlbar"><user>guest</user></login></s:Body></s:Envelope>'
+), qr/403 Forbidden/, 'waf_7005: test body xml attribute block');
+like(http(
+    "POST / HTTP/1.0" . CRLF .
+    "Host: localhost" . CRLF .
+    "Content-Type: application/xml" . CRLF .
+    "Content-Length: 110" . CRLF .
+    CRLF .
+    '<?xml version="1.0"?><s:Envelope><s:Body><login user="xmlbar"><pass>guest</pass></login></s:Body></s:Envelope>'
+), qr/200 OK/, 'waf_7005: test body xml ok');
+
 
 like(http(
     "POST / HTTP/1.1" . CRLF .
@@ -993,7 +1241,30 @@ like(http(
     CRLF .
     "Upload" . CRLF .
     "------WebKitFormBoundaryoWJTVDAYOLw4Tlo4--" . CRLF
-), qr/200 OK/, 'waf_8001: test body multipart overflow');
+), qr/403 Forbidden/, 'waf_8001: test body multipart in the temp file block');
+
+sub http_upload {
+    my $body = "------WebKitFormBoundaryoWJTVDAYOLw4Tlo4" . CRLF .
+        "Content-Disposition: form-data; name='uploaded'; filename='big'" .
+        CRLF . CRLF .
+        $_[0] . CRLF .
+        "------WebKitFormBoundaryoWJTVDAYOLw4Tlo4--" . CRLF;
+
+    return http(
+        "POST / HTTP/1.1" . CRLF .
+        "Host: localhost" . CRLF .
+        "Content-Type: multipart/form-data; boundary=----WebKitFormBoundaryoWJTVDAYOLw4Tlo4" . CRLF .
+        "Content-Length: " . length($body) . CRLF .
+        "Connection: close" . CRLF .
+        CRLF .
+        $body
+    );
+}
+
+like(http_upload($upload), qr/403 Forbidden/,
+    'waf_8003: test md5 of a file over the window block');
+like(http_upload($upload . 'z'), qr/200 OK/,
+    'waf_8003: test md5 of a file over the window ok');
 
 
 like(http_get("/?foo=testscorecheck"),